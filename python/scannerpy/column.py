@@ -35,6 +35,10 @@ class Column(object):
             self._descriptor = descriptor
             self._video_descriptor = video_descriptor
 
+    def _encoded_codec_types(self):
+        VideoDescriptor = self._db.protobufs.VideoDescriptor
+        return (VideoDescriptor.H264, VideoDescriptor.HEVC)
+
     def name(self):
         return self._name
 
@@ -49,8 +53,8 @@ class Column(object):
     def keyframes(self):
         self._load_meta()
         if (self._descriptor.type == self._db.protobufs.Video
-                and self._video_descriptor.codec_type ==
-                self._db.protobufs.VideoDescriptor.H264):
+                and self._video_descriptor.codec_type in
+                self._encoded_codec_types()):
             # For each encoded video, add start frame offset
             frame_offset = 0
             kf_offset = 0
@@ -204,8 +208,8 @@ class Column(object):
         # If the column is a video, then dump the requested frames to disk as
         # PNGs and return the decoded PNGs
         if (self._descriptor.type == self._db.protobufs.Video
-                and self._video_descriptor.codec_type ==
-                self._db.protobufs.VideoDescriptor.H264):
+                and self._video_descriptor.codec_type in
+                self._encoded_codec_types()):
             png_table_name = self._db._png_dump_prefix.format(
                 self._table.name())
             if self._db.has_table(png_table_name):
@@ -248,12 +252,12 @@ class Column(object):
     def save_mp4(self, output_name, fps=None, scale=None):
         self._load_meta()
         if not (self._descriptor.type == self._db.protobufs.Video
-                and self._video_descriptor.codec_type ==
-                self._db.protobufs.VideoDescriptor.H264):
-            raise ScannerException('Attempted to save a non-h264-compressed '
-                                   'column as an mp4. Try compressing the '
-                                   'column first by saving the output as '
-                                   'an RGB24 frame')
+                and self._video_descriptor.codec_type in
+                self._encoded_codec_types()):
+            raise ScannerException('Attempted to save a non-h264/hevc-'
+                                   'compressed column as an mp4. Try '
+                                   'compressing the column first by saving '
+                                   'the output as an RGB24 frame')
         num_items = len(self._table._descriptor.end_rows)
 
         paths = [
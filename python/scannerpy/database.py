@@ -163,6 +163,7 @@ class Database(object):
         self._db_path = self.config.db_path
         self._storage = self.config.storage
         self._cached_db_metadata = None
+        self._result_cache_stats = (0, 0)
         self._png_dump_prefix = '__png_dump_{:s}'
 
         self.ops = OpGenerator(self)
@@ -227,6 +228,7 @@ class Database(object):
         if self._cached_db_metadata is None:
             desc = self._load_descriptor(self.protobufs.DatabaseDescriptor,
                                          'db_metadata.bin')
+            self._replay_metadata_log(desc)
             self._cached_db_metadata = desc
             # table id cache
             self._table_id = {}
@@ -251,6 +253,43 @@ class Database(object):
 
         return self._cached_db_metadata
 
+    def _replay_metadata_log(self, desc):
+        # db_metadata.bin is only a periodic snapshot. Changes made after it
+        # was written live in numbered entries of the metadata log.
+        tables = {t.id: (t.name, t.committed) for t in desc.tables}
+        bulk_jobs = {j.id: (j.name, j.committed) for j in desc.bulk_jobs}
+        sequence = desc.log_sequence + 1
+        replayed = False
+        while True:
+            path = '{}/metadata_log/{:d}.bin'.format(self._db_path, sequence)
+            try:
+                data = self._storage.read(path)
+            except UserWarning:
+                break
+            entry = self.protobufs.MetadataLogEntry()
+            entry.ParseFromString(data)
+            desc.next_table_id = max(desc.next_table_id, entry.next_table_id)
+            desc.next_bulk_job_id = max(desc.next_bulk_job_id,
+                                        entry.next_bulk_job_id)
+            for t in entry.tables:
+                tables[t.id] = (t.name, t.committed)
+            for tid in entry.removed_tables:
+                tables.pop(tid, None)
+            for j in entry.bulk_jobs:
+                bulk_jobs[j.id] = (j.name, j.committed)
+            for jid in entry.removed_bulk_jobs:
+                bulk_jobs.pop(jid, None)
+            sequence += 1
+            replayed = True
+
+        if replayed:
+            del desc.tables[:]
+            for tid, (name, committed) in tables.items():
+                desc.tables.add(id=tid, name=name, committed=committed)
+            del desc.bulk_jobs[:]
+            for jid, (name, committed) in bulk_jobs.items():
+                desc.bulk_jobs.add(id=jid, name=name, committed=committed)
+
     def _make_grpc_channel(self, address):
         max_message_length = 1024 * 1024 * 1024
         return grpc.insecure_channel(
@@ -953,7 +992,11 @@ class Database(object):
             self,
             videos: List[Tuple[str, str]],
             inplace: bool = False,
-            force: bool = False) -> Tuple[List[Table], List[Tuple[str, str]]]:
+            force: bool = False,
+            proxy_scales: List[int] = None,
+            parallel_index_min_bytes: int = None,
+            index_chunk_bytes: int = None
+    ) -> Tuple[List[Table], List[Tuple[str, str]]]:
         r"""Creates tables from videos.
 
         Parameters
@@ -969,6 +1012,21 @@ class Database(object):
         force
           If true, deletes existing tables with the same names.
 
+        proxy_scales
+          For each factor, also stores a copy of every video downscaled by
+          that factor in a column named 'frame_proxy_<factor>'. Jobs which
+          only resize the frames of a video to the size of one of its proxies
+          or below decode the proxy instead.
+
+        parallel_index_min_bytes
+          Videos at least this large are indexed on several threads. Defaults
+          to 256MB.
+
+        index_chunk_bytes
+          Videos indexed on several threads are split into chunks which end at
+          the first IDR frame after this many bytes of packets. Defaults to
+          16MB.
+
         Returns
         -------
         tables: List[Table]
@@ -997,6 +1055,12 @@ class Database(object):
         ingest_params.table_names.extend(table_names)
         ingest_params.video_paths.extend(paths)
         ingest_params.inplace = inplace
+        if proxy_scales is not None:
+            ingest_params.proxy_scales.extend(proxy_scales)
+        if parallel_index_min_bytes is not None:
+            ingest_params.parallel_index_min_bytes = parallel_index_min_bytes
+        if index_chunk_bytes is not None:
+            ingest_params.index_chunk_bytes = index_chunk_bytes
         ingest_result = self._try_rpc(
             lambda: self._master.IngestVideos(ingest_params))
         if not ingest_result.result.success:
@@ -1057,7 +1121,8 @@ class Database(object):
                   columns: List[str],
                   rows: List[List[bytes]],
                   fns=None,
-                  force: bool = False) -> Table:
+                  force: bool = False,
+                  append: bool = False) -> Table:
         r"""Creates a new table from a list of rows.
 
         Parameters
@@ -1077,13 +1142,17 @@ class Database(object):
 
         force
 
+        append
+          If the table already exists, add the rows to the end of it instead
+          of failing. The columns must match the existing table.
+
         Returns
         -------
         Table
           The new table object.
         """
 
-        if self.has_table(name):
+        if self.has_table(name) and not append:
             if force:
                 self.delete_table(name)
             else:
@@ -1097,6 +1166,7 @@ class Database(object):
         params = self.protobufs.NewTableParams()
         params.table_name = name
         params.columns[:] = columns
+        params.append = append
 
         for i, row in enumerate(rows):
             row_proto = params.rows.add()
@@ -1164,6 +1234,17 @@ class Database(object):
 
         return Profiler(self, job_id)
 
+    def result_cache_stats(self) -> Tuple[int, int]:
+        r"""Returns the result cache hits and misses of the last run.
+
+        Returns
+        -------
+        Tuple[int, int]
+          The number of op outputs which were read from a previous job's
+          output table and the number which had to be computed.
+        """
+        return self._result_cache_stats
+
     def wait_on_job(self, bulk_job_id, show_progress=True):
         pbar = None
         total_tasks = None
@@ -1238,7 +1319,16 @@ class Database(object):
             load_sparsity_threshold: int = 8,
             tasks_in_queue_per_pu: int = 4,
             task_timeout: int = 0,
-            checkpoint_frequency: int = 1000):
+            checkpoint_frequency: int = 1000,
+            cache_results: bool = True,
+            incremental: bool = False,
+            gop_parallel_decoders: int = 1,
+            decoder_buffered_frames: int = 0,
+            use_proxies: bool = True,
+            fuse_kernels: bool = True,
+            branch_threads: int = 1,
+            cross_task_batch_timeout: int = 0,
+            task_affinity: bool = False):
         r"""Runs a collection of jobs.
 
         Parameters
@@ -1288,6 +1378,65 @@ class Database(object):
 
         checkpoint_frequency
 
+        cache_results
+          If true, op outputs which were stored in an output table by a
+          previous job, with the same op arguments and input tables, are read
+          from that table instead of being recomputed. Set to false for ops
+          which are not deterministic. Ops are versioned by the build of the
+          library which registered them. See result_cache_stats for the hits
+          and misses of the run.
+
+        incremental
+          If true, output tables which already exist are extended instead of
+          overwritten: only the rows which have been added to the source
+          tables since the output table was written are processed, and the
+          results are appended to it as new items. The ops and arguments must
+          be the same as when the output table was created.
+
+        gop_parallel_decoders
+          The number of decoders each pipeline instance uses to decode a
+          video column. Each task's frames are split at keyframes and the
+          pieces are decoded concurrently. This parameter only affects
+          performance and should not affect the output.
+
+        decoder_buffered_frames
+          The maximum number of decoded frames each video decoder buffers
+          ahead of the pipeline. The buffer grows up to this size when the
+          pipeline waits on the decoder. 0 uses the default. This parameter
+          only affects performance and memory usage.
+
+        use_proxies
+          If true, video columns whose frames are only resized are decoded
+          from the smallest proxy of the video (see ingest_videos) which is at
+          least as large as the resized frames. The proxies are lossy copies,
+          so set to false to always decode the original video.
+
+        fuse_kernels
+          If true, chains of stateless kernels without stencils which run on
+          the same device are run back-to-back on each batch, so the frames
+          passed between them are freed as soon as they are consumed. This
+          parameter only affects performance and should not affect the output.
+
+        branch_threads
+          Number of threads each pipeline instance uses to evaluate
+          independent branches of the computation graph. With more than one
+          thread, a CPU op whose outputs are not read by the op after it keeps
+          running while the following ops are evaluated (e.g. two analyses of
+          the same frames). This parameter only affects performance and should
+          not affect the output.
+
+        cross_task_batch_timeout
+          Milliseconds a pipeline instance waits for the next task of a job to
+          fill up the partial last batch of a task. Only applies to stateless
+          batched ops without a stencil whose output is written by the sink.
+          0 evaluates the last batch of each task on its own.
+
+        task_affinity
+          If true, consecutive tasks of a job are handed to the same worker
+          and pipeline instance. Ops with bounded state then keep their state
+          from the previous task and skip the warmup rows it already computed,
+          which shows up in the warmup_rows profiler counters.
+
         Returns
         -------
         List[Table]
@@ -1483,7 +1632,7 @@ class Database(object):
             j.output_table_name = output_table_name
 
         # Delete tables if they exist and force was specified
-        if is_table_output:
+        if is_table_output and not incremental:
             to_delete = []
             for name in job_output_table_names:
                 if self.has_table(name):
@@ -1507,6 +1656,15 @@ class Database(object):
             self.protobufs.BulkJobParameters.REPEAT_EDGE)
         job_params.task_timeout = task_timeout
         job_params.checkpoint_frequency = checkpoint_frequency
+        job_params.disable_result_cache = not cache_results
+        job_params.incremental = incremental
+        job_params.gop_parallel_decoders = gop_parallel_decoders
+        job_params.decoder_buffered_frames = decoder_buffered_frames
+        job_params.disable_video_proxies = not use_proxies
+        job_params.disable_kernel_fusion = not fuse_kernels
+        job_params.branch_threads = branch_threads
+        job_params.cross_task_batch_timeout_ms = cross_task_batch_timeout
+        job_params.task_affinity = task_affinity
 
         job_params.memory_pool_config.pinned_cpu = False
         if cpu_pool is not None:
@@ -1531,6 +1689,8 @@ class Database(object):
 
         bulk_job_id = result.bulk_job_id
         job_status = self.wait_on_job(bulk_job_id, show_progress)
+        self._result_cache_stats = (job_status.result_cache_hits,
+                                    job_status.result_cache_misses)
 
         if not job_status.result.success:
             raise ScannerException(job_status.result.msg)
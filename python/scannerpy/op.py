@@ -26,26 +26,43 @@ class OpColumn:
         self._assert_is_video()
         codecs = {
             'video': self.compress_video,
+            'hevc': self.compress_hevc,
             'default': self.compress_default,
             'raw': self.lossless
         }
         if codec in codecs:
-            return codecs[codec](self, **kwargs)
+            return codecs[codec](**kwargs)
         else:
             raise ScannerException('Compression codec {} not currently '
                                    'supported. Available codecs are: {}.'
-                                   .format(' '.join(list(codecs.keys()))))
-
-    def compress_video(self, quality=-1, bitrate=-1, keyframe_distance=-1):
+                                   .format(codec,
+                                           ' '.join(list(codecs.keys()))))
+
+    def compress_video(self,
+                       quality=-1,
+                       bitrate=-1,
+                       keyframe_distance=-1,
+                       threads=-1,
+                       preset=None,
+                       encoders=-1,
+                       codec='h264'):
         self._assert_is_video()
         encode_options = {
-            'codec': 'h264',
+            'codec': codec,
             'quality': quality,
             'bitrate': bitrate,
-            'keyframe_distance': keyframe_distance
+            'keyframe_distance': keyframe_distance,
+            'threads': threads
         }
+        if preset is not None:
+            encode_options['preset'] = preset
+        if encoders != -1:
+            encode_options['encoders'] = encoders
         return self._new_compressed_column(encode_options)
 
+    def compress_hevc(self, **kwargs):
+        return self.compress_video(codec='hevc', **kwargs)
+
     def lossless(self):
         self._assert_is_video()
         encode_options = {'codec': 'raw'}
@@ -80,6 +97,11 @@ class OpGenerator:
     When a particular op is requested from the generator, e.g.
     `db.ops.Histogram`, the generator does a dynamic lookup for the
     op in a C++ registry.
+
+    An op which is much slower than the rest of the computation can be
+    created with `replicas=N` so that each pipeline instance evaluates
+    disjoint batches of its rows with N kernel instances in parallel. Only
+    CPU ops without state can be replicated.
     """
 
     def __init__(self, db):
@@ -119,10 +141,12 @@ class OpGenerator:
             batch = kwargs.pop('batch', -1)
             bounded_state = kwargs.pop('bounded_state', -1)
             stencil = kwargs.pop('stencil', [])
+            replicas = kwargs.pop('replicas', 1)
             extra = kwargs.pop('extra', None)
             args = kwargs.pop('args', None)
             op = Op(self._db, name, inputs, device, batch, bounded_state,
-                    stencil, kwargs if args is None else args, extra)
+                    stencil, kwargs if args is None else args, extra,
+                    replicas)
             return op.outputs()
 
         return make_op
@@ -138,7 +162,8 @@ class Op:
                  warmup=-1,
                  stencil=[0],
                  args={},
-                 extra=None):
+                 extra=None,
+                 replicas=1):
         self._db = db
         self._name = name
         self._inputs = inputs
@@ -148,6 +173,7 @@ class Op:
         self._stencil = stencil
         self._args = args
         self._extra = extra
+        self._replicas = replicas
 
         if (name == 'Space' or name == 'Sample' or name == 'Slice'
                 or name == 'Unslice'):
@@ -175,6 +201,7 @@ class Op:
         e.stencil.extend(self._stencil)
         e.batch = self._batch
         e.warmup = self._warmup
+        e.replicas = self._replicas
 
         if e.name == "Input":
             inp = e.inputs.add()
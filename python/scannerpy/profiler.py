@@ -132,6 +132,19 @@ class Profiler:
         readable_totals = self._convert_time(totals)
         return readable_totals
 
+    def counters(self):
+        """
+        Returns the totals of the counters recorded by the job (e.g.
+        frame_cache_hits) across all nodes and threads.
+        """
+        totals = {}
+        for _, profiler in list(self._profilers.values()):
+            for kind in profiler:
+                for thread in profiler[kind]:
+                    for (name, value) in thread['counters'].items():
+                        totals[name] = totals.get(name, 0) + value
+        return totals
+
     def _parse_profiler_output(self, bytes_buffer, offset):
         # Node
         t, offset = read_advance('q', bytes_buffer, offset)
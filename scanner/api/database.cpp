@@ -14,7 +14,6 @@
  */
 
 #include "scanner/api/database.h"
-#include "scanner/engine/ingest.h"
 #include "scanner/engine/master.h"
 #include "scanner/engine/metadata.h"
 #include "scanner/engine/rpc.grpc.pb.h"
@@ -59,6 +58,9 @@ internal::DatabaseParameters machine_params_to_db_params(
   db.num_load_workers = params.num_load_workers;
   db.num_save_workers = params.num_save_workers;
   db.gpu_ids = params.gpu_ids;
+  db.disk_cache_path = params.disk_cache_path;
+  db.disk_cache_size = params.disk_cache_size;
+  db.frame_cache_size = params.frame_cache_size;
   db.no_workers_timeout = 30;
   return db;
 }
@@ -69,6 +71,9 @@ MachineParameters default_machine_params() {
   machine_params.num_cpus = std::thread::hardware_concurrency();
   machine_params.num_load_workers = 8;
   machine_params.num_save_workers = 2;
+  machine_params.disk_cache_path = "";
+  machine_params.disk_cache_size = 0;
+  machine_params.frame_cache_size = 0;
 #ifdef HAVE_CUDA
   i32 gpu_count;
   CU_CHECK(cudaGetDeviceCount(&gpu_count));
@@ -164,13 +169,8 @@ Result Database::ingest_videos(const std::vector<std::string>& table_names,
                                const std::vector<std::string>& paths,
                                bool inplace,
                                std::vector<FailedVideo>& failed_videos) {
-  internal::ingest_videos(storage_config_, db_path_, table_names, paths,
-                          inplace,
-                          failed_videos);
-  Result result;
-  result.set_success(true);
-  return result;
-
+  // Ingest goes through the master so that its metadata log is the only
+  // writer of log entries
   auto channel =
       grpc::CreateChannel(master_address_, grpc::InsecureChannelCredentials());
   std::unique_ptr<proto::Master::Stub> master_ =
@@ -184,10 +184,15 @@ Result Database::ingest_videos(const std::vector<std::string>& table_names,
   for (auto& p : paths) {
     params.add_video_paths(p);
   }
+  params.set_inplace(inplace);
   proto::IngestResult job_result;
   grpc::Status status = master_->IngestVideos(&context, params, &job_result);
-  LOG_IF(FATAL, !status.ok())
-      << "Could not contact master server: " << status.error_message();
+  if (!status.ok()) {
+    Result result;
+    RESULT_ERROR(&result, "Could not contact master server: %s",
+                 status.error_message().c_str());
+    return result;
+  }
   for (i32 i = 0; i < job_result.failed_paths().size(); ++i) {
     FailedVideo failed;
     failed.path = job_result.failed_paths(i);
@@ -198,21 +203,27 @@ Result Database::ingest_videos(const std::vector<std::string>& table_names,
 }
 
 Result Database::delete_table(const std::string& table_name) {
-  Result result;
-  internal::DatabaseMetadata meta = internal::read_database_metadata(
-      storage_.get(), internal::DatabaseMetadata::descriptor_path());
+  // Deletions go through the master so that its metadata log is the only
+  // writer of log entries
+  auto channel =
+      grpc::CreateChannel(master_address_, grpc::InsecureChannelCredentials());
+  std::unique_ptr<proto::Master::Stub> master_ =
+      proto::Master::NewStub(channel);
 
-  i32 id = meta.get_table_id(table_name);
-  if (id == -1) {
-    RESULT_ERROR(&result, "Table %s does not exist", table_name.c_str());
+  grpc::ClientContext context;
+  proto::DeleteTablesParams params;
+  params.add_tables(table_name);
+  proto::Empty empty;
+  grpc::Status status = master_->DeleteTables(&context, params, &empty);
+
+  Result result;
+  if (!status.ok()) {
+    RESULT_ERROR(&result, "Could not contact master server: %s",
+                 status.error_message().c_str());
     return result;
   }
-
-  meta.remove_table(id);
-  internal::write_database_metadata(storage_.get(), meta);
-
-  internal::TableMetadata table = internal::read_table_metadata(
-      storage_.get(), internal::TableMetadata::descriptor_path(id));
+  result.set_success(true);
+  return result;
 }
 
 Result Database::shutdown_master() {
@@ -37,6 +37,10 @@ struct MachineParameters {
   i32 num_save_workers;
   std::vector<i32>
       gpu_ids;  //!< List of CUDA device IDs that Scanner should use.
+  std::string disk_cache_path;  //!< Local directory for caching remote reads.
+  i64 disk_cache_size;  //!< Byte budget of the disk cache, 0 disables it.
+  i64 frame_cache_size;  //!< Byte budget for caching decoded frames, 0
+                         //!< disables it.
 };
 
 //! Pick smart defaults for the current machine.
@@ -37,7 +37,27 @@ size_t size_of_frame_type(FrameType type) {
   return s;
 }
 
-FrameInfo::FrameInfo(int shape0, int shape1, int shape2, FrameType t) {
+size_t size_of_frame_format(FrameFormat format, int height, int width) {
+  size_t luma = (size_t)height * width;
+  size_t chroma = (size_t)((height + 1) / 2) * ((width + 1) / 2);
+  size_t s;
+  switch (format) {
+    case FrameFormat::RGB24:
+      s = luma * 3;
+      break;
+    case FrameFormat::GRAY8:
+      s = luma;
+      break;
+    case FrameFormat::YUV420P:
+    case FrameFormat::NV12:
+      s = luma + 2 * chroma;
+      break;
+  }
+  return s;
+}
+
+FrameInfo::FrameInfo(int shape0, int shape1, int shape2, FrameType t,
+                     FrameFormat f) {
   assert(shape0 >= 0);
   assert(shape1 >= 0);
   assert(shape2 >= 0);
@@ -46,6 +66,7 @@ FrameInfo::FrameInfo(int shape0, int shape1, int shape2, FrameType t) {
   shape[1] = shape1;
   shape[2] = shape2;
   type = t;
+  format = f;
 }
 
 FrameInfo::FrameInfo(const std::vector<int> shapes, FrameType t) {
@@ -58,8 +79,13 @@ FrameInfo::FrameInfo(const std::vector<int> shapes, FrameType t) {
   type = t;
 }
 
+FrameInfo FrameInfo::with_format(int height, int width, FrameFormat format) {
+  int channels = (format == FrameFormat::RGB24) ? 3 : 1;
+  return FrameInfo(height, width, channels, FrameType::U8, format);
+}
+
 bool FrameInfo::operator==(const FrameInfo& other) const {
-  bool same = (type == other.type);
+  bool same = (type == other.type) && (format == other.format);
   for (int i = 0; i < FRAME_DIMS; ++i) {
     same &= (shape[i] == other.shape[i]);
   }
@@ -71,6 +97,9 @@ bool FrameInfo::operator!=(const FrameInfo& other) const {
 }
 
 size_t FrameInfo::size() const {
+  if (format == FrameFormat::YUV420P || format == FrameFormat::NV12) {
+    return size_of_frame_format(format, height(), width());
+  }
   size_t s = size_of_frame_type(type);
   for (int i = 0; i < FRAME_DIMS; ++i) {
     s *= shape[i];
@@ -88,10 +117,11 @@ int FrameInfo::channels() const { return shape[2]; }
 Frame::Frame(FrameInfo info, u8* b) : data(b) {
   memcpy(shape, info.shape, sizeof(int) * FRAME_DIMS);
   type = info.type;
+  format = info.format;
 }
 
 FrameInfo Frame::as_frame_info() const {
-  return FrameInfo(shape[0], shape[1], shape[2], type);
+  return FrameInfo(shape[0], shape[1], shape[2], type, format);
 }
 
 size_t Frame::size() const { return as_frame_info().size(); }
@@ -26,8 +26,14 @@ namespace scanner {
 // Currently supports U8, U16, F32, F64
 using proto::FrameType;
 
+// Currently supports RGB24, GRAY8, YUV420P, NV12
+using proto::FrameFormat;
+
 size_t size_of_frame_type(FrameType type);
 
+//! Bytes needed to store a height x width frame of the given U8 format
+size_t size_of_frame_format(FrameFormat format, int height, int width);
+
 const i32 FRAME_DIMS = 3;
 
 //! FrameInfo
@@ -37,9 +43,13 @@ struct FrameInfo {
   FrameInfo(FrameInfo&& info) = default;
   FrameInfo& operator=(const FrameInfo&) = default;
 
-  FrameInfo(int shape0, int shape1, int shape2, FrameType type);
+  FrameInfo(int shape0, int shape1, int shape2, FrameType type,
+            FrameFormat format = FrameFormat::RGB24);
   FrameInfo(const std::vector<int> shapes, FrameType type);
 
+  //! Info of a height x width U8 frame stored in the given format
+  static FrameInfo with_format(int height, int width, FrameFormat format);
+
   bool operator==(const FrameInfo& other) const;
   bool operator!=(const FrameInfo& other) const;
 
@@ -56,6 +66,9 @@ struct FrameInfo {
 
   int shape[FRAME_DIMS];
   FrameType type;
+  //! Planar formats store the Y plane as a (height, width, 1) array
+  //! followed by the chroma planes
+  FrameFormat format = FrameFormat::RGB24;
 };
 
 //! Frame
@@ -78,6 +91,7 @@ class Frame {
 
   int shape[FRAME_DIMS];
   FrameType type;
+  FrameFormat format;
   u8* data;
 };
 
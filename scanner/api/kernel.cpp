@@ -97,13 +97,15 @@ void Kernel::execute_kernel(
 void VideoKernel::check_frame(const DeviceHandle& device,
                               const Element& element) {
   const Frame* frame = element.as_const_frame();
-  bool same = (frame->type == frame_info_.type);
+  bool same = (frame->type == frame_info_.type) &&
+              (frame->format == frame_info_.format);
   for (i32 i = 0; i < 3; ++i) {
     same &= (frame->shape[i] == frame_info_.shape[i]);
   }
   if (!same) {
     memcpy(frame_info_.shape, frame->shape, sizeof(int) * 3);
     frame_info_.type = frame->type;
+    frame_info_.format = frame->format;
     new_frame_info();
   }
 }
@@ -115,13 +117,15 @@ void VideoKernel::check_frame_info(const DeviceHandle& device,
   memcpy_buffer((u8*)buffer, CPU_DEVICE, element.buffer, device, element.size);
   FrameInfo* frame_info = reinterpret_cast<FrameInfo*>(buffer);
 
-  bool same = (frame_info->type == frame_info_.type);
+  bool same = (frame_info->type == frame_info_.type) &&
+              (frame_info->format == frame_info_.format);
   for (i32 i = 0; i < 3; ++i) {
     same &= (frame_info->shape[i] == frame_info_.shape[i]);
   }
   if (!same) {
     memcpy(frame_info_.shape, frame_info->shape, sizeof(int) * 3);
     frame_info_.type = frame_info->type;
+    frame_info_.format = frame_info->format;
     new_frame_info();
   }
   delete_buffer(CPU_DEVICE, buffer);
@@ -30,6 +30,11 @@ OpRegistration::OpRegistration(const OpBuilder& builder) {
     col.set_id(i++);
     col.set_name(std::get<0>(name_type));
     col.set_type(std::get<1>(name_type));
+    if (builder.input_frame_formats_.count(col.id()) > 0) {
+      for (FrameFormat format : builder.input_frame_formats_.at(col.id())) {
+        col.add_frame_formats(format);
+      }
+    }
     input_columns.push_back(col);
   }
   std::vector<Column> output_columns;
@@ -50,7 +55,7 @@ OpRegistration::OpRegistration(const OpBuilder& builder) {
   OpInfo* info = new OpInfo(name, variadic_inputs, input_columns,
                             output_columns, can_stencil, stencil,
                             has_bounded_state, warmup, has_unbounded_state,
-                            pbn);
+                            pbn, builder.frame_resize_);
   OpRegistry* registry = get_op_registry();
   Result result = registry->add_op(name, info);
   if (!result.success()) {
@@ -15,13 +15,22 @@
 
 #pragma once
 
+#include "scanner/api/frame.h"
 #include "scanner/util/common.h"
 #include "scanner/util/profiler.h"
 
+#include <functional>
+#include <map>
 #include <vector>
 
 namespace scanner {
 
+/// Computes the size an op resizes width x height frames to, given the op's
+/// serialized arguments
+using FrameResizeFn =
+    std::function<void(const std::vector<u8>& args, i32 width, i32 height,
+                       i32& out_width, i32& out_height)>;
+
 ///////////////////////////////////////////////////////////////////////////////
 /// Implementation Details
 namespace internal {
@@ -64,6 +73,17 @@ class OpBuilder {
     return input(name, ColumnType::Video);
   }
 
+  /// Declares a frame input which also accepts frames in the given formats.
+  /// RGB24 is always accepted since frames produced by other ops are RGB24.
+  /// The decoder produces the cheapest format which every consumer of a video
+  /// column accepts.
+  OpBuilder& frame_input(const std::string& name,
+                         const std::vector<FrameFormat>& formats) {
+    input(name, ColumnType::Video);
+    input_frame_formats_[input_columns_.size() - 1] = formats;
+    return *this;
+  }
+
   OpBuilder& output(const std::string& name,
                     ColumnType type = ColumnType::Other) {
     output_columns_.push_back(std::make_tuple(name, type));
@@ -101,6 +121,15 @@ class OpBuilder {
     return *this;
   }
 
+  /// Declares that the op only resizes the frames of its single frame input.
+  /// When the op is the only consumer of a decoded video column, the decoder
+  /// produces frames at the size computed by fn and the op receives frames
+  /// which are already the right size.
+  OpBuilder& decoder_resize(FrameResizeFn fn) {
+    frame_resize_ = fn;
+    return *this;
+  }
+
   OpBuilder& protobuf_name(std::string protobuf_name) {
     protobuf_name_ = protobuf_name;
     return *this;
@@ -110,6 +139,7 @@ class OpBuilder {
   std::string name_;
   bool variadic_inputs_;
   std::vector<std::tuple<std::string, ColumnType>> input_columns_;
+  std::map<size_t, std::vector<FrameFormat>> input_frame_formats_;
   std::vector<std::tuple<std::string, ColumnType>> output_columns_;
   bool can_stencil_;
   std::vector<int> preferred_stencil_ = {0};
@@ -117,6 +147,7 @@ class OpBuilder {
   i32 warmup_;
   bool has_unbounded_state_;
   std::string protobuf_name_;
+  FrameResizeFn frame_resize_;
 };
 }
 
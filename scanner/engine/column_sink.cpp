@@ -18,6 +18,7 @@
 #include "scanner/sink_args.pb.h"
 #include "scanner/engine/video_index_entry.h"
 #include "scanner/video/h264_byte_stream_index_creator.h"
+#include "scanner/video/h265_byte_stream_index_creator.h"
 
 #include "storehouse/storage_backend.h"
 
@@ -33,6 +34,56 @@ using storehouse::RandomReadFile;
 namespace scanner {
 namespace internal {
 
+namespace {
+
+// Writes the packets of one encoded video through index_creator and appends
+// its index to the descriptor. Returns the number of packet bytes written.
+template <typename IndexCreator>
+i64 index_encoded_video(IndexCreator& index_creator, const Elements& packets,
+                        proto::VideoDescriptor& video_descriptor) {
+  i64 size_written = 0;
+  for (const Element& element : packets) {
+    if (!index_creator.feed_packet(element.buffer, element.size)) {
+      LOG(FATAL) << "Error in save worker index creator: "
+                 << index_creator.error_message();
+    }
+    size_written += element.size;
+  }
+
+  index_creator.finish();
+  i64 frame = index_creator.frames();
+  const std::vector<u8>& metadata_bytes = index_creator.metadata_bytes();
+  const std::vector<u64>& keyframe_indices = index_creator.keyframe_indices();
+
+  video_descriptor.set_frames(video_descriptor.frames() + frame);
+  video_descriptor.add_frames_per_video(frame);
+  video_descriptor.add_keyframes_per_video(keyframe_indices.size());
+  video_descriptor.add_size_per_video(index_creator.bytestream_pos());
+  video_descriptor.set_metadata_packets(metadata_bytes.data(),
+                                        metadata_bytes.size());
+
+  for (u64 v : keyframe_indices) {
+    video_descriptor.add_keyframe_indices(v);
+  }
+  for (u64 v : index_creator.sample_offsets()) {
+    video_descriptor.add_sample_offsets(v);
+  }
+  for (u64 v : index_creator.sample_sizes()) {
+    video_descriptor.add_sample_sizes(v);
+  }
+  video_descriptor.add_non_reference_samples_per_video(
+      index_creator.non_reference_samples().size());
+  for (u64 v : index_creator.non_reference_samples()) {
+    video_descriptor.add_non_reference_samples(v);
+  }
+  for (u64 v : index_creator.non_reference_frames()) {
+    video_descriptor.add_non_reference_frames(v);
+  }
+  return size_written;
+}
+
+}
+
 ColumnSink::ColumnSink(const SinkConfig& config) : Sink(config) {
   // Deserialize ColumnSinkConfig
   scanner::proto::ColumnSinkArgs args;
@@ -109,53 +160,27 @@ void ColumnSink::write(const BatchedElements& input_columns) {
 
       if (compressed_[out_idx] && frame_info.type == FrameType::U8 &&
           frame_info.channels() == 3) {
-        H264ByteStreamIndexCreator index_creator(output_file);
-        for (size_t i = 0; i < num_elements; ++i) {
-          const Element& element = input_columns[out_idx][i];
-          if (!index_creator.feed_packet(element.buffer, element.size)) {
-            LOG(FATAL) << "Error in save worker h264 index creator: "
-                       << index_creator.error_message();
-          }
-          size_written += element.size;
-        }
-
-        i64 frame = index_creator.frames();
-        i32 num_non_ref_frames = index_creator.num_non_ref_frames();
-        const std::vector<u8>& metadata_bytes = index_creator.metadata_bytes();
-        const std::vector<u64>& keyframe_indices =
-            index_creator.keyframe_indices();
-        const std::vector<u64>& sample_offsets =
-            index_creator.sample_offsets();
-        const std::vector<u64>& sample_sizes =
-            index_creator.sample_sizes();
-
         video_descriptor.set_chroma_format(proto::VideoDescriptor::YUV_420);
-        video_descriptor.set_codec_type(proto::VideoDescriptor::H264);
-
-        video_descriptor.set_frames(video_descriptor.frames() + frame);
-        video_descriptor.add_frames_per_video(frame);
-        video_descriptor.add_keyframes_per_video(keyframe_indices.size());
-        video_descriptor.add_size_per_video(index_creator.bytestream_pos());
-        video_descriptor.set_metadata_packets(metadata_bytes.data(),
-                                              metadata_bytes.size());
+        video_descriptor.set_codec_type(codecs_[out_idx]);
+        if (codecs_[out_idx] == proto::VideoDescriptor::HEVC) {
+          H265ByteStreamIndexCreator index_creator(output_file);
+          size_written = index_encoded_video(index_creator,
+                                             input_columns[out_idx],
+                                             video_descriptor);
+        } else {
+          H264ByteStreamIndexCreator index_creator(output_file);
+          size_written = index_encoded_video(index_creator,
+                                             input_columns[out_idx],
+                                             video_descriptor);
+        }
 
         const std::string output_path =
             table_item_output_path(video_descriptor.table_id(), out_idx,
                                    video_descriptor.item_id());
         video_descriptor.set_data_path(output_path);
         video_descriptor.set_inplace(false);
-
-        for (u64 v : keyframe_indices) {
-          video_descriptor.add_keyframe_indices(v);
-        }
-        for (u64 v : sample_offsets) {
-          video_descriptor.add_sample_offsets(v);
-        }
-        for (u64 v : sample_sizes) {
-          video_descriptor.add_sample_sizes(v);
-        }
       } else {
-        // Non h264 compressible video column
+        // Non h264/hevc compressible video column
         video_descriptor.set_codec_type(proto::VideoDescriptor::RAW);
         // Need to specify but not used for this type
         video_descriptor.set_chroma_format(proto::VideoDescriptor::YUV_420);
@@ -249,9 +274,12 @@ void ColumnSink::new_task(i32 table_id, i32 task_id,
   }
 }
 
-void ColumnSink::provide_column_info(const std::vector<bool>& compressed,
-                                     const std::vector<FrameInfo>& frame_info) {
+void ColumnSink::provide_column_info(
+    const std::vector<bool>& compressed,
+    const std::vector<proto::VideoDescriptor::VideoCodecType>& codecs,
+    const std::vector<FrameInfo>& frame_info) {
   compressed_ = compressed;
+  codecs_ = codecs;
   frame_info_ = frame_info;
 }
 
@@ -40,6 +40,7 @@ class ColumnSink : public Sink {
 
   void provide_column_info(
       const std::vector<bool>& compressed,
+      const std::vector<proto::VideoDescriptor::VideoCodecType>& codecs,
       const std::vector<FrameInfo>& frame_info);
 
  private:
@@ -53,6 +54,7 @@ class ColumnSink : public Sink {
 
   std::vector<ColumnType> column_types_;
   std::vector<bool> compressed_;
+  std::vector<proto::VideoDescriptor::VideoCodecType> codecs_;
   std::vector<FrameInfo> frame_info_;
 
   // Continuation state
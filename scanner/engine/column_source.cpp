@@ -14,13 +14,16 @@
  */
 
 #include "scanner/engine/column_source.h"
+#include "scanner/engine/decode_cost_model.h"
 #include "scanner/engine/metadata.h"
 #include "scanner/source_args.pb.h"
 #include "scanner/engine/video_index_entry.h"
+#include "scanner/util/disk_cache.h"
 
 #include "storehouse/storage_backend.h"
 
 #include <glog/logging.h>
+#include <algorithm>
 #include <vector>
 
 using storehouse::StorageBackend;
@@ -116,73 +119,6 @@ RowIntervals slice_into_row_intervals(const TableMetadata& table,
   return info;
 }
 
-struct VideoIntervals {
-  std::vector<std::tuple<size_t, size_t>> keyframe_index_intervals;
-  std::vector<std::vector<i64>> valid_frames;
-};
-
-VideoIntervals slice_into_video_intervals(
-    const std::vector<u64>& keyframe_positions,
-    const std::vector<u64>& sample_offsets,
-    const std::vector<u64>& sample_sizes, const std::vector<i64>& rows) {
-  VideoIntervals info;
-  assert(keyframe_positions.size() >= 2);
-  size_t start_keyframe_index = 0;
-  size_t end_keyframe_index = 1;
-  i64 next_keyframe = keyframe_positions[end_keyframe_index];
-  std::vector<i64> valid_frames;
-
-  i64 prev_row = 0;
-  if (rows.size() > 0) {
-    prev_row = rows[0];
-  }
-  for (i64 row : rows) {
-    if (row >= next_keyframe) {
-      // Check if this keyframe is adjacent
-      uint64_t last_endpoint = sample_offsets.at(next_keyframe - 1) +
-                               sample_sizes.at(next_keyframe - 1);
-      bool is_adjacent = (last_endpoint == sample_offsets.at(next_keyframe));
-
-      assert(end_keyframe_index < keyframe_positions.size() - 1);
-      i64 prev_prev_keyframe = keyframe_positions[end_keyframe_index - 1];
-      i64 prev_keyframe = next_keyframe;
-      next_keyframe = keyframe_positions[++end_keyframe_index];
-      uint64_t keyframe_interval = next_keyframe - prev_keyframe;
-      // If the interval between the previous row and the current row is larger
-      // than half the keyframe interval or if they are exactly equal to the
-      // keyframes, then we should make a new interval so that we can avoid
-      // decoding everything in between
-      // bool large_distance = (row - prev_row) > (keyframe_interval / 2);
-      // bool exactly_keyframes =
-      //     (row == prev_keyframe) && (prev_row == prev_prev_keyframe);
-      // if (exactly_keyframes || large_distance || row >= next_keyframe ||
-      //     !is_adjacent) {
-      if (row >= next_keyframe || !is_adjacent) {
-        // Skipped a keyframe, so make a new interval
-        if (!valid_frames.empty()) {
-          info.keyframe_index_intervals.push_back(
-              std::make_tuple(start_keyframe_index, end_keyframe_index - 1));
-          info.valid_frames.push_back(valid_frames);
-        }
-
-        while (row >= keyframe_positions[end_keyframe_index]) {
-          end_keyframe_index++;
-          assert(end_keyframe_index < keyframe_positions.size());
-        }
-        valid_frames.clear();
-        start_keyframe_index = end_keyframe_index - 1;
-        next_keyframe = keyframe_positions[end_keyframe_index];
-      }
-    }
-    valid_frames.push_back(row);
-    prev_row = row;
-  }
-  info.keyframe_index_intervals.push_back(
-      std::make_tuple(start_keyframe_index, end_keyframe_index));
-  info.valid_frames.push_back(valid_frames);
-  return info;
-}
-
 std::tuple<size_t, size_t> find_keyframe_indices(
     i32 start_frame, i32 end_frame,
     const std::vector<i64>& keyframe_positions) {
@@ -206,6 +142,16 @@ std::tuple<size_t, size_t> find_keyframe_indices(
   return std::make_tuple(start_keyframe_index, end_keyframe_index);
 }
 
+// Adds the disk cache hits and misses of a column read to the profiler
+void record_disk_cache_stats(Profiler& profiler, const DiskCacheStats& stats) {
+  if (get_disk_cache() == nullptr) {
+    return;
+  }
+  profiler.increment("disk_cache_hits", stats.hits);
+  profiler.increment("disk_cache_misses", stats.misses);
+  profiler.increment("disk_cache_bytes_fetched", stats.bytes_fetched);
+}
+
 void read_video_column(Profiler& profiler, const VideoIndexEntry& index_entry,
                        const std::vector<i64>& rows, i64 start_frame,
                        Elements& element_list) {
@@ -220,8 +166,14 @@ void read_video_column(Profiler& profiler, const VideoIndexEntry& index_entry,
   // the bytes starting at the first iframe at or preceding the first frame
   // we are interested and will continue up to the bytes before the
   // first iframe at or after the last frame we are interested in.
-  VideoIntervals intervals = slice_into_video_intervals(
-      keyframe_indices, sample_offsets, sample_sizes, rows);
+  DecodeCostModel& cost_model = get_decode_cost_model();
+  DecodeCost cost = cost_model.cost(
+      std::make_tuple(index_entry.table_id, index_entry.column_id,
+                      index_entry.item_id),
+      index_entry.width, index_entry.height);
+  VideoIntervals intervals = plan_decode_intervals(
+      keyframe_indices, sample_offsets, sample_sizes,
+      index_entry.non_reference_samples, rows, cost);
   size_t num_intervals = intervals.keyframe_index_intervals.size();
   for (size_t i = 0; i < num_intervals; ++i) {
     size_t start_keyframe_index;
@@ -257,10 +209,14 @@ void read_video_column(Profiler& profiler, const VideoIndexEntry& index_entry,
     auto io_start = now();
 
     u64 pos = start_keyframe_byte_offset;
-    s_read(video_file.get(), buffer, buffer_size, pos);
+    DiskCacheStats cache_stats;
+    s_read_cached(video_file.get(), file_size, buffer, buffer_size, pos,
+                  &cache_stats);
 
     profiler.add_interval("io", io_start, now());
+    record_disk_cache_stats(profiler, cache_stats);
     profiler.increment("io_read", static_cast<i64>(buffer_size));
+    cost_model.record_read(buffer_size, nano_since(io_start) / 1e9);
 
     proto::DecodeArgs decode_args;
     decode_args.set_width(index_entry.width);
@@ -287,10 +243,27 @@ void read_video_column(Profiler& profiler, const VideoIndexEntry& index_entry,
     for (size_t j = 0; j < intervals.valid_frames[i].size(); ++j) {
       decode_args.add_valid_frames(intervals.valid_frames[i][j] + start_frame);
     }
+    const std::vector<u64>& non_ref_samples =
+        index_entry.non_reference_samples;
+    size_t first_non_ref =
+        std::lower_bound(non_ref_samples.begin(), non_ref_samples.end(),
+                         (u64)start_keyframe) -
+        non_ref_samples.begin();
+    for (size_t j = first_non_ref;
+         j < non_ref_samples.size() && non_ref_samples[j] < (u64)end_keyframe;
+         ++j) {
+      decode_args.add_non_reference_samples(non_ref_samples[j] + start_frame);
+      decode_args.add_non_reference_frames(
+          index_entry.non_reference_frames[j] + start_frame);
+    }
     decode_args.set_encoded_video((i64)buffer);
     decode_args.set_encoded_video_size(buffer_size);
     decode_args.set_metadata(index_entry.metadata.data(),
                              index_entry.metadata.size());
+    decode_args.set_codec_type(index_entry.codec_type);
+    decode_args.set_table_id(index_entry.table_id);
+    decode_args.set_column_id(index_entry.column_id);
+    decode_args.set_item_id(index_entry.item_id);
 
     size_t size = decode_args.ByteSizeLong();
     u8* decode_args_buffer = new_buffer(CPU_DEVICE, size);
@@ -306,6 +279,7 @@ void read_other_column(StorageBackend* storage, Profiler& profiler,
                        i32 load_sparsity_threshold,
                        Elements& element_list) {
   const std::vector<i64>& valid_offsets = rows;
+  DiskCacheStats cache_stats;
 
   // Read metadata file to determine num rows and sizes
   u64 num_elements = 0;
@@ -320,17 +294,26 @@ void read_other_column(StorageBackend* storage, Profiler& profiler,
     BACKOFF_FAIL(file->get_size(file_size),
                  "while trying to get size for " + metadata_path);
 
+    // Read the whole metadata file at once so it can be served from the
+    // disk cache
+    std::vector<u8> metadata(file_size);
+    u64 read_pos = 0;
+    s_read_cached(file.get(), file_size, metadata.data(), file_size, read_pos,
+                  &cache_stats);
+
     // Read number of elements in file
     u64 pos = 0;
     while (pos < file_size) {
-      u64 elements = s_read<u64>(file.get(), pos);
+      u64 elements;
+      memcpy(&elements, metadata.data() + pos, sizeof(u64));
+      pos += sizeof(u64);
 
       // Read element sizes from work item file header
       size_t prev_size = element_sizes.size();
       element_sizes.resize(prev_size + elements);
-      s_read(file.get(),
-             reinterpret_cast<u8*>(element_sizes.data() + prev_size),
-             elements * sizeof(i64), pos);
+      memcpy(element_sizes.data() + prev_size, metadata.data() + pos,
+             elements * sizeof(i64));
+      pos += elements * sizeof(i64);
 
       num_elements += elements;
     }
@@ -378,7 +361,8 @@ void read_other_column(StorageBackend* storage, Profiler& profiler,
       for (i32 i = item_start; i < row; ++i) {
         row_offset += element_sizes[i];
       }
-      s_read(file.get(), buffer, buffer_size, row_offset);
+      s_read_cached(file.get(), file_size, buffer, buffer_size, row_offset,
+                    &cache_stats);
       insert_element(element_list, buffer, buffer_size);
       block_buffer += buffer_size;
     }
@@ -389,7 +373,8 @@ void read_other_column(StorageBackend* storage, Profiler& profiler,
     std::vector<u8> element_data(element_data_size);
 
     // Read chunk of file corresponding to requested elements
-    s_read(file.get(), element_data.data(), element_data.size(), pos);
+    s_read_cached(file.get(), file_size, element_data.data(),
+                  element_data.size(), pos, &cache_stats);
 
     // Extract individual elements and insert into output work entry
     u64 offset = 0;
@@ -407,6 +392,7 @@ void read_other_column(StorageBackend* storage, Profiler& profiler,
     }
     assert(valid_idx == valid_offsets.size());
   }
+  record_disk_cache_stats(profiler, cache_stats);
 }
 
 }  // namespace
@@ -492,8 +478,8 @@ void ColumnSource::read(const std::vector<ElementArgs>& element_args,
       info = FrameInfo(entry.height, entry.width, entry.channels,
                        entry.frame_type);
       codec_type_= entry.codec_type;
-      if (entry.codec_type == proto::VideoDescriptor::H264) {
-        // Video was encoded using h264
+      if (entry.codec_type != proto::VideoDescriptor::RAW) {
+        // Video was encoded using h264 or hevc
         read_video_column(*profiler_, entry, valid_offsets, item_start_row,
                           output_columns[0]);
       } else {
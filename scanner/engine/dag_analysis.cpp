@@ -20,6 +20,12 @@
 #include "scanner/engine/column_enumerator.h"
 #include "scanner/api/op.h"
 #include "scanner/api/kernel.h"
+#include "scanner/source_args.pb.h"
+#include "scanner/util/util.h"
+
+#include <algorithm>
+#include <iterator>
+#include <set>
 
 namespace scanner {
 namespace internal {
@@ -925,6 +931,189 @@ void populate_analysis_info(const std::vector<proto::Op>& ops,
   }
 }
 
+namespace {
+
+// The (op, input index) pairs which consume the frames of a source op,
+// looking through builtin ops which pass frames along unchanged
+std::vector<std::tuple<i64, i32>> source_frame_consumers(
+    const std::vector<proto::Op>& ops, const DAGAnalysisInfo& info,
+    i64 source_idx) {
+  auto passes_frames_through = [](const std::string& name) {
+    return is_builtin_op(name) || name == "SampleFrame" ||
+           name == "SpaceFrame" || name == "SliceFrame" ||
+           name == "UnsliceFrame";
+  };
+
+  std::vector<std::tuple<i64, i32>> consumers;
+  // (op, output column) pairs which carry the source's frames
+  std::vector<std::tuple<i64, std::string>> frontier = {
+      std::make_tuple(source_idx, ops.at(source_idx).inputs(0).column())};
+  while (!frontier.empty()) {
+    i64 op_idx;
+    std::string column;
+    std::tie(op_idx, column) = frontier.back();
+    frontier.pop_back();
+    if (info.op_children.count(op_idx) == 0) {
+      continue;
+    }
+    for (i64 child_idx : info.op_children.at(op_idx)) {
+      const proto::Op& child = ops.at(child_idx);
+      for (i32 i = 0; i < child.inputs_size(); ++i) {
+        const proto::OpInput& input = child.inputs(i);
+        if (input.op_index() != op_idx || input.column() != column) {
+          continue;
+        }
+        if (passes_frames_through(child.name())) {
+          frontier.push_back(std::make_tuple(child_idx, column));
+        } else {
+          consumers.push_back(std::make_tuple(child_idx, i));
+        }
+      }
+    }
+  }
+  return consumers;
+}
+
+}
+
+std::map<i64, FrameFormat> determine_source_frame_formats(
+    const std::vector<proto::Op>& ops, const DAGAnalysisInfo& info) {
+  // Cheapest first. RGB24 is accepted by every frame input.
+  const std::vector<FrameFormat> preference = {
+      FrameFormat::GRAY8, FrameFormat::YUV420P, FrameFormat::NV12,
+      FrameFormat::RGB24};
+
+  OpRegistry* op_registry = get_op_registry();
+  std::map<i64, FrameFormat> formats;
+  for (auto& kv : info.source_ops) {
+    i64 source_idx = kv.first;
+    std::set<FrameFormat> accepted(preference.begin(), preference.end());
+    for (auto& consumer : source_frame_consumers(ops, info, source_idx)) {
+      const proto::Op& op = ops.at(std::get<0>(consumer));
+      // Sinks and variadic inputs only take RGB24
+      std::set<FrameFormat> op_accepted = {FrameFormat::RGB24};
+      OpInfo* op_info =
+          op.is_sink() ? nullptr : op_registry->get_op_info(op.name());
+      if (op_info != nullptr && !op_info->variadic_inputs()) {
+        const Column& col = op_info->input_columns().at(std::get<1>(consumer));
+        for (i32 format : col.frame_formats()) {
+          op_accepted.insert((FrameFormat)format);
+        }
+      }
+      std::set<FrameFormat> both;
+      std::set_intersection(accepted.begin(), accepted.end(),
+                            op_accepted.begin(), op_accepted.end(),
+                            std::inserter(both, both.begin()));
+      accepted.swap(both);
+    }
+    for (FrameFormat format : preference) {
+      if (accepted.count(format) > 0) {
+        formats[source_idx] = format;
+        break;
+      }
+    }
+  }
+  return formats;
+}
+
+std::map<i64, DecoderResize> determine_source_decoder_resizes(
+    const std::vector<proto::Op>& ops, const DAGAnalysisInfo& info) {
+  OpRegistry* op_registry = get_op_registry();
+  std::map<i64, DecoderResize> resizes;
+  for (auto& kv : info.source_ops) {
+    i64 source_idx = kv.first;
+    auto consumers = source_frame_consumers(ops, info, source_idx);
+    // Every consumer must be the same resize, otherwise some of them need
+    // the frames at their original size
+    bool fusable = !consumers.empty();
+    for (auto& consumer : consumers) {
+      const proto::Op& op = ops.at(std::get<0>(consumer));
+      const proto::Op& first_op = ops.at(std::get<0>(consumers[0]));
+      fusable &= !op.is_sink() && op.name() == first_op.name() &&
+                 op.kernel_args() == first_op.kernel_args() &&
+                 op_registry->get_op_info(op.name())->frame_resize();
+    }
+    if (fusable) {
+      const proto::Op& op = ops.at(std::get<0>(consumers[0]));
+      DecoderResize& resize = resizes[source_idx];
+      resize.fn = op_registry->get_op_info(op.name())->frame_resize();
+      resize.args =
+          std::vector<u8>(op.kernel_args().begin(), op.kernel_args().end());
+      for (auto& consumer : consumers) {
+        resize.op_indices.push_back(std::get<0>(consumer));
+      }
+    }
+  }
+  return resizes;
+}
+
+i64 select_video_proxies(const DatabaseMetadata& meta,
+                         TableMetaCache& table_metas,
+                         const std::vector<proto::Op>& ops,
+                         const DAGAnalysisInfo& info,
+                         std::vector<proto::Job>& jobs) {
+  std::map<i64, DecoderResize> resizes =
+      determine_source_decoder_resizes(ops, info);
+  i64 num_proxies = 0;
+  for (auto& job : jobs) {
+    for (auto& input : *job.mutable_inputs()) {
+      auto it = resizes.find(input.op_index());
+      if (it == resizes.end()) {
+        continue;
+      }
+      const DecoderResize& resize = it->second;
+      // Job arguments of the resize could change the size it resizes to
+      bool has_job_args = false;
+      for (auto& op_args : job.op_args()) {
+        has_job_args |=
+            std::find(resize.op_indices.begin(), resize.op_indices.end(),
+                      op_args.op_index()) != resize.op_indices.end();
+      }
+      if (has_job_args) {
+        continue;
+      }
+      proto::ColumnEnumeratorArgs args;
+      if (!args.ParseFromString(input.enumerator_args()) ||
+          !meta.has_table(args.table_name())) {
+        continue;
+      }
+      const TableMetadata& table =
+          table_metas.at(meta.get_table_id(args.table_name()));
+      if (!table.has_column(args.column_name())) {
+        continue;
+      }
+      i32 column_id = table.column_id(args.column_name());
+
+      const proto::TableDescriptor::VideoProxy* best = nullptr;
+      for (auto& proxy : table.get_descriptor().video_proxies()) {
+        if (proxy.source_column_id() != column_id) {
+          continue;
+        }
+        i32 width, height;
+        resize.fn(resize.args, proxy.source_width(), proxy.source_height(),
+                  width, height);
+        i32 proxy_width, proxy_height;
+        resize.fn(resize.args, proxy.width(), proxy.height(), proxy_width,
+                  proxy_height);
+        if (proxy_width != width || proxy_height != height ||
+            width > proxy.width() || height > proxy.height()) {
+          continue;
+        }
+        if (best == nullptr ||
+            proxy.width() * proxy.height() < best->width() * best->height()) {
+          best = &proxy;
+        }
+      }
+      if (best != nullptr) {
+        args.set_column_name(table.column_name(best->column_id()));
+        input.set_enumerator_args(args.SerializeAsString());
+        num_proxies++;
+      }
+    }
+  }
+  return num_proxies;
+}
+
 void remap_input_op_edges(std::vector<proto::Op>& ops,
                           DAGAnalysisInfo& info) {
   auto rename_col = [](i32 op_idx, const std::string& n) {
@@ -1153,6 +1342,89 @@ void perform_liveness_analysis(const std::vector<proto::Op>& ops,
   }
 }
 
+void determine_fused_kernels(const std::vector<proto::Op>& ops,
+                             DAGAnalysisInfo& info) {
+  OpRegistry* op_registry = get_op_registry();
+  auto can_fuse = [&](i64 op_idx) {
+    const proto::Op& op = ops.at(op_idx);
+    return !op.is_source() && !op.is_sink() && !is_builtin_op(op.name()) &&
+           info.stencils.at(op_idx) == std::vector<i32>{0} &&
+           info.bounded_state_ops.count(op_idx) == 0 &&
+           info.unbounded_state_ops.count(op_idx) == 0 && op.replicas() <= 1;
+  };
+
+  info.fused_kernel_inputs.clear();
+  for (i64 op_idx = 2; op_idx < ops.size(); ++op_idx) {
+    i64 prev_idx = op_idx - 1;
+    const proto::Op& op = ops.at(op_idx);
+    const proto::Op& prev = ops.at(prev_idx);
+    if (!can_fuse(op_idx) || !can_fuse(prev_idx) ||
+        op.device_type() != prev.device_type() ||
+        info.batch_sizes.at(op_idx) != info.batch_sizes.at(prev_idx)) {
+      continue;
+    }
+    // The outputs of the previous op must only be read by this op, since
+    // they are never materialized
+    bool other_consumer = false;
+    for (size_t i = 0; i < ops.size(); ++i) {
+      for (auto& input : ops.at(i).inputs()) {
+        other_consumer |= ((i64)i != op_idx && input.op_index() == prev_idx);
+      }
+    }
+    if (other_consumer) {
+      continue;
+    }
+    // Find each input among the outputs of the previous op which are kept
+    // after it executes
+    const std::vector<Column>& prev_outputs =
+        op_registry->get_op_info(prev.name())->output_columns();
+    const std::vector<i32>& unused = info.unused_outputs.at(prev_idx);
+    std::vector<i32> fused_inputs;
+    for (auto& input : op.inputs()) {
+      if (input.op_index() != prev_idx) {
+        break;
+      }
+      i32 used_idx = 0;
+      for (i32 c = 0; c < (i32)prev_outputs.size(); ++c) {
+        if (prev_outputs[c].name() == input.column()) {
+          fused_inputs.push_back(used_idx);
+          break;
+        }
+        if (std::find(unused.begin(), unused.end(), c) == unused.end()) {
+          used_idx++;
+        }
+      }
+    }
+    if (fused_inputs.size() == op.inputs_size()) {
+      VLOG(1) << "Fusing op " << op.name() << " (" << op_idx << ") with "
+              << prev.name() << " (" << prev_idx << ")";
+      info.fused_kernel_inputs[op_idx] = fused_inputs;
+    }
+  }
+}
+
+void determine_concurrent_kernels(const std::vector<proto::Op>& ops,
+                                  DAGAnalysisInfo& info) {
+  info.concurrent_kernels.clear();
+  for (i64 op_idx = 1; op_idx + 1 < ops.size(); ++op_idx) {
+    const proto::Op& op = ops.at(op_idx);
+    if (op.is_source() || op.is_sink() || is_builtin_op(op.name()) ||
+        op.device_type() != DeviceType::CPU ||
+        info.fused_kernel_inputs.count(op_idx) > 0 ||
+        info.fused_kernel_inputs.count(op_idx + 1) > 0) {
+      continue;
+    }
+    // Nothing would run alongside the kernel if the next op waits for it
+    bool next_reads_outputs = false;
+    for (auto& input : ops.at(op_idx + 1).inputs()) {
+      next_reads_outputs |= (input.op_index() == op_idx);
+    }
+    if (!next_reads_outputs) {
+      info.concurrent_kernels[op_idx] = true;
+    }
+  }
+}
+
 Result derive_stencil_requirements(
     const DatabaseMetadata& meta, TableMetaCache& table_meta,
     const proto::Job& job, const std::vector<proto::Op>& ops,
@@ -1239,12 +1511,12 @@ Result derive_stencil_requirements(
   // For each Op, determine the set of rows needed in the live columns list
   // and the set of rows to feed to the Op at the current column mapping
   // Op -> Rows
-  std::vector<std::set<i64>> required_output_rows_at_op(ops.size());
+  std::vector<RowSet> required_output_rows_at_op(ops.size());
   std::vector<std::vector<i64>> required_input_rows_at_op(ops.size());
   // Track inputs for ecah column of the input Op since different rnput Op
   // colums may correspond to different tables and conservatively requesting
   // all rows could cause an invalid access
-  std::vector<std::set<i64>> required_input_op_output_rows;
+  std::vector<RowSet> required_input_op_output_rows;
   required_input_op_output_rows.resize(ops.at(0).inputs_size());
   std::vector<std::vector<i64>> required_input_op_input_rows;
   required_input_op_input_rows.resize(ops.at(0).inputs_size());
@@ -1279,15 +1551,12 @@ Result derive_stencil_requirements(
   i32 slice_group = 0;
   {
     // Initialize output rows
-    required_output_rows_at_op.at(num_ops - 1) =
-        std::set<i64>(output_rows.begin(), output_rows.end());
+    required_output_rows_at_op.at(num_ops - 1) = RowSet(output_rows);
     // For each kernel, derive the minimal required upstream elements
     for (i64 op_idx = num_ops - 1; op_idx >= 0; --op_idx) {
       auto& op = ops.at(op_idx);
-      std::vector<i64> downstream_rows(
-          required_output_rows_at_op.at(op_idx).begin(),
-          required_output_rows_at_op.at(op_idx).end());
-      std::sort(downstream_rows.begin(), downstream_rows.end());
+      std::vector<i64> downstream_rows =
+          required_output_rows_at_op.at(op_idx).rows();
       std::vector<i64> compute_rows;
       // Determine which upstream rows are needed for the requested output rows
       std::vector<i64> new_rows;
@@ -1296,10 +1565,8 @@ Result derive_stencil_requirements(
         // Ignore if it is not the first input
         if (op_idx == 0) {
           for (size_t i = 0; i < enumerators.size(); ++i) {
-            std::vector<i64> output_rows(
-                required_input_op_output_rows.at(i).begin(),
-                required_input_op_output_rows.at(i).end());
-            std::sort(output_rows.begin(), output_rows.end());
+            std::vector<i64> output_rows =
+                required_input_op_output_rows.at(i).rows();
             std::vector<i64>& input_rows = required_input_op_input_rows.at(i);
             i64 num_rows = enumerators[i]->total_elements();
 
@@ -1410,8 +1677,7 @@ Result derive_stencil_requirements(
       // Regular Op
       else {
         assert(!is_builtin_op(op.name()));
-        std::unordered_set<i64> current_rows;
-        current_rows.reserve(downstream_rows.size());
+        std::vector<i64> current_rows;
         // If bounded state, we need to handle warmup
         if (bounded_state_ops.count(op_idx) > 0) {
           i32 warmup = warmup_sizes.at(op_idx);
@@ -1422,7 +1688,7 @@ Result derive_stencil_requirements(
               if (req_row < 0) {
                 continue;
               }
-              current_rows.insert(req_row);
+              current_rows.push_back(req_row);
             }
           }
         }
@@ -1430,25 +1696,25 @@ Result derive_stencil_requirements(
         else if (unbounded_state_ops.count(op_idx) > 0) {
           i32 max_required_row = downstream_rows.back();
           for (i64 i = 0; i <= max_required_row; ++i) {
-            current_rows.insert(i);
+            current_rows.push_back(i);
           }
         } else {
-          current_rows.insert(downstream_rows.begin(), downstream_rows.end());
+          current_rows = downstream_rows;
         }
-        compute_rows = std::vector<i64>(current_rows.begin(),
-                                        current_rows.end());
-        std::sort(compute_rows.begin(), compute_rows.end());
+        compute_rows = RowSet(current_rows).rows();
 
-        // Ensure we have inputs for stenciling kernels
-        std::unordered_set<i64> stencil_rows;
+        // Ensure we have inputs for stenciling kernels. Each stencil offset
+        // shifts the sorted compute rows, which merge in linear time.
+        RowSet stencil_rows;
         const std::vector<i32>& stencil = stencils.at(op_idx);
-        for (i64 r : current_rows) {
-          for (i64 s : stencil) {
-            stencil_rows.insert(r + s);
+        std::vector<i64> shifted_rows(compute_rows.size());
+        for (i64 s : stencil) {
+          for (size_t i = 0; i < compute_rows.size(); ++i) {
+            shifted_rows[i] = compute_rows[i] + s;
           }
+          stencil_rows.insert(shifted_rows);
         }
-        new_rows = std::vector<i64>(stencil_rows.begin(), stencil_rows.end());
-        std::sort(new_rows.begin(), new_rows.end());
+        new_rows = stencil_rows.rows();
 
         // Perform boundary restriction to limit requested rows from other ops
         // to only those which are within the domain
@@ -1484,11 +1750,10 @@ Result derive_stencil_requirements(
               }
             }
             assert(col_id != -1);
-            required_input_op_output_rows.at(col_id).insert(
-                new_rows.begin(), new_rows.end());
+            required_input_op_output_rows.at(col_id).insert(new_rows);
           }
           auto& input_outputs = required_output_rows_at_op.at(input.op_index());
-          input_outputs.insert(new_rows.begin(), new_rows.end());
+          input_outputs.insert(new_rows);
         }
       }
 
@@ -1515,9 +1780,9 @@ Result derive_stencil_requirements(
 
       TaskStream s;
       s.slice_group = slice_group;
-      s.valid_input_rows = new_rows;
-      s.compute_input_rows = compute_rows;
-      s.valid_output_rows = downstream_rows;
+      s.valid_input_rows = RowSet(new_rows);
+      s.compute_input_rows = RowSet(compute_rows);
+      s.valid_output_rows = RowSet(downstream_rows);
       task_streams.push_front(s);
     }
   }
@@ -1531,9 +1796,9 @@ Result derive_stencil_requirements(
         required_input_op_input_rows.at(i).begin(),
         required_input_op_input_rows.at(i).end());
     out_arg->mutable_input_row_ids()->Swap(&input_data);
-    google::protobuf::RepeatedField<i64> output_data(
-        required_input_op_output_rows.at(i).begin(),
-        required_input_op_output_rows.at(i).end());
+    std::vector<i64> source_rows = required_input_op_output_rows.at(i).rows();
+    google::protobuf::RepeatedField<i64> output_data(source_rows.begin(),
+                                                     source_rows.end());
     out_arg->mutable_output_row_ids()->Swap(&output_data);
 
     const auto& ele = required_input_op_element_args.at(i);
@@ -1546,5 +1811,147 @@ Result derive_stencil_requirements(
   return result;
 }
 
+Result validate_incremental_ops(const std::vector<proto::Op>& ops) {
+  Result result;
+  result.set_success(true);
+  OpRegistry* op_registry = get_op_registry();
+  for (size_t op_idx = 0; op_idx < ops.size(); ++op_idx) {
+    auto& op = ops.at(op_idx);
+    if (op.is_source()) {
+      if (op.name() != "Column" && op.name() != "FrameColumn") {
+        RESULT_ERROR(&result,
+                     "Incremental jobs can only read from tables, but source "
+                     "%s at index %lu is not a Column source.",
+                     op.name().c_str(), op_idx);
+        return result;
+      }
+      continue;
+    }
+    if (op.is_sink()) {
+      continue;
+    }
+    if (is_builtin_op(op.name())) {
+      RESULT_ERROR(&result,
+                   "Incremental jobs can not use stream op %s (index %lu) "
+                   "since it changes which source rows map to which output "
+                   "rows.",
+                   op.name().c_str(), op_idx);
+      return result;
+    }
+    OpInfo* info = op_registry->get_op_info(op.name());
+    if (info->has_unbounded_state()) {
+      RESULT_ERROR(&result,
+                   "Incremental jobs can not use Op %s (index %lu) since it "
+                   "has unbounded state.",
+                   op.name().c_str(), op_idx);
+      return result;
+    }
+    // Rows near the end of the previous run were computed with padding in
+    // place of the rows which are now available
+    std::vector<i32> stencil(op.stencil().begin(), op.stencil().end());
+    if (stencil.empty()) {
+      stencil = info->preferred_stencil();
+    }
+    for (i32 s : stencil) {
+      if (s > 0) {
+        RESULT_ERROR(&result,
+                     "Incremental jobs can not use Op %s (index %lu) since "
+                     "its stencil depends on later rows.",
+                     op.name().c_str(), op_idx);
+        return result;
+      }
+    }
+  }
+  return result;
+}
+
+std::string job_pipeline_signature(const proto::Job& job,
+                                   const std::vector<proto::Op>& ops,
+                                   const proto::BulkJobParameters& params) {
+  std::stringstream ss;
+  for (auto& op : ops) {
+    ss << op.SerializeAsString() << ";";
+  }
+  for (auto& input : job.inputs()) {
+    ss << input.SerializeAsString() << ";";
+  }
+  for (auto& op_args : job.op_args()) {
+    ss << op_args.SerializeAsString() << ";";
+  }
+  for (auto& saa : job.sampling_args_assignment()) {
+    ss << saa.SerializeAsString() << ";";
+  }
+  for (auto& name : params.output_column_names()) {
+    ss << name << ";";
+  }
+  for (auto& compression : params.compression()) {
+    ss << compression.SerializeAsString() << ";";
+  }
+  return stable_hash(ss.str());
+}
+
+std::vector<proto::TableDescriptor::SourceVersion> job_source_versions(
+    const DatabaseMetadata& meta, TableMetaCache& table_metas,
+    const proto::Job& job, const std::vector<proto::Op>& ops) {
+  std::vector<proto::TableDescriptor::SourceVersion> versions;
+  for (auto& input : job.inputs()) {
+    auto& op = ops.at(input.op_index());
+    if (op.name() != "Column" && op.name() != "FrameColumn") {
+      continue;
+    }
+    proto::ColumnEnumeratorArgs args;
+    if (!args.ParseFromString(input.enumerator_args()) ||
+        !meta.has_table(args.table_name())) {
+      continue;
+    }
+    i32 table_id = meta.get_table_id(args.table_name());
+    versions.emplace_back();
+    versions.back().set_table_id(table_id);
+    versions.back().set_num_rows(table_metas.at(table_id).num_rows());
+  }
+  return versions;
+}
+
+Result validate_incremental_table(
+    const TableMetadata& table, const std::string& signature,
+    const std::vector<proto::TableDescriptor::SourceVersion>& versions) {
+  Result result;
+  result.set_success(true);
+  const auto& desc = table.get_descriptor();
+  if (desc.pipeline_signature() != signature) {
+    RESULT_ERROR(&result,
+                 "Table %s was not produced by the same ops and arguments, so "
+                 "it can not be extended incrementally. Rerun with force to "
+                 "overwrite it.",
+                 table.name().c_str());
+    return result;
+  }
+  if (desc.source_versions_size() != versions.size()) {
+    RESULT_ERROR(&result,
+                 "Table %s was produced from a different number of source "
+                 "tables.",
+                 table.name().c_str());
+    return result;
+  }
+  for (size_t i = 0; i < versions.size(); ++i) {
+    auto& previous = desc.source_versions(i);
+    if (previous.table_id() != versions[i].table_id()) {
+      RESULT_ERROR(&result,
+                   "A source table of %s has been replaced since it was "
+                   "produced. Rerun with force to overwrite it.",
+                   table.name().c_str());
+      return result;
+    }
+    if (previous.num_rows() > versions[i].num_rows()) {
+      RESULT_ERROR(&result,
+                   "A source table of %s has fewer rows than when it was "
+                   "produced.",
+                   table.name().c_str());
+      return result;
+    }
+  }
+  return result;
+}
+
 }
 }
@@ -40,6 +40,13 @@ const std::vector<std::string> BUILTIN_OP_NAMES = {
 
 bool is_builtin_op(const std::string& name);
 
+// An op resizing the frames of a source, fused into the source's decoder
+struct DecoderResize {
+  FrameResizeFn fn;
+  std::vector<u8> args;
+  std::vector<i64> op_indices;  // The resize ops consuming the source
+};
+
 struct DAGAnalysisInfo {
   bool is_table_output;
 
@@ -77,6 +84,13 @@ struct DAGAnalysisInfo {
   std::vector<std::vector<i32>> dead_columns;
   std::vector<std::vector<i32>> unused_outputs;
   std::vector<std::vector<i32>> column_mapping;
+
+  // Filled in by determine_fused_kernels
+  // Op -> for each input, the index among the outputs of the previous op
+  // which are not discarded
+  std::map<i64, std::vector<i32>> fused_kernel_inputs;
+  // Filled in by determine_concurrent_kernels
+  std::map<i64, bool> concurrent_kernels;
 };
 
 
@@ -103,6 +117,29 @@ Result derive_slice_final_output_rows(
 void populate_analysis_info(const std::vector<proto::Op>& ops,
                             DAGAnalysisInfo& info);
 
+// Picks the format frames should be decoded into for each source op: the
+// cheapest format accepted by every op which consumes the source's column,
+// looking through builtin ops which pass frames along unchanged. Must be
+// called before remap_input_op_edges.
+std::map<i64, FrameFormat> determine_source_frame_formats(
+    const std::vector<proto::Op>& ops, const DAGAnalysisInfo& info);
+
+// Finds the sources whose frames are only consumed by ops which resize them
+// to the same size (see OpBuilder::decoder_resize), so that the decoder can
+// produce frames at that size. Must be called before remap_input_op_edges.
+std::map<i64, DecoderResize> determine_source_decoder_resizes(
+    const std::vector<proto::Op>& ops, const DAGAnalysisInfo& info);
+
+// Points the sources whose frames are only resized (see
+// determine_source_decoder_resizes) at the smallest proxy of their video
+// column which the resize turns into the same frames without upscaling.
+// Returns the number of job inputs which now read a proxy.
+i64 select_video_proxies(const DatabaseMetadata& meta,
+                         TableMetaCache& table_metas,
+                         const std::vector<proto::Op>& ops,
+                         const DAGAnalysisInfo& info,
+                         std::vector<proto::Job>& jobs);
+
 // Change all edges from input Ops to instead come from the first Op.
 // We currently only implement IO at the start and end of a pipeline.
 void remap_input_op_edges(std::vector<proto::Op>& ops,
@@ -111,6 +148,20 @@ void remap_input_op_edges(std::vector<proto::Op>& ops,
 void perform_liveness_analysis(const std::vector<proto::Op>& ops,
                                DAGAnalysisInfo& info);
 
+// Finds kernels which can run on each batch right after the previous op,
+// without materializing its outputs: both ops are stateless kernels with a
+// {0} stencil and the same device and batch size, and the kernel is the only
+// reader of the previous op's outputs. Must be called after
+// perform_liveness_analysis.
+void determine_fused_kernels(const std::vector<proto::Op>& ops,
+                             DAGAnalysisInfo& info);
+
+// Finds CPU kernels which can keep running while the ops after them are
+// evaluated, because the next op does not read their outputs (e.g. two
+// analyses of the same frames). Must be called after determine_fused_kernels.
+void determine_concurrent_kernels(const std::vector<proto::Op>& ops,
+                                  DAGAnalysisInfo& info);
+
 Result derive_stencil_requirements(
     const DatabaseMetadata& meta, TableMetaCache& table_meta,
     const proto::Job& job, const std::vector<proto::Op>& ops,
@@ -120,6 +171,28 @@ Result derive_stencil_requirements(
     const std::vector<i64>& output_rows, LoadWorkEntry& output_entry,
     std::deque<TaskStream>& task_streams);
 
+// Checks that the ops can be run incrementally: every output row must only
+// depend on source rows at or before it, and sources must be tables so that
+// new rows can be detected.
+Result validate_incremental_ops(const std::vector<proto::Op>& ops);
+
+// Hash of everything about a job which determines the contents of its output
+// table, other than the number of rows in its source tables
+std::string job_pipeline_signature(const proto::Job& job,
+                                   const std::vector<proto::Op>& ops,
+                                   const proto::BulkJobParameters& params);
+
+// The tables read by the job's sources and their current number of rows
+std::vector<proto::TableDescriptor::SourceVersion> job_source_versions(
+    const DatabaseMetadata& meta, TableMetaCache& table_metas,
+    const proto::Job& job, const std::vector<proto::Op>& ops);
+
+// Checks that table was produced by a job with the given signature from a
+// prefix of the given source tables
+Result validate_incremental_table(
+    const TableMetadata& table, const std::string& signature,
+    const std::vector<proto::TableDescriptor::SourceVersion>& versions);
+
 // Result derive_input_rows_from_output_rows(
 //     const std::vector<proto::Job>& jobs,
 //     const std::vector<proto::Op>& ops,
@@ -0,0 +1,187 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "scanner/engine/decode_cost_model.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+// Weight of the newest measurement in the running estimates
+const double MEASUREMENT_WEIGHT = 0.1;
+
+// Number of samples in [start, end) which are decoded when none of their
+// frames are sampled
+i64 decoded_samples(const std::vector<u64>& non_reference_samples, u64 start,
+                    u64 end) {
+  auto first = std::lower_bound(non_reference_samples.begin(),
+                                non_reference_samples.end(), start);
+  auto last = std::lower_bound(first, non_reference_samples.end(), end);
+  return (end - start) - (last - first);
+}
+
+}
+
+void DecodeCostModel::record_decode(const VideoKey& video, i64 frames,
+                                    double seconds) {
+  if (frames <= 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(lock_);
+  double frame_seconds = seconds / frames;
+  auto it = frame_seconds_.find(video);
+  if (it == frame_seconds_.end()) {
+    frame_seconds_[video] = frame_seconds;
+  } else {
+    it->second += MEASUREMENT_WEIGHT * (frame_seconds - it->second);
+  }
+}
+
+void DecodeCostModel::record_read(i64 bytes, double seconds) {
+  std::lock_guard<std::mutex> lock(lock_);
+  double decay = 1 - MEASUREMENT_WEIGHT;
+  double x = bytes;
+  read_weight_ = decay * read_weight_ + 1;
+  read_bytes_ = decay * read_bytes_ + x;
+  read_seconds_ = decay * read_seconds_ + seconds;
+  read_bytes_sq_ = decay * read_bytes_sq_ + x * x;
+  read_bytes_seconds_ = decay * read_bytes_seconds_ + x * seconds;
+}
+
+DecodeCost DecodeCostModel::cost(const VideoKey& video, i32 width,
+                                 i32 height) const {
+  std::lock_guard<std::mutex> lock(lock_);
+  DecodeCost cost;
+  auto it = frame_seconds_.find(video);
+  cost.frame_seconds = (it != frame_seconds_.end())
+                           ? it->second
+                           : DEFAULT_DECODE_SECONDS_PER_PIXEL * width * height;
+
+  double request_seconds = DEFAULT_READ_REQUEST_SECONDS;
+  cost.byte_seconds = DEFAULT_READ_BYTE_SECONDS;
+  double mean_bytes = read_bytes_ / std::max(read_weight_, 1e-9);
+  double variance = read_bytes_sq_ / std::max(read_weight_, 1e-9) -
+                    mean_bytes * mean_bytes;
+  // The fit is only meaningful once reads of different sizes were measured
+  if (read_weight_ > 0 && variance > 1.0) {
+    double mean_seconds = read_seconds_ / read_weight_;
+    double covariance =
+        read_bytes_seconds_ / read_weight_ - mean_bytes * mean_seconds;
+    cost.byte_seconds = std::max(covariance / variance, 0.0);
+    request_seconds =
+        std::max(mean_seconds - cost.byte_seconds * mean_bytes, 0.0);
+  }
+  cost.interval_seconds =
+      request_seconds + DECODER_RESTART_FRAMES * cost.frame_seconds;
+  return cost;
+}
+
+DecodeCostModel& get_decode_cost_model() {
+  static DecodeCostModel model;
+  return model;
+}
+
+VideoIntervals plan_decode_intervals(
+    const std::vector<u64>& keyframe_positions,
+    const std::vector<u64>& sample_offsets,
+    const std::vector<u64>& sample_sizes,
+    const std::vector<u64>& non_reference_samples,
+    const std::vector<i64>& rows, const DecodeCost& cost) {
+  assert(keyframe_positions.size() >= 2);
+  // Index of the GOP holding row
+  auto gop_of = [&keyframe_positions](i64 row) -> size_t {
+    return std::upper_bound(keyframe_positions.begin(),
+                            keyframe_positions.end() - 1, (u64)row) -
+           keyframe_positions.begin() - 1;
+  };
+  // Whether decoding on from the sampled row prev_row to the start of GOP to
+  // is cheaper than starting a new interval at GOP to. Decoding through
+  // costs the rest of the GOP of prev_row, which a new interval would never
+  // decode, and the GOPs skipped in between.
+  auto decode_through = [&](i64 prev_row, size_t to) {
+    size_t from = gop_of(prev_row) + 1;
+    for (size_t g = from; g <= to; ++g) {
+      u64 keyframe = keyframe_positions[g];
+      if (sample_offsets[keyframe - 1] + sample_sizes[keyframe - 1] !=
+          sample_offsets[keyframe]) {
+        return false;
+      }
+    }
+    u64 gap_end = keyframe_positions[to];
+    i64 frames =
+        decoded_samples(non_reference_samples, (u64)prev_row + 1, gap_end);
+    u64 bytes = sample_offsets[gap_end] -
+                sample_offsets[keyframe_positions[from]];
+    return frames * cost.frame_seconds + bytes * cost.byte_seconds <=
+           cost.interval_seconds;
+  };
+
+  VideoIntervals plan;
+  size_t start_gop = rows.empty() ? 0 : gop_of(rows[0]);
+  size_t end_gop = start_gop;
+  std::vector<i64> valid_frames;
+  for (i64 row : rows) {
+    size_t gop = gop_of(row);
+    assert(gop >= end_gop);
+    if (gop > end_gop) {
+      if (!decode_through(valid_frames.back(), gop)) {
+        plan.keyframe_index_intervals.push_back(
+            std::make_tuple(start_gop, end_gop + 1));
+        plan.valid_frames.push_back(valid_frames);
+        valid_frames.clear();
+        start_gop = gop;
+      }
+      end_gop = gop;
+    }
+    valid_frames.push_back(row);
+  }
+  plan.keyframe_index_intervals.push_back(
+      std::make_tuple(start_gop, end_gop + 1));
+  plan.valid_frames.push_back(valid_frames);
+  return plan;
+}
+
+double estimate_plan_seconds(const VideoIntervals& plan,
+                             const std::vector<u64>& keyframe_positions,
+                             const std::vector<u64>& sample_offsets,
+                             const std::vector<u64>& non_reference_samples,
+                             const DecodeCost& cost) {
+  double seconds = 0;
+  for (size_t i = 0; i < plan.keyframe_index_intervals.size(); ++i) {
+    size_t start_gop;
+    size_t end_gop;
+    std::tie(start_gop, end_gop) = plan.keyframe_index_intervals[i];
+    u64 start = keyframe_positions[start_gop];
+    u64 end = keyframe_positions[end_gop];
+    // The decoder stops after the last valid frame of the interval
+    u64 last = plan.valid_frames[i].empty()
+                   ? start
+                   : (u64)plan.valid_frames[i].back() + 1;
+    i64 frames = std::max((i64)plan.valid_frames[i].size(),
+                          decoded_samples(non_reference_samples, start, last));
+    seconds += cost.interval_seconds + frames * cost.frame_seconds +
+               (sample_offsets[end] - sample_offsets[start]) *
+                   cost.byte_seconds;
+  }
+  return seconds;
+}
+
+}
+}
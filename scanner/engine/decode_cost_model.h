@@ -0,0 +1,109 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "scanner/util/common.h"
+
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+// Assumed decode time of a frame, per pixel, until a video has been measured
+static const double DEFAULT_DECODE_SECONDS_PER_PIXEL = 2e-9;
+// Assumed cost of a read until reads have been measured on this node
+static const double DEFAULT_READ_REQUEST_SECONDS = 5e-3;
+static const double DEFAULT_READ_BYTE_SECONDS = 5e-9;
+// Frames worth of decode time lost when a decode interval ends, since the
+// frames in flight in the decoder are flushed before it restarts
+static const i32 DECODER_RESTART_FRAMES = 4;
+
+struct DecodeCost {
+  double frame_seconds;     //!< Decoding one frame
+  double byte_seconds;      //!< Reading one byte of encoded video
+  double interval_seconds;  //!< Starting a new decode interval
+};
+
+/// Node-wide calibration of the cost of reading and decoding videos.
+///
+/// The decoders report how long each video took to decode per frame and the
+/// column sources report how long their reads took. Read time is fit as a
+/// fixed cost per request plus a cost per byte. Recent measurements are
+/// weighted more heavily so the model follows changes in load.
+class DecodeCostModel {
+ public:
+  // (table id, column id, item id)
+  using VideoKey = std::tuple<i32, i32, i32>;
+
+  void record_decode(const VideoKey& video, i64 frames, double seconds);
+
+  void record_read(i64 bytes, double seconds);
+
+  DecodeCost cost(const VideoKey& video, i32 width, i32 height) const;
+
+ private:
+  mutable std::mutex lock_;
+  std::map<VideoKey, double> frame_seconds_;
+  // Exponentially weighted sums for the least squares fit of read time
+  // against bytes read
+  double read_weight_ = 0;
+  double read_bytes_ = 0;
+  double read_seconds_ = 0;
+  double read_bytes_sq_ = 0;
+  double read_bytes_seconds_ = 0;
+};
+
+DecodeCostModel& get_decode_cost_model();
+
+struct VideoIntervals {
+  std::vector<std::tuple<size_t, size_t>> keyframe_index_intervals;
+  std::vector<std::vector<i64>> valid_frames;
+};
+
+// Splits the sorted rows of a video into decode intervals. Each interval is
+// a range of keyframe indices [start, end) which is read and decoded in one
+// go. Between two sampled rows in different GOPs, the decoder either seeks
+// to the keyframe of the later row by starting a new interval, or decodes
+// on from the earlier row through the GOPs in between, whichever cost
+// estimates to be cheaper. The
+// choices for each pair of rows are independent, so this gives the cheapest
+// plan under the cost model. Videos which were encoded separately can not
+// be decoded through.
+//
+// keyframe_positions and sample_offsets end with the number of frames and
+// the size of the file. non_reference_samples are the sorted samples that
+// the decoder skips when their frames are not sampled.
+VideoIntervals plan_decode_intervals(
+    const std::vector<u64>& keyframe_positions,
+    const std::vector<u64>& sample_offsets,
+    const std::vector<u64>& sample_sizes,
+    const std::vector<u64>& non_reference_samples,
+    const std::vector<i64>& rows, const DecodeCost& cost);
+
+// Estimated time to read and decode the intervals of a plan. Each interval
+// is read whole but only decoded up to its last valid frame.
+double estimate_plan_seconds(const VideoIntervals& plan,
+                             const std::vector<u64>& keyframe_positions,
+                             const std::vector<u64>& sample_offsets,
+                             const std::vector<u64>& non_reference_samples,
+                             const DecodeCost& cost);
+
+}
+}
@@ -11,16 +11,26 @@
 namespace scanner {
 namespace internal {
 
+// Chunks of decoded frames each GOP-parallel decoder may have waiting for
+// yield before it stalls
+static const i32 GOP_DECODE_BUFFERED_CHUNKS = 2;
+
 PreEvaluateWorker::PreEvaluateWorker(const PreEvaluateWorkerArgs& args)
   : node_id_(args.node_id),
     worker_id_(args.worker_id),
     device_handle_(args.device_handle),
     num_cpus_(args.num_cpus),
     decoder_cpus_(args.decoder_cpus),
+    work_packet_size_(std::max(1, args.work_packet_size)),
+    gop_parallel_decoders_(args.gop_parallel_decoders),
+    decoder_buffered_frames_(args.decoder_buffered_frames),
+    frame_formats_(args.frame_formats),
+    decoder_resizes_(args.decoder_resizes),
     profiler_(args.profiler) {
 }
 
 PreEvaluateWorker::~PreEvaluateWorker() {
+  wait_for_gop_decodes();
   for (auto& encoded_data : decode_args_) {
     for (auto& args : encoded_data) {
       delete_buffer(CPU_DEVICE, (u8*)args.encoded_video());
@@ -72,8 +82,24 @@ void PreEvaluateWorker::feed(EvalWorkEntry& work_entry, bool first) {
     }
     for (size_t c = 0; c < work_entry.columns.size(); ++c) {
       if (work_entry.column_types[c] == ColumnType::Video &&
-          work_entry.video_encoding_type[media_col_idx] ==
-              proto::VideoDescriptor::H264) {
+          work_entry.video_encoding_type[media_col_idx] !=
+              proto::VideoDescriptor::RAW) {
+        gop_decoders_.emplace_back();
+        // Only the software decoder produces formats other than RGB24 and
+        // resizes frames
+        FrameFormat format = FrameFormat::RGB24;
+        DecoderResize resize;
+        if (decoder_type == VideoDecoderType::SOFTWARE &&
+            !work_entry.inplace_video[c]) {
+          if (c < frame_formats_.size()) {
+            format = frame_formats_[c];
+          }
+          if (c < decoder_resizes_.size()) {
+            resize = decoder_resizes_[c];
+          }
+        }
+        decode_formats_.push_back(format);
+        decode_resizes_.push_back(resize);
         if (work_entry.inplace_video[c]) {
           hwang::DeviceHandle hd;
           switch (device_handle_.type) {
@@ -104,20 +130,46 @@ void PreEvaluateWorker::feed(EvalWorkEntry& work_entry, bool first) {
               new hwang::DecoderAutomata(hd, num_devices, vd));
           //decoders_.back()->set_profiler(&profiler_);
           decoders_.emplace_back(nullptr);
+        } else if (gop_parallel_decoders_ > 1) {
+          // The software decoder threads are shared between the decoders
+          i32 gop_num_devices =
+              (decoder_type == VideoDecoderType::SOFTWARE)
+                  ? std::max(1, num_devices / gop_parallel_decoders_)
+                  : num_devices;
+          for (i32 i = 0; i < gop_parallel_decoders_; ++i) {
+            gop_decoders_.back().emplace_back(
+                new DecoderAutomata(device_handle_, gop_num_devices,
+                                    decoder_type, decoder_buffered_frames_));
+            gop_decoders_.back().back()->set_profiler(&profiler_);
+          }
+          decoders_.emplace_back(nullptr);
+          inplace_decoders_.emplace_back(nullptr);
         } else {
           decoders_.emplace_back(
-              new DecoderAutomata(device_handle_, num_devices, decoder_type));
+              new DecoderAutomata(device_handle_, num_devices, decoder_type,
+                                  decoder_buffered_frames_));
           decoders_.back()->set_profiler(&profiler_);
           inplace_decoders_.emplace_back(nullptr);
         }
         media_col_idx++;
       }
     }
+    decoded_infos_.resize(decoders_.size());
+    gop_decodes_.resize(decoders_.size());
+    gop_cursors_.resize(decoders_.size());
+    cached_frames_.resize(decoders_.size());
+    frame_keys_.resize(decoders_.size());
+    decoded_rows_before_.resize(decoders_.size());
+    if (gop_parallel_decoders_ > 1) {
+      gop_decode_pool_.reset(new ThreadPool(gop_parallel_decoders_));
+    }
     profiler_.add_interval("init", init_start, now());
   }
 
   media_col_idx = 0;
   auto setup_start = now();
+  // The GOP decodes of the previous task read from the decode args buffers
+  wait_for_gop_decodes();
   // Deserialize all decode args into protobufs
   for (auto& encoded_data : decode_args_) {
     for (auto& args : encoded_data) {
@@ -127,8 +179,8 @@ void PreEvaluateWorker::feed(EvalWorkEntry& work_entry, bool first) {
   decode_args_.clear();
   for (size_t c = 0; c < work_entry.columns.size(); ++c) {
     if (work_entry.column_types[c] == ColumnType::Video &&
-        work_entry.video_encoding_type[media_col_idx] ==
-            proto::VideoDescriptor::H264) {
+        work_entry.video_encoding_type[media_col_idx] !=
+            proto::VideoDescriptor::RAW) {
       decode_args_.emplace_back();
       auto& args = decode_args_.back();
       for (Element element : work_entry.columns[c]) {
@@ -143,8 +195,126 @@ void PreEvaluateWorker::feed(EvalWorkEntry& work_entry, bool first) {
         delete_element(CPU_DEVICE, element);
       }
 
-      if (!work_entry.inplace_video[c]) {
-        decoders_[media_col_idx]->initialize(args);
+      i64 num_rows = 0;
+      for (auto& da : args) {
+        num_rows += da.valid_frames_size();
+      }
+      FrameInfo& info = decoded_infos_[media_col_idx];
+      if (!args.empty()) {
+        info = decoded_frame_info(media_col_idx, args[0]);
+      }
+      std::vector<u8*>& cached_frames = cached_frames_[media_col_idx];
+      std::vector<FrameCacheKey>& frame_keys = frame_keys_[media_col_idx];
+      cached_frames.assign(num_rows, nullptr);
+      frame_keys.clear();
+
+      // Only decode the frames which are not in the node's frame cache
+      std::vector<proto::DecodeArgs> missing_args;
+      FrameCache* frame_cache = get_frame_cache();
+      if (frame_cache != nullptr && !work_entry.inplace_video[c]) {
+        i64 row = 0;
+        for (auto& da : args) {
+          missing_args.push_back(da);
+          auto* valid_frames = missing_args.back().mutable_valid_frames();
+          i32 num_missing = 0;
+          for (i64 frame : da.valid_frames()) {
+            frame_keys.emplace_back(da.table_id(), da.column_id(),
+                                    da.item_id(), frame, info.format,
+                                    info.width(), info.height());
+            cached_frames[row] =
+                frame_cache->get(decoder_output_handle_, frame_keys.back());
+            if (cached_frames[row] == nullptr) {
+              valid_frames->Set(num_missing++, frame);
+            }
+            row++;
+          }
+          valid_frames->Truncate(num_missing);
+        }
+        // Drop the GOPs which no longer have any frames to decode
+        std::vector<std::vector<proto::DecodeArgs>> groups =
+            split_decode_args_at_keyframes(missing_args, 1);
+        missing_args = groups.empty() ? std::vector<proto::DecodeArgs>()
+                                      : groups[0];
+      } else {
+        missing_args = args;
+      }
+
+      std::vector<i64>& decoded_rows_before =
+          decoded_rows_before_[media_col_idx];
+      decoded_rows_before.assign(num_rows + 1, 0);
+      for (i64 r = 0; r < num_rows; ++r) {
+        decoded_rows_before[r + 1] =
+            decoded_rows_before[r] + (cached_frames[r] == nullptr ? 1 : 0);
+      }
+      i64 num_decoded_rows = decoded_rows_before[num_rows];
+      if (frame_cache != nullptr) {
+        profiler_.increment("frame_cache_hits", num_rows - num_decoded_rows);
+      }
+      profiler_.increment(
+          "decoded_" + proto::FrameFormat_Name(info.format) + "_frames",
+          num_decoded_rows);
+      // Pixels of the frames as stored, before any fused resize
+      profiler_.increment(
+          "decoded_pixels",
+          num_decoded_rows * args[0].width() * args[0].height());
+      if (decode_resizes_[media_col_idx].fn && num_decoded_rows > 0) {
+        // The full size frames the resize op would have read are never
+        // allocated
+        size_t full_size = FrameInfo::with_format(args[0].height(),
+                                                  args[0].width(), info.format)
+                               .size();
+        profiler_.increment("fused_resize_frames", num_decoded_rows);
+        profiler_.increment("fused_resize_bytes_saved",
+                            num_decoded_rows * full_size);
+      }
+
+      if (!gop_decoders_[media_col_idx].empty()) {
+        // Split the frames at keyframes so that each decoder works on its own
+        // GOPs. Each decoder hands its frames to yield in row order, in
+        // chunks of at most a work packet.
+        auto& decoders = gop_decoders_[media_col_idx];
+        std::vector<std::vector<proto::DecodeArgs>> groups =
+            split_decode_args_at_keyframes(missing_args, decoders.size());
+        gop_cursors_[media_col_idx] = GOPCursor();
+        if (num_decoded_rows > 0) {
+          const DeviceHandle handle = decoder_output_handle_;
+          const i64 chunk_rows = work_packet_size_;
+          i64 start_row = 0;
+          for (size_t g = 0; g < groups.size(); ++g) {
+            i64 group_rows = 0;
+            for (auto& da : groups[g]) {
+              group_rows += da.valid_frames_size();
+            }
+            GOPDecode decode;
+            decode.start_row = start_row;
+            decode.end_row = start_row + group_rows;
+            decode.num_chunks = (group_rows + chunk_rows - 1) / chunk_rows;
+            decode.chunks_popped = 0;
+            decode.chunks.reset(
+                new Queue<GOPChunk>(GOP_DECODE_BUFFERED_CHUNKS));
+            DecoderAutomata* decoder = decoders[g].get();
+            Queue<GOPChunk>* chunks = decode.chunks.get();
+            decode.done = gop_decode_pool_->enqueue(
+                [decoder, chunks, handle, start_row, group_rows, chunk_rows,
+                 info, group_args = std::move(groups[g])]() {
+                  decoder->initialize(group_args, info);
+                  for (i64 r = 0; r < group_rows; r += chunk_rows) {
+                    i64 rows = std::min(chunk_rows, group_rows - r);
+                    u8* buffer =
+                        new_block_buffer(handle, rows * info.size(), rows);
+                    decoder->get_frames(buffer, rows);
+                    chunks->push(GOPChunk{start_row + r, rows, buffer});
+                  }
+                });
+            gop_decodes_[media_col_idx].push_back(std::move(decode));
+            start_row += group_rows;
+          }
+          profiler_.increment("gop_decode_segments", groups.size());
+        }
+      } else if (!work_entry.inplace_video[c]) {
+        if (!missing_args.empty()) {
+          decoders_[media_col_idx]->initialize(missing_args, info);
+        }
       } else {
         // Translate into encoded data
         std::vector<hwang::DecoderAutomata::EncodedData> encoded_data;
@@ -182,6 +352,67 @@ void PreEvaluateWorker::feed(EvalWorkEntry& work_entry, bool first) {
   profiler_.add_interval("feed", feed_start, now());
 }
 
+FrameInfo PreEvaluateWorker::decoded_frame_info(
+    i32 media_col_idx, const proto::DecodeArgs& args) {
+  i32 width = args.width();
+  i32 height = args.height();
+  const DecoderResize& resize = decode_resizes_[media_col_idx];
+  if (resize.fn) {
+    resize.fn(resize.args, args.width(), args.height(), width, height);
+  }
+  return FrameInfo::with_format(height, width, decode_formats_[media_col_idx]);
+}
+
+u8* PreEvaluateWorker::next_gop_frame(i32 media_col_idx, i64 decoded_row,
+                                      size_t frame_size) {
+  std::vector<GOPDecode>& decodes = gop_decodes_[media_col_idx];
+  GOPCursor& cursor = gop_cursors_[media_col_idx];
+  while (decoded_row >= cursor.chunk.start_row + cursor.chunk.num_rows) {
+    GOPDecode& decode = decodes.at(cursor.decode_idx);
+    if (decode.chunks_popped == decode.num_chunks) {
+      cursor.decode_idx++;
+      continue;
+    }
+    decode.chunks->pop(cursor.chunk);
+    decode.chunks_popped++;
+    cursor.next_row = cursor.chunk.start_row;
+  }
+  assert(decoded_row == cursor.next_row);
+  cursor.next_row++;
+  return cursor.chunk.buffer +
+         (decoded_row - cursor.chunk.start_row) * frame_size;
+}
+
+void PreEvaluateWorker::wait_for_gop_decodes() {
+  for (size_t c = 0; c < gop_decodes_.size(); ++c) {
+    auto& decodes = gop_decodes_[c];
+    GOPCursor& cursor = gop_cursors_[c];
+    size_t frame_size = decoded_infos_[c].size();
+    auto free_rows = [&](const GOPChunk& chunk, i64 from_row) {
+      for (i64 r = from_row; r < chunk.start_row + chunk.num_rows; ++r) {
+        delete_buffer(decoder_output_handle_,
+                      chunk.buffer + (r - chunk.start_row) * frame_size);
+      }
+    };
+    // Frames of a task which was not yielded to the end, e.g. on shutdown.
+    // Popping every chunk also unblocks decoders waiting on a full queue.
+    if (cursor.chunk.buffer != nullptr) {
+      free_rows(cursor.chunk, cursor.next_row);
+    }
+    for (GOPDecode& decode : decodes) {
+      while (decode.chunks_popped < decode.num_chunks) {
+        GOPChunk chunk;
+        decode.chunks->pop(chunk);
+        decode.chunks_popped++;
+        free_rows(chunk, chunk.start_row);
+      }
+      decode.done.wait();
+    }
+    decodes.clear();
+    cursor = GOPCursor();
+  }
+}
+
 bool PreEvaluateWorker::yield(i32 item_size,
                               EvalWorkEntry& output_entry) {
   if (current_row_ >= total_rows_) return false;
@@ -215,23 +446,55 @@ bool PreEvaluateWorker::yield(i32 item_size,
     if (work_entry.column_types[c] == ColumnType::Video) {
       // Perform decoding
       i64 num_rows = column_end_row - column_start_row;
-      if (work_entry.video_encoding_type[media_col_idx] ==
-          proto::VideoDescriptor::H264) {
+      if (work_entry.video_encoding_type[media_col_idx] !=
+          proto::VideoDescriptor::RAW) {
         if (num_rows > 0) {
           // Encoded as video
-          FrameInfo frame_info(decode_args_[media_col_idx][0].height(),
-                               decode_args_[media_col_idx][0].width(), 3,
-                               FrameType::U8);
-          u8* buffer = new_block_buffer(decoder_output_handle_,
-                                        num_rows * frame_info.size(), num_rows);
-          if (!work_entry.inplace_video[c]) {
-            decoders_[media_col_idx]->get_frames(buffer, num_rows);
-          } else {
-            inplace_decoders_[media_col_idx]->get_frames(buffer, num_rows);
+          const FrameInfo& frame_info = decoded_infos_[media_col_idx];
+          // Rows which were found in the frame cache are not decoded
+          const std::vector<i64>& decoded_rows_before =
+              decoded_rows_before_[media_col_idx];
+          i64 decode_start = decoded_rows_before[column_start_row];
+          i64 decode_end = decoded_rows_before[column_end_row];
+          i64 num_decoded = decode_end - decode_start;
+          u8* buffer = nullptr;
+          bool gop_parallel = !gop_decoders_[media_col_idx].empty();
+          if (num_decoded > 0 && !gop_parallel) {
+            buffer = new_block_buffer(decoder_output_handle_,
+                                      num_decoded * frame_info.size(),
+                                      num_decoded);
+            if (!work_entry.inplace_video[c]) {
+              decoders_[media_col_idx]->get_frames(buffer, num_decoded);
+            } else {
+              inplace_decoders_[media_col_idx]->get_frames(buffer,
+                                                           num_decoded);
+            }
+          }
+          FrameCache* frame_cache = get_frame_cache();
+          const std::vector<FrameCacheKey>& frame_keys =
+              frame_keys_[media_col_idx];
+          auto frames_start = now();
+          for (i64 r = column_start_row; r < column_end_row; ++r) {
+            u8* frame_buffer = cached_frames_[media_col_idx][r];
+            if (frame_buffer == nullptr) {
+              if (gop_parallel) {
+                // Waits for the decoder producing the row
+                frame_buffer = next_gop_frame(
+                    media_col_idx, decoded_rows_before[r], frame_info.size());
+              } else {
+                frame_buffer =
+                    buffer + (decoded_rows_before[r] - decode_start) *
+                                 frame_info.size();
+              }
+              if (frame_cache != nullptr && !frame_keys.empty()) {
+                frame_cache->insert(decoder_output_handle_, frame_keys[r],
+                                    frame_buffer);
+              }
+            }
+            insert_frame(entry.columns[c], new Frame(frame_info, frame_buffer));
           }
-          for (i64 n = 0; n < num_rows; ++n) {
-            insert_frame(entry.columns[c],
-                         new Frame(frame_info, buffer + frame_info.size() * n));
+          if (gop_parallel && num_decoded > 0) {
+            profiler_.add_interval("gop_decode_wait", frames_start, now());
           }
         }
         entry.column_handles.push_back(decoder_output_handle_);
@@ -273,6 +536,7 @@ EvaluateWorker::EvaluateWorker(const EvaluateWorkerArgs& args)
     column_mapping_set_.emplace_back(col.begin(), col.end());
   }
   // Instantiate kernels
+  i32 max_replicas = 1;
   {
     OpRegistry* registry = get_op_registry();
     DeviceHandle last_device = CPU_DEVICE;
@@ -284,6 +548,7 @@ EvaluateWorker::EvaluateWorker(const EvaluateWorkerArgs& args)
         kernel_output_devices_.push_back({last_device});
         kernel_num_outputs_.push_back(1);
         kernels_.emplace_back(nullptr);
+        kernel_replicas_.emplace_back();
         continue;
       }
       OpInfo* op_info = registry->get_op_info(factory->get_op_name());
@@ -339,26 +604,54 @@ EvaluateWorker::EvaluateWorker(const EvaluateWorkerArgs& args)
         THREAD_RETURN_SUCCESS();
       }
       kernels_.emplace_back(kernel);
+
+      // Extra instances of replicated kernels, which evaluate disjoint
+      // batches in parallel
+      kernel_replicas_.emplace_back();
+      for (i32 r = 1; r < arg_group_.kernel_replicas[i]; ++r) {
+        BaseKernel* replica = factory->new_instance(config);
+        Result result;
+        replica->validate(&result);
+        LOG_IF(FATAL, !result.success())
+            << "Kernel replica validate failed: " << result.msg();
+        kernel_replicas_.back().emplace_back(replica);
+      }
+      max_replicas =
+          std::max(max_replicas, (i32)kernel_replicas_.back().size() + 1);
     }
   }
   assert(kernels_.size() > 0);
+  if (max_replicas > 1) {
+    replica_pool_.reset(new ThreadPool(max_replicas - 1));
+  }
 
   for (auto& kernel : kernels_) {
     if (kernel != nullptr) {
       kernel->set_profiler(&args.profiler);
     }
   }
+  for (auto& replicas : kernel_replicas_) {
+    for (auto& replica : replicas) {
+      replica->set_profiler(&args.profiler);
+    }
+  }
   // Setup kernel cache sizes
-  element_cache_row_ids_.resize(kernels_.size());
   element_cache_.resize(kernels_.size());
   element_cache_devices_.resize(kernels_.size());
+  fused_outputs_.resize(kernels_.size());
+  if (args.branch_threads > 1) {
+    branch_pool_.reset(new ThreadPool(args.branch_threads - 1));
+  }
   for (size_t i = 0; i < kernels_.size(); ++i) {
-    // Resize stencil cache to be the same size as the number of inputs
-    // to the kernel
-    element_cache_[i].resize(arg_group_.column_mapping[i].size());
-    element_cache_row_ids_[i].resize(arg_group_.column_mapping[i].size());
+    // One stencil cache per input to the kernel, sized to hold the stencil
+    // window of a full batch
+    i64 capacity = stencil_cache_capacity(arg_group_.kernel_stencils[i],
+                                          arg_group_.kernel_batch_sizes[i]);
+    element_cache_[i].assign(arg_group_.column_mapping[i].size(),
+                             StencilCache(capacity));
   }
   valid_output_rows_.resize(kernels_.size());
+  last_computed_row_.assign(kernels_.size(), -1);
   current_valid_input_idx_.resize(kernels_.size());
   current_valid_output_idx_.assign(kernels_.size(), 0);
 
@@ -371,12 +664,27 @@ EvaluateWorker::EvaluateWorker(const EvaluateWorkerArgs& args)
 }
 
 EvaluateWorker::~EvaluateWorker() {
+  if (carried_batch_) {
+    release_carried_inputs();
+    for (size_t cidx = 0; cidx < carried_batch_->output_columns.size();
+         ++cidx) {
+      DeviceHandle handle = used_output_handles(carried_batch_->k)[cidx];
+      for (Element& element : carried_batch_->output_columns[cidx]) {
+        delete_element(handle, element);
+      }
+    }
+  }
   // Clear the stencil cache
   clear_stencil_cache();
 }
 
 void EvaluateWorker::new_task(i64 job_idx, i64 task_idx,
                               const std::vector<TaskStream>& task_streams) {
+  // Kernels which carry their state over from the previous task only
+  // compute the rows after the last row they computed for it, instead of
+  // warming up again
+  bool continues_task = job_idx == job_idx_ && task_idx == task_idx_ + 1;
+  std::vector<bool> carry_state(task_streams.size(), false);
   job_idx_ = job_idx;
   task_idx_ = task_idx;
   for (size_t i = 0; i < task_streams.size(); ++i) {
@@ -385,15 +693,12 @@ void EvaluateWorker::new_task(i64 job_idx, i64 task_idx,
     }
   }
   valid_input_rows_.clear();
-  valid_input_rows_set_.clear();
   current_valid_input_idx_.clear();
 
   compute_rows_.clear();
-  compute_rows_set_.clear();
   current_compute_idx_.clear();
 
   valid_output_rows_.clear();
-  valid_output_rows_set_.clear();
   current_valid_output_idx_.clear();
 
   current_element_cache_input_idx_.clear();
@@ -403,24 +708,48 @@ void EvaluateWorker::new_task(i64 job_idx, i64 task_idx,
     if (ts.slice_group != -1) {
       slice_group_ = ts.slice_group;
     }
-    valid_input_rows_.push_back(ts.valid_input_rows);
-    valid_input_rows_set_.push_back(
-        std::set<i64>(ts.valid_input_rows.begin(), ts.valid_input_rows.end()));
+    // The feed loop walks these rows in order, so expand them once here
+    valid_input_rows_.push_back(ts.valid_input_rows.rows());
     current_valid_input_idx_.emplace_back();
     for(i64 i = 0; i < arg_group_.column_mapping[k].size(); ++i) {
       current_valid_input_idx_.back().push_back(0);
     }
 
-    compute_rows_.push_back(ts.compute_input_rows);
-    compute_rows_set_.push_back(std::set<i64>(
-        ts.compute_input_rows.begin(), ts.compute_input_rows.end()));
+    compute_rows_.push_back(ts.compute_input_rows.rows());
     current_compute_idx_.push_back(0);
 
-    valid_output_rows_.push_back(ts.valid_output_rows);
-    valid_output_rows_set_.push_back(std::set<i64>(ts.valid_output_rows.begin(),
-                                                   ts.valid_output_rows.end()));
+    valid_output_rows_.push_back(ts.valid_output_rows.rows());
     current_valid_output_idx_.push_back(0);
 
+    if (arg_group_.carries_state[k]) {
+      std::vector<i64>& compute_rows = compute_rows_.back();
+      const std::vector<i64>& output_rows = valid_output_rows_.back();
+      i64 last_row = last_computed_row_[k];
+      carry_state[k] = continues_task && last_row >= 0 &&
+                       !output_rows.empty() && last_row < output_rows[0];
+      if (carry_state[k]) {
+        compute_rows.erase(compute_rows.begin(),
+                           std::upper_bound(compute_rows.begin(),
+                                            compute_rows.end(), last_row));
+      }
+      // Rows computed only to warm up the kernel state
+      i64 warmup_rows = compute_rows.size();
+      size_t o = 0;
+      for (i64 row : compute_rows) {
+        while (o < output_rows.size() && output_rows[o] < row) {
+          o++;
+        }
+        if (o < output_rows.size() && output_rows[o] == row) {
+          warmup_rows--;
+        }
+      }
+      profiler_.increment("warmup_rows:" + arg_group_.op_names[k],
+                          warmup_rows);
+    }
+    if (!carry_state[k]) {
+      last_computed_row_[k] = -1;
+    }
+
     current_element_cache_input_idx_.push_back(0);
   }
 
@@ -469,8 +798,17 @@ void EvaluateWorker::new_task(i64 job_idx, i64 task_idx,
 
   // Make the op aware of the format of the data
   for (size_t i = 0; i < kernels_.size(); ++i) {
-    auto& kernel = kernels_[i];
-    if (kernel) {
+    if (carry_state[i]) {
+      continue;
+    }
+    std::vector<BaseKernel*> instances;
+    if (kernels_[i]) {
+      instances.push_back(kernels_[i].get());
+    }
+    for (auto& replica : kernel_replicas_[i]) {
+      instances.push_back(replica.get());
+    }
+    for (BaseKernel* kernel : instances) {
       kernel->reset();
       // Pass new op args
       if (arg_group_.op_args[i].size() > 0) {
@@ -505,11 +843,29 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
   BatchedElements side_output_columns = work_entry.columns;
   std::vector<std::vector<i64>> side_row_ids = work_entry.row_ids;
 
+  // Kernels running on the branch pool whose outputs have not been added to
+  // the side outputs yet
+  std::vector<std::unique_ptr<PendingKernel>> pending_kernels;
+
   // For each kernel, produce as much output as can be produced given current
   // input rows and stencil cache.
   for (size_t k = 0; k < arg_group_.op_names.size(); ++k) {
     auto op_start = now();
     const std::string& op_name = arg_group_.op_names.at(k);
+    // Wait for any pending kernel whose outputs this op reads
+    for (i32 in_col_idx : arg_group_.column_mapping[k]) {
+      bool reads_pending = false;
+      for (auto& pending : pending_kernels) {
+        reads_pending |= (in_col_idx >= pending->first_col_idx &&
+                          in_col_idx < pending->first_col_idx +
+                                           pending->num_output_columns);
+      }
+      if (reads_pending) {
+        join_pending_kernels(pending_kernels, side_output_columns,
+                             side_output_handles, side_row_ids);
+        break;
+      }
+    }
     bool is_source = arg_group_.is_source.at(k);
     DeviceHandle current_handle = kernel_devices_[k];
     const std::vector<DeviceHandle>& current_input_handles =
@@ -520,21 +876,17 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
     VLOG(1) << "Processing Op " << op_name;
 
     std::vector<i64>& kernel_valid_input_rows = valid_input_rows_[k];
-    std::set<i64>& kernel_valid_input_rows_set = valid_input_rows_set_[k];
     std::vector<i64>& kernel_current_input_idx = current_valid_input_idx_[k];
 
     std::vector<i64>& kernel_compute_rows = compute_rows_[k];
     i64& kernel_current_compute_idx = current_compute_idx_[k];
 
     std::vector<i64>& kernel_valid_output_rows = valid_output_rows_[k];
-    std::set<i64>& kernel_valid_output_rows_set = valid_output_rows_set_[k];
     i64& kernel_current_output_idx = current_valid_output_idx_[k];
 
     i64& kernel_element_cache_input_idx = current_element_cache_input_idx_[k];
-    std::vector<std::deque<Element>>& kernel_cache = element_cache_[k];
+    std::vector<StencilCache>& kernel_cache = element_cache_[k];
     std::vector<DeviceHandle>& kernel_cache_devices = element_cache_devices_[k];
-    std::vector<std::deque<i64>>& kernel_cache_row_ids =
-        element_cache_row_ids_[k];
     std::vector<i32>& input_column_idx = arg_group_.column_mapping[k];
     std::set<i32>& input_column_idx_set = column_mapping_set_[k];
 
@@ -556,6 +908,7 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
       // Select elements which this kernel requires as inputs
       auto& row_ids = side_row_ids[in_col_idx];
       Elements valid_inputs;
+      std::vector<i64> valid_input_row_ids;
       i64& current_input_idx = kernel_current_input_idx[i];
       auto input_create_start = now();
       for (size_t r = 0; r < row_ids.size(); ++r) {
@@ -563,8 +916,7 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
                row_ids[r] <= kernel_valid_input_rows[current_input_idx]);
         if (current_input_idx < kernel_valid_input_rows.size() &&
             row_ids[r] == kernel_valid_input_rows[current_input_idx]) {
-          // Insert row ids for valid elements into cache
-          kernel_cache_row_ids[i].push_back(row_ids[r]);
+          valid_input_row_ids.push_back(row_ids[r]);
           Element element(side_output_columns[in_col_idx][r]);
           // We provide the input index to the kernel so that it can detect
           // non-consecutive elements
@@ -575,27 +927,34 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
       }
       profiler_.add_interval("input_create", input_create_start, now());
       if (valid_inputs.size() > 0) {
-        auto copy_start = now();
-        Elements list =
-            copy_or_ref_elements(profiler_, side_output_handles[in_col_idx],
-                                 current_input_handles[i], valid_inputs);
-        profiler_.add_interval("op_marshal", copy_start, now());
+        Elements list = valid_inputs;
+        // Inputs from a fused kernel are null placeholders, so there is
+        // nothing to copy
+        if (arg_group_.fused_inputs[k].empty()) {
+          auto copy_start = now();
+          list =
+              copy_or_ref_elements(profiler_, side_output_handles[in_col_idx],
+                                   current_input_handles[i], valid_inputs);
+          profiler_.add_interval("op_marshal", copy_start, now());
+        }
         // Insert new elements into cache
-        kernel_cache[i].insert(kernel_cache[i].end(), list.begin(), list.end());
+        for (size_t j = 0; j < list.size(); ++j) {
+          kernel_cache[i].push_back(valid_input_row_ids[j], list[j]);
+        }
       }
     }
     // Determine the highest row seen so we know how many elements we
     // might be able to produce
     i64 max_row_id_seen = -1;
-    if (input_column_idx.size() > 0 && kernel_cache_row_ids[0].size() > 0) {
-      max_row_id_seen = kernel_cache_row_ids[0].back();
+    if (input_column_idx.size() > 0 && !kernel_cache[0].empty()) {
+      max_row_id_seen = kernel_cache[0].back_row();
       for (i32 i = 1; i < input_column_idx.size(); ++i) {
         max_row_id_seen =
-            std::min(max_row_id_seen, kernel_cache_row_ids[i].back());
+            std::min(max_row_id_seen, kernel_cache[i].back_row());
       }
       // Update current compute position
-      for (i64 i = 0; i < kernel_cache_row_ids[0].size(); ++i) {
-        i64 row_id = kernel_cache_row_ids[0][i];
+      for (i64 i = 0; i < kernel_cache[0].size(); ++i) {
+        i64 row_id = kernel_cache[0].row_at(i);
         assert(kernel_current_compute_idx >= kernel_compute_rows.size() ||
                row_id <= kernel_compute_rows[kernel_current_compute_idx]);
         if (kernel_current_compute_idx < kernel_compute_rows.size() &&
@@ -620,7 +979,7 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
     auto compute_producible_elements =
         [kernel_element_cache_input_idx, kernel_current_compute_idx,
          &kernel_compute_rows, max_row_id_seen,
-         max_rows](i64 stencil, i64 batch) {
+         max_rows](i64 stencil, i64 batch, i64 carried) {
           i64 producible_rows = 0;
           for (i64 i = kernel_element_cache_input_idx;
                i < kernel_current_compute_idx; ++i) {
@@ -639,8 +998,9 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
             }
             producible_rows++;
           }
-          i64 batch_over = producible_rows % batch;
-          return producible_rows - batch_over;
+          // Rows carried over from the previous task fill up the first batch
+          i64 batch_over = (producible_rows + carried) % batch;
+          return std::max((i64)0, producible_rows - batch_over);
         };
 
     // NOTE(apoms): the number of producible rows should be a multiple of the
@@ -651,7 +1011,7 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
     std::vector<i32> kernel_stencil;
 
     if (is_source || is_builtin_op(op_name)) {
-      producible_elements = compute_producible_elements(0, 1);
+      producible_elements = compute_producible_elements(0, 1, 0);
       num_output_columns = 1;
       kernel_stencil = {0};
       if (is_source) {
@@ -669,8 +1029,13 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
       if (rows_left_in_task < kernel_batch_size) {
         bs = 1;
       }
+      i64 carried_rows = 0;
+      if (carried_batch_ && carried_batch_->k == k &&
+          !carried_batch_->evaluated) {
+        carried_rows = carried_batch_->row_ids.size();
+      }
       producible_elements =
-          compute_producible_elements(kernel_stencil.back(), bs);
+          compute_producible_elements(kernel_stencil.back(), bs, carried_rows);
 
       auto& unused_outputs = arg_group_.unused_outputs[k];
       num_output_columns = kernel_num_outputs_[k] - unused_outputs.size();
@@ -709,6 +1074,8 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
     }
 
     auto full_eval_start = now();
+    std::unique_ptr<PendingKernel> pending_kernel;
+    bool carried_batch_created = false;
     if (is_source) {
       // Should ignore it since we remapped inputs
     } else if (op_name == SAMPLE_OP_NAME) {
@@ -729,7 +1096,7 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
       auto& output_column = side_output_columns.back();
       for (size_t i = 0; i < downstream_rows.size(); ++i) {
         i64 upstream_row_idx = downstream_upstream_mapping[i];
-        auto& element = *(kernel_cache.at(0).begin() + upstream_row_idx);
+        auto& element = kernel_cache.at(0).at(upstream_row_idx);
         Element ele = add_element_ref(current_handle, element);
         output_column.push_back(ele);
       }
@@ -753,7 +1120,7 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
           // Put null element
           output_column.emplace_back();
         } else {
-          auto& element = *(kernel_cache.at(0).begin() + upstream_row_idx);
+          auto& element = kernel_cache.at(0).at(upstream_row_idx);
           Element ele = add_element_ref(current_handle, element);
           output_column.push_back(ele);
         }
@@ -776,7 +1143,7 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
       for (size_t i = 0; i < producible_row_ids.size(); ++i) {
         i64 rrow = index.at(producible_row_ids[i]);
         output_row_ids.push_back(rrow);
-        auto& element = *(kernel_cache.at(0).begin() + i);
+        auto& element = kernel_cache.at(0).at(i);
         Element ele = add_element_ref(current_handle, element);
         output_column.push_back(ele);
       }
@@ -793,7 +1160,7 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
       auto& output_row_ids = side_row_ids.back();
       for (size_t i = 0; i < producible_row_ids.size(); ++i) {
         output_row_ids.push_back(producible_row_ids[i] + offset);
-        auto& element = *(kernel_cache.at(0).begin() + i);
+        auto& element = kernel_cache.at(0).at(i);
         Element ele = add_element_ref(current_handle, element);
         output_column.push_back(ele);
       }
@@ -804,85 +1171,151 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
       i32 kernel_batch_size = arg_group_.kernel_batch_sizes[k];
       i64 row_start = kernel_element_cache_input_idx;
       i64 row_end = row_start + producible_elements;
-
-      // First build mapping from row number to element in the cache
-      auto& cache_row_deque = kernel_cache_row_ids[0];
-      std::vector<std::unordered_map<i32, Element>> cache_row_maps;
-      for (size_t i = 0; i < input_column_idx.size(); ++i) {
-        cache_row_maps.emplace_back();
-        auto& row_map = cache_row_maps[i];
-        auto& cache_deque = kernel_cache[i];
-        for (size_t j = 0; j < cache_row_deque.size(); ++j) {
-          row_map[cache_row_deque[j]] = cache_deque[j];
-        }
+      // Kernels fused with the previous kernel were already run on each
+      // batch by the first kernel of their chain (see run_fused_kernels)
+      bool fused_with_prev = !arg_group_.fused_inputs[k].empty();
+      bool fused_with_next = k + 1 < arg_group_.fused_inputs.size() &&
+                             !arg_group_.fused_inputs[k + 1].empty();
+      // Kernels whose outputs are not read by the next op are evaluated on
+      // the branch pool while the feed moves on
+      std::shared_ptr<std::vector<StenciledBatchedElements>> pending_inputs;
+      // Batches of replicated kernels are staged and then evaluated by all
+      // instances of the kernel at once
+      bool replicated = !kernel_replicas_[k].empty();
+      std::vector<StenciledBatchedElements> replica_inputs;
+      std::vector<std::vector<i64>> replica_row_ids;
+      if (branch_pool_ && arg_group_.run_concurrently[k] &&
+          producible_elements > 0) {
+        pending_kernel.reset(new PendingKernel);
+        pending_kernel->k = k;
+        pending_kernel->producible_elements = producible_elements;
+        pending_kernel->first_col_idx =
+            side_output_columns.size() - num_output_columns;
+        pending_kernel->num_output_columns = num_output_columns;
+        pending_inputs.reset(new std::vector<StenciledBatchedElements>());
       }
 
-      for (i32 start = row_start; start < row_end; start += kernel_batch_size) {
-        i32 batch = std::min((i64)kernel_batch_size, row_end - start);
+      i32 batch = 0;
+      for (i32 start = row_start; start < row_end; start += batch) {
+        // The first batch is filled up with the rows held from the last
+        // batch of the previous task
+        i64 carried_rows = 0;
+        if (carried_batch_ && carried_batch_->k == k &&
+            !carried_batch_->evaluated) {
+          carried_rows = carried_batch_->row_ids.size();
+        }
+        batch = std::min(kernel_batch_size - carried_rows, row_end - start);
         i32 end = start + batch;
-        // Stage inputs to the kernel using the stencil cache
-        StenciledBatchedElements input_columns(input_column_idx.size());
-        // For each column
-        // NOTE(apoms): choosing the first columns row ids is fine because all
-        // input row ids for each column should be the same since all inputs
-        // must have the same domain
-        auto stencil_create_start = now();
-        for (size_t i = 0; i < input_column_idx.size(); ++i) {
-          auto& cache_row_map = cache_row_maps[i];
-          auto& col = input_columns[i];
-          col.resize(batch);
-          // For each batch element
-          for (i64 r = start; r < end; ++r) {
-            auto& input_stencil = col[r - start];
-            i64 last_cache_element = 0;
-            // Place elements in "stencil" dimension of input columns
-            i64 curr_row = kernel_compute_rows[r];
-            for (i64 s : kernel_stencil) {
-              i64 desired_row = curr_row + s;
-              if (desired_row < 0) {
-                desired_row = 0;
-              } else if (desired_row >= max_rows) {
-                desired_row = max_rows - 1;
+        std::vector<i64> batch_row_ids(
+            producible_row_ids.begin() + start - row_start,
+            producible_row_ids.begin() + start - row_start + batch);
+        last_computed_row_[k] = batch_row_ids.back();
+        BatchedElements output_columns;
+        if (fused_with_prev && fused_with_next) {
+          output_columns.assign(num_output_columns, Elements(batch));
+        } else if (fused_with_prev) {
+          BatchedElements& fused_outputs = fused_outputs_[k];
+          for (Elements& column : fused_outputs) {
+            LOG_IF(FATAL, column.size() < batch)
+                << "Op " << k << " has " << column.size()
+                << " fused outputs for a batch of " << batch;
+            output_columns.emplace_back(column.begin(),
+                                        column.begin() + batch);
+            column.erase(column.begin(), column.begin() + batch);
+          }
+        } else {
+          // Stage inputs to the kernel using the stencil cache
+          StenciledBatchedElements input_columns(input_column_idx.size());
+          // For each column
+          // NOTE(apoms): choosing the first columns row ids is fine because
+          // all input row ids for each column should be the same since all
+          // inputs must have the same domain
+          auto stencil_create_start = now();
+          for (size_t i = 0; i < input_column_idx.size(); ++i) {
+            auto& cache = kernel_cache[i];
+            auto& col = input_columns[i];
+            col.resize(batch);
+            // For each batch element
+            for (i64 r = start; r < end; ++r) {
+              auto& input_stencil = col[r - start];
+              i64 last_cache_element = 0;
+              // Place elements in "stencil" dimension of input columns
+              i64 curr_row = kernel_compute_rows[r];
+              for (i64 s : kernel_stencil) {
+                i64 desired_row = curr_row + s;
+                if (desired_row < 0) {
+                  desired_row = 0;
+                } else if (desired_row >= max_rows) {
+                  desired_row = max_rows - 1;
+                }
+                // Rows missing from the cache are passed as null elements
+                const Element* element = cache.find(desired_row);
+                input_stencil.push_back(element ? *element : Element());
               }
-              input_stencil.push_back(cache_row_map[desired_row]);
+              assert(input_stencil.size() == kernel_stencil.size());
             }
-            assert(input_stencil.size() == kernel_stencil.size());
           }
-        }
-        profiler_.add_interval("stencil_create:" + op_name,
-                               stencil_create_start, now());
+          profiler_.add_interval("stencil_create:" + op_name,
+                                 stencil_create_start, now());
 
-        // Setup output buffers to receive op output
-        BatchedElements output_columns;
-        output_columns.resize(kernel_num_outputs_[k]);
-
-        // Map from previous output columns to the set of input columns needed
-        // by the kernel
-        auto eval_start = now();
-        kernel->execute_kernel(input_columns, output_columns);
-        profiler_.add_interval("evaluate:" + op_name, eval_start, now());
+          if (pending_kernel) {
+            pending_inputs->push_back(std::move(input_columns));
+            pending_kernel->batch_row_ids.push_back(batch_row_ids);
+            continue;
+          }
 
-        auto cleanup_start = now();
-        // Delete unused output columns
-        auto& unused_outputs = arg_group_.unused_outputs[k];
-        for (size_t y = 0; y < unused_outputs.size(); ++y) {
-          i32 unused_col_idx =
-              unused_outputs[unused_outputs.size() - 1 - y];
-          Elements& column = output_columns[unused_col_idx];
-          for (Element& element : column) {
-            delete_element(current_output_handles[unused_col_idx], element);
+          // Hold a partial last batch of the task until the next task can
+          // fill it up
+          if (arg_group_.batch_across_tasks[k] && !carried_batch_ &&
+              batch < kernel_batch_size && end == kernel_compute_rows.size()) {
+            carry_batch(k, side_output_columns.size() - num_output_columns,
+                        batch_row_ids, input_columns);
+            carried_batch_created = true;
+            continue;
+          }
+          if (replicated) {
+            replica_inputs.push_back(std::move(input_columns));
+            replica_row_ids.push_back(batch_row_ids);
+            continue;
+          }
+          if (carried_rows > 0) {
+            auto& carried_inputs = carried_batch_->input_columns;
+            for (size_t i = 0; i < input_columns.size(); ++i) {
+              input_columns[i].insert(input_columns[i].begin(),
+                                      carried_inputs[i].begin(),
+                                      carried_inputs[i].end());
+            }
           }
-          output_columns.erase(output_columns.begin() + unused_col_idx);
-        }
 
-        // Verify the kernel produced the correct amount of output
-        for (size_t i = 0; i < output_columns.size(); ++i) {
-          LOG_IF(FATAL, output_columns[i].size() != batch)
-              << "Op " << k << " produced " << output_columns[i].size()
-              << " output elements for column " << i << ". Expected " << batch
-              << " outputs.";
+          // Setup output buffers to receive op output
+          output_columns.resize(kernel_num_outputs_[k]);
+
+          // Map from previous output columns to the set of input columns
+          // needed by the kernel
+          auto eval_start = now();
+          kernel->execute_kernel(input_columns, output_columns);
+          profiler_.add_interval("evaluate:" + op_name, eval_start, now());
+
+          discard_unused_outputs(k, carried_rows + batch, output_columns);
+          if (carried_rows > 0) {
+            // Split off the outputs of the previous task
+            auto& carried_outputs = carried_batch_->output_columns;
+            for (Elements& column : output_columns) {
+              carried_outputs.emplace_back(column.begin(),
+                                           column.begin() + carried_rows);
+              column.erase(column.begin(), column.begin() + carried_rows);
+            }
+            release_carried_inputs();
+            carried_batch_->evaluated = true;
+            profiler_.increment("cross_task_batch_rows:" + op_name,
+                                carried_rows);
+          }
+          if (fused_with_next) {
+            run_fused_kernels(k, batch_row_ids, output_columns);
+          }
         }
 
+        auto cleanup_start = now();
         // Add new output columns
         for (size_t cidx = 0; cidx < output_columns.size(); ++cidx) {
           const Elements& column = output_columns[cidx];
@@ -890,90 +1323,61 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
           side_output_columns[col_idx].insert(
               side_output_columns[col_idx].end(), column.begin(), column.end());
           auto& output_row_ids = side_row_ids[col_idx];
-          output_row_ids.insert(
-              output_row_ids.end(),
-              producible_row_ids.begin() + start - row_start,
-              producible_row_ids.begin() + start - row_start + batch);
+          output_row_ids.insert(output_row_ids.end(), batch_row_ids.begin(),
+                                batch_row_ids.end());
         }
         profiler_.add_interval("cleanup:" + op_name, cleanup_start, now());
       }
-    }
-    profiler_.add_interval("full_eval:" + op_name, full_eval_start, now());
-
-    auto full_cleanup_start = now();
-    i64 row_start = kernel_element_cache_input_idx;
-    i64 row_end = row_start + producible_elements;
-    // Filter outputs to only the ones that will be used downstream
-    // For each output row, check if it is in the valid output rows
-    if (num_output_columns > 0) {
-      BatchedElements temp_output_columns(num_output_columns);
-      std::vector<std::vector<i64>> temp_row_ids(num_output_columns);
-
-      // For each column, transfer all valid rows to temp output, deleting all
-      // the non valid rows, and then swap the temp rows into the side
-      // output columns
-      i32 first_col_idx = side_output_columns.size() - num_output_columns;
-      for (i64 row_start = 0;
-           row_start < side_output_columns[first_col_idx].size(); ++row_start) {
-        assert(!side_row_ids[first_col_idx].empty());
-        // assert(side_row_ids[first_col_idx][row_start] <=
-        //        kernel_valid_output_rows[kernel_current_output_idx]);
-        if (kernel_current_output_idx < kernel_valid_output_rows.size() &&
-            side_row_ids[first_col_idx][row_start] ==
-                kernel_valid_output_rows[kernel_current_output_idx]) {
-          i64 next_row = kernel_valid_output_rows[kernel_current_output_idx];
-          // Is a valid row, so keep
-          for (i64 i = 0; i < num_output_columns; ++i) {
-            i32 col_idx = side_output_columns.size() - num_output_columns + i;
-            auto& element = side_output_columns[col_idx][row_start];
-            temp_output_columns[i].push_back(element);
-            temp_row_ids[i].push_back(next_row);
-          }
-          kernel_current_output_idx++;
-        } else {
-          // Is not a valid row, so delete
-          for (i64 i = 0; i < num_output_columns; ++i) {
-            i32 col_idx = side_output_columns.size() - num_output_columns + i;
-            auto& element = side_output_columns[col_idx][row_start];
-            delete_element(side_output_handles[col_idx], element);
+      if (!replica_inputs.empty()) {
+        std::vector<BatchedElements> outputs =
+            run_replicated_kernel(k, replica_inputs, replica_row_ids);
+        auto cleanup_start = now();
+        // Add the outputs in the order of their batches
+        for (size_t b = 0; b < outputs.size(); ++b) {
+          const std::vector<i64>& batch_row_ids = replica_row_ids[b];
+          for (size_t cidx = 0; cidx < outputs[b].size(); ++cidx) {
+            const Elements& column = outputs[b][cidx];
+            i32 col_idx =
+                side_output_columns.size() - num_output_columns + cidx;
+            side_output_columns[col_idx].insert(
+                side_output_columns[col_idx].end(), column.begin(),
+                column.end());
+            side_row_ids[col_idx].insert(side_row_ids[col_idx].end(),
+                                         batch_row_ids.begin(),
+                                         batch_row_ids.end());
           }
         }
+        profiler_.add_interval("cleanup:" + op_name, cleanup_start, now());
       }
-      for (i64 i = 0; i < num_output_columns; ++i) {
-        i32 col_idx = side_output_columns.size() - num_output_columns + i;
-        side_output_columns[col_idx].swap(temp_output_columns[i]);
-        side_row_ids[col_idx].swap(temp_row_ids[i]);
+      if (pending_kernel) {
+        BaseKernel* pending_op = kernel.get();
+        pending_kernel->outputs = branch_pool_->enqueue([this, k, op_name,
+                                                         pending_op,
+                                                         pending_inputs]() {
+          std::vector<BatchedElements> outputs;
+          for (StenciledBatchedElements& input_columns : *pending_inputs) {
+            i32 batch = input_columns.empty() ? 0 : input_columns[0].size();
+            BatchedElements output_columns(kernel_num_outputs_[k]);
+            auto eval_start = now();
+            pending_op->execute_kernel(input_columns, output_columns);
+            profiler_.add_interval("evaluate:" + op_name, eval_start, now());
+            discard_unused_outputs(k, batch, output_columns);
+            outputs.push_back(std::move(output_columns));
+          }
+          return outputs;
+        });
       }
     }
+    profiler_.add_interval("full_eval:" + op_name, full_eval_start, now());
 
-    // Remove elements from the element cache we won't access anymore
-    if (kernel_valid_input_rows.size() > 0) {
-      i64 last_cache_element = 0;
-      i64 min_used_row = kernel_valid_input_rows[std::min(
-          row_end, (i64)kernel_valid_input_rows.size() - 1)];
-      min_used_row += kernel_stencil[0];
-      {
-        auto& row_id_deque = kernel_cache_row_ids[0];
-        while (row_id_deque.size() > 0) {
-          i64 cache_row = row_id_deque.front();
-          if (cache_row < min_used_row) {
-            for (auto& deqs : kernel_cache_row_ids) {
-              deqs.pop_front();
-            }
-            for (size_t i = 0; i < kernel_cache.size(); ++i) {
-              auto device = kernel_cache_devices[i];
-              auto& cache_deque = kernel_cache[i];
-              assert(cache_deque.size() > 0);
-              Element element = cache_deque.front();
-              delete_element(device, element);
-              cache_deque.pop_front();
-            }
-          } else {
-            break;
-          }
-        }
-        kernel_element_cache_input_idx += producible_elements;
-      }
+    auto full_cleanup_start = now();
+    if (pending_kernel) {
+      pending_kernels.push_back(std::move(pending_kernel));
+    } else {
+      finish_kernel_outputs(k, producible_elements, kernel_stencil,
+                            side_output_columns.size() - num_output_columns,
+                            num_output_columns, side_output_columns,
+                            side_output_handles, side_row_ids);
     }
 
     // Remove dead columns from side_output_handles
@@ -988,11 +1392,22 @@ void EvaluateWorker::feed(EvalWorkEntry& work_entry) {
       side_output_columns.erase(side_output_columns.begin() + dead_col_idx);
       side_output_handles.erase(side_output_handles.begin() + dead_col_idx);
       side_row_ids.erase(side_row_ids.begin() + dead_col_idx);
+      for (auto& pending : pending_kernels) {
+        if (pending->first_col_idx > dead_col_idx) {
+          pending->first_col_idx--;
+        }
+      }
+      if (carried_batch_created &&
+          carried_batch_->first_col_idx > dead_col_idx) {
+        carried_batch_->first_col_idx--;
+      }
     }
     // Delete elements from stencil cache that will no longer be used
     profiler_.add_interval("full_cleanup:" + op_name, full_cleanup_start, now());
     profiler_.add_interval("op:" + op_name, op_start, now());
   }
+  join_pending_kernels(pending_kernels, side_output_columns,
+                       side_output_handles, side_row_ids);
 
   final_output_handles_ = side_output_handles;
   if (final_output_columns_.size() == 0) {
@@ -1056,27 +1471,344 @@ bool EvaluateWorker::yield(i32 item_size, EvalWorkEntry& output_entry) {
   return true;
 }
 
+bool EvaluateWorker::has_carried_batch() const {
+  return carried_batch_ != nullptr;
+}
+
+bool EvaluateWorker::carried_batch_evaluated() const {
+  return carried_batch_ && carried_batch_->evaluated;
+}
+
+void EvaluateWorker::finish_carried_batch(EvalWorkEntry& task_output) {
+  assert(carried_batch_);
+  CarriedBatch& carried = *carried_batch_;
+  size_t k = carried.k;
+  if (!carried.evaluated) {
+    // The next task did not arrive in time, so evaluate the batch on its own
+    const std::string& op_name = arg_group_.op_names.at(k);
+    carried.output_columns.resize(kernel_num_outputs_[k]);
+    auto eval_start = now();
+    kernels_[k]->execute_kernel(carried.input_columns, carried.output_columns);
+    profiler_.add_interval("evaluate:" + op_name, eval_start, now());
+    discard_unused_outputs(k, carried.row_ids.size(), carried.output_columns);
+    release_carried_inputs();
+    carried.evaluated = true;
+  }
+  for (size_t cidx = 0; cidx < carried.output_columns.size(); ++cidx) {
+    i32 col_idx = carried.first_col_idx + cidx;
+    Elements& column = carried.output_columns[cidx];
+    for (size_t r = 0; r < carried.row_ids.size(); ++r) {
+      if (carried.valid_rows[r]) {
+        task_output.columns[col_idx].push_back(column[r]);
+        task_output.row_ids[col_idx].push_back(carried.row_ids[r]);
+      } else {
+        delete_element(task_output.column_handles[col_idx], column[r]);
+      }
+    }
+  }
+  carried_batch_.reset();
+}
+
+void EvaluateWorker::carry_batch(size_t k, i32 first_col_idx,
+                                 const std::vector<i64>& row_ids,
+                                 StenciledBatchedElements& input_columns) {
+  carried_batch_.reset(new CarriedBatch);
+  CarriedBatch& carried = *carried_batch_;
+  carried.k = k;
+  carried.first_col_idx = first_col_idx;
+  carried.row_ids = row_ids;
+  const std::vector<i64>& valid_output_rows = valid_output_rows_[k];
+  for (i64 row : row_ids) {
+    carried.valid_rows.push_back(std::binary_search(
+        valid_output_rows.begin(), valid_output_rows.end(), row));
+  }
+  // The stencil cache is cleared when the next task starts, so take a
+  // reference to each input
+  for (size_t i = 0; i < input_columns.size(); ++i) {
+    DeviceHandle device = element_cache_devices_[k][i];
+    for (auto& stencil : input_columns[i]) {
+      for (Element& element : stencil) {
+        element = add_element_ref(device, element);
+      }
+    }
+  }
+  carried.input_columns = std::move(input_columns);
+  carried.evaluated = false;
+}
+
+void EvaluateWorker::release_carried_inputs() {
+  CarriedBatch& carried = *carried_batch_;
+  for (size_t i = 0; i < carried.input_columns.size(); ++i) {
+    DeviceHandle device = element_cache_devices_[carried.k][i];
+    for (auto& stencil : carried.input_columns[i]) {
+      for (Element& element : stencil) {
+        delete_element(device, element);
+      }
+    }
+  }
+  carried.input_columns.clear();
+}
+
+std::vector<BatchedElements> EvaluateWorker::run_replicated_kernel(
+    size_t k, std::vector<StenciledBatchedElements>& batches,
+    const std::vector<std::vector<i64>>& batch_row_ids) {
+  const std::string& op_name = arg_group_.op_names.at(k);
+  size_t num_instances = kernel_replicas_[k].size() + 1;
+  std::vector<BatchedElements> outputs(batches.size());
+  // Instance r evaluates every num_instances-th batch starting at batch r
+  auto run_instance = [&, k](size_t r) {
+    BaseKernel* kernel =
+        r == 0 ? kernels_[k].get() : kernel_replicas_[k][r - 1].get();
+    for (size_t b = r; b < batches.size(); b += num_instances) {
+      outputs[b].resize(kernel_num_outputs_[k]);
+      auto eval_start = now();
+      kernel->execute_kernel(batches[b], outputs[b]);
+      profiler_.add_interval("evaluate:" + op_name, eval_start, now());
+      discard_unused_outputs(k, batch_row_ids[b].size(), outputs[b]);
+    }
+  };
+  std::vector<std::future<void>> instances;
+  for (size_t r = 1; r < num_instances && r < batches.size(); ++r) {
+    instances.push_back(replica_pool_->enqueue(run_instance, r));
+  }
+  run_instance(0);
+  for (auto& instance : instances) {
+    instance.get();
+  }
+  return outputs;
+}
+
+void EvaluateWorker::join_pending_kernels(
+    std::vector<std::unique_ptr<PendingKernel>>& pending_kernels,
+    BatchedElements& side_output_columns,
+    std::vector<DeviceHandle>& side_output_handles,
+    std::vector<std::vector<i64>>& side_row_ids) {
+  if (pending_kernels.empty()) {
+    return;
+  }
+  auto join_start = now();
+  for (auto& pending : pending_kernels) {
+    std::vector<BatchedElements> outputs = pending->outputs.get();
+    for (size_t b = 0; b < outputs.size(); ++b) {
+      const std::vector<i64>& batch_row_ids = pending->batch_row_ids[b];
+      for (size_t cidx = 0; cidx < outputs[b].size(); ++cidx) {
+        const Elements& column = outputs[b][cidx];
+        i32 col_idx = pending->first_col_idx + cidx;
+        side_output_columns[col_idx].insert(
+            side_output_columns[col_idx].end(), column.begin(), column.end());
+        side_row_ids[col_idx].insert(side_row_ids[col_idx].end(),
+                                     batch_row_ids.begin(),
+                                     batch_row_ids.end());
+      }
+    }
+    finish_kernel_outputs(pending->k, pending->producible_elements,
+                          arg_group_.kernel_stencils[pending->k],
+                          pending->first_col_idx, pending->num_output_columns,
+                          side_output_columns, side_output_handles,
+                          side_row_ids);
+  }
+  pending_kernels.clear();
+  profiler_.add_interval("branch_join", join_start, now());
+}
+
+void EvaluateWorker::finish_kernel_outputs(
+    size_t k, i64 producible_elements, const std::vector<i32>& kernel_stencil,
+    i32 first_col_idx, i32 num_output_columns,
+    BatchedElements& side_output_columns,
+    std::vector<DeviceHandle>& side_output_handles,
+    std::vector<std::vector<i64>>& side_row_ids) {
+  std::vector<i64>& kernel_valid_input_rows = valid_input_rows_[k];
+  std::vector<i64>& kernel_valid_output_rows = valid_output_rows_[k];
+  i64& kernel_current_output_idx = current_valid_output_idx_[k];
+  i64& kernel_element_cache_input_idx = current_element_cache_input_idx_[k];
+  std::vector<StencilCache>& kernel_cache = element_cache_[k];
+  std::vector<DeviceHandle>& kernel_cache_devices = element_cache_devices_[k];
+
+  i64 row_start = kernel_element_cache_input_idx;
+  i64 row_end = row_start + producible_elements;
+  // Filter outputs to only the ones that will be used downstream
+  // For each output row, check if it is in the valid output rows
+  if (num_output_columns > 0) {
+    BatchedElements temp_output_columns(num_output_columns);
+    std::vector<std::vector<i64>> temp_row_ids(num_output_columns);
+
+    // For each column, transfer all valid rows to temp output, deleting all
+    // the non valid rows, and then swap the temp rows into the side
+    // output columns
+    for (i64 row_start = 0;
+         row_start < side_output_columns[first_col_idx].size(); ++row_start) {
+      assert(!side_row_ids[first_col_idx].empty());
+      // assert(side_row_ids[first_col_idx][row_start] <=
+      //        kernel_valid_output_rows[kernel_current_output_idx]);
+      if (kernel_current_output_idx < kernel_valid_output_rows.size() &&
+          side_row_ids[first_col_idx][row_start] ==
+              kernel_valid_output_rows[kernel_current_output_idx]) {
+        i64 next_row = kernel_valid_output_rows[kernel_current_output_idx];
+        // Is a valid row, so keep
+        for (i64 i = 0; i < num_output_columns; ++i) {
+          i32 col_idx = first_col_idx + i;
+          auto& element = side_output_columns[col_idx][row_start];
+          temp_output_columns[i].push_back(element);
+          temp_row_ids[i].push_back(next_row);
+        }
+        kernel_current_output_idx++;
+      } else {
+        // Is not a valid row, so delete
+        for (i64 i = 0; i < num_output_columns; ++i) {
+          i32 col_idx = first_col_idx + i;
+          auto& element = side_output_columns[col_idx][row_start];
+          delete_element(side_output_handles[col_idx], element);
+        }
+      }
+    }
+    for (i64 i = 0; i < num_output_columns; ++i) {
+      i32 col_idx = first_col_idx + i;
+      side_output_columns[col_idx].swap(temp_output_columns[i]);
+      side_row_ids[col_idx].swap(temp_row_ids[i]);
+    }
+  }
+
+  // Remove elements from the element cache we won't access anymore
+  if (kernel_valid_input_rows.size() > 0) {
+    i64 last_cache_element = 0;
+    i64 min_used_row = kernel_valid_input_rows[std::min(
+        row_end, (i64)kernel_valid_input_rows.size() - 1)];
+    min_used_row += kernel_stencil[0];
+    {
+      while (!kernel_cache.empty() && !kernel_cache[0].empty()) {
+        i64 cache_row = kernel_cache[0].front_row();
+        if (cache_row < min_used_row) {
+          for (size_t i = 0; i < kernel_cache.size(); ++i) {
+            auto device = kernel_cache_devices[i];
+            assert(!kernel_cache[i].empty());
+            Element element = kernel_cache[i].pop_front();
+            delete_element(device, element);
+          }
+        } else {
+          break;
+        }
+      }
+      kernel_element_cache_input_idx += producible_elements;
+    }
+  }
+}
+
+void EvaluateWorker::discard_unused_outputs(size_t k, i32 batch,
+                                            BatchedElements& output_columns) {
+  const std::vector<DeviceHandle>& output_handles = kernel_output_devices_[k];
+  auto& unused_outputs = arg_group_.unused_outputs[k];
+  for (size_t y = 0; y < unused_outputs.size(); ++y) {
+    i32 unused_col_idx = unused_outputs[unused_outputs.size() - 1 - y];
+    Elements& column = output_columns[unused_col_idx];
+    for (Element& element : column) {
+      delete_element(output_handles[unused_col_idx], element);
+    }
+    output_columns.erase(output_columns.begin() + unused_col_idx);
+  }
+
+  // Verify the kernel produced the correct amount of output
+  for (size_t i = 0; i < output_columns.size(); ++i) {
+    LOG_IF(FATAL, output_columns[i].size() != batch)
+        << "Op " << k << " produced " << output_columns[i].size()
+        << " output elements for column " << i << ". Expected " << batch
+        << " outputs.";
+  }
+}
+
+std::vector<DeviceHandle> EvaluateWorker::used_output_handles(size_t k) {
+  std::vector<DeviceHandle> handles;
+  auto& unused_outputs = arg_group_.unused_outputs[k];
+  for (i32 c = 0; c < kernel_num_outputs_[k]; ++c) {
+    if (std::find(unused_outputs.begin(), unused_outputs.end(), c) ==
+        unused_outputs.end()) {
+      handles.push_back(kernel_output_devices_[k][c]);
+    }
+  }
+  return handles;
+}
+
+void EvaluateWorker::run_fused_kernels(size_t k,
+                                       const std::vector<i64>& row_ids,
+                                       BatchedElements& columns) {
+  i32 batch = row_ids.size();
+  // The kernels fused with k only see the outputs of the previous kernel
+  // through this batch, so k passes null placeholders down the pipeline
+  BatchedElements placeholders(columns.size(), Elements(batch));
+  size_t j = k + 1;
+  for (; j < kernels_.size() && !arg_group_.fused_inputs[j].empty(); ++j) {
+    const std::string& op_name = arg_group_.op_names[j];
+    const std::vector<i32>& fused_inputs = arg_group_.fused_inputs[j];
+
+    auto stencil_create_start = now();
+    StenciledBatchedElements input_columns(fused_inputs.size());
+    for (size_t i = 0; i < fused_inputs.size(); ++i) {
+      auto& col = input_columns[i];
+      col.resize(batch);
+      for (i32 r = 0; r < batch; ++r) {
+        Element element = columns[fused_inputs[i]][r];
+        element.index = row_ids[r];
+        col[r].push_back(element);
+      }
+    }
+    profiler_.add_interval("stencil_create:" + op_name, stencil_create_start,
+                           now());
+
+    BatchedElements output_columns(kernel_num_outputs_[j]);
+    auto eval_start = now();
+    kernels_[j]->execute_kernel(input_columns, output_columns);
+    profiler_.add_interval("evaluate:" + op_name, eval_start, now());
+
+    auto cleanup_start = now();
+    discard_unused_outputs(j, batch, output_columns);
+    // Release the intermediate outputs right away so that the next batch
+    // reuses their buffers
+    std::vector<DeviceHandle> handles = used_output_handles(j - 1);
+    for (size_t c = 0; c < columns.size(); ++c) {
+      for (Element& element : columns[c]) {
+        delete_element(handles[c], element);
+      }
+    }
+    columns.swap(output_columns);
+    profiler_.add_interval("cleanup:" + op_name, cleanup_start, now());
+  }
+
+  // Picked up by the last kernel of the chain when the feed loop reaches it
+  BatchedElements& fused_outputs = fused_outputs_[j - 1];
+  fused_outputs.resize(columns.size());
+  for (size_t c = 0; c < columns.size(); ++c) {
+    fused_outputs[c].insert(fused_outputs[c].end(), columns[c].begin(),
+                            columns[c].end());
+  }
+  columns.swap(placeholders);
+}
+
 void EvaluateWorker::clear_stencil_cache() {
   for (size_t k = 0; k < kernels_.size(); ++k) {
     std::vector<i32>& kernel_stencil = arg_group_.kernel_stencils[k];
     bool degenerate_stencil =
         (kernel_stencil.size() == 1 && kernel_stencil[0] == 0);
-    std::vector<std::deque<Element>>& kernel_cache = element_cache_[k];
+    std::vector<StencilCache>& kernel_cache = element_cache_[k];
     std::vector<DeviceHandle>& kernel_cache_devices = element_cache_devices_[k];
-    std::vector<std::deque<i64>>& kernel_cache_row_ids =
-        element_cache_row_ids_[k];
     auto& input_column_idx = arg_group_.column_mapping[k];
     for (i32 i = 0; i < input_column_idx.size(); ++i) {
-      auto& row_id_deque = kernel_cache_row_ids[i];
-      row_id_deque.clear();
-      auto& cache_deque = kernel_cache[i];
-      while (!cache_deque.empty()) {
+      auto& cache = kernel_cache[i];
+      while (!cache.empty()) {
         assert(!kernel_cache_devices.empty());
-        Element element = cache_deque.back();
+        Element element = cache.pop_front();
         delete_element(kernel_cache_devices[i], element);
-        cache_deque.pop_back();
       }
     }
+    // Outputs of a fused chain whose last kernel was never reached
+    BatchedElements& fused_outputs = fused_outputs_[k];
+    if (!fused_outputs.empty()) {
+      std::vector<DeviceHandle> handles = used_output_handles(k);
+      for (size_t c = 0; c < fused_outputs.size(); ++c) {
+        for (Element& element : fused_outputs[c]) {
+          delete_element(handles[c], element);
+        }
+      }
+      fused_outputs.clear();
+    }
   }
 }
 
@@ -1092,6 +1824,14 @@ PostEvaluateWorker::PostEvaluateWorker(const PostEvaluateWorkerArgs& args)
 
   // Setup video encoders
   // TODO(apoms): Make this dynamic based on the encoded column type
+  i32 encode_threads = 0;
+  encode_options_.resize(args.columns.size());
+  segment_frames_.resize(args.columns.size(), DEFAULT_KEYFRAME_DISTANCE);
+  max_encoding_segments_.resize(args.columns.size(), 0);
+  open_segments_.resize(args.columns.size());
+  // Constructed in place since the queues of futures can not be copied
+  encoding_segments_ = decltype(encoding_segments_)(args.columns.size());
+  idle_encoders_.resize(args.columns.size());
   for (size_t i = 0; i < args.columns.size(); ++i) {
     auto& col = args.columns[i];
     auto& compression_opts = args.column_compression[i];
@@ -1101,18 +1841,38 @@ PostEvaluateWorker::PostEvaluateWorker(const PostEvaluateWorkerArgs& args)
     frame_size_initialized_.push_back(false);
 
     if (compression_opts.codec == "raw") continue;
-    encoders_.emplace_back(
-        VideoEncoder::make_from_config(encoder_handle_, 1, encoder_type_));
-    encoder_configured_.push_back(false);
-
-    EncodeOptions opts;
-    if (compression_opts.codec == "h264") {
-      opts.quality = std::atoi(compression_opts.options.at("quality").c_str());
-      opts.bitrate = std::atoi(compression_opts.options.at("bitrate").c_str());
-      opts.keyframe_distance =
-          std::atoi(compression_opts.options.at("keyframe_distance").c_str());
+
+    auto option = [&](const std::string& name, i64 default_value) {
+      auto it = compression_opts.options.find(name);
+      return it == compression_opts.options.end()
+                 ? default_value
+                 : std::atoll(it->second.c_str());
+    };
+    EncodeOptions& opts = encode_options_[i];
+    if (compression_opts.codec == "hevc") {
+      opts.codec = proto::VideoDescriptor::HEVC;
+    }
+    if (compression_opts.codec == "h264" || compression_opts.codec == "hevc") {
+      opts.quality = option("quality", -1);
+      opts.bitrate = option("bitrate", -1);
+      opts.keyframe_distance = option("keyframe_distance", -1);
+    }
+    opts.threads = option("threads", -1);
+    auto preset = compression_opts.options.find("preset");
+    if (preset != compression_opts.options.end()) {
+      opts.preset = preset->second;
+    }
+    if (opts.keyframe_distance > 0) {
+      segment_frames_[i] = opts.keyframe_distance;
     }
-    encode_options_.push_back(opts);
+    i32 encoders =
+        std::max<i64>(1, option("encoders", DEFAULT_ENCODERS_PER_COLUMN));
+    // Let the encoder threads run ahead of the segments being retired
+    max_encoding_segments_[i] = 2 * encoders;
+    encode_threads = std::max(encode_threads, encoders);
+  }
+  if (encode_threads > 0) {
+    encode_pool_.reset(new ThreadPool(encode_threads));
   }
   for (auto& compression_opts : args.column_compression) {
     auto& codec = compression_opts.codec;
@@ -1142,22 +1902,19 @@ void PostEvaluateWorker::feed(EvalWorkEntry& entry) {
       buffered_entry_.column_handles.clear();
       buffered_entry_.frame_sizes.clear();
       buffered_entry_.compressed.clear();
+      buffered_entry_.compression_codecs.clear();
       for (size_t i = 0; i < columns_.size(); ++i) {
         i32 col_idx = column_mapping_[i];
         buffered_entry_.column_types.push_back(columns_[i].type());
         buffered_entry_.column_handles.push_back(CPU_DEVICE);
         buffered_entry_.compressed.push_back(compression_enabled_[i]);
+        buffered_entry_.compression_codecs.push_back(encode_options_[i].codec);
         if (columns_[i].type() == ColumnType::Video) {
           buffered_entry_.frame_sizes.emplace_back();
           frame_size_initialized_[encoder_idx] = false;
           encoder_idx++;
         }
       }
-      if (work_entry.needs_configure) {
-        for (size_t i = 0; i < encoder_configured_.size(); ++i) {
-          encoder_configured_[i] = false;
-        }
-      }
     }
   }
 
@@ -1188,37 +1945,23 @@ void PostEvaluateWorker::feed(EvalWorkEntry& entry) {
       // Encode video frames
       if (compression_enabled_[i] && column_type == ColumnType::Video &&
           buffered_entry_.frame_sizes[encoder_idx].type == FrameType::U8) {
-        auto& encoder = encoders_[encoder_idx];
-        if (!encoder_configured_[encoder_idx]) {
-          // Configure encoder
-          encoder_configured_[encoder_idx] = true;
-          Frame* frame = work_entry.columns[col_idx][0].as_frame();
-          encoder->configure(frame->as_frame_info(),
-
-                             encode_options_[encoder_idx]);
-        }
-
         // Move frames to device for the encoder
         move_if_different_address_space(
             profiler_, work_entry.column_handles[col_idx], encoder_handle_,
             work_entry.columns[col_idx]);
 
-        // Pass frames into encoder
+        // Hand every full GOP to the encoder threads
         auto encode_start = now();
         for (auto& row : work_entry.columns[col_idx]) {
-          Frame* frame = row.as_frame();
-          bool new_packet = encoder->feed(frame->data, frame->size());
-          while (new_packet) {
-            size_t buffer_size = 4 * 1024 * 1024;
-            u8* buffer = new_buffer(CPU_DEVICE, buffer_size);
-            size_t actual_size;
-            new_packet = encoder->get_packet(buffer, buffer_size, actual_size);
-            LOG_IF(FATAL, new_packet && actual_size > buffer_size)
-                << "Packet buffer not large enough (" << buffer_size << " vs "
-                << actual_size << ")";
-            insert_element(buffered_entry_.columns[i], buffer, actual_size);
+          auto& segment = open_segments_[i];
+          if (!segment) {
+            segment.reset(new EncodeSegment);
+            segment->frame_info = row.as_frame()->as_frame_info();
+          }
+          segment->frames.push_back(row);
+          if (segment->frames.size() >= segment_frames_[i]) {
+            submit_segment(i);
           }
-          delete_element(encoder_handle_, row);
         }
         profiler_.add_interval("encode", encode_start, now());
         encoder_idx++;
@@ -1249,33 +1992,17 @@ void PostEvaluateWorker::feed(EvalWorkEntry& entry) {
 
   // Flush row buffer
   if (work_entry.last_in_io_packet) {
-    i32 encoder_idx = 0;
-    // Flush video encoder and get rest of packets
+    // Encode the last GOPs and collect the rest of the packets
+    auto encode_flush_start = now();
     for (size_t i = 0; i < column_mapping_.size(); ++i) {
-      ColumnType column_type = columns_[i].type();
-      if (compression_enabled_[i] && column_type == ColumnType::Video &&
-          encoder_configured_[encoder_idx] &&
-          buffered_entry_.frame_sizes[encoder_idx].type == FrameType::U8) {
-        auto& encoder = encoders_[encoder_idx];
-
-        // Get last packets in encoder
-        auto encode_flush_start = now();
-        bool new_packet = encoder->flush();
-        while (new_packet) {
-          size_t buffer_size = 4 * 1024 * 1024;
-          u8* buffer = new_buffer(CPU_DEVICE, buffer_size);
-          size_t actual_size;
-          new_packet = encoder->get_packet(buffer, buffer_size, actual_size);
-          LOG_IF(FATAL, new_packet && actual_size > buffer_size)
-              << "Packet buffer not large enough (" << buffer_size << " vs "
-              << actual_size << ")";
-          insert_element(buffered_entry_.columns[i], buffer, actual_size);
-        }
-        profiler_.add_interval("encode_flush", encode_flush_start, now());
-        encoder_configured_[encoder_idx] = false;
-        encoder_idx++;
+      if (open_segments_[i]) {
+        submit_segment(i);
+      }
+      while (!encoding_segments_[i].empty()) {
+        retire_segment(i);
       }
     }
+    profiler_.add_interval("encode_flush", encode_flush_start, now());
 
     // Only push an entry if it is non empty
     if (buffered_entry_.columns.size() > 0 &&
@@ -1287,6 +2014,80 @@ void PostEvaluateWorker::feed(EvalWorkEntry& entry) {
   }
 }
 
+void PostEvaluateWorker::submit_segment(i32 column) {
+  EncodeSegment* segment = open_segments_[column].get();
+  std::future<void> encoded = encode_pool_->enqueue(
+      [this, column, segment]() { encode_segment(column, *segment); });
+  encoding_segments_[column].emplace_back(std::move(open_segments_[column]),
+                                          std::move(encoded));
+  // Bound the number of frames waiting to be encoded
+  while (encoding_segments_[column].size() > max_encoding_segments_[column]) {
+    retire_segment(column);
+  }
+}
+
+void PostEvaluateWorker::retire_segment(i32 column) {
+  auto& oldest = encoding_segments_[column].front();
+  auto wait_start = now();
+  std::get<1>(oldest).get();
+  profiler_.add_interval("encode_wait", wait_start, now());
+  Elements& packets = std::get<0>(oldest)->packets;
+  buffered_entry_.columns[column].insert(buffered_entry_.columns[column].end(),
+                                         packets.begin(), packets.end());
+  encoding_segments_[column].pop_front();
+}
+
+namespace {
+
+void read_encoded_packets(VideoEncoder* encoder, Elements& packets) {
+  bool new_packet = true;
+  while (new_packet) {
+    size_t buffer_size = 4 * 1024 * 1024;
+    u8* buffer = new_buffer(CPU_DEVICE, buffer_size);
+    size_t actual_size;
+    new_packet = encoder->get_packet(buffer, buffer_size, actual_size);
+    LOG_IF(FATAL, new_packet && actual_size > buffer_size)
+        << "Packet buffer not large enough (" << buffer_size << " vs "
+        << actual_size << ")";
+    insert_element(packets, buffer, actual_size);
+  }
+}
+
+}
+
+void PostEvaluateWorker::encode_segment(i32 column, EncodeSegment& segment) {
+  std::unique_ptr<VideoEncoder> encoder;
+  {
+    std::lock_guard<std::mutex> lock(idle_encoders_mutex_);
+    auto& idle = idle_encoders_[column];
+    if (!idle.empty()) {
+      encoder = std::move(idle.back());
+      idle.pop_back();
+    }
+  }
+  if (!encoder) {
+    encoder.reset(
+        VideoEncoder::make_from_config(encoder_handle_, 1, encoder_type_));
+  }
+
+  // Configuring opens a new stream, so the segment starts with a keyframe
+  encoder->configure(segment.frame_info, encode_options_[column]);
+  for (auto& row : segment.frames) {
+    Frame* frame = row.as_frame();
+    if (encoder->feed(frame->data, frame->size())) {
+      read_encoded_packets(encoder.get(), segment.packets);
+    }
+    delete_element(encoder_handle_, row);
+  }
+  segment.frames.clear();
+  if (encoder->flush()) {
+    read_encoded_packets(encoder.get(), segment.packets);
+  }
+
+  std::lock_guard<std::mutex> lock(idle_encoders_mutex_);
+  idle_encoders_[column].push_back(std::move(encoder));
+}
+
 bool PostEvaluateWorker::yield(EvalWorkEntry& output) {
   auto yield_start = now();
 
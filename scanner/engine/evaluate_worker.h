@@ -15,11 +15,15 @@
 
 #pragma once
 
+#include "scanner/engine/dag_analysis.h"
+#include "scanner/engine/frame_cache.h"
 #include "scanner/engine/kernel_factory.h"
 #include "scanner/engine/runtime.h"
 #include "scanner/engine/sampler.h"
+#include "scanner/engine/stencil_cache.h"
 #include "scanner/util/common.h"
 #include "scanner/util/queue.h"
+#include "scanner/util/thread_pool.h"
 #include "scanner/video/decoder_automata.h"
 #include "scanner/video/video_encoder.h"
 
@@ -41,6 +45,12 @@ struct PreEvaluateWorkerArgs {
   i32 num_cpus;
   i32 decoder_cpus;
   i32 work_packet_size;
+  i32 gop_parallel_decoders;
+  i32 decoder_buffered_frames;
+  // Format to decode each video column into
+  std::vector<FrameFormat> frame_formats;
+  // Resize fused into the decoder of each video column, if any
+  std::vector<DecoderResize> decoder_resizes;
 
   // Per worker arguments
   i32 worker_id;
@@ -59,11 +69,56 @@ class PreEvaluateWorker {
   bool yield(i32 item_size, EvalWorkEntry& output);
 
  private:
+  // Consecutive frames decoded by one of the GOP-parallel decoders into their
+  // own block
+  struct GOPChunk {
+    i64 start_row;
+    i64 num_rows;
+    u8* buffer;
+  };
+
+  // Frames of a video column decoded by one of the GOP-parallel decoders.
+  // They are handed over in chunks of at most a work packet, and the decoder
+  // stalls while its queue of chunks is full, so the decoded frames held for
+  // a task do not grow with the size of the task.
+  struct GOPDecode {
+    i64 start_row;
+    i64 end_row;
+    i64 num_chunks;
+    i64 chunks_popped;
+    std::unique_ptr<Queue<GOPChunk>> chunks;
+    std::future<void> done;
+  };
+
+  // Position of yield in the GOP-parallel decodes of a video column
+  struct GOPCursor {
+    size_t decode_idx = 0;
+    GOPChunk chunk{0, 0, nullptr};
+    // Next decoded row of chunk to hand out
+    i64 next_row = 0;
+  };
+
+  // Returns the frame at decoded_row of a GOP-parallel video column. Rows
+  // must be requested in order.
+  u8* next_gop_frame(i32 media_col_idx, i64 decoded_row, size_t frame_size);
+
+  // Frees the frames which were not handed out and waits for the decoders
+  void wait_for_gop_decodes();
+
+  // Info of the frames decoded from args for a video column
+  FrameInfo decoded_frame_info(i32 media_col_idx,
+                               const proto::DecodeArgs& args);
+
   const i32 node_id_;
   const i32 worker_id_;
   const DeviceHandle device_handle_;
   const i32 num_cpus_;
   const i32 decoder_cpus_;
+  const i32 work_packet_size_;
+  const i32 gop_parallel_decoders_;
+  const i32 decoder_buffered_frames_;
+  const std::vector<FrameFormat> frame_formats_;
+  const std::vector<DecoderResize> decoder_resizes_;
 
   Profiler& profiler_;
 
@@ -72,6 +127,26 @@ class PreEvaluateWorker {
   DeviceHandle decoder_output_handle_;
   std::vector<std::unique_ptr<DecoderAutomata>> decoders_;
   std::vector<std::unique_ptr<hwang::DecoderAutomata>> inplace_decoders_;
+  // Per video column, the format its frames are decoded into, the resize
+  // fused into its decoder and the info of the frames of the current task
+  std::vector<FrameFormat> decode_formats_;
+  std::vector<DecoderResize> decode_resizes_;
+  std::vector<FrameInfo> decoded_infos_;
+  // Per video column. Empty for columns which are decoded sequentially.
+  std::vector<std::vector<std::unique_ptr<DecoderAutomata>>> gop_decoders_;
+  std::unique_ptr<ThreadPool> gop_decode_pool_;
+  // Per video column, the decodes of the current task and the position of
+  // yield in them
+  std::vector<std::vector<GOPDecode>> gop_decodes_;
+  std::vector<GOPCursor> gop_cursors_;
+  // Per video column and task row, the frame read from the frame cache or
+  // nullptr if the row is decoded
+  std::vector<std::vector<u8*>> cached_frames_;
+  // Per video column and task row, the frame cache key of the row. Empty if
+  // the frame cache is not used for the column.
+  std::vector<std::vector<FrameCacheKey>> frame_keys_;
+  // Per video column, the number of decoded rows before each task row
+  std::vector<std::vector<i64>> decoded_rows_before_;
 
   // Continuation state
   bool first_item_;
@@ -115,6 +190,21 @@ struct OpArgGroup {
   std::vector<std::vector<i32>> kernel_stencils;
   // Batch size needed by kernels
   std::vector<i32> kernel_batch_sizes;
+  // For kernels fused with the previous kernel, the output of the previous
+  // kernel read by each input (see determine_fused_kernels)
+  std::vector<std::vector<i32>> fused_inputs;
+  // Kernels which may run while the following ops are evaluated (see
+  // determine_concurrent_kernels)
+  std::vector<bool> run_concurrently;
+  // Kernels whose partial last batch of a task may be filled up with the
+  // first rows of the next task of the same job
+  std::vector<bool> batch_across_tasks;
+  // Number of instances of each kernel which evaluate disjoint batches in
+  // parallel
+  std::vector<i32> kernel_replicas;
+  // Kernels with bounded state which keep their state across consecutive
+  // tasks of a job instead of warming up again
+  std::vector<bool> carries_state;
 };
 
 struct EvaluateWorkerArgs {
@@ -129,6 +219,10 @@ struct EvaluateWorkerArgs {
   i32 kg;
   OpArgGroup arg_group;
   proto::BulkJobParameters::BoundaryCondition boundary_condition;
+  i32 branch_threads;
+  // How long the last output of a task may be held back waiting for the
+  // next task to fill up a partial batch. 0 disables batching across tasks.
+  i32 cross_task_batch_timeout_ms;
 
   Profiler& profiler;
   proto::Result& result;
@@ -148,7 +242,91 @@ class EvaluateWorker {
 
   bool yield(i32 item_size, EvalWorkEntry& output);
 
+  // True if the last batch of the previous task is being held to be
+  // evaluated along with rows of the next task. The output of that task
+  // must not be passed on until finish_carried_batch has been called.
+  bool has_carried_batch() const;
+
+  // True if the held batch has been evaluated
+  bool carried_batch_evaluated() const;
+
+  // Evaluates the held batch if it has not been evaluated yet and adds its
+  // outputs to the last output of the task it belongs to
+  void finish_carried_batch(EvalWorkEntry& task_output);
+
  private:
+  // The partial last batch of a task, which is evaluated together with the
+  // first batch of the next task
+  struct CarriedBatch {
+    size_t k;
+    // Index of the kernel's first output column in the task's output
+    i32 first_col_idx;
+    std::vector<i64> row_ids;
+    // Whether each row is needed downstream
+    std::vector<bool> valid_rows;
+    // Inputs of the batch. Holds a reference to each element.
+    StenciledBatchedElements input_columns;
+    bool evaluated;
+    BatchedElements output_columns;
+  };
+
+  // A kernel whose batches are evaluated on branch_pool_ while the feed loop
+  // moves on to ops which do not read its outputs
+  struct PendingKernel {
+    size_t k;
+    i64 producible_elements;
+    // Index of the kernel's first output column among the side outputs
+    i32 first_col_idx;
+    i32 num_output_columns;
+    std::vector<std::vector<i64>> batch_row_ids;
+    std::future<std::vector<BatchedElements>> outputs;
+  };
+
+  // Holds the last batch of the task for kernel k, taking a reference to its
+  // inputs
+  void carry_batch(size_t k, i32 first_col_idx,
+                   const std::vector<i64>& row_ids,
+                   StenciledBatchedElements& input_columns);
+
+  // Drops the references to the inputs of the carried batch
+  void release_carried_inputs();
+
+  // Evaluates the batches of kernel k with all of its instances and returns
+  // the outputs of each batch
+  std::vector<BatchedElements> run_replicated_kernel(
+      size_t k, std::vector<StenciledBatchedElements>& batches,
+      const std::vector<std::vector<i64>>& batch_row_ids);
+
+  // Waits for the pending kernels and adds their outputs to the side outputs
+  void join_pending_kernels(
+      std::vector<std::unique_ptr<PendingKernel>>& pending_kernels,
+      BatchedElements& side_output_columns,
+      std::vector<DeviceHandle>& side_output_handles,
+      std::vector<std::vector<i64>>& side_row_ids);
+
+  // Drops the outputs of kernel k which are not needed downstream and
+  // removes the inputs it will not read again from its stencil cache
+  void finish_kernel_outputs(size_t k, i64 producible_elements,
+                             const std::vector<i32>& kernel_stencil,
+                             i32 first_col_idx, i32 num_output_columns,
+                             BatchedElements& side_output_columns,
+                             std::vector<DeviceHandle>& side_output_handles,
+                             std::vector<std::vector<i64>>& side_row_ids);
+
+  // Deletes the outputs of kernel k which are never used and checks that it
+  // produced an element for each row of the batch
+  void discard_unused_outputs(size_t k, i32 batch,
+                              BatchedElements& output_columns);
+
+  // Device handles of the outputs of kernel k which are not discarded
+  std::vector<DeviceHandle> used_output_handles(size_t k);
+
+  // Runs the kernels fused with kernel k on the batch of rows k just
+  // produced columns for. The outputs of the last kernel in the chain are
+  // held until it is reached, and columns is replaced with placeholders.
+  void run_fused_kernels(size_t k, const std::vector<i64>& row_ids,
+                         BatchedElements& columns);
+
   void clear_stencil_cache();
 
   const i32 node_id_;
@@ -162,42 +340,50 @@ class EvaluateWorker {
   std::vector<std::vector<DeviceHandle>> kernel_output_devices_;
   std::vector<i32> kernel_num_outputs_;
   std::vector<std::unique_ptr<BaseKernel>> kernels_;
+  // Per kernel -> instances besides the one in kernels_
+  std::vector<std::vector<std::unique_ptr<BaseKernel>>> kernel_replicas_;
 
   // Used for computing complement of column mapping
   std::vector<std::set<i32>> column_mapping_set_;
 
   /// Task state
-  i64 job_idx_;
-  i64 task_idx_;
+  i64 job_idx_ = -1;
+  i64 task_idx_ = -1;
   i64 slice_group_;
   std::map<i64, std::unique_ptr<Partitioner>> partitioners_;
   std::map<i64, std::unique_ptr<DomainSampler>> domain_samplers_;
 
   // Inputs
-  std::vector<std::set<i64>> valid_input_rows_set_;
   std::vector<std::vector<i64>> valid_input_rows_;
   // Tracks which input we should expect next for which column
   std::vector<std::vector<i64>> current_valid_input_idx_;
 
   // List of row ids of the uutputs to compute
-  std::vector<std::set<i64>> compute_rows_set_;
   std::vector<std::vector<i64>> compute_rows_;
   // Tracks which index in compute_rows_ we should expect next
   std::vector<i64> current_compute_idx_;
 
+  // Per kernel -> last row passed to the kernel, or -1 if its state was
+  // reset since
+  std::vector<i64> last_computed_row_;
+
   // Outputs to keep
-  std::vector<std::set<i64>> valid_output_rows_set_;
   std::vector<std::vector<i64>> valid_output_rows_;
   // Tracks which output we should expect next
   std::vector<i64> current_valid_output_idx_;
 
-  // Per kernel -> per input column -> deque of element)
+  // Per kernel -> per input column -> cached elements and their row ids
   std::vector<i64> current_element_cache_input_idx_;
-  std::vector<std::vector<std::deque<Element>>> element_cache_;
+  std::vector<std::vector<StencilCache>> element_cache_;
   // Per kernel -> per input column -> device handle
   std::vector<std::vector<DeviceHandle>> element_cache_devices_;
-  // Per kernel -> per input column -> deque of row ids
-  std::vector<std::vector<std::deque<i64>>> element_cache_row_ids_;
+  // Per kernel -> outputs computed by the first kernel of its fused chain
+  std::vector<BatchedElements> fused_outputs_;
+  // Evaluates kernels concurrently with the ops after them
+  std::unique_ptr<ThreadPool> branch_pool_;
+  std::unique_ptr<CarriedBatch> carried_batch_;
+  // Runs the extra instances of replicated kernels
+  std::unique_ptr<ThreadPool> replica_pool_;
 
   // Continutation state
   EvalWorkEntry entry_;
@@ -209,6 +395,9 @@ class EvaluateWorker {
   std::vector<std::vector<i64>> final_row_ids_;
 };
 
+// GOPs of one output video column which are encoded at the same time
+static const i32 DEFAULT_ENCODERS_PER_COLUMN = 2;
+
 struct ColumnCompressionOptions {
   std::string codec;
   std::map<std::string, std::string> options;
@@ -241,18 +430,48 @@ class PostEvaluateWorker {
   std::vector<Column> columns_;
   std::set<i32> column_set_;
 
+  // Frames of one GOP of an output column, encoded independently of the
+  // other GOPs so that they can be encoded in parallel
+  struct EncodeSegment {
+    FrameInfo frame_info;
+    Elements frames;
+    Elements packets;
+  };
+
+  // Hands the open segment of column to the encoder threads
+  void submit_segment(i32 column);
+
+  // Waits for the oldest segment of column and appends its packets
+  void retire_segment(i32 column);
+
+  // Runs on an encoder thread
+  void encode_segment(i32 column, EncodeSegment& segment);
+
   DeviceHandle encoder_handle_;
   VideoEncoderType encoder_type_;
-  std::vector<std::unique_ptr<VideoEncoder>> encoders_;
   std::vector<bool> frame_size_initialized_;
-  std::vector<bool> encoder_configured_;
-  std::vector<EncodeOptions> encode_options_;
   std::vector<bool> compression_enabled_;
 
+  // Per output column
+  std::vector<EncodeOptions> encode_options_;
+  std::vector<i64> segment_frames_;
+  std::vector<i32> max_encoding_segments_;
+  std::vector<std::unique_ptr<EncodeSegment>> open_segments_;
+  std::vector<std::deque<
+      std::tuple<std::unique_ptr<EncodeSegment>, std::future<void>>>>
+      encoding_segments_;
+
+  std::mutex idle_encoders_mutex_;
+  std::vector<std::vector<std::unique_ptr<VideoEncoder>>> idle_encoders_;
+
   // Generator state
   EvalWorkEntry buffered_entry_;
   i64 current_offset_;
   std::deque<EvalWorkEntry> buffered_entries_;
+
+  // Destroyed first, so that pending segments finish before the state they
+  // reference goes away
+  std::unique_ptr<ThreadPool> encode_pool_;
 };
 }
 }
@@ -0,0 +1,124 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/frame_cache.h"
+#include "scanner/util/memory.h"
+
+#include <memory>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+std::unique_ptr<FrameCache> frame_cache;
+
+}
+
+FrameCache::FrameCache(i64 capacity) : capacity_(capacity) {}
+
+FrameCache::~FrameCache() { clear(); }
+
+u8* FrameCache::get(DeviceHandle device, const FrameCacheKey& key) {
+  std::lock_guard<std::mutex> lock(lock_);
+  auto it = entries_.find(key);
+  if (it == entries_.end() || it->second.device != device) {
+    stats_.misses++;
+    return nullptr;
+  }
+  Entry& entry = it->second;
+  lru_.splice(lru_.begin(), lru_, entry.lru_position);
+  add_buffer_ref(device, entry.buffer);
+  stats_.hits++;
+  return entry.buffer;
+}
+
+void FrameCache::insert(DeviceHandle device, const FrameCacheKey& key,
+                        u8* buffer) {
+  u8* block;
+  size_t block_size;
+  get_buffer_block(device, buffer, block, block_size);
+
+  std::lock_guard<std::mutex> lock(lock_);
+  if (entries_.count(key) > 0) {
+    return;
+  }
+  BlockKey block_key(device.type, device.id, block);
+  auto block_it = blocks_.find(block_key);
+  if (block_it == blocks_.end()) {
+    if ((i64)block_size > capacity_) {
+      return;
+    }
+    block_it = blocks_.emplace(block_key, Block{(i64)block_size, 0}).first;
+    bytes_used_ += block_size;
+  }
+  block_it->second.frames++;
+  add_buffer_ref(device, buffer);
+  lru_.push_front(key);
+  entries_[key] = Entry{device, buffer, block, lru_.begin()};
+  stats_.insertions++;
+
+  // Evict least recently used frames until the blocks they pin are back under
+  // budget
+  while (bytes_used_ > capacity_ && lru_.size() > 1) {
+    erase(entries_.find(lru_.back()));
+    stats_.evictions++;
+  }
+}
+
+void FrameCache::clear() {
+  std::lock_guard<std::mutex> lock(lock_);
+  while (!entries_.empty()) {
+    erase(entries_.begin());
+  }
+}
+
+FrameCacheStats FrameCache::stats() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return stats_;
+}
+
+i64 FrameCache::bytes_used() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return bytes_used_;
+}
+
+void FrameCache::erase(std::map<FrameCacheKey, Entry>::iterator it) {
+  Entry& entry = it->second;
+  auto block_it =
+      blocks_.find(BlockKey(entry.device.type, entry.device.id, entry.block));
+  if (--block_it->second.frames == 0) {
+    bytes_used_ -= block_it->second.size;
+    blocks_.erase(block_it);
+  }
+  delete_buffer(entry.device, entry.buffer);
+  lru_.erase(entry.lru_position);
+  entries_.erase(it);
+}
+
+void init_frame_cache(i64 capacity) {
+  if (capacity <= 0) {
+    frame_cache.reset();
+    return;
+  }
+  frame_cache.reset(new FrameCache(capacity));
+}
+
+void destroy_frame_cache() { frame_cache.reset(); }
+
+FrameCache* get_frame_cache() { return frame_cache.get(); }
+
+}
+}
@@ -0,0 +1,106 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/api/frame.h"
+#include "scanner/util/common.h"
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <tuple>
+
+namespace scanner {
+namespace internal {
+
+// (table id, column id, item id, frame, format, width, height). The last
+// three describe the decoded frame, which may be resized.
+using FrameCacheKey =
+    std::tuple<i32, i32, i32, i64, FrameFormat, i32, i32>;
+
+struct FrameCacheStats {
+  i64 hits = 0;
+  i64 misses = 0;
+  i64 insertions = 0;
+  i64 evictions = 0;
+};
+
+/// Per-node cache of decoded video frames, shared by every pipeline instance.
+///
+/// Frames stay in the block buffers they were decoded into. The cache holds a
+/// reference to each cached frame and hands out new references on a hit, so
+/// cached frames are never copied. Since a cached frame keeps its whole block
+/// alive, the byte budget is charged for every block that holds at least one
+/// cached frame. The least recently used frames are evicted until the pinned
+/// blocks fit in the budget.
+class FrameCache {
+ public:
+  FrameCache(i64 capacity);
+
+  ~FrameCache();
+
+  // Returns the frame for key with a reference added for the caller, or
+  // nullptr if the frame is not cached on device.
+  u8* get(DeviceHandle device, const FrameCacheKey& key);
+
+  // Caches the decoded frame in buffer, which must be part of a block buffer
+  // allocated on device
+  void insert(DeviceHandle device, const FrameCacheKey& key, u8* buffer);
+
+  // Releases every cached frame. Must be called before the memory allocators
+  // are destroyed.
+  void clear();
+
+  FrameCacheStats stats() const;
+
+  i64 bytes_used() const;
+
+ private:
+  // (device type, device id, block)
+  using BlockKey = std::tuple<DeviceType, i32, u8*>;
+
+  struct Entry {
+    DeviceHandle device;
+    u8* buffer;
+    u8* block;
+    std::list<FrameCacheKey>::iterator lru_position;
+  };
+
+  struct Block {
+    i64 size;
+    i64 frames;
+  };
+
+  void erase(std::map<FrameCacheKey, Entry>::iterator it);
+
+  const i64 capacity_;
+  mutable std::mutex lock_;
+  std::list<FrameCacheKey> lru_;  // Front is most recently used
+  std::map<FrameCacheKey, Entry> entries_;
+  std::map<BlockKey, Block> blocks_;
+  i64 bytes_used_ = 0;
+  FrameCacheStats stats_;
+};
+
+void init_frame_cache(i64 capacity);
+
+void destroy_frame_cache();
+
+// Returns nullptr if the frame cache is disabled on this node
+FrameCache* get_frame_cache();
+
+}
+}
@@ -15,11 +15,16 @@
 
 #include "scanner/api/database.h"
 #include "scanner/api/frame.h"
+#include "scanner/engine/ingest.h"
 #include "scanner/engine/metadata.h"
+#include "scanner/engine/metadata_log.h"
 #include "scanner/video/h264_byte_stream_index_creator.h"
+#include "scanner/video/h265_byte_stream_index_creator.h"
+#include "scanner/video/video_encoder.h"
 
 #include "scanner/util/common.h"
 #include "scanner/util/h264.h"
+#include "scanner/util/thread_pool.h"
 #include "scanner/util/util.h"
 
 #include "storehouse/storage_backend.h"
@@ -37,13 +42,20 @@ extern "C" {
 #include "libavformat/avformat.h"
 #include "libavformat/avio.h"
 #include "libavutil/error.h"
+#include "libavutil/imgutils.h"
 #include "libavutil/opt.h"
 #include "libavutil/pixdesc.h"
 #include "libswscale/swscale.h"
 }
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <deque>
 #include <fstream>
+#include <functional>
+#include <map>
+#include <set>
 
 using storehouse::StoreResult;
 using storehouse::WriteFile;
@@ -55,6 +67,12 @@ namespace {
 
 const std::string BAD_VIDEOS_FILE_PATH = "bad_videos.txt";
 
+// Granularity of the reads made while parsing the container index of a video
+// ingested in place
+const u64 INPLACE_INDEX_BLOCK_BYTES = 64 * 1024;
+// Initial size of the buffer encoded proxy packets are copied into
+const size_t PROXY_PACKET_BUFFER_BYTES = 1024 * 1024;
+
 struct FFStorehouseState {
   std::unique_ptr<RandomReadFile> file = nullptr;
   u64 size = 0;  // total file size
@@ -124,9 +142,11 @@ struct CodecState {
 #endif
   i32 video_stream_index;
   AVBitStreamFilterContext* annexb;
+  proto::VideoDescriptor::VideoCodecType codec_type;
 };
 
-bool setup_video_codec(FFStorehouseState* fs, CodecState& state) {
+bool setup_video_codec(FFStorehouseState* fs, CodecState& state,
+                       i32 decode_threads = 1) {
   VLOG(1) << "Setting up video codec";
   av_init_packet(&state.av_packet);
   state.picture = av_frame_alloc();
@@ -166,9 +186,16 @@ bool setup_video_codec(FFStorehouseState* fs, CodecState& state) {
   AVStream const* const in_stream =
       state.format_context->streams[state.video_stream_index];
 
-  state.in_codec = avcodec_find_decoder(AV_CODEC_ID_H264);
+  AVCodecID codec_id = AV_CODEC_ID_H264;
+  state.codec_type = proto::VideoDescriptor::H264;
+  if (in_stream->codec->codec_id == AV_CODEC_ID_HEVC) {
+    codec_id = AV_CODEC_ID_HEVC;
+    state.codec_type = proto::VideoDescriptor::HEVC;
+  }
+  state.in_codec = avcodec_find_decoder(codec_id);
   if (state.in_codec == NULL) {
-    LOG(FATAL) << "could not find h264 decoder";
+    LOG(FATAL) << "could not find " << avcodec_get_name(codec_id)
+               << " decoder";
   }
 
   state.in_cc = avcodec_alloc_context3(state.in_codec);
@@ -190,12 +217,14 @@ bool setup_video_codec(FFStorehouseState* fs, CodecState& state) {
   }
 #endif
 
+  state.in_cc->thread_count = decode_threads;
   if (avcodec_open2(state.in_cc, state.in_codec, NULL) < 0) {
     LOG(ERROR) << "could not open codec";
     return false;
   }
 
-  state.annexb = av_bitstream_filter_init("h264_mp4toannexb");
+  state.annexb = av_bitstream_filter_init(
+      codec_id == AV_CODEC_ID_HEVC ? "hevc_mp4toannexb" : "h264_mp4toannexb");
 
   return true;
 }
@@ -219,6 +248,167 @@ void cleanup_video_codec(CodecState state) {
   av_bitstream_filter_close(state.annexb);
 }
 
+// Serves the reads of the MP4 box parser from whole blocks of the file. The
+// parser walks the file one box header at a time, so reading blocks keeps the
+// number of requests to the storage backend to a handful per file.
+class BlockReader {
+ public:
+  BlockReader(RandomReadFile* file, u64 file_size, u64 block_size)
+    : file_(file), file_size_(file_size), block_size_(block_size) {}
+
+  void read(u64 offset, u64 size, u8* data) {
+    assert(offset + size <= file_size_);
+    if (size == 0) {
+      return;
+    }
+    u64 first_block = offset / block_size_;
+    u64 last_block = (offset + size - 1) / block_size_;
+    // Fetch each run of missing blocks with a single request
+    u64 b = first_block;
+    while (b <= last_block) {
+      if (blocks_.count(b) > 0) {
+        b++;
+        continue;
+      }
+      u64 run_end = b;
+      while (run_end + 1 <= last_block && blocks_.count(run_end + 1) == 0) {
+        run_end++;
+      }
+      fetch(b, run_end);
+      b = run_end + 1;
+    }
+    for (b = first_block; b <= last_block; ++b) {
+      const std::vector<u8>& block = blocks_.at(b);
+      u64 block_start = b * block_size_;
+      u64 copy_start = std::max(offset, block_start);
+      u64 copy_end = std::min(offset + size, block_start + block.size());
+      memcpy(data + (copy_start - offset),
+             block.data() + (copy_start - block_start),
+             copy_end - copy_start);
+    }
+  }
+
+  u64 bytes_fetched() const { return bytes_fetched_; }
+
+  i64 requests() const { return requests_; }
+
+ private:
+  void fetch(u64 first_block, u64 last_block) {
+    u64 start = first_block * block_size_;
+    u64 end = std::min((last_block + 1) * block_size_, file_size_);
+    std::vector<u8> data(end - start);
+    size_t size_read;
+    StoreResult result;
+    EXP_BACKOFF(file_->read(start, data.size(), data.data(), size_read),
+                result);
+    exit_on_error(result);
+    assert(size_read == data.size());
+    for (u64 b = first_block; b <= last_block; ++b) {
+      u64 block_start = b * block_size_ - start;
+      u64 block_end = std::min(block_start + block_size_, (u64)data.size());
+      blocks_[b].assign(data.begin() + block_start, data.begin() + block_end);
+    }
+    bytes_fetched_ += data.size();
+    requests_++;
+  }
+
+  RandomReadFile* file_;
+  u64 file_size_;
+  u64 block_size_;
+  std::map<u64, std::vector<u8>> blocks_;
+  u64 bytes_fetched_ = 0;
+  i64 requests_ = 0;
+};
+
+// Reads the header of the MP4 box at offset, which must end by end
+bool read_mp4_box(BlockReader& reader, u64 offset, u64 end, std::string& type,
+                  u64& payload_start, u64& box_end) {
+  if (offset + 8 > end) {
+    return false;
+  }
+  u8 header[16];
+  reader.read(offset, 8, header);
+  u64 size = ((u64)header[0] << 24) | ((u64)header[1] << 16) |
+             ((u64)header[2] << 8) | (u64)header[3];
+  type.assign((const char*)header + 4, 4);
+  payload_start = offset + 8;
+  if (size == 1) {
+    // 64 bit size
+    if (offset + 16 > end) {
+      return false;
+    }
+    reader.read(offset + 8, 8, header + 8);
+    size = 0;
+    for (i32 i = 8; i < 16; ++i) {
+      size = (size << 8) | header[i];
+    }
+    payload_start = offset + 16;
+  } else if (size == 0) {
+    // The box extends to the end of its parent
+    size = end - offset;
+  }
+  box_end = offset + size;
+  return size >= payload_start - offset && box_end <= end;
+}
+
+// Finds the first child box of the given type in [start, end)
+bool find_mp4_box(BlockReader& reader, u64 start, u64 end,
+                  const std::string& type, u64& payload_start, u64& box_end) {
+  std::string box_type;
+  u64 offset = start;
+  while (read_mp4_box(reader, offset, end, box_type, payload_start,
+                      box_end)) {
+    if (box_type == type) {
+      return true;
+    }
+    offset = box_end;
+  }
+  return false;
+}
+
+// Reads the sample entry type (e.g. avc1 or hvc1) of the first video track of
+// an MP4 file
+bool read_mp4_video_codec(BlockReader& reader, u64 file_size,
+                          std::string& codec) {
+  u64 moov_start, moov_end;
+  if (!find_mp4_box(reader, 0, file_size, "moov", moov_start, moov_end)) {
+    return false;
+  }
+  std::string type;
+  u64 trak_start, trak_end;
+  for (u64 offset = moov_start; read_mp4_box(reader, offset, moov_end, type,
+                                             trak_start, trak_end);
+       offset = trak_end) {
+    u64 mdia_start, mdia_end, hdlr_start, hdlr_end;
+    if (type != "trak" ||
+        !find_mp4_box(reader, trak_start, trak_end, "mdia", mdia_start,
+                      mdia_end) ||
+        !find_mp4_box(reader, mdia_start, mdia_end, "hdlr", hdlr_start,
+                      hdlr_end) ||
+        hdlr_end - hdlr_start < 12) {
+      continue;
+    }
+    // The handler type follows the version, flags and pre_defined fields
+    char handler[4];
+    reader.read(hdlr_start + 8, 4, (u8*)handler);
+    if (std::string(handler, 4) != "vide") {
+      continue;
+    }
+    u64 minf_start, minf_end, stbl_start, stbl_end, stsd_start, stsd_end;
+    u64 entry_start, entry_end;
+    // The sample entries follow the version, flags and entry count fields
+    return find_mp4_box(reader, mdia_start, mdia_end, "minf", minf_start,
+                        minf_end) &&
+           find_mp4_box(reader, minf_start, minf_end, "stbl", stbl_start,
+                        stbl_end) &&
+           find_mp4_box(reader, stbl_start, stbl_end, "stsd", stsd_start,
+                        stsd_end) &&
+           read_mp4_box(reader, stsd_start + 8, stsd_end, codec, entry_start,
+                        entry_end);
+  }
+  return false;
+}
+
 bool parse_video_inplace(storehouse::StorageBackend* storage,
                          const std::string& table_name, i32 table_id,
                          const std::string& path, std::string& error_message) {
@@ -262,17 +452,21 @@ bool parse_video_inplace(storehouse::StorageBackend* storage,
     return false;
   }
 
+  // The sample table is read from the moov box alone, without touching the
+  // media data. Files the parser can not index fall back to a copy ingest,
+  // which scans the packets instead.
   hwang::MP4IndexCreator index_creator(file_size);
+  BlockReader reader(file.get(), file_size, INPLACE_INDEX_BLOCK_BYTES);
   u64 offset = 0;
   u64 size_to_read = 1024;
   while (!index_creator.is_done()) {
+    if (offset + size_to_read > file_size) {
+      error_message = "Container index extends past the end of the file";
+      return false;
+    }
     std::vector<u8> data(size_to_read);
-    size_t size_read;
-    EXP_BACKOFF(
-        file->read(offset, size_to_read, data.data(), size_read),
-        result);
-    exit_on_error(result);
-    assert(size_read == size_to_read);
+    size_t size_read = size_to_read;
+    reader.read(offset, size_to_read, data.data());
     u64 next_offset;
     u64 next_size;
     index_creator.feed(data.data(), size_read,
@@ -281,6 +475,18 @@ bool parse_video_inplace(storehouse::StorageBackend* storage,
     offset = next_offset;
     size_to_read = next_size;
   }
+  VLOG(1) << "Read " << reader.bytes_fetched() << " bytes of " << path
+          << " in " << reader.requests() << " requests to index it";
+  // The in-place decoder only handles H.264
+  std::string codec;
+  if (!read_mp4_video_codec(reader, file_size, codec)) {
+    error_message = "Can not find the video track's sample description";
+    return false;
+  }
+  if (codec != "avc1" && codec != "avc3") {
+    error_message = "In-place ingest only supports H.264 videos, not " + codec;
+    return false;
+  }
   if (index_creator.is_error()) {
     error_message = index_creator.error_message();
     return false;
@@ -366,9 +572,276 @@ bool parse_video_inplace(storehouse::StorageBackend* storage,
   return true;
 }
 
+// Index of a demuxed bytestream. When a video is indexed in chunks, the
+// indexes of the chunks are appended in stream order.
+struct DemuxedVideoIndex {
+  i64 frames = 0;
+  i64 num_non_ref_frames = 0;
+  u64 bytestream_size = 0;
+  std::vector<u8> metadata_bytes;
+  std::vector<u64> keyframe_indices;
+  std::vector<u64> sample_offsets;
+  std::vector<u64> sample_sizes;
+  std::vector<u64> non_reference_samples;
+  std::vector<u64> non_reference_frames;
+
+  template <typename IndexCreator>
+  void append(IndexCreator& index_creator) {
+    if (metadata_bytes.empty()) {
+      metadata_bytes = index_creator.metadata_bytes();
+    }
+    for (u64 v : index_creator.keyframe_indices()) {
+      keyframe_indices.push_back(frames + v);
+    }
+    for (u64 v : index_creator.sample_offsets()) {
+      sample_offsets.push_back(bytestream_size + v);
+    }
+    sample_sizes.insert(sample_sizes.end(),
+                        index_creator.sample_sizes().begin(),
+                        index_creator.sample_sizes().end());
+    for (u64 v : index_creator.non_reference_samples()) {
+      non_reference_samples.push_back(frames + v);
+    }
+    for (u64 v : index_creator.non_reference_frames()) {
+      non_reference_frames.push_back(frames + v);
+    }
+    frames += index_creator.frames();
+    num_non_ref_frames += index_creator.num_non_ref_frames();
+    bytestream_size += index_creator.bytestream_pos();
+  }
+};
+
+// Reads the packets of the video stream, converts them to annex b and passes
+// each to fn. Stops and returns false if fn does, leaving fn to set the error.
+bool demux_video(CodecState& state, const std::function<bool(u8*, i32)>& fn,
+                 std::string& error_message) {
+  i64 frame = 0;
+  while (true) {
+    // Read from format context
+    i32 err = av_read_frame(state.format_context, &state.av_packet);
+    if (err == AVERROR_EOF) {
+      av_packet_unref(&state.av_packet);
+      break;
+    } else if (err != 0) {
+      char err_msg[256];
+      av_strerror(err, err_msg, 256);
+      LOG(ERROR) << "Error while decoding frame " << frame << " (" << err
+                 << "): " << err_msg;
+      error_message = "Error while decoding frame " + std::to_string(frame) +
+                      " (" + std::to_string(err) + "): " + std::string(err_msg);
+      return false;
+    }
+
+    if (state.av_packet.stream_index != state.video_stream_index) {
+      av_packet_unref(&state.av_packet);
+      continue;
+    }
+
+    u8* filtered_data;
+    i32 filtered_data_size;
+    err = av_bitstream_filter_filter(state.annexb, state.in_cc, NULL,
+                                     &filtered_data, &filtered_data_size,
+                                     state.av_packet.data, state.av_packet.size,
+                                     state.av_packet.flags & AV_PKT_FLAG_KEY);
+    if (err < 0) {
+      char err_msg[256];
+      av_strerror(err, err_msg, 256);
+      LOG(ERROR) << "Error while filtering " << frame << " (" << frame
+                 << "): " << err_msg;
+      av_packet_unref(&state.av_packet);
+      error_message = "Error while filtering frame " + std::to_string(frame) +
+                      " (" + std::to_string(err) + "): " + std::string(err_msg);
+      return false;
+    }
+
+    bool keep_going = fn(filtered_data, filtered_data_size);
+    free(filtered_data);
+    av_packet_unref(&state.av_packet);
+    if (!keep_going) {
+      return false;
+    }
+    frame++;
+  }
+  return true;
+}
+
+template <typename IndexCreator>
+bool index_video(CodecState& state, WriteFile* demuxed_bytestream,
+                 DemuxedVideoIndex& index, std::string& error_message) {
+  IndexCreator index_creator(demuxed_bytestream);
+  bool demuxed = demux_video(state,
+                             [&](u8* data, i32 size) {
+                               if (!index_creator.feed_packet(data, size)) {
+                                 error_message = index_creator.error_message();
+                                 return false;
+                               }
+                               return true;
+                             },
+                             error_message);
+  if (!demuxed) {
+    return false;
+  }
+  index_creator.finish();
+  index.append(index_creator);
+  return true;
+}
+
+// Indexes the video in chunks which start at IDR frames, using num_threads
+// threads. A chunk ends at the first IDR frame after chunk_bytes of packets.
+// Each chunk is indexed by its own IndexCreator seeded with the parameter
+// sets which precede the chunk, so the bytestream and index are identical to
+// the ones index_video produces.
+template <typename IndexCreator>
+bool index_video_parallel(CodecState& state, i32 num_threads, u64 chunk_bytes,
+                          WriteFile* demuxed_bytestream,
+                          DemuxedVideoIndex& index,
+                          std::string& error_message) {
+  struct Chunk {
+    std::vector<u8> packet_data;
+    std::vector<i32> packet_sizes;
+    std::vector<u8> bytestream;
+    std::unique_ptr<IndexCreator> index_creator;
+  };
+
+  // Follows the parameter sets of the stream as it is demuxed
+  std::vector<u8> unused_bytestream;
+  IndexCreator tracker(&unused_bytestream);
+
+  ThreadPool pool(num_threads);
+  std::deque<std::pair<std::unique_ptr<Chunk>, std::future<bool>>> in_flight;
+  std::unique_ptr<Chunk> chunk;
+  bool succeeded = true;
+
+  // Waits for the oldest chunk and appends it to the bytestream and index
+  auto retire_chunk = [&]() {
+    bool indexed = in_flight.front().second.get();
+    Chunk& c = *in_flight.front().first;
+    if (succeeded && indexed) {
+      s_write(demuxed_bytestream, c.bytestream.data(), c.bytestream.size());
+      index.append(*c.index_creator);
+    } else if (succeeded) {
+      error_message = c.index_creator->error_message();
+      succeeded = false;
+    }
+    in_flight.pop_front();
+  };
+
+  auto submit_chunk = [&]() {
+    Chunk* c = chunk.get();
+    std::future<bool> indexed = pool.enqueue([c]() {
+      size_t offset = 0;
+      for (i32 size : c->packet_sizes) {
+        if (!c->index_creator->feed_packet(c->packet_data.data() + offset,
+                                           size)) {
+          return false;
+        }
+        offset += size;
+      }
+      c->index_creator->finish();
+      std::vector<u8>().swap(c->packet_data);
+      return true;
+    });
+    in_flight.emplace_back(std::move(chunk), std::move(indexed));
+    // Bound the number of chunks held in memory
+    while (in_flight.size() > (size_t)num_threads) {
+      retire_chunk();
+    }
+  };
+
+  bool demuxed = demux_video(
+      state,
+      [&](u8* data, i32 size) {
+        bool is_idr;
+        if (!tracker.scan_packet(data, size, is_idr)) {
+          error_message = tracker.error_message();
+          return false;
+        }
+        if (chunk && is_idr &&
+            chunk->packet_data.size() >= chunk_bytes) {
+          submit_chunk();
+          if (!succeeded) {
+            return false;
+          }
+        }
+        if (!chunk) {
+          chunk.reset(new Chunk);
+          chunk->index_creator.reset(new IndexCreator(&chunk->bytestream));
+          chunk->index_creator->copy_parameter_sets(tracker);
+        }
+        chunk->packet_data.insert(chunk->packet_data.end(), data, data + size);
+        chunk->packet_sizes.push_back(size);
+        return true;
+      },
+      error_message);
+  if (demuxed && chunk) {
+    submit_chunk();
+  }
+  // Chunks still reference this frame, so they are drained even on failure
+  while (!in_flight.empty()) {
+    retire_chunk();
+  }
+  return demuxed && succeeded;
+}
+
+bool open_video_file(storehouse::StorageBackend* storage,
+                     const std::string& path, FFStorehouseState& file_state,
+                     std::string& error_message) {
+  StoreResult result;
+  EXP_BACKOFF(make_unique_random_read_file(storage, path, file_state.file),
+              result);
+  if (result != StoreResult::Success) {
+    error_message = "Can not open video file";
+    return false;
+  }
+
+  EXP_BACKOFF(file_state.file->get_size(file_state.size), result);
+  if (result != StoreResult::Success) {
+    error_message = "Can not get file size";
+    return false;
+  }
+  if (file_state.size <= 0) {
+    error_message = "Can not ingest empty video file";
+    return false;
+  }
+
+  file_state.pos = 0;
+  return true;
+}
+
+// Stores the index of a single demuxed bytestream in the descriptor
+void set_video_index(const DemuxedVideoIndex& index,
+                     proto::VideoDescriptor& video_descriptor) {
+  video_descriptor.set_frames(index.frames);
+  video_descriptor.set_num_encoded_videos(1);
+  video_descriptor.add_frames_per_video(index.frames);
+  video_descriptor.add_keyframes_per_video(index.keyframe_indices.size());
+  video_descriptor.add_size_per_video(index.bytestream_size);
+  video_descriptor.set_metadata_packets(index.metadata_bytes.data(),
+                                        index.metadata_bytes.size());
+
+  for (u64 v : index.sample_offsets) {
+    video_descriptor.add_sample_offsets(v);
+  }
+  for (u64 v : index.sample_sizes) {
+    video_descriptor.add_sample_sizes(v);
+  }
+  for (u64 v : index.keyframe_indices) {
+    video_descriptor.add_keyframe_indices(v);
+  }
+  video_descriptor.add_non_reference_samples_per_video(
+      index.non_reference_samples.size());
+  for (u64 v : index.non_reference_samples) {
+    video_descriptor.add_non_reference_samples(v);
+  }
+  for (u64 v : index.non_reference_frames) {
+    video_descriptor.add_non_reference_frames(v);
+  }
+}
+
 bool parse_and_write_video(storehouse::StorageBackend* storage,
                            const std::string& table_name, i32 table_id,
-                           const std::string& path,
+                           const std::string& path, i32 index_threads,
+                           const IngestIndexOptions& index_options,
                            std::string& error_message) {
   proto::TableDescriptor table_desc;
   table_desc.set_id(table_id);
@@ -393,26 +866,10 @@ bool parse_and_write_video(storehouse::StorageBackend* storage,
   // Setup custom buffer for libavcodec so that we can read from a storehouse
   // file instead of a posix file
   FFStorehouseState file_state{};
-  StoreResult result;
-  EXP_BACKOFF(make_unique_random_read_file(storage, path, file_state.file),
-              result);
-  if (result != StoreResult::Success) {
-    error_message = "Can not open video file";
+  if (!open_video_file(storage, path, file_state, error_message)) {
     return false;
   }
 
-  EXP_BACKOFF(file_state.file->get_size(file_state.size), result);
-  if (result != StoreResult::Success) {
-    error_message = "Can not get file size";
-    return false;
-  }
-  if (file_state.size <= 0) {
-    error_message = "Can not ingest empty video file";
-    return false;
-  }
-
-  file_state.pos = 0;
-
   CodecState state;
   if (!setup_video_codec(&file_state, state)) {
     error_message = "Failed to set up video codec";
@@ -430,7 +887,7 @@ bool parse_and_write_video(storehouse::StorageBackend* storage,
   video_descriptor.set_channels(3);
   video_descriptor.set_frame_type(FrameType::U8);
   video_descriptor.set_chroma_format(proto::VideoDescriptor::YUV_420);
-  video_descriptor.set_codec_type(proto::VideoDescriptor::H264);
+  video_descriptor.set_codec_type(state.codec_type);
 
   std::string data_path = table_item_output_path(table_id, 1, 0);
   std::unique_ptr<WriteFile> demuxed_bytestream{};
@@ -441,90 +898,41 @@ bool parse_and_write_video(storehouse::StorageBackend* storage,
   video_descriptor.set_inplace(false);
 
   bool succeeded = true;
-  H264ByteStreamIndexCreator index_creator(demuxed_bytestream.get());
-  while (true) {
-    // Read from format context
-    i32 err = av_read_frame(state.format_context, &state.av_packet);
-    if (err == AVERROR_EOF) {
-      av_packet_unref(&state.av_packet);
-      break;
-    } else if (err != 0) {
-      char err_msg[256];
-      av_strerror(err, err_msg, 256);
-      int frame = index_creator.frames();
-      LOG(ERROR) << "Error while decoding frame " << frame << " (" << err
-                 << "): " << err_msg;
-      cleanup_video_codec(state);
-      error_message = "Error while decoding frame " + std::to_string(frame) +
-                      " (" + std::to_string(err) + "): " + std::string(err_msg);
-      return false;
-    }
-
-    if (state.av_packet.stream_index != state.video_stream_index) {
-      av_packet_unref(&state.av_packet);
-      continue;
-    }
-
-    /* NOTE1: some codecs are stream based (mpegvideo, mpegaudio)
-       and this is the only method to use them because you cannot
-       know the compressed data size before analysing it.
-
-       BUT some other codecs (msmpeg4, mpeg4) are inherently frame
-       based, so you must call them with all the data for one
-       frame exactly. You must also initialize 'width' and
-       'height' before initializing them. */
-
-    /* NOTE2: some codecs allow the raw parameters (frame size,
-       sample rate) to be changed at any frame. We handle this, so
-       you should also take care of it */
-
-    /* here, we use a stream based decoder (mpeg1video), so we
-       feed decoder and see if it could decode a frame */
-
-    u8* orig_data = state.av_packet.data;
-    i32 orig_size = state.av_packet.size;
-
-    u8* filtered_data;
-    i32 filtered_data_size;
-    err = av_bitstream_filter_filter(state.annexb, state.in_cc, NULL,
-                                     &filtered_data, &filtered_data_size,
-                                     state.av_packet.data, state.av_packet.size,
-                                     state.av_packet.flags & AV_PKT_FLAG_KEY);
-    if (err < 0) {
-      int frame = index_creator.frames();
-      char err_msg[256];
-      av_strerror(err, err_msg, 256);
-      LOG(ERROR) << "Error while filtering " << frame << " (" << frame
-                 << "): " << err_msg;
-      cleanup_video_codec(state);
-      error_message = "Error while filtering frame " + std::to_string(frame) +
-                      " (" + std::to_string(err) + "): " + std::string(err_msg);
-      return false;
-    }
-
-    if (!index_creator.feed_packet(filtered_data, filtered_data_size)) {
-      error_message = index_creator.error_message();
-      return false;
-    }
-    free(filtered_data);
-
-    av_packet_unref(&state.av_packet);
+  DemuxedVideoIndex index;
+  bool parallel = index_threads > 1 &&
+                  (i64)file_state.size >= index_options.parallel_min_bytes;
+  u64 chunk_bytes = index_options.chunk_bytes;
+  if (state.codec_type == proto::VideoDescriptor::HEVC) {
+    succeeded = parallel ? index_video_parallel<H265ByteStreamIndexCreator>(
+                               state, index_threads, chunk_bytes,
+                               demuxed_bytestream.get(), index, error_message)
+                         : index_video<H265ByteStreamIndexCreator>(
+                               state, demuxed_bytestream.get(), index,
+                               error_message);
+  } else {
+    succeeded = parallel ? index_video_parallel<H264ByteStreamIndexCreator>(
+                               state, index_threads, chunk_bytes,
+                               demuxed_bytestream.get(), index, error_message)
+                         : index_video<H264ByteStreamIndexCreator>(
+                               state, demuxed_bytestream.get(), index,
+                               error_message);
+  }
+  if (!succeeded) {
+    cleanup_video_codec(state);
+    return false;
   }
 
   video_descriptor.set_time_base_num(state.in_cc->time_base.num);
   video_descriptor.set_time_base_denom(state.in_cc->time_base.den);
 
-  i64 frame = index_creator.frames();
-  i32 num_non_ref_frames = index_creator.num_non_ref_frames();
-  const std::vector<u8>& metadata_bytes = index_creator.metadata_bytes();
-  const std::vector<u64>& keyframe_indices = index_creator.keyframe_indices();
-  const std::vector<u64>& sample_offsets = index_creator.sample_offsets();
-  const std::vector<u64>& sample_sizes = index_creator.sample_sizes();
+  i64 frame = index.frames;
+  i64 num_non_ref_frames = index.num_non_ref_frames;
 
   VLOG(2) << "Num frames: " << frame;
   VLOG(2) << "Num non-reference frames: " << num_non_ref_frames;
   VLOG(2) << "% non-reference frames: " << num_non_ref_frames / (float)frame;
-  VLOG(2) << "Average GOP length: " << frame / (float)keyframe_indices.size();
+  VLOG(2) << "Average GOP length: "
+          << frame / (float)index.keyframe_indices.size();
 
   // Cleanup video decoder
   cleanup_video_codec(state);
@@ -557,23 +965,7 @@ bool parse_and_write_video(storehouse::StorageBackend* storage,
                "while trying to save " + index_file->path());
 
   table_desc.add_end_rows(frame);
-  video_descriptor.set_frames(frame);
-  video_descriptor.set_num_encoded_videos(1);
-  video_descriptor.add_frames_per_video(frame);
-  video_descriptor.add_keyframes_per_video(keyframe_indices.size());
-  video_descriptor.add_size_per_video(index_creator.bytestream_pos());
-  video_descriptor.set_metadata_packets(metadata_bytes.data(),
-                                        metadata_bytes.size());
-
-  for (u64 v : sample_offsets) {
-    video_descriptor.add_sample_offsets(v);
-  }
-  for (u64 v : sample_sizes) {
-    video_descriptor.add_sample_sizes(v);
-  }
-  for (u64 v : keyframe_indices) {
-    video_descriptor.add_keyframe_indices(v);
-  }
+  set_video_index(index, video_descriptor);
 
   // Save our metadata for the frame column
   write_video_metadata(storage, video_meta);
@@ -587,6 +979,278 @@ bool parse_and_write_video(storehouse::StorageBackend* storage,
   return succeeded;
 }
 
+std::string av_error_string(i32 err) {
+  char err_msg[256];
+  av_strerror(err, err_msg, 256);
+  return std::string(err_msg);
+}
+
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 25, 0)
+// Passes the pictures the decoder has ready to fn in display order. Stops and
+// returns false if fn does, leaving fn to set the error.
+bool receive_pictures(CodecState& state,
+                      const std::function<bool(AVFrame*)>& fn,
+                      std::string& error_message) {
+  while (true) {
+    i32 err = avcodec_receive_frame(state.in_cc, state.picture);
+    if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+      return true;
+    } else if (err < 0) {
+      error_message = "Error while receiving frame: " + av_error_string(err);
+      return false;
+    }
+    bool keep_going = fn(state.picture);
+    av_frame_unref(state.picture);
+    if (!keep_going) {
+      return false;
+    }
+  }
+}
+#endif
+
+// Decodes the video stream and passes each picture to fn in display order
+bool decode_video(CodecState& state, const std::function<bool(AVFrame*)>& fn,
+                  std::string& error_message) {
+  auto decode_packet = [&](AVPacket* packet) {
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(57, 25, 0)
+    i32 err = avcodec_send_packet(state.in_cc, packet);
+    if (err < 0 && err != AVERROR_EOF) {
+      error_message = "Error while sending packet: " + av_error_string(err);
+      return false;
+    }
+    return receive_pictures(state, fn, error_message);
+#else
+    AVPacket empty_packet;
+    if (packet == NULL) {
+      av_init_packet(&empty_packet);
+      empty_packet.data = NULL;
+      empty_packet.size = 0;
+      packet = &empty_packet;
+    }
+    i32 got_picture = 1;
+    while (got_picture) {
+      i32 consumed = avcodec_decode_video2(state.in_cc, state.picture,
+                                           &got_picture, packet);
+      if (consumed < 0) {
+        error_message =
+            "Error while decoding frame: " + av_error_string(consumed);
+        return false;
+      }
+      if (got_picture && !fn(state.picture)) {
+        return false;
+      }
+      // Only an empty (flush) packet can hold more than one picture
+      if (packet->size > 0) {
+        break;
+      }
+    }
+    return true;
+#endif
+  };
+
+  while (true) {
+    i32 err = av_read_frame(state.format_context, &state.av_packet);
+    if (err == AVERROR_EOF) {
+      av_packet_unref(&state.av_packet);
+      break;
+    } else if (err != 0) {
+      error_message = "Error while reading packet: " + av_error_string(err);
+      return false;
+    }
+    if (state.av_packet.stream_index != state.video_stream_index) {
+      av_packet_unref(&state.av_packet);
+      continue;
+    }
+    bool decoded = decode_packet(&state.av_packet);
+    av_packet_unref(&state.av_packet);
+    if (!decoded) {
+      return false;
+    }
+  }
+  // Drain the pictures still held by the decoder
+  return decode_packet(NULL);
+}
+
+// A downscaled copy of a video being encoded at ingest
+struct ProxyStream {
+  i32 scale;
+  i32 column_id;
+  i32 width;
+  i32 height;
+  SwsContext* sws_context = nullptr;
+  std::vector<u8> frame;  // RGB24 picture at the proxy size
+  std::unique_ptr<VideoEncoder> encoder;
+  std::unique_ptr<WriteFile> bytestream;
+  std::unique_ptr<H264ByteStreamIndexCreator> index_creator;
+};
+
+// Moves the packets the proxy's encoder has ready into its bytestream
+bool write_proxy_packets(ProxyStream& proxy, bool packets_ready,
+                         std::vector<u8>& buffer,
+                         std::string& error_message) {
+  while (packets_ready) {
+    size_t packet_size;
+    packets_ready =
+        proxy.encoder->get_packet(buffer.data(), buffer.size(), packet_size);
+    if (packet_size > buffer.size()) {
+      // The packet was left in the encoder, so retry with a larger buffer
+      buffer.resize(packet_size);
+      packets_ready = true;
+      continue;
+    }
+    if (packet_size == 0) {
+      break;
+    }
+    if (!proxy.index_creator->feed_packet(buffer.data(), packet_size)) {
+      error_message = proxy.index_creator->error_message();
+      return false;
+    }
+  }
+  return true;
+}
+
+// Encodes copies of the table's video downscaled by each of the scales as
+// H.264 and adds them to the table as proxy columns of the frame column.
+// Pictures are decoded once and scaled to every proxy size.
+bool write_video_proxies(storehouse::StorageBackend* storage, i32 table_id,
+                         const std::string& path,
+                         const std::vector<i32>& proxy_scales,
+                         i32 decode_threads, std::string& error_message) {
+  TableMetadata table_meta =
+      read_table_metadata(storage, TableMetadata::descriptor_path(table_id));
+  proto::TableDescriptor table_desc = table_meta.get_descriptor();
+  const i32 frame_column_id = table_meta.column_id(frame_column_name());
+  const i64 num_frames = table_meta.num_rows();
+
+  FFStorehouseState file_state{};
+  if (!open_video_file(storage, path, file_state, error_message)) {
+    return false;
+  }
+  CodecState state;
+  if (!setup_video_codec(&file_state, state, decode_threads)) {
+    error_message = "Failed to set up video codec";
+    return false;
+  }
+  const i32 width = state.in_cc->width;
+  const i32 height = state.in_cc->height;
+
+  std::vector<ProxyStream> proxies(proxy_scales.size());
+  for (size_t i = 0; i < proxy_scales.size(); ++i) {
+    ProxyStream& proxy = proxies[i];
+    proxy.scale = proxy_scales[i];
+    proxy.column_id = table_desc.columns_size() + i;
+    // Chroma is subsampled by two in both directions
+    proxy.width = std::max(2, width / proxy.scale / 2 * 2);
+    proxy.height = std::max(2, height / proxy.scale / 2 * 2);
+    proxy.frame.resize(proxy.width * proxy.height * 3);
+
+    proxy.encoder.reset(VideoEncoder::make_from_config(
+        CPU_DEVICE, 1, VideoEncoderType::SOFTWARE));
+    proxy.encoder->configure(
+        FrameInfo(proxy.height, proxy.width, 3, FrameType::U8),
+        EncodeOptions());
+
+    std::string data_path =
+        table_item_output_path(table_id, proxy.column_id, 0);
+    BACKOFF_FAIL(make_unique_write_file(storage, data_path, proxy.bytestream),
+                 "while trying to make write file for " + data_path);
+    proxy.index_creator.reset(
+        new H264ByteStreamIndexCreator(proxy.bytestream.get()));
+  }
+
+  std::vector<u8> packet_buffer(PROXY_PACKET_BUFFER_BYTES);
+  auto encode_picture = [&](AVFrame* picture) {
+    for (ProxyStream& proxy : proxies) {
+      proxy.sws_context = sws_getCachedContext(
+          proxy.sws_context, picture->width, picture->height,
+          (AVPixelFormat)picture->format, proxy.width, proxy.height,
+          AV_PIX_FMT_RGB24, SWS_AREA, NULL, NULL, NULL);
+      if (proxy.sws_context == NULL) {
+        error_message = "Could not get proxy scaling context";
+        return false;
+      }
+      u8* out_slices[4];
+      i32 out_linesizes[4];
+      av_image_fill_arrays(out_slices, out_linesizes, proxy.frame.data(),
+                           AV_PIX_FMT_RGB24, proxy.width, proxy.height, 1);
+      sws_scale(proxy.sws_context, picture->data, picture->linesize, 0,
+                picture->height, out_slices, out_linesizes);
+      bool packets_ready =
+          proxy.encoder->feed(proxy.frame.data(), proxy.frame.size());
+      if (!write_proxy_packets(proxy, packets_ready, packet_buffer,
+                               error_message)) {
+        return false;
+      }
+    }
+    return true;
+  };
+  bool succeeded = decode_video(state, encode_picture, error_message);
+
+  for (ProxyStream& proxy : proxies) {
+    if (succeeded) {
+      succeeded = write_proxy_packets(proxy, proxy.encoder->flush(),
+                                      packet_buffer, error_message);
+    }
+    sws_freeContext(proxy.sws_context);
+  }
+  i32 time_base_num = state.in_cc->time_base.num;
+  i32 time_base_denom = state.in_cc->time_base.den;
+  cleanup_video_codec(state);
+  if (!succeeded) {
+    return false;
+  }
+
+  for (ProxyStream& proxy : proxies) {
+    proxy.index_creator->finish();
+    if (proxy.index_creator->frames() != num_frames) {
+      error_message = "Proxy has " +
+                      std::to_string(proxy.index_creator->frames()) +
+                      " frames but the video has " +
+                      std::to_string(num_frames);
+      return false;
+    }
+    DemuxedVideoIndex index;
+    index.append(*proxy.index_creator);
+    BACKOFF_FAIL(proxy.bytestream->save(),
+                 "while trying to save " + proxy.bytestream->path());
+
+    VideoMetadata video_meta;
+    proto::VideoDescriptor& video_descriptor = video_meta.get_descriptor();
+    video_descriptor.set_table_id(table_id);
+    video_descriptor.set_column_id(proxy.column_id);
+    video_descriptor.set_item_id(0);
+    video_descriptor.set_width(proxy.width);
+    video_descriptor.set_height(proxy.height);
+    video_descriptor.set_channels(3);
+    video_descriptor.set_frame_type(FrameType::U8);
+    video_descriptor.set_chroma_format(proto::VideoDescriptor::YUV_420);
+    video_descriptor.set_codec_type(proto::VideoDescriptor::H264);
+    video_descriptor.set_data_path(proxy.bytestream->path());
+    video_descriptor.set_inplace(false);
+    video_descriptor.set_time_base_num(time_base_num);
+    video_descriptor.set_time_base_denom(time_base_denom);
+    set_video_index(index, video_descriptor);
+    write_video_metadata(storage, video_meta);
+
+    Column* col = table_desc.add_columns();
+    col->set_name(proxy_column_name(proxy.scale));
+    col->set_id(proxy.column_id);
+    col->set_type(ColumnType::Video);
+
+    auto video_proxy = table_desc.add_video_proxies();
+    video_proxy->set_column_id(proxy.column_id);
+    video_proxy->set_source_column_id(frame_column_id);
+    video_proxy->set_width(proxy.width);
+    video_proxy->set_height(proxy.height);
+    video_proxy->set_source_width(width);
+    video_proxy->set_source_height(height);
+  }
+
+  // The proxies only become visible once all of them have been written
+  write_table_metadata(storage, TableMetadata(table_desc));
+  return true;
+}
+
 // void ingest_images(storehouse::StorageBackend* storage,
 //                    const std::string& table_name,
 //                    std::vector<std::string>& image_paths) {
@@ -902,48 +1566,63 @@ bool parse_and_write_video(storehouse::StorageBackend* storage,
 // }
 }  // end anonymous namespace
 
-Result ingest_videos(storehouse::StorageConfig* storage_config,
-                     const std::string& db_path,
+Result ingest_videos(storehouse::StorageBackend* storage,
+                     MetadataLog& metadata_log, DatabaseMetadata& meta,
+                     std::mutex& meta_mutex,
                      const std::vector<std::string>& table_names,
                      const std::vector<std::string>& paths,
-                     bool inplace,
-                     std::vector<FailedVideo>& failed_videos) {
+                     bool inplace, const std::vector<i32>& proxy_scales,
+                     std::vector<FailedVideo>& failed_videos,
+                     const IngestIndexOptions& index_options) {
   Result result;
   result.set_success(true);
 
-  internal::set_database_path(db_path);
-  av_register_all();
-
-  std::unique_ptr<storehouse::StorageBackend> storage{
-      storehouse::StorageBackend::make_from_config(storage_config)};
+  for (i32 scale : proxy_scales) {
+    if (scale < 2) {
+      RESULT_ERROR(&result, "Proxy scale %d must be at least 2.", scale);
+      return result;
+    }
+  }
+  std::set<i32> unique_scales(proxy_scales.begin(), proxy_scales.end());
+  const std::vector<i32> scales(unique_scales.begin(), unique_scales.end());
 
-  internal::DatabaseMetadata meta = internal::read_database_metadata(
-      storage.get(), internal::DatabaseMetadata::descriptor_path());
+  av_register_all();
 
   std::vector<i32> table_ids;
-  std::set<std::string> inserted_table_names;
-  for (size_t i = 0; i < table_names.size(); ++i) {
-    if (inserted_table_names.count(table_names[i]) > 0) {
-      RESULT_ERROR(&result, "Duplicate table name %s in ingest video set.",
-                   table_names[i].c_str());
-      break;
+  {
+    std::unique_lock<std::mutex> lock(meta_mutex);
+    std::set<std::string> inserted_table_names;
+    for (size_t i = 0; i < table_names.size(); ++i) {
+      if (inserted_table_names.count(table_names[i]) > 0) {
+        RESULT_ERROR(&result, "Duplicate table name %s in ingest video set.",
+                     table_names[i].c_str());
+        break;
+      }
+      i32 table_id = meta.add_table(table_names[i]);
+      if (table_id == -1) {
+        RESULT_ERROR(&result, "Table name %s already exists in databse.",
+                     table_names[i].c_str());
+        break;
+      }
+      table_ids.push_back(table_id);
+      inserted_table_names.insert(table_names[i]);
     }
-    i32 table_id = meta.add_table(table_names[i]);
-    if (table_id == -1) {
-      RESULT_ERROR(&result, "Table name %s already exists in databse.",
-                   table_names[i].c_str());
-      break;
+    if (!result.success()) {
+      // Drop the tables added before the failure
+      for (i32 table_id : table_ids) {
+        meta.remove_table(table_id);
+      }
+      return result;
     }
-    table_ids.push_back(table_id);
-    inserted_table_names.insert(table_names[i]);
-  }
-  if (!result.success()) {
-    return result;
   }
   std::vector<bool> bad_videos(table_names.size(), false);
   std::vector<std::string> bad_messages(table_names.size());
   std::vector<std::thread> ingest_threads;
   i32 num_threads = std::thread::hardware_concurrency();
+  // Threads left over when there are fewer videos than threads index the
+  // chunks of large videos in parallel
+  i32 index_threads =
+      std::max(1, num_threads / std::max(1, (i32)table_names.size()));
   i32 videos_allocated = 0;
   for (i32 t = 0; t < num_threads; ++t) {
     i32 to_allocate =
@@ -958,7 +1637,7 @@ Result ingest_videos(storehouse::StorageConfig* storage_config,
         bool inplace_succeeded = false;
         if (inplace) {
           std::string inplace_error_string;
-          if (internal::parse_video_inplace(storage.get(), table_names[i],
+          if (internal::parse_video_inplace(storage, table_names[i],
                                             table_ids[i], paths[i],
                                             inplace_error_string)) {
             inplace_succeeded = true;
@@ -971,13 +1650,24 @@ Result ingest_videos(storehouse::StorageConfig* storage_config,
         }
         // If inplace failed or not specified, copy
         if (!inplace_succeeded) {
-          if (!internal::parse_and_write_video(storage.get(), table_names[i],
+          if (!internal::parse_and_write_video(storage, table_names[i],
                                                table_ids[i], paths[i],
+                                               index_threads, index_options,
                                                bad_messages[i])) {
             // Did not ingest correctly, skip it
             bad_videos[i] = true;
           }
         }
+        // Proxies only speed up later jobs, so the video is kept without
+        // them if they can not be written
+        std::string proxy_error_string;
+        if (!bad_videos[i] && !scales.empty() &&
+            !internal::write_video_proxies(storage, table_ids[i],
+                                           paths[i], scales, index_threads,
+                                           proxy_error_string)) {
+          LOG(WARNING) << "Failed to write proxies of " << paths[i] << ": "
+                       << proxy_error_string;
+        }
       }
     });
   }
@@ -985,6 +1675,7 @@ Result ingest_videos(storehouse::StorageConfig* storage_config,
     ingest_threads[t].join();
   }
 
+  std::unique_lock<std::mutex> lock(meta_mutex);
   size_t num_bad_videos = 0;
   for (size_t i = 0; i < table_names.size(); ++i) {
     if (bad_videos[i]) {
@@ -1000,10 +1691,8 @@ Result ingest_videos(storehouse::StorageConfig* storage_config,
     RESULT_ERROR(&result, "All videos failed to ingest properly");
   }
 
-  if (result.success()) {
-    // Save the db metadata
-    internal::write_database_metadata(storage.get(), meta);
-  }
+  // Log the new tables, along with the removal of the ones which failed
+  metadata_log.append(meta, {});
   return result;
 }
 
@@ -16,6 +16,7 @@
 #pragma once
 
 #include "scanner/api/database.h"
+#include "scanner/engine/metadata_log.h"
 #include "scanner/util/common.h"
 
 #include "storehouse/storage_backend.h"
@@ -26,12 +27,31 @@
 namespace scanner {
 namespace internal {
 
-Result ingest_videos(storehouse::StorageConfig* storage_config,
-                     const std::string& db_path,
+// Videos at least this large are indexed on several threads by default
+static const i64 DEFAULT_PARALLEL_INGEST_MIN_BYTES = 256 * 1024 * 1024;
+// Default bytes of packets after which a chunk of a video indexed in parallel
+// ends at the next IDR frame
+static const i64 DEFAULT_INGEST_CHUNK_BYTES = 16 * 1024 * 1024;
+
+// Tuning of how ingest indexes the bytestreams of videos
+struct IngestIndexOptions {
+  i64 parallel_min_bytes = DEFAULT_PARALLEL_INGEST_MIN_BYTES;
+  i64 chunk_bytes = DEFAULT_INGEST_CHUNK_BYTES;
+};
+
+// Ingests the videos at paths into new tables, recording them in meta and
+// metadata_log. meta_mutex guards meta and is only held while the tables are
+// added and committed. Only the master ingests, through its own metadata log,
+// so that log entries are never appended by two writers.
+Result ingest_videos(storehouse::StorageBackend* storage,
+                     MetadataLog& metadata_log, DatabaseMetadata& meta,
+                     std::mutex& meta_mutex,
                      const std::vector<std::string>& table_names,
                      const std::vector<std::string>& paths,
-                     bool inplace,
-                     std::vector<FailedVideo>& failed_videos);
+                     bool inplace, const std::vector<i32>& proxy_scales,
+                     std::vector<FailedVideo>& failed_videos,
+                     const IngestIndexOptions& index_options =
+                         IngestIndexOptions());
 
 // void ingest_images(storehouse::StorageConfig *storage_config,
 //                    const std::string &db_path, const std::string &table_name,
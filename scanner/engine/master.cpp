@@ -25,9 +25,12 @@
 #include "scanner/engine/source_registry.h"
 #include "scanner/engine/sink_registry.h"
 #include "scanner/engine/enumerator_registry.h"
+#include "scanner/engine/op_registry.h"
 #include "scanner/util/thread_pool.h"
 
 #include <grpc/support/log.h>
+#include <sys/stat.h>
+#include <algorithm>
 #include <set>
 #include <mutex>
 #include <pybind11/embed.h>
@@ -47,6 +50,23 @@ static const u32 POKE_WATCHDOG_WORKER_TIMEOUT = 5;
 static const u32 PING_WORKER_TIMEOUT = 5;
 static const u32 NEW_JOB_WORKER_TIMEOUT = 30;
 
+namespace {
+
+// Version of the ops registered by a library, made of its path, size and
+// modification time so that rebuilding the library changes it
+std::string library_version(const std::string& path) {
+  struct stat st;
+  std::string version = path;
+  if (stat(path.c_str(), &st) == 0) {
+    version += "@" + std::to_string(st.st_size) + "@" +
+               std::to_string(st.st_mtim.tv_sec) + "." +
+               std::to_string(st.st_mtim.tv_nsec);
+  }
+  return version;
+}
+
+}
+
 MasterServerImpl::MasterServerImpl(DatabaseParameters& params, const std::string& port)
     : watchdog_awake_(true), db_params_(params), port_(port) {
   VLOG(1) << "Creating master...";
@@ -67,6 +87,16 @@ MasterServerImpl::MasterServerImpl(DatabaseParameters& params, const std::string
   // Perform database consistency checks on startup
   recover_and_init_database();
 
+  // Ops compiled into the scanner library itself are versioned by its build
+  Dl_info info;
+  if (dladdr((void*)&get_op_registry, &info) != 0 &&
+      info.dli_fname != nullptr) {
+    std::string version = library_version(info.dli_fname);
+    for (auto& name : get_op_registry()->op_names()) {
+      kernel_versions_[name] = version;
+    }
+  }
+
   start_job_processor();
   VLOG(1) << "Master created.";
 }
@@ -245,7 +275,7 @@ void MasterServerImpl::GetTablesHandler(
   for (const auto& table_name : params->tables()) {
     table_names.push_back(table_name);
   }
-  // table_metas_->prefetch(table_names);
+  table_metas_->prefetch(table_names);
 
   VLOG(1) << "Creating output";
   for (const auto& table_name : params->tables()) {
@@ -283,7 +313,7 @@ void MasterServerImpl::DeleteTablesHandler(
 
   // TODO(apoms): delete the actual table data
 
-  write_database_metadata(storage_, meta_);
+  write_metadata_log();
 
   REQUEST_RPC(DeleteTables, proto::DeleteTablesParams, proto::Empty);
   call->Respond(grpc::Status::OK);
@@ -298,35 +328,44 @@ void MasterServerImpl::NewTableHandler(
   const auto& columns = params->columns();
   const auto& rows = params->rows();
 
-  i32 table_id = meta_.add_table(table_name);
-  LOG_IF(FATAL, table_id == -1) << "failed to add table";
+  i32 table_id;
+  i32 item_id = 0;
   proto::TableDescriptor table_desc;
-  table_desc.set_id(table_id);
-  table_desc.set_name(table_name);
-  table_desc.set_timestamp(
-      std::chrono::duration_cast<std::chrono::seconds>(now().time_since_epoch())
-          .count());
-  for (size_t i = 0; i < columns.size(); ++i) {
-    proto::Column* col = table_desc.add_columns();
-    col->set_id(i);
-    col->set_name(columns[i]);
-    col->set_type(proto::ColumnType::Other);
-  }
-
-  table_desc.add_end_rows(rows.size());
-  table_desc.set_job_id(-1);
-  meta_.commit_table(table_id);
+  if (params->append() && meta_.has_table(table_name)) {
+    // New rows are written as a new item of the existing table
+    table_id = meta_.get_table_id(table_name);
+    table_desc = table_metas_->at(table_id).get_descriptor();
+    LOG_IF(FATAL, table_desc.columns_size() != columns.size())
+        << "Appended rows must have the same columns as table " << table_name;
+    item_id = table_desc.end_rows_size();
+    i64 prev_rows = item_id > 0 ? table_desc.end_rows(item_id - 1) : 0;
+    table_desc.add_end_rows(prev_rows + rows.size());
+  } else {
+    table_id = meta_.add_table(table_name);
+    LOG_IF(FATAL, table_id == -1) << "failed to add table";
+    table_desc.set_id(table_id);
+    table_desc.set_name(table_name);
+    table_desc.set_timestamp(std::chrono::duration_cast<std::chrono::seconds>(
+                                 now().time_since_epoch())
+                                 .count());
+    for (size_t i = 0; i < columns.size(); ++i) {
+      proto::Column* col = table_desc.add_columns();
+      col->set_id(i);
+      col->set_name(columns[i]);
+      col->set_type(proto::ColumnType::Other);
+    }
 
-  write_table_metadata(storage_, TableMetadata(table_desc));
-  write_database_metadata(storage_, meta_);
+    table_desc.add_end_rows(rows.size());
+    table_desc.set_job_id(-1);
+  }
 
   LOG_IF(FATAL, rows[0].columns().size() != columns.size()) << "Row 0 doesn't have # entries == # columns";
   for (size_t j = 0; j < columns.size(); ++j) {
     const std::string output_path =
-        table_item_output_path(table_id, j, 0);
+        table_item_output_path(table_id, j, item_id);
 
     const std::string output_metadata_path =
-        table_item_metadata_path(table_id, j, 0);
+        table_item_metadata_path(table_id, j, item_id);
 
     std::unique_ptr<storehouse::WriteFile> output_file;
     storehouse::make_unique_write_file(storage_, output_path,
@@ -355,6 +394,11 @@ void MasterServerImpl::NewTableHandler(
                  "while trying to save " + output_metadata_file->path());
   }
 
+  // Only make the rows visible once they have been written
+  meta_.commit_table(table_id);
+  table_metas_->update(TableMetadata(table_desc));
+  write_metadata_log();
+
   REQUEST_RPC(NewTable, proto::NewTableParams, proto::Empty);
   call->Respond(grpc::Status::OK);
 }
@@ -417,22 +461,30 @@ void MasterServerImpl::IngestVideosHandler(
   auto params = &call->request;
   auto result = &call->reply;
   std::vector<FailedVideo> failed_videos;
+  IngestIndexOptions index_options;
+  if (params->parallel_index_min_bytes() > 0) {
+    index_options.parallel_min_bytes = params->parallel_index_min_bytes();
+  }
+  if (params->index_chunk_bytes() > 0) {
+    index_options.chunk_bytes = params->index_chunk_bytes();
+  }
+  // Ingest records the new tables through the master's metadata log, so log
+  // entries are only ever appended by one writer
   result->mutable_result()->CopyFrom(
-      ingest_videos(db_params_.storage_config, db_params_.db_path,
+      ingest_videos(storage_, *metadata_log_.get(), meta_, work_mutex_,
                     std::vector<std::string>(params->table_names().begin(),
                                              params->table_names().end()),
                     std::vector<std::string>(params->video_paths().begin(),
                                              params->video_paths().end()),
-                    params->inplace(), failed_videos));
+                    params->inplace(),
+                    std::vector<i32>(params->proxy_scales().begin(),
+                                     params->proxy_scales().end()),
+                    failed_videos, index_options));
   for (auto& failed : failed_videos) {
     result->add_failed_paths(failed.path);
     result->add_failed_messages(failed.message);
   }
 
-  // HACK(apoms): instead of doing this, we should just add tables to db and
-  //              table cache.
-  recover_and_init_database();
-
   REQUEST_RPC(IngestVideos, proto::IngestParameters, proto::IngestResult);
   call->Respond(grpc::Status::OK);
 }
@@ -708,6 +760,8 @@ void MasterServerImpl::LoadOpHandler(MCall<proto::OpPath, Result>* call) {
     }
   }
 
+  OpRegistry* op_registry = get_op_registry();
+  std::vector<std::string> previous_ops = op_registry->op_names();
   void* handle = dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
   if (handle == nullptr) {
     RESULT_ERROR(result, "Failed to load op library: %s", dlerror());
@@ -716,6 +770,17 @@ void MasterServerImpl::LoadOpHandler(MCall<proto::OpPath, Result>* call) {
     return;
   }
   so_paths_.push_back(so_path);
+  {
+    // Ops registered by this library are versioned by the library's build,
+    // so rebuilding it invalidates their cached outputs
+    std::string version = library_version(so_path);
+    for (auto& name : op_registry->op_names()) {
+      if (std::find(previous_ops.begin(), previous_ops.end(), name) ==
+          previous_ops.end()) {
+        kernel_versions_[name] = version;
+      }
+    }
+  }
 
   ThreadPool pool(GRPC_THREADS);
   auto send_message = [&](auto& k) {
@@ -896,6 +961,8 @@ void MasterServerImpl::RegisterPythonKernelHandler(
     // Register the kernel
     KernelRegistry* registry = get_kernel_registry();
     registry->add_kernel(op_name, factory);
+
+    kernel_versions_[op_name] = kernel_code + pickled_config;
   }
 
   ThreadPool pool(GRPC_THREADS);
@@ -987,6 +1054,8 @@ void MasterServerImpl::GetJobStatusHandler(
     }
     reply->set_num_workers(num_workers);
     reply->set_failed_workers(state->num_failed_workers);
+    reply->set_result_cache_hits(state->result_cache_stats.hits);
+    reply->set_result_cache_misses(state->result_cache_stats.misses);
 
     REQUEST_RPC(GetJobStatus, proto::GetJobStatusRequest,
                 proto::GetJobStatusReply);
@@ -1028,19 +1097,77 @@ void MasterServerImpl::NextWorkHandler(
 
     auto& state = bulk_jobs_state_.at(bulk_job_id);
 
-    // If we do not have any outstanding work, try and create more
-    if (state->unallocated_job_tasks.empty()) {
-      // If we have no more samples for this task, try and get another task
-      if (state->next_task == state->num_tasks) {
-        // Check if there are any tasks left
-        if (state->next_job < state->num_jobs && state->task_result.success()) {
-          state->next_task = 0;
-          state->num_tasks = state->job_tasks.at(state->next_job).size();
-          state->next_job++;
-          VLOG(1) << "Tasks left: "
-                  << state->total_tasks - state->total_tasks_used;
+    // If we have no more samples for this task, try and get another task.
+    // Jobs without tasks left to hand out (e.g. incremental jobs without new
+    // rows) are skipped.
+    auto advance_job = [&state]() {
+      while (state->next_task == state->num_tasks &&
+             state->next_job < state->num_jobs &&
+             state->task_result.success()) {
+        state->next_task = state->first_task_per_job.at(state->next_job);
+        state->num_tasks = state->job_tasks.at(state->next_job).size();
+        state->task_chain_length = 0;
+        state->next_job++;
+        VLOG(1) << "Tasks left: "
+                << state->total_tasks - state->total_tasks_used;
+      }
+    };
+
+    // With task affinity, each worker is handed a chain of consecutive tasks
+    // of a job so that it can carry kernel state from one task to the next
+    if (state->job_params.task_affinity() &&
+        state->unallocated_job_tasks.empty()) {
+      auto& chain = state->worker_task_chains[worker_id];
+      if (chain.empty()) {
+        advance_job();
+        if (state->next_task < state->num_tasks) {
+          // Split the job evenly among the workers active when its first
+          // chain is handed out. The split is fixed for the job, since
+          // splitting the remaining tasks again on every request would
+          // shrink each chain after the first.
+          if (state->task_chain_length == 0) {
+            i64 active_workers = 0;
+            for (auto& kv : workers_) {
+              active_workers += kv.second->active ? 1 : 0;
+            }
+            active_workers = std::max(active_workers, (i64)1);
+            i64 job_tasks = state->num_tasks - state->next_task;
+            state->task_chain_length =
+                (job_tasks + active_workers - 1) / active_workers;
+          }
+          i64 chain_length = std::min(state->task_chain_length,
+                                      state->num_tasks - state->next_task);
+          for (i64 i = 0; i < chain_length; ++i) {
+            chain.push_back(
+                std::make_tuple(state->next_job - 1, state->next_task));
+            state->next_task++;
+          }
+          advance_job();
+        } else {
+          // Take the last task of the longest chain, which only breaks the
+          // chain at its end
+          std::deque<std::tuple<i64, i64>>* longest = nullptr;
+          for (auto& kv : state->worker_task_chains) {
+            if (!kv.second.empty() &&
+                (longest == nullptr || kv.second.size() > longest->size())) {
+              longest = &kv.second;
+            }
+          }
+          if (longest != nullptr) {
+            chain.push_back(longest->back());
+            longest->pop_back();
+          }
         }
       }
+      if (!chain.empty()) {
+        state->unallocated_job_tasks.push_back(chain.front());
+        chain.pop_front();
+      }
+    }
+
+    // If we do not have any outstanding work, try and create more
+    if (state->unallocated_job_tasks.empty()) {
+      advance_job();
 
       // Create more work if possible
       if (state->next_task < state->num_tasks) {
@@ -1050,6 +1177,7 @@ void MasterServerImpl::NextWorkHandler(
         state->unallocated_job_tasks.push_front(
             std::make_tuple(current_job, current_task));
         state->next_task++;
+        advance_job();
       }
     }
 
@@ -1167,16 +1295,23 @@ void MasterServerImpl::FinishedWorkHandler(
       state->tasks_used_per_job[job_id]++;
 
       if (state->tasks_used_per_job[job_id] ==
-          state->job_tasks[job_id].size()) {
+          state->job_tasks[job_id].size() -
+              state->first_task_per_job[job_id]) {
         if (state->dag_info.is_table_output) {
           i32 tid = state->job_uncommitted_tables[job_id];
-          meta_.commit_table(tid);
+          auto it = state->job_incremental_tables.find(job_id);
+          if (it != state->job_incremental_tables.end()) {
+            // Expose the appended items now that they have all been written
+            table_metas_->update(TableMetadata(it->second));
+          } else {
+            meta_.commit_table(tid);
+          }
         }
 
         // Commit database metadata every so often
         if (job_id % state->job_params.checkpoint_frequency() == 0) {
           VLOG(1) << "Saving database metadata checkpoint";
-          write_database_metadata(storage_, meta_);
+          write_metadata_log();
         }
       }
     }
@@ -1410,18 +1545,29 @@ void MasterServerImpl::recover_and_init_database() {
 
   VLOG(1) << "Reading database metadata";
   // TODO(apoms): handle uncommitted database tables
-  meta_ = read_database_metadata(storage_, DatabaseMetadata::descriptor_path());
+  metadata_log_.reset(new MetadataLog(storage_));
+  meta_ = metadata_log_->recover();
 
   VLOG(1) << "Setting up table metadata cache";
   // Setup table metadata cache
   table_metas_.reset(new TableMetaCache(storage_, meta_));
 
-  // VLOG(1) << "Writing database metadata";
-  // write_database_metadata(storage_, meta_);
+  result_cache_.reset(new ResultCache(storage_));
+
+  if (metadata_log_->should_compact(meta_)) {
+    metadata_log_->compact(meta_, *table_metas_.get());
+  }
 
   VLOG(1) << "Database initialized.";
 }
 
+void MasterServerImpl::write_metadata_log(bool allow_compaction) {
+  metadata_log_->append(meta_, table_metas_->take_pending_updates());
+  if (allow_compaction && metadata_log_->should_compact(meta_)) {
+    metadata_log_->compact(meta_, *table_metas_.get());
+  }
+}
+
 void MasterServerImpl::start_job_processor() {
   VLOG(1) << "Starting job processor";
   job_processor_thread_ = std::thread([this]() {
@@ -1528,6 +1674,94 @@ bool MasterServerImpl::process_job(const proto::BulkJobParameters* job_params,
     return false;
   }
 
+  // Record how each output table was produced so that it can be extended
+  // incrementally later. Jobs whose output table already exists only
+  // process the rows added to their sources since.
+  std::vector<std::string> job_signatures;
+  std::vector<std::vector<proto::TableDescriptor::SourceVersion>>
+      job_sources;
+  std::map<i64, i32> incremental_tables;
+  for (const auto& job : jobs) {
+    job_signatures.push_back(job_pipeline_signature(job, ops, *job_params));
+    job_sources.push_back(
+        job_source_versions(meta_, *table_metas_.get(), job, ops));
+  }
+  if (job_params->incremental() && dag_info.is_table_output) {
+    *job_result = validate_incremental_ops(ops);
+    for (size_t i = 0; i < jobs.size() && job_result->success(); ++i) {
+      const std::string& table_name = jobs[i].output_table_name();
+      if (!meta_.has_table(table_name)) {
+        continue;
+      }
+      i32 table_id = meta_.get_table_id(table_name);
+      if (!meta_.table_is_committed(table_id)) {
+        RESULT_ERROR(job_result, "Output table %s is not committed.",
+                     table_name.c_str());
+        break;
+      }
+      *job_result = validate_incremental_table(table_metas_->at(table_id),
+                                               job_signatures[i],
+                                               job_sources[i]);
+      incremental_tables[i] = table_id;
+    }
+    if (!job_result->success()) {
+      finished_fn();
+      return false;
+    }
+  }
+
+  // Frames which are only resized are decoded from a smaller proxy of the
+  // video when the table has one. This happens before the result cache keys
+  // are computed since the proxy frames differ from the original ones.
+  if (!job_params->disable_video_proxies()) {
+    i64 num_proxies = select_video_proxies(meta_, *table_metas_.get(), ops,
+                                           dag_info, jobs);
+    if (num_proxies > 0) {
+      VLOG(1) << "Decoding " << num_proxies << " video inputs from proxies";
+      job_params_.mutable_jobs()->Clear();
+      for (auto& job : jobs) {
+        job_params_.add_jobs()->CopyFrom(job);
+      }
+      state->job_params.CopyFrom(job_params_);
+    }
+  }
+
+  // Keys of the op outputs in the DAG as submitted, used to record the
+  // outputs of this job in the result cache once it commits
+  std::vector<OpOutputKeys> job_output_keys;
+  const proto::Op original_sink = ops.back();
+  if (!job_params->disable_result_cache()) {
+    VLOG(1) << "Looking up materialized op outputs";
+    for (const auto& job : jobs) {
+      job_output_keys.push_back(compute_op_output_keys(
+          meta_, *table_metas_.get(), job, ops, kernel_versions_));
+    }
+    state->result_cache_stats = result_cache_->rewrite(
+        meta_, *table_metas_.get(), job_output_keys, ops, jobs);
+    VLOG(1) << "Result cache hits: " << state->result_cache_stats.hits
+            << ", misses: " << state->result_cache_stats.misses;
+    if (state->result_cache_stats.hits > 0) {
+      // Workers and the bulk job descriptor see the rewritten DAG
+      job_params_.mutable_ops()->Clear();
+      for (auto& op : ops) {
+        job_params_.add_ops()->CopyFrom(op);
+      }
+      job_params_.mutable_jobs()->Clear();
+      for (auto& job : jobs) {
+        job_params_.add_jobs()->CopyFrom(job);
+      }
+      state->job_params.CopyFrom(job_params_);
+
+      dag_info = DAGAnalysisInfo();
+      *job_result = validate_jobs_and_ops(meta_, *table_metas_.get(), jobs,
+                                          ops, dag_info);
+      if (!job_result->success()) {
+        finished_fn();
+        return false;
+      }
+    }
+  }
+
   // Map all source Ops into a single input collection
   const std::map<i64, i64>& input_op_idx_to_column_idx = dag_info.source_ops;
 
@@ -1651,11 +1885,31 @@ bool MasterServerImpl::process_job(const proto::BulkJobParameters* job_params,
     auto& slice_input_rows = state->slice_input_rows_per_job[i];
     i64 total_output_rows = state->total_output_rows_per_job[i];
 
+    // Incremental jobs skip the rows already in the output table. Tasks map
+    // to table items, so the existing items are kept as empty tasks.
+    i64 first_row = 0;
+    i64 first_task = 0;
+    if (incremental_tables.count(i) > 0) {
+      const TableMetadata& table =
+          table_metas_->at(incremental_tables.at(i));
+      first_row = table.num_rows();
+      first_task = table.end_rows().size();
+      if (first_row > total_output_rows) {
+        RESULT_ERROR(job_result,
+                     "Table %s has more rows (%ld) than the job produces "
+                     "(%ld).",
+                     table.name().c_str(), first_row, total_output_rows);
+        finished_fn();
+        return false;
+      }
+    }
+    state->first_task_per_job.push_back(first_task);
+
     std::vector<i64> partition_boundaries;
     if (slice_input_rows.size() == 0) {
       // No slices, so we can split as desired. Currently use IO packet size
       // since it is the smallest granularity we can specify
-      for (i64 r = 0; r < total_output_rows; r += io_packet_size) {
+      for (i64 r = first_row; r < total_output_rows; r += io_packet_size) {
         partition_boundaries.push_back(r);
       }
       partition_boundaries.push_back(total_output_rows);
@@ -1677,7 +1931,7 @@ bool MasterServerImpl::process_job(const proto::BulkJobParameters* job_params,
       }
     }
     assert(partition_boundaries.back() == total_output_rows);
-    state->job_tasks.emplace_back();
+    state->job_tasks.emplace_back(first_task);
     auto& tasks = state->job_tasks.back();
     for (i64 pi = 0; pi < partition_boundaries.size() - 1; ++pi) {
       tasks.emplace_back();
@@ -1692,6 +1946,12 @@ bool MasterServerImpl::process_job(const proto::BulkJobParameters* job_params,
     }
   }
   state->total_tasks = total_tasks_temp;
+  if (state->total_tasks == 0) {
+    // Nothing to do (e.g. no new rows for an incremental job), but workers
+    // are still started so that they see the job finish
+    std::unique_lock<std::mutex> lock(finished_mutex_);
+    finished_ = true;
+  }
 
   if (!job_result->success()) {
     // No database changes made at this point, so just return
@@ -1707,6 +1967,30 @@ bool MasterServerImpl::process_job(const proto::BulkJobParameters* job_params,
   if (dag_info.is_table_output) {
     for (i64 job_idx = 0; job_idx < job_params->jobs_size(); ++job_idx) {
       auto& job = job_params->jobs(job_idx);
+      if (incremental_tables.count(job_idx) > 0) {
+        // The table stays committed with its current items until all of the
+        // new items have been written
+        i32 table_id = incremental_tables.at(job_idx);
+        state->job_to_table_id[job_idx] = table_id;
+        proto::TableDescriptor table_desc =
+            table_metas_->at(table_id).get_descriptor();
+        i64 first_task = state->first_task_per_job.at(job_idx);
+        i64 total_rows = first_task > 0 ? table_desc.end_rows(first_task - 1)
+                                        : 0;
+        auto& tasks = state->job_tasks.at(job_idx);
+        for (i64 task_id = first_task; task_id < tasks.size(); ++task_id) {
+          total_rows += tasks.at(task_id).size();
+          table_desc.add_end_rows(total_rows);
+        }
+        table_desc.set_job_id(bulk_job_id);
+        table_desc.mutable_source_versions()->Clear();
+        for (auto& v : job_sources.at(job_idx)) {
+          table_desc.add_source_versions()->CopyFrom(v);
+        }
+        state->job_uncommitted_tables.push_back(table_id);
+        state->job_incremental_tables[job_idx] = table_desc;
+        continue;
+      }
       i32 table_id = meta_.add_table(job.output_table_name());
       state->job_to_table_id[job_idx] = table_id;
       proto::TableDescriptor table_desc;
@@ -1734,32 +2018,13 @@ bool MasterServerImpl::process_job(const proto::BulkJobParameters* job_params,
         table_desc.add_end_rows(r);
       }
       table_desc.set_job_id(bulk_job_id);
+      for (auto& v : job_sources.at(job_idx)) {
+        table_desc.add_source_versions()->CopyFrom(v);
+      }
+      table_desc.set_pipeline_signature(job_signatures.at(job_idx));
       state->job_uncommitted_tables.push_back(table_id);
       table_metas_->update(TableMetadata(table_desc));
     }
-    // Write table metadata
-    table_metas_->write_megafile();
-    // auto write_meta = [&](std::vector<i32> table_ids) {
-    //   for (i32 table_id : table_ids) {
-    //     write_table_metadata(storage_, table_metas_->at(table_id));
-    //   }
-    // };
-    // std::vector<std::thread> threads;
-    // i32 num_threads = std::thread::hardware_concurrency() * 4;
-    // i32 job_idx = 0;
-    // for (i64 tid = 0; tid < num_threads; ++tid) {
-    //   std::vector<i32> table_ids;
-    //   i32 jobs_to_compute =
-    //       (job_params->jobs_size() - job_idx) / (num_threads - tid);
-    //   for (i32 i = job_idx; i < job_idx + jobs_to_compute; ++i) {
-    //     table_ids.push_back(job_uncommitted_tables_[i]);
-    //   }
-    //   threads.emplace_back(write_meta, table_ids);
-    //   job_idx += jobs_to_compute;
-    // }
-    // for (i64 tid = 0; tid < num_threads; ++tid) {
-    //   threads[tid].join();
-    // }
   }
 
   // Setup initial task sampler
@@ -1769,7 +2034,9 @@ bool MasterServerImpl::process_job(const proto::BulkJobParameters* job_params,
   state->next_job = 0;
   state->num_jobs = jobs.size();
 
-  write_database_metadata(storage_, meta_);
+  // Only the new tables and bulk job entry are written here, instead of the
+  // full database descriptor and table megafile
+  write_metadata_log();
   job_params_.mutable_db_meta()->CopyFrom(meta_.get_descriptor());
 
   VLOG(1) << "Total jobs: " << state->num_jobs;
@@ -1924,8 +2191,22 @@ bool MasterServerImpl::process_job(const proto::BulkJobParameters* job_params,
   if (job_result->success()) {
     // Commit job since it was successful
     meta_.commit_bulk_job(bulk_job_id);
+
+    // Remember the committed output tables so later jobs can reuse them
+    if (dag_info.is_table_output && !job_output_keys.empty()) {
+      std::vector<proto::OutputColumnCompression> compression(
+          job_params->compression().begin(), job_params->compression().end());
+      for (auto& kv : state->job_to_table_id) {
+        if (meta_.table_is_committed(kv.second)) {
+          result_cache_->record(job_output_keys.at(kv.first), original_sink,
+                                compression, table_metas_->at(kv.second));
+        }
+      }
+    }
+    result_cache_->save(meta_, *table_metas_.get());
   }
-  write_database_metadata(storage_, meta_);
+  // No tasks are in flight anymore, so this is a safe point to compact the log
+  write_metadata_log(true);
 
   if (!state->task_result.success()) {
     job_result->CopyFrom(state->task_result);
@@ -2125,6 +2406,13 @@ void MasterServerImpl::stop_job_on_worker(i32 worker_id) {
     }
     state->active_job_tasks.erase(worker_id);
   }
+  // Hand out the tasks reserved for the worker to the other workers
+  if (state->worker_task_chains.count(worker_id) > 0) {
+    for (auto& job_task : state->worker_task_chains.at(worker_id)) {
+      state->unallocated_job_tasks.push_front(job_task);
+    }
+    state->worker_task_chains.erase(worker_id);
+  }
 
   state->worker_histories[worker_id].end_time = now();
   state->unfinished_workers[worker_id] = false;
@@ -2160,8 +2448,9 @@ void MasterServerImpl::blacklist_job(i64 job_id) {
   // All tasks in unallocated_job_tasks_ with this job id will be thrown away
   state->blacklisted_jobs.insert(job_id);
   // Add number of remaining tasks to tasks used
-  i64 num_tasks_left_in_job =
-      state->job_tasks[job_id].size() - state->tasks_used_per_job[job_id];
+  i64 num_tasks_left_in_job = state->job_tasks[job_id].size() -
+                              state->first_task_per_job[job_id] -
+                              state->tasks_used_per_job[job_id];
   state->total_tasks_used += num_tasks_left_in_job;
 
   VLOG(1) << "Blacklisted job " << job_id;
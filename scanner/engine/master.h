@@ -21,6 +21,8 @@
 #include "scanner/engine/runtime.h"
 #include "scanner/engine/sampler.h"
 #include "scanner/engine/dag_analysis.h"
+#include "scanner/engine/metadata_log.h"
+#include "scanner/engine/result_cache.h"
 #include "scanner/util/util.h"
 #include "scanner/util/grpc.h"
 #include "scanner/util/thread_pool.h"
@@ -125,6 +127,10 @@ class MasterServerImpl final : public proto::Master::Service {
 
   void recover_and_init_database();
 
+  // Appends all pending database and table metadata changes to the metadata
+  // log, compacting the log if it has grown too long
+  void write_metadata_log(bool allow_compaction = false);
+
   void start_job_processor();
 
   void stop_job_processor();
@@ -159,8 +165,13 @@ class MasterServerImpl final : public proto::Master::Service {
   grpc::Alarm* shutdown_alarm_ = nullptr;
   storehouse::StorageBackend* storage_;
   DatabaseMetadata meta_;
+  std::unique_ptr<MetadataLog> metadata_log_;
   std::unique_ptr<TableMetaCache> table_metas_;
+  std::unique_ptr<ResultCache> result_cache_;
   std::vector<std::string> so_paths_;
+  // Op name -> identifier of the kernel code, used to invalidate cached op
+  // outputs when a kernel changes
+  std::map<std::string, std::string> kernel_versions_;
   std::vector<proto::OpRegistration> op_registrations_;
   std::vector<proto::PythonKernelRegistration> py_kernel_registrations_;
 
@@ -230,9 +241,16 @@ class MasterServerImpl final : public proto::Master::Service {
     i64 next_task = 0;
     // Total samples in the current task
     i64 num_tasks = -1;
+    // With task affinity, the number of tasks in each chain of the current
+    // job, or 0 until its first chain is handed out
+    i64 task_chain_length = 0;
     // All job task output rows
     // Job -> Task -> task output rows
     std::vector<std::vector<std::vector<i64>>> job_tasks;
+    // Index of the first task to process for each job. Tasks before it
+    // are items which already exist in the output table of an incremental
+    // job.
+    std::vector<i64> first_task_per_job;
     // Outstanding set of generated task samples that should be processed
     std::deque<std::tuple<i64, i64>> unallocated_job_tasks;
     // The total number of tasks that have been completed
@@ -259,6 +277,10 @@ class MasterServerImpl final : public proto::Master::Service {
     std::map<i64, std::map<i64, i64>> job_tasks_num_failures;
     // Tracks the jobs that have failed too many times and should be ignored
     std::set<i64> blacklisted_jobs;
+    // With task affinity, the consecutive tasks of a job reserved for each
+    // worker, in the order they are handed out
+    // Worker id -> (job_id, task_id)
+    std::map<i64, std::deque<std::tuple<i64, i64>>> worker_task_chains;
 
     struct WorkerHistory {
       timepoint_t start_time;
@@ -271,7 +293,12 @@ class MasterServerImpl final : public proto::Master::Service {
     std::vector<i32> unstarted_workers;
     std::atomic<i64> num_failed_workers{0};
     std::vector<i32> job_uncommitted_tables;
-    
+    // Job -> updated descriptor of an existing output table, for
+    // incremental jobs
+    std::map<i64, proto::TableDescriptor> job_incremental_tables;
+    // Op outputs reused from or missing in the result cache
+    ResultCacheStats result_cache_stats;
+
     Result job_result;
   };
 
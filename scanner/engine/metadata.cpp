@@ -16,6 +16,7 @@
 #include "scanner/engine/metadata.h"
 #include "scanner/engine/runtime.h"
 #include "scanner/util/storehouse.h"
+#include "scanner/util/thread_pool.h"
 #include "scanner/util/util.h"
 #include "storehouse/storage_backend.h"
 
@@ -63,12 +64,14 @@ std::string Metadata<TableDescriptor>::descriptor_path() const {
   return table_descriptor_path(meta->id());
 }
 
-DatabaseMetadata::DatabaseMetadata() : next_table_id_(0), next_bulk_job_id_(0) {}
+DatabaseMetadata::DatabaseMetadata()
+  : next_table_id_(0), next_bulk_job_id_(0), log_sequence_(0) {}
 
 DatabaseMetadata::DatabaseMetadata(const DatabaseDescriptor& d)
   : Metadata(d),
     next_table_id_(d.next_table_id()),
-    next_bulk_job_id_(d.next_bulk_job_id()) {
+    next_bulk_job_id_(d.next_bulk_job_id()),
+    log_sequence_(d.log_sequence()) {
   for (int i = 0; i < descriptor_.tables_size(); ++i) {
     const DatabaseDescriptor::Table& table = descriptor_.tables(i);
     table_id_names_.insert({table.id(), table.name()});
@@ -85,6 +88,7 @@ DatabaseMetadata::DatabaseMetadata(const DatabaseDescriptor& d)
 const DatabaseDescriptor& DatabaseMetadata::get_descriptor() const {
   descriptor_.set_next_table_id(next_table_id_);
   descriptor_.set_next_bulk_job_id(next_bulk_job_id_);
+  descriptor_.set_log_sequence(log_sequence_);
   descriptor_.clear_tables();
   descriptor_.clear_bulk_jobs();
 
@@ -144,6 +148,8 @@ i32 DatabaseMetadata::add_table(const std::string& table) {
     table_id_names_[table_id] = table;
     table_name_ids_[table] = table_id;
     table_committed_[table_id] = false;
+    dirty_tables_.insert(table_id);
+    removed_tables_.erase(table_id);
   }
   return table_id;
 }
@@ -151,6 +157,7 @@ i32 DatabaseMetadata::add_table(const std::string& table) {
 void DatabaseMetadata::commit_table(i32 table_id) {
   assert(table_id_names_.count(table_id) > 0);
   table_committed_[table_id] = true;
+  dirty_tables_.insert(table_id);
 }
 
 bool DatabaseMetadata::table_is_committed(i32 table_id) const {
@@ -162,6 +169,9 @@ void DatabaseMetadata::remove_table(i32 table_id) {
   assert(table_id_names_.count(table_id) > 0);
   table_name_ids_.erase(table_id_names_[table_id]);
   table_id_names_.erase(table_id);
+  table_committed_.erase(table_id);
+  dirty_tables_.erase(table_id);
+  removed_tables_.insert(table_id);
 }
 
 const std::vector<std::string>& DatabaseMetadata::bulk_job_names() const {
@@ -205,13 +215,14 @@ i32 DatabaseMetadata::add_bulk_job(const std::string& bulk_job_name) {
   i32 bulk_job_id = next_bulk_job_id_++;
   bulk_job_id_names_[bulk_job_id] = bulk_job_name;
   bulk_job_committed_[bulk_job_id] = false;
+  dirty_bulk_jobs_.insert(bulk_job_id);
   return bulk_job_id;
 }
 
 void DatabaseMetadata::commit_bulk_job(i32 bulk_job_id) {
   assert(bulk_job_id_names_.count(bulk_job_id) > 0);
   bulk_job_committed_[bulk_job_id] = true;
-
+  dirty_bulk_jobs_.insert(bulk_job_id);
 }
 
 bool DatabaseMetadata::bulk_job_is_committed(i32 bulk_job_id) const {
@@ -222,6 +233,79 @@ bool DatabaseMetadata::bulk_job_is_committed(i32 bulk_job_id) const {
 void DatabaseMetadata::remove_bulk_job(i32 bulk_job_id) {
   assert(bulk_job_id_names_.count(bulk_job_id) > 0);
   bulk_job_id_names_.erase(bulk_job_id);
+  bulk_job_committed_.erase(bulk_job_id);
+  dirty_bulk_jobs_.erase(bulk_job_id);
+  removed_bulk_jobs_.insert(bulk_job_id);
+}
+
+i64 DatabaseMetadata::log_sequence() const { return log_sequence_; }
+
+void DatabaseMetadata::set_log_sequence(i64 sequence) {
+  log_sequence_ = sequence;
+}
+
+bool DatabaseMetadata::has_pending_updates() const {
+  return !(dirty_tables_.empty() && removed_tables_.empty() &&
+           dirty_bulk_jobs_.empty() && removed_bulk_jobs_.empty());
+}
+
+void DatabaseMetadata::take_pending_updates(MetadataLogEntry& entry) {
+  entry.set_next_table_id(next_table_id_);
+  entry.set_next_bulk_job_id(next_bulk_job_id_);
+  for (i32 id : dirty_tables_) {
+    auto table = entry.add_tables();
+    table->set_id(id);
+    table->set_name(table_id_names_.at(id));
+    table->set_committed(table_committed_.at(id));
+  }
+  for (i32 id : removed_tables_) {
+    entry.add_removed_tables(id);
+  }
+  for (i32 id : dirty_bulk_jobs_) {
+    auto bulk_job = entry.add_bulk_jobs();
+    bulk_job->set_id(id);
+    bulk_job->set_name(bulk_job_id_names_.at(id));
+    bulk_job->set_committed(bulk_job_committed_.at(id));
+  }
+  for (i32 id : removed_bulk_jobs_) {
+    entry.add_removed_bulk_jobs(id);
+  }
+  dirty_tables_.clear();
+  removed_tables_.clear();
+  dirty_bulk_jobs_.clear();
+  removed_bulk_jobs_.clear();
+}
+
+void DatabaseMetadata::apply_log_entry(const MetadataLogEntry& entry) {
+  // Entries are idempotent so replaying one which is already reflected in the
+  // snapshot is harmless. The log sequence is left untouched since it marks
+  // the snapshot the log is being replayed on top of.
+  next_table_id_ = std::max(next_table_id_, entry.next_table_id());
+  next_bulk_job_id_ = std::max(next_bulk_job_id_, entry.next_bulk_job_id());
+  for (const auto& table : entry.tables()) {
+    auto it = table_id_names_.find(table.id());
+    if (it != table_id_names_.end() && it->second != table.name()) {
+      table_name_ids_.erase(it->second);
+    }
+    table_id_names_[table.id()] = table.name();
+    table_name_ids_[table.name()] = table.id();
+    table_committed_[table.id()] = table.committed();
+  }
+  for (i32 id : entry.removed_tables()) {
+    if (table_id_names_.count(id) > 0) {
+      table_name_ids_.erase(table_id_names_.at(id));
+      table_id_names_.erase(id);
+      table_committed_.erase(id);
+    }
+  }
+  for (const auto& bulk_job : entry.bulk_jobs()) {
+    bulk_job_id_names_[bulk_job.id()] = bulk_job.name();
+    bulk_job_committed_[bulk_job.id()] = bulk_job.committed();
+  }
+  for (i32 id : entry.removed_bulk_jobs()) {
+    bulk_job_id_names_.erase(id);
+    bulk_job_committed_.erase(id);
+  }
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -290,6 +374,22 @@ std::vector<u64> VideoMetadata::sample_sizes() const {
                           descriptor_.sample_sizes().end());
 }
 
+std::vector<i64> VideoMetadata::non_reference_samples_per_video() const {
+  return std::vector<i64>(
+      descriptor_.non_reference_samples_per_video().begin(),
+      descriptor_.non_reference_samples_per_video().end());
+}
+
+std::vector<u64> VideoMetadata::non_reference_samples() const {
+  return std::vector<u64>(descriptor_.non_reference_samples().begin(),
+                          descriptor_.non_reference_samples().end());
+}
+
+std::vector<u64> VideoMetadata::non_reference_frames() const {
+  return std::vector<u64>(descriptor_.non_reference_frames().begin(),
+                          descriptor_.non_reference_frames().end());
+}
+
 std::vector<u8> VideoMetadata::metadata() const {
   return std::vector<u8>(descriptor_.metadata_packets().begin(),
                          descriptor_.metadata_packets().end());
@@ -454,24 +554,30 @@ void set_database_path(std::string path) {
   std::atomic_thread_fence(std::memory_order_release);
 }
 
+namespace {
+// Number of table descriptors serialized or parsed by one megafile task
+const size_t MEGAFILE_BATCH_SIZE = 10000;
+const i32 NUM_MEGAFILE_THREADS = 16;
+}
+
 void write_table_megafile(
     storehouse::StorageBackend* storage,
-    const std::unordered_map<i32, TableMetadata>& table_metadata) {
+    const std::vector<const TableDescriptor*>& table_descriptors) {
   std::unique_ptr<WriteFile> output_file;
   BACKOFF_FAIL(
       make_unique_write_file(storage, table_megafile_path(), output_file),
       "while trying to make write file for " + table_megafile_path());
   // Get all table descriptor sizes and write them
+  std::vector<const TableDescriptor*> tables(table_descriptors);
+  std::sort(tables.begin(), tables.end(),
+            [](const TableDescriptor* a, const TableDescriptor* b) {
+              return a->id() < b->id();
+            });
   std::vector<i32> ids;
-  for (const auto& kv : table_metadata) {
-    ids.push_back(kv.first);
-  }
-  std::sort(ids.begin(), ids.end());
   std::vector<size_t> sizes;
-  for (i32 id : ids) {
-    const auto& td = table_metadata.at(id).get_descriptor();
-    size_t size = td.ByteSizeLong();
-    sizes.push_back(size);
+  for (const TableDescriptor* td : tables) {
+    ids.push_back(td->id());
+    sizes.push_back(td->ByteSizeLong());
   }
   // Write out # table entries
   s_write(output_file.get(), (size_t)ids.size());
@@ -479,11 +585,11 @@ void write_table_megafile(
   // Write out ids and sizes
   s_write(output_file.get(), (u8*)ids.data(), ids.size() * sizeof(i32));
   s_write(output_file.get(), (u8*)sizes.data(), sizes.size() * sizeof(size_t));
-  // Write all table descriptors
-  size_t BATCH_SIZE = 100000;
-  for (size_t b = 0; b < ids.size(); b += BATCH_SIZE) {
-    size_t max_i = std::min(b + BATCH_SIZE, ids.size());
 
+  // Serialize batches of table descriptors in parallel and write them out in
+  // order. At most NUM_MEGAFILE_THREADS batches are in memory at once.
+  auto serialize_batch = [&](size_t b) {
+    size_t max_i = std::min(b + MEGAFILE_BATCH_SIZE, ids.size());
     size_t total_size = 0;
     for (size_t i = b; i < max_i; ++i) {
       total_size += sizes[i];
@@ -491,25 +597,36 @@ void write_table_megafile(
     std::vector<u8> data(total_size);
     size_t offset = 0;
     for (size_t i = b; i < max_i; ++i) {
-      i32 id = ids[i];
-      const auto& td = table_metadata.at(id).get_descriptor();
-      td.SerializeToArray(data.data() + offset, sizes[i]);
+      tables[i]->SerializeToArray(data.data() + offset, sizes[i]);
       offset += sizes[i];
     }
-    s_write(output_file.get(), data.data(), total_size);
+    return data;
+  };
+  ThreadPool pool(NUM_MEGAFILE_THREADS);
+  const size_t window = MEGAFILE_BATCH_SIZE * NUM_MEGAFILE_THREADS;
+  for (size_t w = 0; w < ids.size(); w += window) {
+    std::vector<std::future<std::vector<u8>>> futures;
+    for (size_t b = w; b < std::min(w + window, ids.size());
+         b += MEGAFILE_BATCH_SIZE) {
+      futures.push_back(pool.enqueue(serialize_batch, b));
+    }
+    for (auto& future : futures) {
+      std::vector<u8> data = future.get();
+      s_write(output_file.get(), data.data(), data.size());
+    }
   }
+  BACKOFF_FAIL(output_file->save(),
+               "while trying to save " + output_file->path());
 }
 
-void read_table_megafile(storehouse::StorageBackend* storage,
-                         std::unordered_map<i32, TableMetadata>& table_metadata) {
+void read_table_megafile(
+    storehouse::StorageBackend* storage,
+    const std::function<void(i32, const TableDescriptor&)>& fn) {
   std::unique_ptr<RandomReadFile> file;
   BACKOFF_FAIL(
       make_unique_random_read_file(storage, table_megafile_path(), file),
-      "while trying to make write file for " + table_megafile_path());
+      "while trying to make read file for " + table_megafile_path());
 
-  u64 file_size = 0;
-  BACKOFF_FAIL(file->get_size(file_size),
-               "while trying to get size for " + file->path());
   u64 pos = 0;
 
   // Read # entires
@@ -521,26 +638,43 @@ void read_table_megafile(storehouse::StorageBackend* storage,
   std::vector<size_t> sizes(num_entries);
   s_read(file.get(), (u8*)sizes.data(), num_entries * sizeof(size_t), pos);
 
-  // Read all table descriptors
-  size_t BATCH_SIZE = 1000000;
-  for (size_t b = 0; b < ids.size(); b += BATCH_SIZE) {
-    size_t max_i = std::min(b + BATCH_SIZE, ids.size());
+  // Read and parse batches of table descriptors in parallel. Each batch uses
+  // its own file handle since reads are issued concurrently.
+  auto read_batch = [&](size_t b, u64 batch_pos) {
+    size_t max_i = std::min(b + MEGAFILE_BATCH_SIZE, ids.size());
 
     size_t total_size = 0;
     for (size_t i = b; i < max_i; ++i) {
       total_size += sizes[i];
     }
+    std::unique_ptr<RandomReadFile> batch_file;
+    BACKOFF_FAIL(
+        make_unique_random_read_file(storage, table_megafile_path(),
+                                     batch_file),
+        "while trying to make read file for " + table_megafile_path());
     std::vector<u8> data(total_size);
-    s_read(file.get(), data.data(), total_size, pos);
+    s_read(batch_file.get(), data.data(), total_size, batch_pos);
 
     size_t offset = 0;
     for (size_t i = b; i < max_i; ++i) {
-      i32 id = ids[i];
-      proto::TableDescriptor td;
+      TableDescriptor td;
       td.ParseFromArray(data.data() + offset, sizes[i]);
-      table_metadata[id] = TableMetadata(td);
+      fn(ids[i], td);
       offset += sizes[i];
     }
+  };
+
+  ThreadPool pool(NUM_MEGAFILE_THREADS);
+  std::vector<std::future<void>> futures;
+  for (size_t b = 0; b < ids.size(); b += MEGAFILE_BATCH_SIZE) {
+    futures.push_back(pool.enqueue(read_batch, b, pos));
+    for (size_t i = b; i < std::min(b + MEGAFILE_BATCH_SIZE, ids.size());
+         ++i) {
+      pos += sizes[i];
+    }
+  }
+  for (auto& future : futures) {
+    future.get();
   }
 }
 
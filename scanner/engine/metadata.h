@@ -19,6 +19,7 @@
 #include "scanner/util/storehouse.h"
 #include "storehouse/storage_backend.h"
 
+#include <functional>
 #include <set>
 
 namespace scanner {
@@ -42,6 +43,18 @@ inline std::string table_megafile_path() {
   return get_database_path() + "table_megafile.bin";
 }
 
+inline std::string metadata_log_directory() {
+  return get_database_path() + "metadata_log";
+}
+
+inline std::string metadata_log_path(i64 sequence) {
+  return metadata_log_directory() + "/" + std::to_string(sequence) + ".bin";
+}
+
+inline std::string result_cache_path() {
+  return get_database_path() + "result_cache.bin";
+}
+
 inline std::string table_directory(i32 table_id) {
   return get_database_path() + "tables/" + std::to_string(table_id);
 }
@@ -130,9 +143,25 @@ class DatabaseMetadata : public Metadata<proto::DatabaseDescriptor> {
   bool bulk_job_is_committed(i32 job_id) const;
   void remove_bulk_job(i32 job_id);
 
+  // Sequence number of the last metadata log entry included in the
+  // compacted snapshot
+  i64 log_sequence() const;
+  void set_log_sequence(i64 sequence);
+
+  // Incremental updates for the metadata log. All modifications made since
+  // the last call to take_pending_updates are moved into the log entry.
+  bool has_pending_updates() const;
+  void take_pending_updates(proto::MetadataLogEntry& entry);
+  void apply_log_entry(const proto::MetadataLogEntry& entry);
+
  private:
   i32 next_table_id_;
   i32 next_bulk_job_id_;
+  i64 log_sequence_;
+  std::set<i32> dirty_tables_;
+  std::set<i32> removed_tables_;
+  std::set<i32> dirty_bulk_jobs_;
+  std::set<i32> removed_bulk_jobs_;
   std::unordered_map<i32, std::string> table_id_names_;
   std::unordered_map<std::string, i32> table_name_ids_;
   std::unordered_map<i32, bool> table_committed_;
@@ -165,6 +194,9 @@ class VideoMetadata : public Metadata<proto::VideoDescriptor> {
   std::vector<u64> keyframe_indices() const;
   std::vector<u64> sample_offsets() const;
   std::vector<u64> sample_sizes() const;
+  std::vector<i64> non_reference_samples_per_video() const;
+  std::vector<u64> non_reference_samples() const;
+  std::vector<u64> non_reference_frames() const;
   std::vector<u8> metadata() const;
   std::string data_path() const;
   bool inplace() const;
@@ -256,6 +288,11 @@ inline std::string index_column_name() { return "index"; }
 
 inline std::string frame_column_name() { return "frame"; }
 
+//! Column holding a copy of the frame column downscaled by scale
+inline std::string proxy_column_name(i32 scale) {
+  return frame_column_name() + "_proxy_" + std::to_string(scale);
+}
+
 inline std::string frame_info_column_name() { return "frame_info"; }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -315,13 +352,16 @@ constexpr WriteFn<DatabaseMetadata> write_database_metadata =
 constexpr ReadFn<DatabaseMetadata> read_database_metadata =
     read_db_proto<DatabaseMetadata>;
 
+// Serializes and writes the table descriptors in parallel batches
 void write_table_megafile(
     storehouse::StorageBackend* storage,
-    const std::unordered_map<i32, TableMetadata>& table_metadata);
+    const std::vector<const proto::TableDescriptor*>& table_descriptors);
 
+// Reads and parses the megafile in parallel batches. fn is called once per
+// table and may be called concurrently from multiple threads.
 void read_table_megafile(
     storehouse::StorageBackend* storage,
-    std::unordered_map<i32, TableMetadata>& table_metadata);
+    const std::function<void(i32, const proto::TableDescriptor&)>& fn);
 
 constexpr WriteFn<BulkJobMetadata> write_bulk_job_metadata =
     write_db_proto<BulkJobMetadata>;
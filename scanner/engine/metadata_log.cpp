@@ -0,0 +1,132 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/metadata_log.h"
+#include "scanner/engine/table_meta_cache.h"
+#include "scanner/util/storehouse.h"
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+bool log_entry_exists(storehouse::StorageBackend* storage, i64 sequence) {
+  storehouse::FileInfo info;
+  storehouse::StoreResult result;
+  EXP_BACKOFF(storage->get_file_info(metadata_log_path(sequence), info),
+              result);
+  return result == storehouse::StoreResult::Success;
+}
+
+}
+
+i64 replay_metadata_log(
+    storehouse::StorageBackend* storage, i64 after_sequence,
+    const std::function<void(const proto::MetadataLogEntry&)>& fn) {
+  i64 sequence = after_sequence + 1;
+  while (log_entry_exists(storage, sequence)) {
+    const std::string path = metadata_log_path(sequence);
+    std::unique_ptr<storehouse::RandomReadFile> file;
+    BACKOFF_FAIL(make_unique_random_read_file(storage, path, file),
+                 "while trying to make read file for " + path);
+    u64 pos = 0;
+    proto::MetadataLogEntry entry =
+        deserialize_db_proto<proto::MetadataLogEntry>(file.get(), pos);
+    LOG_IF(FATAL, entry.sequence() != sequence)
+        << "Metadata log entry " << path << " has sequence "
+        << entry.sequence() << ", expected " << sequence;
+    fn(entry);
+    sequence++;
+  }
+  return sequence - 1;
+}
+
+MetadataLog::MetadataLog(storehouse::StorageBackend* storage)
+  : storage_(storage), next_sequence_(1) {}
+
+DatabaseMetadata MetadataLog::recover() {
+  DatabaseMetadata meta =
+      read_database_metadata(storage_, DatabaseMetadata::descriptor_path());
+  i64 last_sequence = replay_metadata_log(
+      storage_, meta.log_sequence(),
+      [&](const proto::MetadataLogEntry& entry) {
+        meta.apply_log_entry(entry);
+      });
+  VLOG(1) << "Replayed " << last_sequence - meta.log_sequence()
+          << " metadata log entries";
+  next_sequence_ = last_sequence + 1;
+  return meta;
+}
+
+void MetadataLog::append(DatabaseMetadata& meta,
+                         const std::vector<TableMetadata>& table_descriptors) {
+  std::lock_guard<std::mutex> lock(lock_);
+  if (!meta.has_pending_updates() && table_descriptors.empty()) {
+    return;
+  }
+  proto::MetadataLogEntry entry;
+  entry.set_sequence(next_sequence_);
+  meta.take_pending_updates(entry);
+  for (const auto& table : table_descriptors) {
+    entry.add_table_descriptors()->CopyFrom(table.get_descriptor());
+  }
+
+  const std::string path = metadata_log_path(next_sequence_);
+  std::unique_ptr<storehouse::WriteFile> output_file;
+  BACKOFF_FAIL(make_unique_write_file(storage_, path, output_file),
+               "while trying to make write file for " + path);
+  serialize_db_proto<proto::MetadataLogEntry>(output_file.get(), entry);
+  BACKOFF_FAIL(output_file->save(),
+               "while trying to save " + output_file->path());
+  next_sequence_++;
+}
+
+i64 MetadataLog::entries_since_snapshot(const DatabaseMetadata& meta) const {
+  return next_sequence_ - 1 - meta.log_sequence();
+}
+
+bool MetadataLog::should_compact(const DatabaseMetadata& meta) const {
+  return entries_since_snapshot(meta) >= METADATA_LOG_COMPACTION_THRESHOLD;
+}
+
+void MetadataLog::compact(DatabaseMetadata& meta,
+                          TableMetaCache& table_metas) {
+  VLOG(1) << "Compacting " << entries_since_snapshot(meta)
+          << " metadata log entries";
+  // Flush anything which has not made it into the log yet so the snapshot
+  // sequence covers every change
+  append(meta, table_metas.take_pending_updates());
+
+  std::lock_guard<std::mutex> lock(lock_);
+  i64 previous_sequence = meta.log_sequence();
+  i64 last_sequence = next_sequence_ - 1;
+  // The megafile is written first: if we fail before the database descriptor
+  // is saved, the old snapshot plus the (idempotent) log is still valid.
+  table_metas.write_megafile();
+  meta.set_log_sequence(last_sequence);
+  write_database_metadata(storage_, meta);
+
+  // Readers which loaded the previous snapshot may still be replaying entries
+  // after it, so only the entries folded into that snapshot are removed.
+  for (i64 sequence = previous_sequence; sequence > 0; --sequence) {
+    if (!log_entry_exists(storage_, sequence)) {
+      break;
+    }
+    storage_->delete_file(metadata_log_path(sequence));
+  }
+}
+
+}
+}
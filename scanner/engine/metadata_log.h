@@ -0,0 +1,73 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/engine/metadata.h"
+
+#include <functional>
+#include <mutex>
+
+namespace scanner {
+namespace internal {
+
+class TableMetaCache;
+
+// Number of log entries written after the last snapshot before the master
+// rewrites the database descriptor and table megafile
+static const i64 METADATA_LOG_COMPACTION_THRESHOLD = 256;
+
+/// Append-only log of database metadata updates.
+///
+/// The database descriptor and table megafile are snapshots which are only
+/// rewritten during compaction. Every other change to the database (new
+/// tables, commits, deletions) is written as a small, numbered log entry
+/// containing only the changed descriptors. Readers recover the current state
+/// by loading the snapshot and replaying all entries after
+/// DatabaseMetadata::log_sequence().
+class MetadataLog {
+ public:
+  MetadataLog(storehouse::StorageBackend* storage);
+
+  // Reads the database snapshot and replays all log entries written after it
+  DatabaseMetadata recover();
+
+  // Writes the pending updates in meta along with the given table descriptors
+  // as the next log entry. Does nothing if there is nothing to record.
+  void append(DatabaseMetadata& meta,
+              const std::vector<TableMetadata>& table_descriptors);
+
+  i64 entries_since_snapshot(const DatabaseMetadata& meta) const;
+
+  bool should_compact(const DatabaseMetadata& meta) const;
+
+  // Folds all log entries into a new snapshot of the database descriptor and
+  // table megafile.
+  void compact(DatabaseMetadata& meta, TableMetaCache& table_metas);
+
+ private:
+  storehouse::StorageBackend* storage_;
+  std::mutex lock_;
+  i64 next_sequence_;
+};
+
+// Calls fn, in sequence order, on every log entry written after
+// after_sequence. Returns the sequence number of the last entry replayed.
+i64 replay_metadata_log(
+    storehouse::StorageBackend* storage, i64 after_sequence,
+    const std::function<void(const proto::MetadataLogEntry&)>& fn);
+
+}
+}
@@ -29,7 +29,8 @@ class OpInfo {
          const std::vector<Column>& input_columns,
          const std::vector<Column>& output_columns, bool can_stencil,
          const std::vector<i32> preferred_stencil, bool bounded_state,
-         i32 warmup, bool unbounded_state, const std::string& protobuf_name)
+         i32 warmup, bool unbounded_state, const std::string& protobuf_name,
+         FrameResizeFn frame_resize = nullptr)
     : name_(name),
       variadic_inputs_(variadic_inputs),
       input_columns_(input_columns),
@@ -39,7 +40,8 @@ class OpInfo {
       bounded_state_(bounded_state),
       warmup_(warmup),
       unbounded_state_(unbounded_state),
-      protobuf_name_(protobuf_name) {}
+      protobuf_name_(protobuf_name),
+      frame_resize_(frame_resize) {}
 
   const std::string& name() const { return name_; }
 
@@ -65,6 +67,9 @@ class OpInfo {
 
   const std::string& protobuf_name() const { return protobuf_name_; }
 
+  //! Null unless the op can be fused into the video decoder
+  const FrameResizeFn& frame_resize() const { return frame_resize_; }
+
  private:
   std::string name_;
   bool variadic_inputs_;
@@ -76,6 +81,7 @@ class OpInfo {
   i32 warmup_;
   bool unbounded_state_;
   std::string protobuf_name_;
+  FrameResizeFn frame_resize_;
 };
 }
 }
@@ -33,6 +33,8 @@ class OpRegistry {
 
   bool has_op(const std::string& name) const;
 
+  std::vector<std::string> op_names() const;
+
  private:
   std::map<std::string, OpInfo*> ops_;
 };
@@ -21,6 +21,9 @@ namespace scanner {
     for (auto gpu_id : params.gpu_ids) {
       params_proto.add_gpu_ids(gpu_id);
     }
+    params_proto.set_disk_cache_path(params.disk_cache_path);
+    params_proto.set_disk_cache_size(params.disk_cache_size);
+    params_proto.set_frame_cache_size(params.frame_cache_size);
 
     std::string output;
     bool success = params_proto.SerializeToString(&output);
@@ -53,6 +56,9 @@ namespace scanner {
     for (auto gpu_id : params_proto.gpu_ids()) {
       params.gpu_ids.push_back(gpu_id);
     }
+    params.disk_cache_path = params_proto.disk_cache_path();
+    params.disk_cache_size = params_proto.disk_cache_size();
+    params.frame_cache_size = params_proto.frame_cache_size();
 
     return db.start_worker(params, port, python_dir, watchdog);
   }
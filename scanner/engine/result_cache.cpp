@@ -0,0 +1,488 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/result_cache.h"
+#include "scanner/engine/dag_analysis.h"
+#include "scanner/engine/op_registry.h"
+#include "scanner/engine/source_registry.h"
+#include "scanner/source_args.pb.h"
+#include "scanner/util/storehouse.h"
+#include "scanner/util/util.h"
+
+#include <algorithm>
+#include <set>
+#include <sstream>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+const std::string COLUMN_SOURCE_NAME = "Column";
+const std::string FRAME_COLUMN_SOURCE_NAME = "FrameColumn";
+
+bool is_column_source(const proto::Op& op) {
+  return op.is_source() && (op.name() == COLUMN_SOURCE_NAME ||
+                            op.name() == FRAME_COLUMN_SOURCE_NAME);
+}
+
+// Length prefixed so that adjacent fields can not run into each other
+void append_field(std::stringstream& ss, const std::string& field) {
+  ss << field.size() << ":" << field << ";";
+}
+
+}
+
+OpOutputKeys compute_op_output_keys(
+    const DatabaseMetadata& meta, TableMetaCache& table_metas,
+    const proto::Job& job, const std::vector<proto::Op>& ops,
+    const std::map<std::string, std::string>& kernel_versions) {
+  OpOutputKeys keys;
+  OpRegistry* op_registry = get_op_registry();
+  SourceRegistry* source_registry = get_source_registry();
+  for (i64 op_idx = 0; op_idx < ops.size(); ++op_idx) {
+    const proto::Op& op = ops.at(op_idx);
+    if (op.is_sink()) {
+      continue;
+    }
+    std::stringstream desc;
+    std::vector<std::string> output_columns;
+    bool cacheable = true;
+    if (op.is_source()) {
+      // Only tables have an identity we can version, so outputs which depend
+      // on any other source are never reused
+      cacheable = false;
+      if (is_column_source(op)) {
+        for (auto& input : job.inputs()) {
+          if (input.op_index() != op_idx) {
+            continue;
+          }
+          proto::ColumnEnumeratorArgs args;
+          if (!args.ParseFromString(input.enumerator_args()) ||
+              !meta.has_table(args.table_name())) {
+            break;
+          }
+          i32 table_id = meta.get_table_id(args.table_name());
+          if (!meta.table_is_committed(table_id)) {
+            break;
+          }
+          const TableMetadata& table = table_metas.at(table_id);
+          if (!table.has_column(args.column_name())) {
+            break;
+          }
+          desc << "source;";
+          append_field(desc, op.name());
+          desc << table_id << ";" << table.num_rows() << ";";
+          append_field(desc, args.column_name());
+          cacheable = true;
+        }
+      }
+      if (source_registry->has_source(op.name())) {
+        for (auto& col :
+             source_registry->get_source(op.name())->output_columns()) {
+          output_columns.push_back(col.name());
+        }
+      }
+    } else {
+      desc << "op;";
+      append_field(desc, op.name());
+      if (op.name() == SLICE_OP_NAME || op.name() == UNSLICE_OP_NAME) {
+        // Replacing an op inside a slice would leave its Unslice unmatched
+        cacheable = false;
+      }
+      if (is_builtin_op(op.name())) {
+        for (auto& input : op.inputs()) {
+          output_columns.push_back(input.column());
+        }
+        for (auto& saa : job.sampling_args_assignment()) {
+          if (saa.op_index() != op_idx) {
+            continue;
+          }
+          for (auto& sa : saa.sampling_args()) {
+            append_field(desc, sa.SerializeAsString());
+          }
+        }
+      } else if (op_registry->has_op(op.name())) {
+        for (auto& col :
+             op_registry->get_op_info(op.name())->output_columns()) {
+          output_columns.push_back(col.name());
+        }
+        // Outputs of kernels whose build is unknown can not be told apart
+        // from those of a rebuilt kernel
+        auto it = kernel_versions.find(op.name());
+        if (it == kernel_versions.end()) {
+          cacheable = false;
+        } else {
+          append_field(desc, it->second);
+        }
+        desc << op.device_type() << ";" << op.warmup() << ";";
+        for (i32 s : op.stencil()) {
+          desc << s << ",";
+        }
+        desc << ";";
+        append_field(desc, op.kernel_args());
+        for (auto& op_args : job.op_args()) {
+          if (op_args.op_index() == op_idx) {
+            append_field(desc, op_args.op_args());
+          }
+        }
+      } else {
+        cacheable = false;
+      }
+      for (auto& input : op.inputs()) {
+        auto it = keys.find(std::make_tuple((i64)input.op_index(),
+                                            input.column()));
+        if (it == keys.end()) {
+          cacheable = false;
+          break;
+        }
+        append_field(desc, it->second);
+      }
+    }
+    if (!cacheable) {
+      continue;
+    }
+    std::string op_key = stable_hash(desc.str());
+    for (auto& col : output_columns) {
+      keys[std::make_tuple(op_idx, col)] = stable_hash(op_key + ":" + col);
+    }
+  }
+  return keys;
+}
+
+ResultCache::ResultCache(storehouse::StorageBackend* storage)
+  : storage_(storage) {
+  const std::string path = result_cache_path();
+  storehouse::FileInfo info;
+  storehouse::StoreResult result;
+  EXP_BACKOFF(storage_->get_file_info(path, info), result);
+  if (result != storehouse::StoreResult::Success) {
+    return;
+  }
+  std::unique_ptr<storehouse::RandomReadFile> file;
+  BACKOFF_FAIL(make_unique_random_read_file(storage_, path, file),
+               "while trying to make read file for " + path);
+  u64 pos = 0;
+  proto::ResultCacheDescriptor descriptor =
+      deserialize_db_proto<proto::ResultCacheDescriptor>(file.get(), pos);
+  for (auto& entry : descriptor.entries()) {
+    entries_[entry.key()] = entry;
+    clock_ = std::max(clock_, entry.last_used());
+  }
+  VLOG(1) << "Loaded " << entries_.size() << " result cache entries";
+}
+
+ResultCacheStats ResultCache::rewrite(const DatabaseMetadata& meta,
+                                      TableMetaCache& table_metas,
+                                      const std::vector<OpOutputKeys>& job_keys,
+                                      std::vector<proto::Op>& ops,
+                                      std::vector<proto::Job>& jobs) {
+  ResultCacheStats stats;
+  if (jobs.empty() || ops.empty() || !ops.back().is_sink()) {
+    return stats;
+  }
+  // Replacement sources reuse the storage arguments of the job's own Column
+  // sources, so only DAGs which already read from tables are rewritten
+  const proto::Op* column_source = nullptr;
+  for (auto& op : ops) {
+    if (is_column_source(op)) {
+      column_source = &op;
+      break;
+    }
+  }
+  if (column_source == nullptr) {
+    return stats;
+  }
+
+  std::map<i64, std::set<std::string>> consumed_columns;
+  for (auto& op : ops) {
+    for (auto& input : op.inputs()) {
+      consumed_columns[input.op_index()].insert(input.column());
+    }
+  }
+
+  // Op index -> materialized column for each job
+  std::map<i64, std::vector<const proto::ResultCacheDescriptor::Entry*>>
+      replaced;
+  // Op index -> number of jobs whose output was not materialized
+  std::map<i64, i64> missed;
+  for (i64 op_idx = 0; op_idx < ops.size(); ++op_idx) {
+    const proto::Op& op = ops.at(op_idx);
+    // Sources only have a single output column, so we can only replace ops
+    // from which a single column is consumed
+    if (op.is_source() || op.is_sink() ||
+        consumed_columns[op_idx].size() != 1) {
+      continue;
+    }
+    auto col = std::make_tuple(op_idx, *consumed_columns[op_idx].begin());
+    std::vector<const proto::ResultCacheDescriptor::Entry*> hits;
+    bool cacheable = true;
+    for (auto& keys : job_keys) {
+      auto it = keys.find(col);
+      if (it == keys.end()) {
+        cacheable = false;
+        break;
+      }
+      auto entry = lookup(meta, table_metas, it->second);
+      if (entry != nullptr) {
+        hits.push_back(entry);
+      }
+    }
+    if (!cacheable) {
+      continue;
+    }
+    if (hits.size() == jobs.size()) {
+      // All jobs must read the same type of column to share a source
+      ColumnType type = ColumnType::Other;
+      bool same_type = true;
+      for (size_t i = 0; i < hits.size(); ++i) {
+        const TableMetadata& table = table_metas.at(hits[i]->table_id());
+        ColumnType t =
+            table.column_type(table.column_id(hits[i]->column_name()));
+        if (i == 0) {
+          type = t;
+        }
+        same_type &= (t == type);
+      }
+      if (same_type) {
+        replaced[op_idx] = hits;
+        continue;
+      }
+    }
+    missed[op_idx] = jobs.size() - hits.size();
+  }
+
+  // Only keep ops which still contribute to the sink
+  std::vector<bool> live(ops.size(), false);
+  live.back() = true;
+  for (i64 op_idx = ops.size() - 1; op_idx >= 0; --op_idx) {
+    if (!live[op_idx] || replaced.count(op_idx) > 0) {
+      continue;
+    }
+    for (auto& input : ops.at(op_idx).inputs()) {
+      if (input.op_index() >= 0) {
+        live.at(input.op_index()) = true;
+      }
+    }
+  }
+  for (auto& kv : missed) {
+    if (live[kv.first]) {
+      stats.misses += kv.second;
+    }
+  }
+  for (auto& kv : replaced) {
+    if (live[kv.first]) {
+      stats.hits += kv.second.size();
+    }
+  }
+  if (stats.hits == 0) {
+    return stats;
+  }
+
+  // Build the rewritten DAG
+  std::vector<i64> new_index(ops.size(), -1);
+  std::map<i64, std::string> replaced_column;
+  std::vector<proto::Op> new_ops;
+  for (i64 op_idx = 0; op_idx < ops.size(); ++op_idx) {
+    if (!live[op_idx]) {
+      continue;
+    }
+    new_index[op_idx] = new_ops.size();
+    new_ops.emplace_back();
+    proto::Op& new_op = new_ops.back();
+    auto it = replaced.find(op_idx);
+    if (it != replaced.end()) {
+      const auto* entry = it->second.at(0);
+      const TableMetadata& table = table_metas.at(entry->table_id());
+      bool is_video =
+          table.column_type(table.column_id(entry->column_name())) ==
+          ColumnType::Video;
+      new_op.set_name(is_video ? FRAME_COLUMN_SOURCE_NAME
+                               : COLUMN_SOURCE_NAME);
+      new_op.set_is_source(true);
+      new_op.set_kernel_args(column_source->kernel_args());
+      const std::string& output_column = get_source_registry()
+                                             ->get_source(new_op.name())
+                                             ->output_columns()
+                                             .at(0)
+                                             .name();
+      auto input = new_op.add_inputs();
+      input->set_op_index(-1);
+      input->set_column(output_column);
+      replaced_column[op_idx] = output_column;
+      continue;
+    }
+    new_op.CopyFrom(ops.at(op_idx));
+    for (auto& input : *new_op.mutable_inputs()) {
+      i64 input_idx = input.op_index();
+      if (input_idx < 0) {
+        continue;
+      }
+      if (replaced_column.count(input_idx) > 0) {
+        input.set_column(replaced_column.at(input_idx));
+      }
+      input.set_op_index(new_index.at(input_idx));
+    }
+  }
+
+  for (size_t job_idx = 0; job_idx < jobs.size(); ++job_idx) {
+    proto::Job& job = jobs[job_idx];
+    proto::Job new_job;
+    new_job.set_output_table_name(job.output_table_name());
+    // Sources are kept in op order
+    for (i64 op_idx = 0; op_idx < ops.size(); ++op_idx) {
+      if (!live[op_idx]) {
+        continue;
+      }
+      if (replaced.count(op_idx) > 0) {
+        const auto* entry = replaced.at(op_idx).at(job_idx);
+        proto::ColumnEnumeratorArgs args;
+        args.set_table_name(entry->table_name());
+        args.set_column_name(entry->column_name());
+        auto input = new_job.add_inputs();
+        input->set_op_index(new_index[op_idx]);
+        input->set_enumerator_args(args.SerializeAsString());
+        continue;
+      }
+      for (auto& input : job.inputs()) {
+        if (input.op_index() == op_idx) {
+          auto new_input = new_job.add_inputs();
+          new_input->CopyFrom(input);
+          new_input->set_op_index(new_index[op_idx]);
+        }
+      }
+    }
+    for (auto& op_args : job.op_args()) {
+      i64 op_idx = op_args.op_index();
+      if (live.at(op_idx) && replaced.count(op_idx) == 0) {
+        auto new_op_args = new_job.add_op_args();
+        new_op_args->CopyFrom(op_args);
+        new_op_args->set_op_index(new_index[op_idx]);
+      }
+    }
+    for (auto& saa : job.sampling_args_assignment()) {
+      i64 op_idx = saa.op_index();
+      if (live.at(op_idx) && replaced.count(op_idx) == 0) {
+        auto new_saa = new_job.add_sampling_args_assignment();
+        new_saa->CopyFrom(saa);
+        new_saa->set_op_index(new_index[op_idx]);
+      }
+    }
+    for (auto& output : job.outputs()) {
+      auto new_output = new_job.add_outputs();
+      new_output->CopyFrom(output);
+      new_output->set_op_index(new_index.at(output.op_index()));
+    }
+    job.Swap(&new_job);
+  }
+
+  for (auto& kv : replaced) {
+    if (!live[kv.first]) {
+      continue;
+    }
+    for (auto* entry : kv.second) {
+      entries_.at(entry->key()).set_last_used(++clock_);
+    }
+    VLOG(1) << "Reusing materialized outputs of op " << ops.at(kv.first).name()
+            << " (" << kv.first << ")";
+  }
+  ops.swap(new_ops);
+  return stats;
+}
+
+void ResultCache::record(
+    const OpOutputKeys& keys, const proto::Op& sink,
+    const std::vector<proto::OutputColumnCompression>& compression,
+    const TableMetadata& table) {
+  for (size_t i = 0; i < sink.inputs_size(); ++i) {
+    auto& input = sink.inputs(i);
+    auto it =
+        keys.find(std::make_tuple((i64)input.op_index(), input.column()));
+    if (it == keys.end() || i >= table.columns().size()) {
+      continue;
+    }
+    if (table.columns().at(i).type() == ColumnType::Video &&
+        (i >= compression.size() || compression.at(i).codec() != "raw")) {
+      continue;
+    }
+    proto::ResultCacheDescriptor::Entry entry;
+    entry.set_key(it->second);
+    entry.set_table_id(table.id());
+    entry.set_table_name(table.name());
+    entry.set_column_name(table.columns().at(i).name());
+    entry.set_num_rows(table.num_rows());
+    entry.set_last_used(++clock_);
+    entries_[it->second] = entry;
+  }
+}
+
+void ResultCache::save(const DatabaseMetadata& meta,
+                       TableMetaCache& table_metas) {
+  std::vector<const proto::ResultCacheDescriptor::Entry*> valid;
+  for (auto& kv : entries_) {
+    if (lookup(meta, table_metas, kv.first) != nullptr) {
+      valid.push_back(&kv.second);
+    }
+  }
+  std::sort(valid.begin(), valid.end(),
+            [](const proto::ResultCacheDescriptor::Entry* a,
+               const proto::ResultCacheDescriptor::Entry* b) {
+              return a->last_used() > b->last_used();
+            });
+  if (valid.size() > RESULT_CACHE_MAX_ENTRIES) {
+    valid.resize(RESULT_CACHE_MAX_ENTRIES);
+  }
+
+  proto::ResultCacheDescriptor descriptor;
+  for (auto* entry : valid) {
+    descriptor.add_entries()->CopyFrom(*entry);
+  }
+  entries_.clear();
+  for (auto& entry : descriptor.entries()) {
+    entries_[entry.key()] = entry;
+  }
+
+  const std::string path = result_cache_path();
+  std::unique_ptr<storehouse::WriteFile> output_file;
+  BACKOFF_FAIL(make_unique_write_file(storage_, path, output_file),
+               "while trying to make write file for " + path);
+  serialize_db_proto<proto::ResultCacheDescriptor>(output_file.get(),
+                                                   descriptor);
+  BACKOFF_FAIL(output_file->save(),
+               "while trying to save " + output_file->path());
+}
+
+const proto::ResultCacheDescriptor::Entry* ResultCache::lookup(
+    const DatabaseMetadata& meta, TableMetaCache& table_metas,
+    const std::string& key) {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return nullptr;
+  }
+  // The table may have been deleted, replaced by a table with the same name or
+  // extended since the entry was recorded
+  const auto& entry = it->second;
+  if (!meta.has_table(entry.table_id()) ||
+      !meta.table_is_committed(entry.table_id()) ||
+      meta.get_table_name(entry.table_id()) != entry.table_name() ||
+      !table_metas.at(entry.table_id()).has_column(entry.column_name()) ||
+      table_metas.at(entry.table_id()).num_rows() != entry.num_rows()) {
+    return nullptr;
+  }
+  return &entry;
+}
+
+}
+}
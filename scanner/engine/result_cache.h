@@ -0,0 +1,91 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/engine/metadata.h"
+#include "scanner/engine/table_meta_cache.h"
+
+#include <map>
+#include <tuple>
+
+namespace scanner {
+namespace internal {
+
+// Maximum number of materialized op outputs remembered by the master. The
+// least recently used entries are forgotten first.
+static const i64 RESULT_CACHE_MAX_ENTRIES = 4096;
+
+// (op index, output column name) -> key of the column. Columns which can not
+// be reused (e.g. they depend on a non-table source) have no key.
+using OpOutputKeys = std::map<std::tuple<i64, std::string>, std::string>;
+
+struct ResultCacheStats {
+  i64 hits = 0;
+  i64 misses = 0;
+};
+
+// Computes the key of every op output column for a job. The key of a column
+// hashes the op name, kernel version, kernel and job arguments, stencil and
+// warmup along with the keys of the op's inputs, bottoming out at the id and
+// row count of the tables read by the job's Column sources. Outputs of ops
+// missing from kernel_versions have no key.
+OpOutputKeys compute_op_output_keys(
+    const DatabaseMetadata& meta, TableMetaCache& table_metas,
+    const proto::Job& job, const std::vector<proto::Op>& ops,
+    const std::map<std::string, std::string>& kernel_versions);
+
+/// Index of op outputs which have been materialized as table columns.
+///
+/// When a bulk job commits, the columns of its output tables are recorded
+/// under the keys of the sink's inputs. A later bulk job which computes an op
+/// output with the same key for every job reads the recorded column with a
+/// Column source instead, and the ops which only fed that op are removed from
+/// its DAG. Entries whose tables have since been deleted are dropped.
+class ResultCache {
+ public:
+  ResultCache(storehouse::StorageBackend* storage);
+
+  // Rewrites ops and jobs to reuse materialized op outputs. job_keys holds
+  // the output keys of each job in the original DAG.
+  ResultCacheStats rewrite(const DatabaseMetadata& meta,
+                           TableMetaCache& table_metas,
+                           const std::vector<OpOutputKeys>& job_keys,
+                           std::vector<proto::Op>& ops,
+                           std::vector<proto::Job>& jobs);
+
+  // Records the columns of a committed output table as the outputs of the
+  // inputs to the sink. Video columns are only recorded if they were stored
+  // losslessly, since otherwise they differ from the op's output.
+  void record(const OpOutputKeys& keys, const proto::Op& sink,
+              const std::vector<proto::OutputColumnCompression>& compression,
+              const TableMetadata& table);
+
+  // Drops entries for deleted tables, evicts the least recently used entries
+  // and writes the index to the database.
+  void save(const DatabaseMetadata& meta, TableMetaCache& table_metas);
+
+ private:
+  const proto::ResultCacheDescriptor::Entry* lookup(
+      const DatabaseMetadata& meta, TableMetaCache& table_metas,
+      const std::string& key);
+
+  storehouse::StorageBackend* storage_;
+  std::map<std::string, proto::ResultCacheDescriptor::Entry> entries_;
+  i64 clock_ = 0;
+};
+
+}
+}
@@ -0,0 +1,166 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/row_set.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+const i64 BITS_PER_WORD = 64;
+
+// Merges sorted rows into sorted, disjoint intervals
+void append_rows(const std::vector<i64>& rows,
+                 std::vector<std::pair<i64, i64>>& intervals) {
+  for (i64 row : rows) {
+    if (!intervals.empty() && row <= intervals.back().second) {
+      intervals.back().second = std::max(intervals.back().second, row + 1);
+    } else {
+      intervals.emplace_back(row, row + 1);
+    }
+  }
+}
+
+// Merges two lists of sorted, disjoint intervals
+std::vector<std::pair<i64, i64>> merge_intervals(
+    const std::vector<std::pair<i64, i64>>& a,
+    const std::vector<std::pair<i64, i64>>& b) {
+  std::vector<std::pair<i64, i64>> sorted;
+  sorted.reserve(a.size() + b.size());
+  std::merge(a.begin(), a.end(), b.begin(), b.end(),
+             std::back_inserter(sorted));
+  std::vector<std::pair<i64, i64>> merged;
+  for (auto& interval : sorted) {
+    if (!merged.empty() && interval.first <= merged.back().second) {
+      merged.back().second = std::max(merged.back().second, interval.second);
+    } else {
+      merged.push_back(interval);
+    }
+  }
+  return merged;
+}
+
+}
+
+RowSet::RowSet(const std::vector<i64>& rows) { insert(rows); }
+
+bool RowSet::contains(i64 row) const {
+  if (is_bitmap_) {
+    i64 bit = row - bitmap_start_;
+    if (bit < 0 || bit >= (i64)bitmap_.size() * BITS_PER_WORD) {
+      return false;
+    }
+    return (bitmap_[bit / BITS_PER_WORD] >> (bit % BITS_PER_WORD)) & 1;
+  }
+  // First interval which starts after row
+  auto it = std::upper_bound(
+      intervals_.begin(), intervals_.end(), row,
+      [](i64 r, const std::pair<i64, i64>& i) { return r < i.first; });
+  return it != intervals_.begin() && row < std::prev(it)->second;
+}
+
+void RowSet::insert(const std::vector<i64>& rows) {
+  if (rows.empty()) {
+    return;
+  }
+  Intervals added;
+  if (std::is_sorted(rows.begin(), rows.end())) {
+    append_rows(rows, added);
+  } else {
+    std::vector<i64> sorted_rows(rows);
+    std::sort(sorted_rows.begin(), sorted_rows.end());
+    append_rows(sorted_rows, added);
+  }
+  assign(empty() ? added : merge_intervals(intervals(), added));
+}
+
+void RowSet::insert(const RowSet& other) {
+  if (other.empty()) {
+    return;
+  }
+  assign(empty() ? other.intervals()
+                 : merge_intervals(intervals(), other.intervals()));
+}
+
+std::vector<i64> RowSet::rows() const {
+  std::vector<i64> rows;
+  rows.reserve(size_);
+  if (is_bitmap_) {
+    for (size_t w = 0; w < bitmap_.size(); ++w) {
+      u64 word = bitmap_[w];
+      while (word != 0) {
+        i64 bit = __builtin_ctzll(word);
+        rows.push_back(bitmap_start_ + w * BITS_PER_WORD + bit);
+        word &= word - 1;
+      }
+    }
+  } else {
+    for (auto& interval : intervals_) {
+      for (i64 r = interval.first; r < interval.second; ++r) {
+        rows.push_back(r);
+      }
+    }
+  }
+  return rows;
+}
+
+bool RowSet::operator==(const RowSet& other) const {
+  return size_ == other.size_ && intervals() == other.intervals();
+}
+
+RowSet::Intervals RowSet::intervals() const {
+  if (!is_bitmap_) {
+    return intervals_;
+  }
+  Intervals intervals;
+  append_rows(rows(), intervals);
+  return intervals;
+}
+
+void RowSet::assign(const Intervals& intervals) {
+  size_ = 0;
+  for (auto& interval : intervals) {
+    size_ += interval.second - interval.first;
+  }
+  intervals_.clear();
+  bitmap_.clear();
+  is_bitmap_ = false;
+  if (intervals.empty()) {
+    return;
+  }
+  i64 start = intervals.front().first;
+  i64 words =
+      (intervals.back().second - start + BITS_PER_WORD - 1) / BITS_PER_WORD;
+  if (words * sizeof(u64) >= intervals.size() * sizeof(intervals[0])) {
+    intervals_ = intervals;
+    return;
+  }
+  is_bitmap_ = true;
+  bitmap_start_ = start;
+  bitmap_.assign(words, 0);
+  for (auto& interval : intervals) {
+    for (i64 r = interval.first; r < interval.second; ++r) {
+      i64 bit = r - start;
+      bitmap_[bit / BITS_PER_WORD] |= (u64)1 << (bit % BITS_PER_WORD);
+    }
+  }
+}
+
+}
+}
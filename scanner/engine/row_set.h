@@ -0,0 +1,73 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+/// Set of row ids of a task.
+///
+/// Rows are stored as sorted, disjoint intervals, so the rows of a dense task
+/// take a single interval however long the task is. Rows which are too
+/// fragmented for that, such as those of a strided sample, are stored as a
+/// bitmap over the range they span instead, whichever is smaller.
+class RowSet {
+ public:
+  RowSet() = default;
+
+  // rows do not need to be sorted or unique
+  RowSet(const std::vector<i64>& rows);
+
+  i64 size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  bool contains(i64 row) const;
+
+  // Adds rows to the set. rows do not need to be sorted or unique.
+  void insert(const std::vector<i64>& rows);
+
+  void insert(const RowSet& other);
+
+  // Returns the rows in increasing order
+  std::vector<i64> rows() const;
+
+  bool operator==(const RowSet& other) const;
+
+  bool operator!=(const RowSet& other) const { return !(*this == other); }
+
+ private:
+  // Half-open [start, end) intervals
+  using Intervals = std::vector<std::pair<i64, i64>>;
+
+  Intervals intervals() const;
+
+  // Stores intervals in whichever representation is smaller
+  void assign(const Intervals& intervals);
+
+  bool is_bitmap_ = false;
+  Intervals intervals_;
+  i64 bitmap_start_ = 0;
+  std::vector<u64> bitmap_;
+  i64 size_ = 0;
+};
+
+}
+}
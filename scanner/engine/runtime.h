@@ -21,6 +21,7 @@
 #include "scanner/engine/kernel_registry.h"
 #include "scanner/engine/metadata.h"
 #include "scanner/engine/op_registry.h"
+#include "scanner/engine/row_set.h"
 #include "scanner/engine/rpc.grpc.pb.h"
 #include "scanner/util/queue.h"
 
@@ -61,13 +62,14 @@ struct EvalWorkEntry {
   // For save and pre worker
   std::vector<FrameInfo> frame_sizes;
   std::vector<bool> compressed;
+  std::vector<proto::VideoDescriptor::VideoCodecType> compression_codecs;
 };
 
 struct TaskStream {
   i64 slice_group;
-  std::vector<i64> valid_input_rows;
-  std::vector<i64> compute_input_rows;
-  std::vector<i64> valid_output_rows;
+  RowSet valid_input_rows;
+  RowSet compute_input_rows;
+  RowSet valid_output_rows;
 };
 
 using LoadInputQueue =
@@ -88,6 +90,9 @@ struct DatabaseParameters {
   i32 num_load_workers;
   i32 num_save_workers;
   std::vector<i32> gpu_ids;
+  std::string disk_cache_path;
+  i64 disk_cache_size;
+  i64 frame_cache_size;
   i64 no_workers_timeout; // in seconds
   std::string python_dir;
 };
@@ -71,6 +71,7 @@ void SaveWorker::feed(EvalWorkEntry& input_entry) {
 
   // Write out each output column to an individual data file
   std::vector<bool> compressed;
+  std::vector<proto::VideoDescriptor::VideoCodecType> codecs;
   std::vector<FrameInfo> frame_info;
   int video_col_idx = 0;
   for (size_t out_idx = 0; out_idx < work_entry.columns.size(); ++out_idx) {
@@ -86,6 +87,7 @@ void SaveWorker::feed(EvalWorkEntry& input_entry) {
                                     CPU_DEVICE, work_entry.columns[out_idx]);
 
     compressed.push_back(work_entry.compressed[out_idx]);
+    codecs.push_back(work_entry.compression_codecs[out_idx]);
     // If this is a video...
     if (work_entry.column_types[out_idx] == ColumnType::Video) {
       // Read frame info column
@@ -101,7 +103,7 @@ void SaveWorker::feed(EvalWorkEntry& input_entry) {
 
   auto& sink = sinks_.at(0);
   if (auto column_sink = dynamic_cast<ColumnSink*>(sink.get())) {
-    column_sink->provide_column_info(compressed, frame_info);
+    column_sink->provide_column_info(compressed, codecs, frame_info);
   }
   // Provide index to sink
   for (size_t i = 0; i < work_entry.columns.size(); ++i) {
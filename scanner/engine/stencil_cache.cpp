@@ -0,0 +1,102 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/stencil_cache.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+i64 next_power_of_two(i64 n) {
+  i64 p = 1;
+  while (p < n) {
+    p <<= 1;
+  }
+  return p;
+}
+
+}
+
+i64 stencil_cache_capacity(const std::vector<i32>& stencil, i32 batch_size) {
+  // Builtin ops have no stencil and read one row at a time
+  i64 window = stencil.empty() ? 1 : stencil.back() - stencil.front() + 1;
+  return next_power_of_two(window + std::max(batch_size, 1) - 1);
+}
+
+StencilCache::StencilCache(i64 capacity)
+  : elements_(next_power_of_two(std::max(capacity, (i64)1))),
+    rows_(elements_.size(), -1) {}
+
+void StencilCache::push_back(i64 row, const Element& element) {
+  assert(empty() || row > back_row());
+  if (size_ == capacity()) {
+    grow();
+  }
+  i64 s = slot(size_);
+  rows_[s] = row;
+  elements_[s] = element;
+  size_++;
+}
+
+const Element* StencilCache::find(i64 row) const {
+  if (empty() || row < front_row() || row > back_row()) {
+    return nullptr;
+  }
+  i64 offset = row - front_row();
+  if (back_row() - front_row() + 1 == size_) {
+    return &elements_[slot(offset)];
+  }
+  // Rows are not consecutive, but a row can be no further from the front
+  // than its offset
+  i64 lo = 0;
+  i64 hi = std::min(offset, size_ - 1);
+  while (lo < hi) {
+    i64 mid = (lo + hi) / 2;
+    if (row_at(mid) < row) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return row_at(lo) == row ? &elements_[slot(lo)] : nullptr;
+}
+
+Element StencilCache::pop_front() {
+  assert(!empty());
+  Element element = elements_[head_];
+  rows_[head_] = -1;
+  head_ = slot(1);
+  size_--;
+  return element;
+}
+
+void StencilCache::grow() {
+  std::vector<Element> elements(capacity() * 2);
+  std::vector<i64> rows(elements.size(), -1);
+  for (i64 i = 0; i < size_; ++i) {
+    elements[i] = elements_[slot(i)];
+    rows[i] = rows_[slot(i)];
+  }
+  elements_.swap(elements);
+  rows_.swap(rows);
+  head_ = 0;
+}
+
+}
+}
@@ -0,0 +1,79 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/api/kernel.h"
+#include "scanner/util/common.h"
+
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+// Number of rows a stencil cache needs to hold to produce a full batch of
+// outputs for a kernel with the given stencil, rounded up to a power of two.
+// An empty stencil is treated as {0}.
+i64 stencil_cache_capacity(const std::vector<i32>& stencil, i32 batch_size);
+
+/// Elements of one kernel input column kept around for the kernel's stencil.
+///
+/// Elements are held in increasing row order in a ring buffer. While the
+/// cached rows are consecutive, as they are for any stencil over a dense
+/// domain, the slot of a row is its offset from the oldest cached row. Rows
+/// of a sparse domain fall back to a binary search over the ring. The ring
+/// doubles in size if more rows are pending than it can hold, so it stops
+/// allocating once it has reached the working set of the kernel.
+class StencilCache {
+ public:
+  StencilCache(i64 capacity = 1);
+
+  i64 size() const { return size_; }
+
+  bool empty() const { return size_ == 0; }
+
+  i64 front_row() const { return rows_[slot(0)]; }
+
+  i64 back_row() const { return rows_[slot(size_ - 1)]; }
+
+  // Row and element at position i, counting from the oldest cached row
+  i64 row_at(i64 i) const { return rows_[slot(i)]; }
+
+  Element& at(i64 i) { return elements_[slot(i)]; }
+
+  // Caches element for row, which must be greater than every cached row
+  void push_back(i64 row, const Element& element);
+
+  // Returns the cached element for row, or nullptr if the row is not cached
+  const Element* find(i64 row) const;
+
+  // Removes and returns the element of the oldest cached row
+  Element pop_front();
+
+ private:
+  i64 slot(i64 i) const { return (head_ + i) & (capacity() - 1); }
+
+  i64 capacity() const { return rows_.size(); }
+
+  void grow();
+
+  std::vector<Element> elements_;
+  std::vector<i64> rows_;
+  i64 head_ = 0;
+  i64 size_ = 0;
+};
+
+}
+}
@@ -14,6 +14,7 @@
  */
 
 #include "scanner/engine/table_meta_cache.h"
+#include "scanner/engine/metadata_log.h"
 #include "scanner/util/thread_pool.h"
 
 namespace scanner {
@@ -23,7 +24,7 @@ static const i32 NUM_PREFETCH_THREADS = 16;
 
 TableMetaCache::TableMetaCache(storehouse::StorageBackend* storage,
                                const DatabaseMetadata& meta)
-  : storage_(storage), meta_(meta) {
+  : storage_(storage), meta_(meta), shards_(NUM_TABLE_CACHE_SHARDS) {
   // Read table megafile
 
   std::string megafile_path = table_megafile_path();
@@ -31,21 +32,35 @@ TableMetaCache::TableMetaCache(storehouse::StorageBackend* storage,
   storehouse::StoreResult result;
   EXP_BACKOFF(storage_->get_file_info(megafile_path, info), result);
   if (result == storehouse::StoreResult::Success) {
-    read_table_megafile(storage, cache_);
+    read_table_megafile(storage,
+                        [&](i32 table_id, const proto::TableDescriptor& td) {
+                          insert(table_id, TableMetadata(td), true);
+                        });
   }
+  // Apply table descriptors which were written after the megafile
+  replay_metadata_log(storage_, meta_.log_sequence(),
+                      [&](const proto::MetadataLogEntry& entry) {
+                        for (const auto& td : entry.table_descriptors()) {
+                          insert(td.id(), TableMetadata(td), true);
+                        }
+                        for (i32 id : entry.removed_tables()) {
+                          Shard& s = shard(id);
+                          std::unique_lock<std::shared_timed_mutex> lock(
+                              s.lock);
+                          s.tables.erase(id);
+                        }
+                      });
 }
 
-const TableMetadata& TableMetaCache::at(const std::string& table_name) const {
-  i32 table_id = meta_.get_table_id(table_name);
-  memoized_read(table_id);
-  std::lock_guard<std::mutex> lock(lock_);
-  return cache_.at(table_id);
+TableMetadata TableMetaCache::at(const std::string& table_name) const {
+  return at(meta_.get_table_id(table_name));
 }
 
-const TableMetadata& TableMetaCache::at(i32 table_id) const {
+TableMetadata TableMetaCache::at(i32 table_id) const {
   memoized_read(table_id);
-  std::lock_guard<std::mutex> lock(lock_);
-  return cache_.at(table_id);
+  Shard& s = shard(table_id);
+  std::shared_lock<std::shared_timed_mutex> lock(s.lock);
+  return s.tables.at(table_id);
 }
 
 bool TableMetaCache::exists(const std::string& table_name) const {
@@ -58,30 +73,47 @@ bool TableMetaCache::exists(i32 table_id) const {
 
 bool TableMetaCache::has(const std::string& table_name) const {
   i32 table_id = meta_.get_table_id(table_name);
-  return cache_.count(table_id) > 0;
+  Shard& s = shard(table_id);
+  std::shared_lock<std::shared_timed_mutex> lock(s.lock);
+  return s.tables.count(table_id) > 0;
 }
 
 void TableMetaCache::update(const TableMetadata& meta) {
-  std::lock_guard<std::mutex> lock(lock_);
   i32 table_id = meta_.get_table_id(meta.name());
-  cache_[table_id] = meta;
+  insert(table_id, meta, true);
+  std::lock_guard<std::mutex> lock(dirty_lock_);
+  dirty_tables_.insert(table_id);
 }
 
 void TableMetaCache::prefetch(const std::vector<std::string>& table_names) {
   VLOG(1) << "Prefetching table metadata";
-  auto load_table_meta = [&](const std::string& table_name) {
+  std::vector<i32> table_ids;
+  for (const auto& table_name : table_names) {
     i32 table_id = meta_.get_table_id(table_name);
-    if (meta_.table_is_committed(table_id)) {
-      std::string table_path = TableMetadata::descriptor_path(table_id);
-      update(read_table_metadata(storage_, table_path));
+    if (table_id == -1 || !meta_.table_is_committed(table_id)) {
+      continue;
+    }
+    Shard& s = shard(table_id);
+    std::shared_lock<std::shared_timed_mutex> lock(s.lock);
+    if (s.tables.count(table_id) == 0) {
+      table_ids.push_back(table_id);
     }
+  }
+  if (table_ids.empty()) {
+    return;
+  }
+
+  auto load_table_meta = [&](i32 table_id) {
+    std::string table_path = TableMetadata::descriptor_path(table_id);
+    insert(table_id, read_table_metadata(storage_, table_path), false);
   };
 
   VLOG(1) << "Spawning thread pool";
-  ThreadPool prefetch_pool(NUM_PREFETCH_THREADS);
+  ThreadPool prefetch_pool(
+      std::min((size_t)NUM_PREFETCH_THREADS, table_ids.size()));
   std::vector<std::future<void>> futures;
-  for (const auto& t : table_names) {
-    futures.emplace_back(prefetch_pool.enqueue(load_table_meta, t));
+  for (i32 table_id : table_ids) {
+    futures.emplace_back(prefetch_pool.enqueue(load_table_meta, table_id));
   }
 
   VLOG(1) << "Waiting on futures";
@@ -92,10 +124,51 @@ void TableMetaCache::prefetch(const std::vector<std::string>& table_names) {
   VLOG(1) << "Prefetch complete.";
 }
 
+std::vector<TableMetadata> TableMetaCache::take_pending_updates() {
+  std::set<i32> dirty_tables;
+  {
+    std::lock_guard<std::mutex> lock(dirty_lock_);
+    dirty_tables.swap(dirty_tables_);
+  }
+  std::vector<TableMetadata> tables;
+  for (i32 table_id : dirty_tables) {
+    Shard& s = shard(table_id);
+    std::shared_lock<std::shared_timed_mutex> lock(s.lock);
+    auto it = s.tables.find(table_id);
+    if (it != s.tables.end()) {
+      tables.push_back(it->second);
+    }
+  }
+  return tables;
+}
+
 void TableMetaCache::write_megafile() {
-  write_table_megafile(storage_, cache_);
+  // Hold every shard for reading so the megafile is a consistent snapshot
+  std::vector<std::shared_lock<std::shared_timed_mutex>> locks;
+  std::vector<const proto::TableDescriptor*> descriptors;
+  for (Shard& s : shards_) {
+    locks.emplace_back(s.lock);
+    for (const auto& kv : s.tables) {
+      descriptors.push_back(&kv.second.get_descriptor());
+    }
+  }
+  write_table_megafile(storage_, descriptors);
 }
 
+TableMetaCache::Shard& TableMetaCache::shard(i32 table_id) const {
+  return shards_[(u32)table_id % NUM_TABLE_CACHE_SHARDS];
+}
+
+void TableMetaCache::insert(i32 table_id, const TableMetadata& meta,
+                            bool overwrite) const {
+  Shard& s = shard(table_id);
+  std::unique_lock<std::shared_timed_mutex> lock(s.lock);
+  if (overwrite) {
+    s.tables[table_id] = meta;
+  } else {
+    s.tables.insert({table_id, meta});
+  }
+}
 
 void TableMetaCache::memoized_read(const std::string& table_name) const {
   memoized_read(meta_.get_table_id(table_name));
@@ -104,14 +177,15 @@ void TableMetaCache::memoized_read(const std::string& table_name) const {
 void TableMetaCache::memoized_read(i32 table_id) const {
   bool b;
   {
-    std::lock_guard<std::mutex> lock(lock_);
-    b = cache_.count(table_id) == 0 && meta_.has_table(table_id);
+    Shard& s = shard(table_id);
+    std::shared_lock<std::shared_timed_mutex> lock(s.lock);
+    b = s.tables.count(table_id) == 0 && meta_.has_table(table_id);
   }
   if (b) {
+    // Storage is read without holding the shard lock. If another thread
+    // loads the same table concurrently, the first insert wins.
     std::string table_path = TableMetadata::descriptor_path(table_id);
-    TableMetadata meta = read_table_metadata(storage_, table_path);
-    std::lock_guard<std::mutex> lock(lock_);
-    cache_.insert({table_id, meta});
+    insert(table_id, read_table_metadata(storage_, table_path), false);
   }
 }
 
@@ -19,18 +19,31 @@
 
 #include <map>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
 
 namespace scanner {
 namespace internal {
 
+// Number of independently locked partitions of the table cache
+static const i32 NUM_TABLE_CACHE_SHARDS = 64;
+
+/// Thread-safe cache of table descriptors.
+///
+/// Descriptors are partitioned by table id into shards which each have their
+/// own reader-writer lock, so lookups from many threads (e.g. when building
+/// tasks for hundreds of thousands of tables) do not serialize on one mutex
+/// and storage reads are never performed while holding a lock.
 class TableMetaCache {
  public:
   TableMetaCache(storehouse::StorageBackend* storage,
                  const DatabaseMetadata& meta);
 
-  const TableMetadata& at(const std::string& table_name) const;
+  // Returns a copy, since another thread may replace the cached descriptor
+  // of the table at any time
+  TableMetadata at(const std::string& table_name) const;
 
-  const TableMetadata& at(i32 table_id) const;
+  TableMetadata at(i32 table_id) const;
 
   bool exists(const std::string& table_name) const;
 
@@ -42,17 +55,31 @@ class TableMetaCache {
 
   void prefetch(const std::vector<std::string>& table_names);
 
+  // Returns the tables modified by update() since the last call, for writing
+  // to the metadata log
+  std::vector<TableMetadata> take_pending_updates();
+
   void write_megafile();
 
  private:
+  struct Shard {
+    mutable std::shared_timed_mutex lock;
+    std::unordered_map<i32, TableMetadata> tables;
+  };
+
+  Shard& shard(i32 table_id) const;
+
+  void insert(i32 table_id, const TableMetadata& meta, bool overwrite) const;
+
   void memoized_read(const std::string& table_name) const;
 
   void memoized_read(i32 table_id) const;
 
   storehouse::StorageBackend* storage_;
   const DatabaseMetadata& meta_;
-  mutable std::mutex lock_;
-  mutable std::unordered_map<i32, TableMetadata> cache_;
+  mutable std::vector<Shard> shards_;
+  std::mutex dirty_lock_;
+  std::set<i32> dirty_tables_;
 };
 
 }
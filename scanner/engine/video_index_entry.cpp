@@ -14,6 +14,7 @@
  */
 
 #include "scanner/engine/video_index_entry.h"
+#include "scanner/util/disk_cache.h"
 
 namespace scanner {
 namespace internal {
@@ -29,9 +30,22 @@ std::unique_ptr<storehouse::RandomReadFile> VideoIndexEntry::open_file() const {
 
 VideoIndexEntry read_video_index(storehouse::StorageBackend* storage,
                                  i32 table_id, i32 column_id, i32 item_id) {
-  VideoMetadata video_meta = read_video_metadata(
-      storage, VideoMetadata::descriptor_path(table_id, column_id, item_id));
-  return read_video_index(storage, video_meta);
+  // Read the descriptor through the disk cache since it is re-read by every
+  // task which touches this item
+  const std::string path =
+      VideoMetadata::descriptor_path(table_id, column_id, item_id);
+  std::unique_ptr<storehouse::RandomReadFile> file;
+  BACKOFF_FAIL(storehouse::make_unique_random_read_file(storage, path, file),
+               "while trying to make read file for " + path);
+  u64 file_size = 0;
+  BACKOFF_FAIL(file->get_size(file_size),
+               "while trying to get size for " + path);
+  std::vector<u8> data(file_size);
+  u64 pos = 0;
+  s_read_cached(file.get(), file_size, data.data(), file_size, pos);
+  proto::VideoDescriptor descriptor;
+  descriptor.ParseFromArray(data.data(), data.size());
+  return read_video_index(storage, VideoMetadata(descriptor));
 }
 
 VideoIndexEntry read_video_index(storehouse::StorageBackend* storage,
@@ -65,12 +79,22 @@ VideoIndexEntry read_video_index(storehouse::StorageBackend* storage,
   index_entry.keyframe_indices = video_meta.keyframe_indices();
   index_entry.sample_offsets = video_meta.sample_offsets();
   index_entry.sample_sizes = video_meta.sample_sizes();
-  if (index_entry.codec_type == proto::VideoDescriptor::H264) {
+  if (index_entry.codec_type != proto::VideoDescriptor::RAW) {
     index_entry.metadata = video_meta.metadata();
     // Update keyframe positions and byte offsets so that the separately
     // encoded videos seem like they are one
+    std::vector<i64> non_ref_per_video =
+        video_meta.non_reference_samples_per_video();
+    // Videos written before non-reference frames were indexed have none
+    if (non_ref_per_video.size() == index_entry.num_encoded_videos) {
+      index_entry.non_reference_samples = video_meta.non_reference_samples();
+      index_entry.non_reference_frames = video_meta.non_reference_frames();
+    } else {
+      non_ref_per_video.assign(index_entry.num_encoded_videos, 0);
+    }
     i64 frame_offset = 0;
     i64 keyframe_offset = 0;
+    i64 non_ref_offset = 0;
     i64 byte_offset = 0;
     for (i64 v = 0; v < index_entry.num_encoded_videos; ++v) {
       for (i64 i = 0; i < index_entry.keyframes_per_video[v]; ++i) {
@@ -81,8 +105,14 @@ VideoIndexEntry read_video_index(storehouse::StorageBackend* storage,
         i64 fo = frame_offset + i;
         index_entry.sample_offsets[fo] += byte_offset;
       }
+      for (i64 i = 0; i < non_ref_per_video[v]; ++i) {
+        i64 no = non_ref_offset + i;
+        index_entry.non_reference_samples[no] += frame_offset;
+        index_entry.non_reference_frames[no] += frame_offset;
+      }
       frame_offset += index_entry.frames_per_video[v];
       keyframe_offset += index_entry.keyframes_per_video[v];
+      non_ref_offset += non_ref_per_video[v];
       byte_offset += index_entry.size_per_video[v];
     }
 
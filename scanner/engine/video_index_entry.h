@@ -47,6 +47,9 @@ struct VideoIndexEntry {
   std::vector<u64> keyframe_indices;
   std::vector<u64> sample_offsets;
   std::vector<u64> sample_sizes;
+  // Sorted by sample
+  std::vector<u64> non_reference_samples;
+  std::vector<u64> non_reference_frames;
   std::vector<u8> metadata;
 };
 
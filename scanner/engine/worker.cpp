@@ -25,6 +25,8 @@
 #include "scanner/engine/python_kernel.h"
 #include "scanner/engine/dag_analysis.h"
 #include "scanner/util/cuda.h"
+#include "scanner/engine/frame_cache.h"
+#include "scanner/util/disk_cache.h"
 #include "scanner/util/glog.h"
 #include "scanner/util/grpc.h"
 
@@ -249,11 +251,35 @@ void evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
                      EvaluateWorkerArgs args) {
   Profiler& profiler = args.profiler;
   EvaluateWorker worker(args);
+  // Outputs held back while the last batch of their task is carried over to
+  // the next task. The first one is the last output of that task.
+  std::deque<std::tuple<std::deque<TaskStream>, EvalWorkEntry>> held_outputs;
+  timepoint_t carry_deadline;
+  auto release_held_outputs = [&]() {
+    if (held_outputs.empty()) {
+      return;
+    }
+    worker.finish_carried_batch(std::get<1>(held_outputs.front()));
+    auto idle_push_start = now();
+    for (auto& held : held_outputs) {
+      output_work.push(held);
+    }
+    held_outputs.clear();
+    args.profiler.add_interval("idle_push", idle_push_start, now());
+  };
   while (true) {
     auto idle_pull_start = now();
 
     std::tuple<std::deque<TaskStream>, EvalWorkEntry> entry;
-    input_work.pop(entry);
+    if (held_outputs.empty()) {
+      input_work.pop(entry);
+    } else {
+      // Wait for the next task until the carried batch times out
+      if (!input_work.pop_until(entry, carry_deadline)) {
+        release_held_outputs();
+        input_work.pop(entry);
+      }
+    }
 
     auto& task_streams = std::get<0>(entry);
     EvalWorkEntry& work_entry = std::get<1>(entry);
@@ -261,6 +287,7 @@ void evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
     args.profiler.add_interval("idle_pull", idle_pull_start, now());
 
     if (work_entry.job_index == -1) {
+      release_held_outputs();
       break;
     }
 
@@ -271,6 +298,12 @@ void evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
     auto work_start = now();
 
     if (task_streams.size() > 0) {
+      // Rows are only carried over to the next task of the same job
+      if (!held_outputs.empty() &&
+          std::get<1>(held_outputs.front()).job_index !=
+              work_entry.job_index) {
+        release_held_outputs();
+      }
       // Start of a new task. Tell kernels what outputs they should produce.
       std::vector<TaskStream> streams;
       for (i32 i = 0; i < args.arg_group.kernel_factories.size(); ++i) {
@@ -296,10 +329,20 @@ void evaluate_driver(EvalQueue& input_work, EvalQueue& output_work,
 
     profiler.add_interval("task", work_start, now());
 
-    auto idle_push_start = now();
-    output_work.push(std::make_tuple(task_streams, output_entry));
-    args.profiler.add_interval("idle_push", idle_push_start, now());
-
+    if (!held_outputs.empty()) {
+      held_outputs.push_back(std::make_tuple(task_streams, output_entry));
+      if (worker.carried_batch_evaluated()) {
+        release_held_outputs();
+      }
+    } else if (worker.has_carried_batch()) {
+      held_outputs.push_back(std::make_tuple(task_streams, output_entry));
+      carry_deadline =
+          now() + std::chrono::milliseconds(args.cross_task_batch_timeout_ms);
+    } else {
+      auto idle_push_start = now();
+      output_work.push(std::make_tuple(task_streams, output_entry));
+      args.profiler.add_interval("idle_push", idle_push_start, now());
+    }
   }
   VLOG(1) << "Evaluate (N/KI: " << args.node_id << "/" << args.ki
           << "): thread finished";
@@ -495,6 +538,15 @@ WorkerImpl::WorkerImpl(DatabaseParameters& db_params,
   storage_ =
       storehouse::StorageBackend::make_from_config(db_params_.storage_config);
 
+  // Local disk cache for reads from remote storage backends
+  DiskCacheConfig disk_cache_config;
+  disk_cache_config.path = db_params_.disk_cache_path;
+  disk_cache_config.capacity = db_params_.disk_cache_size;
+  init_disk_cache(disk_cache_config);
+
+  // Decoded frames shared by the pipeline instances on this node
+  init_frame_cache(db_params_.frame_cache_size);
+
   // Processes jobs in the background
   start_job_processor();
   VLOG(1) << "Worker created.";
@@ -518,9 +570,11 @@ WorkerImpl::~WorkerImpl() {
     watchdog_thread_.join();
   }
   delete storage_;
+  destroy_frame_cache();
   if (memory_pool_initialized_) {
     destroy_memory_allocators();
   }
+  destroy_disk_cache();
 }
 
 grpc::Status WorkerImpl::NewJob(grpc::ServerContext* context,
@@ -902,10 +956,31 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
   populate_analysis_info(ops, analysis_results);
   // Need slice input rows to know which slice we are in
   determine_input_rows_to_slices(meta, table_meta, jobs, ops, analysis_results);
+  std::map<i64, FrameFormat> source_frame_formats =
+      determine_source_frame_formats(ops, analysis_results);
+  std::map<i64, DecoderResize> source_decoder_resizes =
+      determine_source_decoder_resizes(ops, analysis_results);
   remap_input_op_edges(ops, analysis_results);
+  // Decoded frame format and fused resize for each column of the load
+  // worker's output
+  size_t num_source_columns =
+      analysis_results.input_ops_to_first_op_columns.size();
+  std::vector<FrameFormat> frame_formats(num_source_columns,
+                                         FrameFormat::RGB24);
+  std::vector<DecoderResize> decoder_resizes(num_source_columns);
+  for (auto& kv : analysis_results.input_ops_to_first_op_columns) {
+    frame_formats[kv.second] = source_frame_formats.at(kv.first);
+    if (source_decoder_resizes.count(kv.first) > 0) {
+      decoder_resizes[kv.second] = source_decoder_resizes.at(kv.first);
+    }
+  }
   // Analyze op DAG to determine what inputs need to be pipped along
   // and when intermediates can be retired -- essentially liveness analysis
   perform_liveness_analysis(ops, analysis_results);
+  if (!job_params->disable_kernel_fusion()) {
+    determine_fused_kernels(ops, analysis_results);
+  }
+  determine_concurrent_kernels(ops, analysis_results);
   // The live columns at each op index
   std::vector<std::vector<std::tuple<i32, std::string>>>& live_columns =
       analysis_results.live_columns;
@@ -1084,6 +1159,11 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
       auto& cm = groups.back().column_mapping;
       auto& st = groups.back().kernel_stencils;
       auto& bt = groups.back().kernel_batch_sizes;
+      auto& fi = groups.back().fused_inputs;
+      auto& rc = groups.back().run_concurrently;
+      auto& bat = groups.back().batch_across_tasks;
+      auto& rp = groups.back().kernel_replicas;
+      auto& cs = groups.back().carries_state;
       const std::string& op_name = ops.at(i).name();
       op_group.push_back(op_name);
       if (source_registry->has_source(op_name)) {
@@ -1144,6 +1224,40 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
       cm.push_back(column_mapping[i]);
       st.push_back(analysis_results.stencils[i]);
       bt.push_back(analysis_results.batch_sizes[i]);
+      // Only fuse with the previous op if it runs in the same group
+      auto fused_it = analysis_results.fused_kernel_inputs.find(i);
+      if (fused_it != analysis_results.fused_kernel_inputs.end() &&
+          local_op_idx > 0) {
+        fi.push_back(fused_it->second);
+      } else {
+        fi.emplace_back();
+      }
+      bool stateless = analysis_results.bounded_state_ops.count(i) == 0 &&
+                       analysis_results.unbounded_state_ops.count(i) == 0;
+      // Replicas evaluate disjoint batches, so the op must not depend on the
+      // rows evaluated before a batch
+      i32 replicas = std::max(1, ops.at(i).replicas());
+      if (replicas > 1 &&
+          (factory == nullptr || !stateless ||
+           factory->get_device_type() != DeviceType::CPU)) {
+        LOG(WARNING) << "Op " << op_name << " can not be replicated since it "
+                     << "is stateful or not a CPU kernel";
+        replicas = 1;
+      }
+      rp.push_back(replicas);
+      cs.push_back(job_params->task_affinity() &&
+                   analysis_results.bounded_state_ops.count(i) > 0);
+      rc.push_back(analysis_results.concurrent_kernels.count(i) > 0 &&
+                   replicas == 1);
+      // Only the op feeding the sink batches across tasks, since the rows it
+      // carries over are added directly to the output of the previous task
+      bat.push_back(job_params->cross_task_batch_timeout_ms() > 0 &&
+                    i + 2 == ops.size() && factory != nullptr &&
+                    !op_source.back() && !is_builtin_op(op_name) &&
+                    stateless && fi.back().empty() && !rc.back() &&
+                    replicas == 1 &&
+                    analysis_results.stencils[i] == std::vector<i32>{0} &&
+                    analysis_results.batch_sizes[i] > 1);
     }
   }
 
@@ -1221,6 +1335,10 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
       return false;
     }
     if (memory_pool_initialized_) {
+      // Cached frames live in the memory pools
+      if (FrameCache* frame_cache = get_frame_cache()) {
+        frame_cache->clear();
+      }
       destroy_memory_allocators();
     }
     init_memory_allocators(job_params->memory_pool_config(), gpu_ids);
@@ -1438,6 +1556,8 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
 
           // Per worker arguments
           ki, kg, groups[kg], job_params->boundary_condition(),
+          std::max(1, job_params->branch_threads()),
+          job_params->cross_task_batch_timeout_ms(),
           eval_thread_profilers[kg + 1], results[kg]});
       eval_total += 1;
     }
@@ -1462,6 +1582,9 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
           node_id_, num_cpus,
           std::max(1, num_cpus / pipeline_instances_per_node),
           job_params->work_packet_size(),
+          std::max(1, job_params->gop_parallel_decoders()),
+          job_params->decoder_buffered_frames(), frame_formats,
+          decoder_resizes,
 
           // Per worker arguments
           ki, decoder_type, eval_thread_profilers.front(),
@@ -1556,6 +1679,10 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
   // Round robin work
   std::vector<i64> allocated_work_to_queues(pipeline_instances_per_node);
   std::vector<i64> retired_work_for_queues(pipeline_instances_per_node);
+  // Last (job, task) allocated to each pipeline instance, so that with task
+  // affinity the next task of a job goes to the instance holding its state
+  std::vector<std::tuple<i64, i64>> last_task_for_queues(
+      pipeline_instances_per_node, std::make_tuple(-1, -1));
   bool finished = false;
   while (true) {
     if (trigger_shutdown_.raised()) {
@@ -1658,6 +1785,9 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
         // Determine which worker to allocate to
         i32 target_work_queue = -1;
         i32 min_work = std::numeric_limits<i32>::max();
+        i32 previous_task_queue = -1;
+        auto previous_task = std::make_tuple((i64)new_work.job_index(),
+                                             (i64)new_work.task_index() - 1);
         for (int i = 0; i < pipeline_instances_per_node; ++i) {
           i64 outstanding_work =
               allocated_work_to_queues[i] - retired_work_for_queues[i];
@@ -1665,9 +1795,25 @@ bool WorkerImpl::process_job(const proto::BulkJobParameters* job_params,
             min_work = outstanding_work;
             target_work_queue = i;
           }
+          if (last_task_for_queues[i] == previous_task) {
+            previous_task_queue = i;
+          }
+        }
+        // Continue the chain of tasks on the instance which ran the previous
+        // task, unless it is backed up while another instance is idle
+        if (job_params->task_affinity() && previous_task_queue != -1) {
+          i64 outstanding_work =
+              allocated_work_to_queues[previous_task_queue] -
+              retired_work_for_queues[previous_task_queue];
+          if (min_work > 0 ||
+              outstanding_work < job_params->tasks_in_queue_per_pu()) {
+            target_work_queue = previous_task_queue;
+          }
         }
         load_work.push(
             std::make_tuple(target_work_queue, task_stream, stenciled_entry));
+        last_task_for_queues[target_work_queue] = std::make_tuple(
+            (i64)new_work.job_index(), (i64)new_work.task_index());
         allocated_work_to_queues[target_work_queue]++;
         accepted_tasks++;
       }
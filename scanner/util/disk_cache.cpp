@@ -0,0 +1,321 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/disk_cache.h"
+#include "scanner/util/fs.h"
+#include "scanner/util/storehouse.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <tuple>
+
+namespace scanner {
+
+namespace {
+
+std::mutex disk_cache_lock;
+std::unique_ptr<DiskCache> disk_cache;
+i32 disk_cache_users = 0;
+
+std::string block_name_for(const std::string& block_key) {
+  std::stringstream ss;
+  ss << std::hex << std::hash<std::string>{}(block_key);
+  return ss.str();
+}
+
+}
+
+DiskCache::DiskCache(const DiskCacheConfig& config) : config_(config) {
+  LOG_IF(FATAL, config_.block_size <= 0) << "Invalid disk cache block size";
+  mkdir_p(config_.path.c_str(), S_IRWXU);
+
+  // Pick up blocks cached by previous workers on this node
+  rescan();
+  VLOG(1) << "Disk cache at " << config_.path << " has " << entries_.size()
+          << " blocks (" << bytes_used_ << " bytes)";
+}
+
+void DiskCache::read(const std::string& key, u64 version, u64 object_size,
+                     u64 offset, size_t size, u8* buffer, const FetchFn& fetch,
+                     DiskCacheStats* stats) {
+  if (size == 0) {
+    return;
+  }
+  const u64 block_size = config_.block_size;
+  const u64 end = offset + size;
+  assert(end <= object_size);
+  std::vector<u8> data;
+  for (u64 b = offset / block_size; b <= (end - 1) / block_size; ++b) {
+    u64 block_start = b * block_size;
+    u64 block_end = std::min(block_start + block_size, object_size);
+    std::string block_key =
+        key + ":" + std::to_string(version) + ":" + std::to_string(b);
+    std::string block_name = block_name_for(block_key);
+
+    bool hit = read_block(block_name, block_key, data) &&
+               data.size() == block_end - block_start;
+    if (!hit) {
+      data.resize(block_end - block_start);
+      fetch(block_start, data.size(), data.data());
+      write_block(block_name, block_key, data);
+    }
+
+    u64 copy_start = std::max(offset, block_start);
+    u64 copy_end = std::min(end, block_end);
+    memcpy(buffer + (copy_start - offset),
+           data.data() + (copy_start - block_start), copy_end - copy_start);
+
+    std::lock_guard<std::mutex> lock(lock_);
+    for (DiskCacheStats* s : {&stats_, stats}) {
+      if (s == nullptr) {
+        continue;
+      }
+      if (hit) {
+        s->hits++;
+        s->bytes_read_from_cache += copy_end - copy_start;
+      } else {
+        s->misses++;
+        s->bytes_fetched += data.size();
+      }
+    }
+  }
+}
+
+u64 DiskCache::version(const std::string& key, u64 object_size,
+                       const FetchFn& fetch) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    auto it = versions_.find(key);
+    if (it != versions_.end() && it->second.object_size == object_size &&
+        nano_since(it->second.checked) <
+            DISK_CACHE_VERSION_TTL_SECONDS * 1e9) {
+      return it->second.version;
+    }
+  }
+  timepoint_t checked = now();
+  std::stringstream ss;
+  ss << object_size;
+  struct stat st;
+  if (stat(key.c_str(), &st) == 0) {
+    ss << ":" << st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec;
+  }
+  u64 n = std::min(object_size, (u64)DISK_CACHE_FINGERPRINT_BYTES);
+  if (n > 0) {
+    std::string ends(2 * n, '\0');
+    fetch(0, n, (u8*)&ends[0]);
+    fetch(object_size - n, n, (u8*)&ends[n]);
+    ss << ":" << std::hash<std::string>{}(ends);
+  }
+  u64 version = std::hash<std::string>{}(ss.str());
+
+  std::lock_guard<std::mutex> lock(lock_);
+  versions_[key] = ObjectVersion{object_size, version, checked};
+  return version;
+}
+
+DiskCacheStats DiskCache::stats() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return stats_;
+}
+
+i64 DiskCache::bytes_used() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return bytes_used_;
+}
+
+bool DiskCache::read_block(const std::string& block_name,
+                           const std::string& block_key,
+                           std::vector<u8>& data) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (entries_.count(block_name) == 0) {
+      return false;
+    }
+    touch(block_name);
+  }
+  // Other processes on the node order blocks by modification time, so bump
+  // it to mark the block as recently used
+  utimes(block_path(block_name).c_str(), nullptr);
+  // The block may be evicted by another thread or process while we read it,
+  // in which case the open or read fails and we treat it as a miss
+  std::ifstream file(block_path(block_name), std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  u64 key_size;
+  file.read((char*)&key_size, sizeof(u64));
+  std::string stored_key(key_size, '\0');
+  file.read(&stored_key[0], key_size);
+  if (!file || stored_key != block_key) {
+    // Hash collision with a different block
+    return false;
+  }
+  u64 data_size;
+  file.read((char*)&data_size, sizeof(u64));
+  data.resize(data_size);
+  file.read((char*)data.data(), data_size);
+  return (bool)file;
+}
+
+void DiskCache::write_block(const std::string& block_name,
+                            const std::string& block_key,
+                            const std::vector<u8>& data) {
+  if ((i64)data.size() > config_.capacity) {
+    return;
+  }
+  // Write to a temporary file and rename it so readers never observe a
+  // partially written block
+  std::stringstream tmp;
+  tmp << block_path(block_name) << ".tmp." << std::this_thread::get_id();
+  {
+    std::ofstream file(tmp.str(), std::ios::binary | std::ios::trunc);
+    u64 key_size = block_key.size();
+    u64 data_size = data.size();
+    file.write((const char*)&key_size, sizeof(u64));
+    file.write(block_key.data(), key_size);
+    file.write((const char*)&data_size, sizeof(u64));
+    file.write((const char*)data.data(), data_size);
+    if (!file) {
+      LOG(WARNING) << "Failed to write disk cache block " << tmp.str();
+      std::remove(tmp.str().c_str());
+      return;
+    }
+  }
+  if (std::rename(tmp.str().c_str(), block_path(block_name).c_str()) != 0) {
+    std::remove(tmp.str().c_str());
+    return;
+  }
+
+  i64 file_size = sizeof(u64) * 2 + block_key.size() + data.size();
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (entries_.count(block_name) > 0) {
+      erase(block_name);
+    }
+    insert(block_name, file_size);
+    bytes_since_rescan_ += file_size;
+    if (bytes_since_rescan_ < config_.capacity / DISK_CACHE_RESCAN_FRACTION) {
+      return;
+    }
+  }
+  rescan();
+}
+
+void DiskCache::rescan() {
+  // Oldest first, so that the most recently used blocks end up at the front
+  // of the LRU list
+  std::vector<std::tuple<time_t, long, std::string, i64>> existing;
+  DIR* dir = opendir(config_.path.c_str());
+  LOG_IF(FATAL, dir == nullptr) << "Could not open disk cache directory "
+                                << config_.path;
+  while (struct dirent* ent = readdir(dir)) {
+    std::string name(ent->d_name);
+    if (name == "." || name == ".." ||
+        name.find(".tmp") != std::string::npos) {
+      continue;
+    }
+    struct stat st;
+    if (stat(block_path(name).c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      existing.emplace_back(st.st_mtim.tv_sec, st.st_mtim.tv_nsec, name,
+                            st.st_size);
+    }
+  }
+  closedir(dir);
+  std::sort(existing.begin(), existing.end());
+
+  std::lock_guard<std::mutex> lock(lock_);
+  lru_.clear();
+  entries_.clear();
+  bytes_used_ = 0;
+  bytes_since_rescan_ = 0;
+  for (auto& e : existing) {
+    insert(std::get<2>(e), std::get<3>(e));
+  }
+}
+
+void DiskCache::touch(const std::string& block_name) {
+  Entry& entry = entries_.at(block_name);
+  lru_.splice(lru_.begin(), lru_, entry.lru_position);
+}
+
+void DiskCache::insert(const std::string& block_name, i64 size) {
+  lru_.push_front(block_name);
+  entries_[block_name] = Entry{lru_.begin(), size};
+  bytes_used_ += size;
+  // Evict least recently used blocks until we are back under budget
+  while (bytes_used_ > config_.capacity && lru_.size() > 1) {
+    std::string victim = lru_.back();
+    std::remove(block_path(victim).c_str());
+    erase(victim);
+    stats_.evictions++;
+  }
+}
+
+void DiskCache::erase(const std::string& block_name) {
+  auto it = entries_.find(block_name);
+  bytes_used_ -= it->second.size;
+  lru_.erase(it->second.lru_position);
+  entries_.erase(it);
+}
+
+std::string DiskCache::block_path(const std::string& block_name) const {
+  return config_.path + "/" + block_name;
+}
+
+void init_disk_cache(const DiskCacheConfig& config) {
+  std::lock_guard<std::mutex> lock(disk_cache_lock);
+  disk_cache_users++;
+  if (disk_cache || config.path.empty() || config.capacity <= 0) {
+    return;
+  }
+  disk_cache.reset(new DiskCache(config));
+}
+
+void destroy_disk_cache() {
+  std::lock_guard<std::mutex> lock(disk_cache_lock);
+  if (--disk_cache_users <= 0) {
+    disk_cache_users = 0;
+    disk_cache.reset();
+  }
+}
+
+DiskCache* get_disk_cache() { return disk_cache.get(); }
+
+void s_read_cached(storehouse::RandomReadFile* file, u64 file_size, u8* buffer,
+                   size_t size, u64& pos, DiskCacheStats* stats) {
+  DiskCache* cache = get_disk_cache();
+  if (cache == nullptr) {
+    s_read(file, buffer, size, pos);
+    return;
+  }
+  DiskCache::FetchFn fetch = [file](u64 offset, size_t fetch_size,
+                                    u8* fetch_buffer) {
+    u64 fetch_pos = offset;
+    s_read(file, fetch_buffer, fetch_size, fetch_pos);
+  };
+  const std::string path = file->path();
+  cache->read(path, cache->version(path, file_size, fetch), file_size, pos,
+              size, buffer, fetch, stats);
+  pos += size;
+}
+
+}
@@ -0,0 +1,141 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+#include "scanner/util/util.h"
+#include "storehouse/storage_backend.h"
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace scanner {
+
+static const i64 DEFAULT_DISK_CACHE_BLOCK_SIZE = 4L * 1024L * 1024L;
+// Bytes read from each end of an object and hashed into its version, so that
+// an object rewritten with the same size is not served from stale blocks
+static const i64 DISK_CACHE_FINGERPRINT_BYTES = 4096;
+// Seconds for which the version of an object is reused before its ends are
+// read again
+static const i64 DISK_CACHE_VERSION_TTL_SECONDS = 5;
+// The cache directory is rescanned for blocks written by other processes on
+// the node each time this fraction of the capacity has been written
+static const i64 DISK_CACHE_RESCAN_FRACTION = 16;
+
+struct DiskCacheConfig {
+  std::string path;         //!< Local directory holding cached blocks
+  i64 capacity = 0;         //!< Byte budget for this node, 0 disables
+  i64 block_size = DEFAULT_DISK_CACHE_BLOCK_SIZE;
+};
+
+struct DiskCacheStats {
+  i64 hits = 0;
+  i64 misses = 0;
+  i64 bytes_read_from_cache = 0;
+  i64 bytes_fetched = 0;
+  i64 evictions = 0;
+};
+
+/// Size-bounded, read-through cache of remote file contents on local disk.
+///
+/// Objects are split into fixed size blocks. Each block is stored in its own
+/// file named by a hash of (object key, object version, block index), so the
+/// same bytes read by different tasks, sources or jobs resolve to the same
+/// cached block. The least recently used blocks are evicted once the cache
+/// grows beyond its capacity. The capacity applies to the node: blocks
+/// written by other processes sharing the directory are picked up when it is
+/// rescanned, and recency is tracked through the blocks' modification times.
+class DiskCache {
+ public:
+  // Reads size bytes at offset of the remote object into buffer
+  using FetchFn = std::function<void(u64 offset, size_t size, u8* buffer)>;
+
+  DiskCache(const DiskCacheConfig& config);
+
+  // Reads [offset, offset + size) of the object identified by key. The
+  // version should change whenever the object contents change (see
+  // version()). Blocks which are not cached are read with fetch and inserted.
+  // The hits and misses of this read are added to stats if it is given.
+  void read(const std::string& key, u64 version, u64 object_size, u64 offset,
+            size_t size, u8* buffer, const FetchFn& fetch,
+            DiskCacheStats* stats = nullptr);
+
+  // Version of the object identified by key, derived from its size, its
+  // modification time if key is a local path and a hash of the bytes at both
+  // ends of the object, which are read with fetch.
+  u64 version(const std::string& key, u64 object_size, const FetchFn& fetch);
+
+  DiskCacheStats stats() const;
+
+  i64 bytes_used() const;
+
+ private:
+  struct Entry {
+    std::list<std::string>::iterator lru_position;
+    i64 size;
+  };
+
+  struct ObjectVersion {
+    u64 object_size;
+    u64 version;
+    timepoint_t checked;
+  };
+
+  // Rebuilds the index from the blocks in the cache directory, ordered by
+  // modification time, and evicts blocks until the node is under budget
+  void rescan();
+
+  bool read_block(const std::string& block_name, const std::string& block_key,
+                  std::vector<u8>& data);
+
+  void write_block(const std::string& block_name, const std::string& block_key,
+                   const std::vector<u8>& data);
+
+  void touch(const std::string& block_name);
+
+  void insert(const std::string& block_name, i64 size);
+
+  void erase(const std::string& block_name);
+
+  std::string block_path(const std::string& block_name) const;
+
+  DiskCacheConfig config_;
+  mutable std::mutex lock_;
+  std::list<std::string> lru_;  // Front is most recently used
+  std::unordered_map<std::string, Entry> entries_;
+  i64 bytes_used_ = 0;
+  i64 bytes_since_rescan_ = 0;
+  DiskCacheStats stats_;
+  std::unordered_map<std::string, ObjectVersion> versions_;
+};
+
+// Workers in the same process share one cache, which is destroyed when the
+// last of them calls destroy_disk_cache
+void init_disk_cache(const DiskCacheConfig& config);
+
+void destroy_disk_cache();
+
+// Returns nullptr if the disk cache is disabled on this node
+DiskCache* get_disk_cache();
+
+// Same as s_read, but goes through the node's disk cache when it is enabled.
+// The hits and misses of the read are added to stats if it is given.
+void s_read_cached(storehouse::RandomReadFile* file, u64 file_size, u8* buffer,
+                   size_t size, u64& pos, DiskCacheStats* stats = nullptr);
+
+}
@@ -0,0 +1,194 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+#include "scanner/util/h264.h"
+
+#include <vector>
+
+namespace scanner {
+
+// HEVC NAL unit types, from table 7-1 of the H.265 spec
+const i32 HEVC_NAL_RASL_N = 8;
+const i32 HEVC_NAL_RASL_R = 9;
+const i32 HEVC_NAL_BLA_W_LP = 16;
+const i32 HEVC_NAL_IDR_W_RADL = 19;
+const i32 HEVC_NAL_IDR_N_LP = 20;
+const i32 HEVC_NAL_CRA_NUT = 21;
+const i32 HEVC_NAL_VPS = 32;
+const i32 HEVC_NAL_SPS = 33;
+const i32 HEVC_NAL_PPS = 34;
+
+// HEVC NAL units have a two byte header
+inline i32 get_hevc_nal_unit_type(const u8* nal_start) {
+  return (nal_start[0] >> 1) & 0x3F;
+}
+
+inline i32 get_hevc_temporal_id(const u8* nal_start) {
+  return (nal_start[1] & 0x7) - 1;
+}
+
+inline bool is_hevc_vcl_nal(i32 nal_type) { return nal_type < 32; }
+
+// Intra random access point pictures: BLA, IDR and CRA
+inline bool is_hevc_irap_nal(i32 nal_type) {
+  return nal_type >= HEVC_NAL_BLA_W_LP && nal_type <= 23;
+}
+
+// TRAIL_N, TSA_N, STSA_N, RADL_N, RASL_N and the reserved non-reference
+// types. Pictures of these types are not referenced by pictures of the same
+// temporal sub-layer.
+inline bool is_hevc_sub_layer_non_reference_nal(i32 nal_type) {
+  return nal_type <= 14 && nal_type % 2 == 0;
+}
+
+inline bool is_hevc_rasl_nal(i32 nal_type) {
+  return nal_type == HEVC_NAL_RASL_N || nal_type == HEVC_NAL_RASL_R;
+}
+
+// first_slice_segment_in_pic_flag of a slice segment NAL unit
+inline bool is_hevc_first_slice_segment(const u8* nal_start, i32 nal_size) {
+  return nal_size > 2 && (nal_start[2] & 0x80) != 0;
+}
+
+// Removes the emulation prevention bytes from the payload of a NAL unit
+inline void nal_to_rbsp(const u8* payload, i32 size, std::vector<u8>& rbsp) {
+  rbsp.clear();
+  rbsp.reserve(size);
+  u32 consecutive_zeros = 0;
+  for (i32 i = 0; i < size; ++i) {
+    if (consecutive_zeros < 2 || payload[i] != 0x03) {
+      rbsp.push_back(payload[i]);
+    }
+    consecutive_zeros = (payload[i] == 0) ? consecutive_zeros + 1 : 0;
+  }
+}
+
+struct HEVCSPS {
+  u32 vps_id;
+  u32 max_sub_layers;
+  u32 sps_id;
+  bool separate_colour_plane;
+  u32 log2_max_pic_order_cnt_lsb;
+};
+
+struct HEVCPPS {
+  u32 pps_id;
+  u32 sps_id;
+  bool output_flag_present;
+  u32 num_extra_slice_header_bits;
+};
+
+// Parses the RBSP of an SPS up to the size of its POC LSBs (section 7.3.2.2)
+inline bool parse_hevc_sps(GetBitsState& gb, HEVCSPS& info) {
+  info.vps_id = get_bits(gb, 4);
+  info.max_sub_layers = get_bits(gb, 3) + 1;
+  // sps_temporal_id_nesting_flag
+  get_bit(gb);
+
+  // profile_tier_level(1, sps_max_sub_layers_minus1), section 7.3.3
+  i32 sub_layers = info.max_sub_layers - 1;
+  // General profile, tier and level
+  gb.offset += 88 + 8;
+  std::vector<bool> profile_present(sub_layers);
+  std::vector<bool> level_present(sub_layers);
+  for (i32 i = 0; i < sub_layers; ++i) {
+    profile_present[i] = get_bit(gb);
+    level_present[i] = get_bit(gb);
+  }
+  if (sub_layers > 0) {
+    // reserved_zero_2bits
+    gb.offset += 2 * (8 - sub_layers);
+  }
+  for (i32 i = 0; i < sub_layers; ++i) {
+    if (profile_present[i]) {
+      gb.offset += 88;
+    }
+    if (level_present[i]) {
+      gb.offset += 8;
+    }
+  }
+  if (gb.offset >= gb.size * 8) {
+    return false;
+  }
+  info.sps_id = get_ue_golomb(gb);
+  u32 chroma_format_idc = get_ue_golomb(gb);
+  info.separate_colour_plane = chroma_format_idc == 3 && get_bit(gb);
+  // pic_width_in_luma_samples and pic_height_in_luma_samples
+  get_ue_golomb(gb);
+  get_ue_golomb(gb);
+  if (get_bit(gb)) {
+    // conformance_window_flag, followed by the four window offsets
+    for (i32 i = 0; i < 4; ++i) {
+      get_ue_golomb(gb);
+    }
+  }
+  // bit_depth_luma_minus8 and bit_depth_chroma_minus8
+  get_ue_golomb(gb);
+  get_ue_golomb(gb);
+  info.log2_max_pic_order_cnt_lsb = get_ue_golomb(gb) + 4;
+  return info.sps_id < 16 && info.log2_max_pic_order_cnt_lsb <= 16 &&
+         gb.offset <= gb.size * 8;
+}
+
+// Parses the RBSP of a PPS up to num_extra_slice_header_bits (section
+// 7.3.2.3)
+inline bool parse_hevc_pps(GetBitsState& gb, HEVCPPS& info) {
+  info.pps_id = get_ue_golomb(gb);
+  info.sps_id = get_ue_golomb(gb);
+  // dependent_slice_segments_enabled_flag
+  get_bit(gb);
+  info.output_flag_present = get_bit(gb);
+  info.num_extra_slice_header_bits = get_bits(gb, 3);
+  return info.pps_id < 64 && info.sps_id < 16 && gb.offset <= gb.size * 8;
+}
+
+// Id of the PPS referred to by the first slice segment of a picture, whose
+// RBSP after the NAL unit header is in gb (section 7.3.6.1)
+inline u32 get_hevc_slice_pps_id(GetBitsState& gb, i32 nal_unit_type) {
+  // first_slice_segment_in_pic_flag
+  get_bit(gb);
+  if (is_hevc_irap_nal(nal_unit_type)) {
+    // no_output_of_prior_pics_flag
+    get_bit(gb);
+  }
+  return get_ue_golomb(gb);
+}
+
+// slice_pic_order_cnt_lsb of the first slice segment of a picture, read on
+// from get_hevc_slice_pps_id. IDR pictures have no POC LSBs and return 0.
+inline u32 get_hevc_slice_poc_lsb(GetBitsState& gb, i32 nal_unit_type,
+                                  const HEVCSPS& sps, const HEVCPPS& pps) {
+  if (nal_unit_type == HEVC_NAL_IDR_W_RADL ||
+      nal_unit_type == HEVC_NAL_IDR_N_LP) {
+    return 0;
+  }
+  gb.offset += pps.num_extra_slice_header_bits;
+  // slice_type
+  get_ue_golomb(gb);
+  if (pps.output_flag_present) {
+    // pic_output_flag
+    get_bit(gb);
+  }
+  if (sps.separate_colour_plane) {
+    // colour_plane_id
+    gb.offset += 2;
+  }
+  return get_bits(gb, sps.log2_max_pic_order_cnt_lsb);
+}
+
+}
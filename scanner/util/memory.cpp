@@ -359,6 +359,15 @@ class BlockAllocator {
     return find_buffer(buffer, index);
   }
 
+  void get_block(u8* buffer, u8*& block, size_t& block_size) {
+    std::lock_guard<std::mutex> guard(lock_);
+    i32 index;
+    bool found = find_buffer(buffer, index);
+    LOG_IF(FATAL, !found) << "Block allocator queried non-block buffer";
+    block = allocations_[index].buffer;
+    block_size = allocations_[index].size;
+  }
+
   bool find_buffer(u8* buffer, i32& index) {
     i32 num_alloc = allocations_.size();
     for (i32 i = 0; i < num_alloc; ++i) {
@@ -517,6 +526,16 @@ class LinkedAllocator {
     return find_buffer(device, buffer, index);
   }
 
+  void get_block(DeviceHandle device, u8* buffer, u8*& block,
+                 size_t& block_size) {
+    std::lock_guard<std::mutex> guard(lock_);
+    i32 index;
+    bool found = find_buffer(device, buffer, index);
+    LOG_IF(FATAL, !found) << "Linked allocator queried non-block buffer";
+    block = allocations_[index].buffers[device];
+    block_size = allocations_[index].size;
+  }
+
  private:
   bool find_buffer(DeviceHandle device, u8* buffer, i32& index) {
     auto& allocations = allocations_;
@@ -712,6 +731,17 @@ void delete_buffer(DeviceHandle device, u8* buffer) {
 #endif
 }
 
+void get_buffer_block(DeviceHandle device, u8* buffer, u8*& block,
+                      size_t& block_size) {
+  assert(buffer != nullptr);
+#ifdef USE_LINKED_ALLOCATOR
+  linked_allocator->get_block(device, buffer, block, block_size);
+#else
+  BlockAllocator* block_allocator = block_allocator_for_device(device);
+  block_allocator->get_block(buffer, block, block_size);
+#endif
+}
+
 // FIXME(wcrichto): case if transferring between two different GPUs
 void memcpy_buffer(u8* dest_buffer, DeviceHandle dest_device,
                    const u8* src_buffer, DeviceHandle src_device, size_t size) {
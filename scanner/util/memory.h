@@ -54,6 +54,10 @@ void add_buffer_refs(DeviceHandle device, u8* buffer, i32 refs);
 
 void delete_buffer(DeviceHandle device, u8* buffer);
 
+// Gets the start and size of the block allocation which contains buffer
+void get_buffer_block(DeviceHandle device, u8* buffer, u8*& block,
+                      size_t& block_size);
+
 void memcpy_buffer(u8* dest_buffer, DeviceHandle dest_device,
                    const u8* src_buffer, DeviceHandle src_device, size_t size);
 
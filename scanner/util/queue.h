@@ -16,6 +16,7 @@
 #pragma once
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <deque>
 #include <mutex>
@@ -39,6 +40,12 @@ class Queue {
 
   void pop(T& item);
 
+  // Waits until deadline for an item to pop. Returns false if the queue was
+  // still empty at the deadline.
+  template <typename Clock, typename Duration>
+  bool pop_until(T& item,
+                 const std::chrono::time_point<Clock, Duration>& deadline);
+
   void peek(T& item);
 
   void clear();
@@ -93,6 +93,30 @@ void Queue<T>::pop(T& item) {
   not_full_.notify_one();
 }
 
+template <typename T>
+template <typename Clock, typename Duration>
+bool Queue<T>::pop_until(
+    T& item, const std::chrono::time_point<Clock, Duration>& deadline) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  pop_waiters_++;
+  bool popped = not_empty_.wait_until(lock, deadline,
+                                      [this]{ return data_.size() > 0; });
+  pop_waiters_--;
+  if (!popped) {
+    return false;
+  }
+
+  item = data_.front();
+  data_.pop_front();
+
+  lock.unlock();
+  if (size() <= 0) {
+    empty_.notify_all();
+  }
+  not_full_.notify_one();
+  return true;
+}
+
 template <typename T>
 void Queue<T>::peek(T& item) {
   std::unique_lock<std::mutex> lock(mutex_);
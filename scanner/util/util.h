@@ -24,6 +24,7 @@
 #include <chrono>
 #include <condition_variable>
 #include <cstring>
+#include <iomanip>
 #include <mutex>
 #include <sstream>
 #include <string>
@@ -76,6 +77,19 @@ inline std::vector<std::string> split(const std::string& s, char delim) {
   return elems;
 }
 
+// 64-bit FNV-1a as a hex string. Unlike std::hash, this is stable across
+// builds, so it can be used for keys which are persisted in the database.
+inline std::string stable_hash(const std::string& data) {
+  uint64_t h = 14695981039346656037ULL;
+  for (char c : data) {
+    h ^= (uint8_t)c;
+    h *= 1099511628211ULL;
+  }
+  std::stringstream ss;
+  ss << std::hex << std::setw(16) << std::setfill('0') << h;
+  return ss.str();
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// pthread utils
 #define THREAD_RETURN_SUCCESS()      \
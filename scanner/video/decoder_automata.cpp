@@ -14,23 +14,42 @@
  */
 
 #include "scanner/video/decoder_automata.h"
+#include "scanner/engine/decode_cost_model.h"
 #include "scanner/metadata.pb.h"
 
 #include "scanner/util/h264.h"
+#include "scanner/util/h265.h"
 #include "scanner/util/memory.h"
 
+#include <algorithm>
+#include <chrono>
 #include <thread>
 
 namespace scanner {
 namespace internal {
 
+namespace {
+
+// Hardware decoders produce frames on their own threads without notifying
+// us, so waits on the decoder's buffer re-check it at this interval
+const std::chrono::microseconds BUFFER_POLL_INTERVAL(500);
+
+}
+
 DecoderAutomata::DecoderAutomata(DeviceHandle device_handle, i32 num_devices,
-                                 VideoDecoderType decoder_type)
+                                 VideoDecoderType decoder_type,
+                                 i32 max_buffered_frames)
   : device_handle_(device_handle),
     num_devices_(num_devices),
     decoder_type_(decoder_type),
     decoder_(VideoDecoder::make_from_config(device_handle, num_devices,
                                             decoder_type)),
+    max_buffered_frames_(max_buffered_frames > 0
+                             ? max_buffered_frames
+                             : DEFAULT_MAX_DECODER_BUFFERED_FRAMES),
+    buffer_depth_(std::min(INITIAL_DECODER_BUFFERED_FRAMES,
+                           max_buffered_frames_)),
+    feeder_stalled_(false),
     feeder_waiting_(false),
     not_done_(true),
     frames_retrieved_(0),
@@ -44,9 +63,10 @@ DecoderAutomata::~DecoderAutomata() {
     frames_retrieved_ = 0;
     while (decoder_->discard_frame()) {
     }
+    notify_state_changed();
 
     std::unique_lock<std::mutex> lk(feeder_mutex_);
-    wake_feeder_.wait(lk, [this] { return feeder_waiting_.load(); });
+    state_changed_.wait(lk, [this] { return feeder_waiting_.load(); });
 
     if (frames_retrieved_ > 0) {
       decoder_->feed(nullptr, 0, true);
@@ -55,31 +75,55 @@ DecoderAutomata::~DecoderAutomata() {
     feeder_waiting_ = false;
   }
 
-  wake_feeder_.notify_one();
+  state_changed_.notify_all();
   feeder_thread_.join();
 }
 
 void DecoderAutomata::initialize(
     const std::vector<proto::DecodeArgs>& encoded_data) {
   assert(!encoded_data.empty());
+  initialize(encoded_data,
+             FrameInfo::with_format(encoded_data[0].height(),
+                                    encoded_data[0].width(),
+                                    FrameFormat::RGB24));
+}
+
+void DecoderAutomata::initialize(
+    const std::vector<proto::DecodeArgs>& encoded_data,
+    const FrameInfo& info) {
+  assert(!encoded_data.empty());
   while (decoder_->discard_frame()) {
   }
 
   std::unique_lock<std::mutex> lk(feeder_mutex_);
-  wake_feeder_.wait(lk, [this] { return feeder_waiting_.load(); });
+  state_changed_.wait(lk, [this] { return feeder_waiting_.load(); });
 
   encoded_data_ = encoded_data;
-  frame_size_ = encoded_data[0].width() * encoded_data[0].height() * 3;
+  skipped_samples_.assign(encoded_data.size(), {});
+  skipped_frames_.assign(encoded_data.size(), {});
+  for (size_t i = 0; i < encoded_data.size(); ++i) {
+    const auto& args = encoded_data[i];
+    for (i32 j = 0; j < args.non_reference_samples_size(); ++j) {
+      i64 frame = args.non_reference_frames(j);
+      if (!std::binary_search(args.valid_frames().begin(),
+                              args.valid_frames().end(), frame)) {
+        skipped_samples_[i].push_back(args.non_reference_samples(j));
+        skipped_frames_[i].push_back(frame);
+      }
+    }
+    std::sort(skipped_samples_[i].begin(), skipped_samples_[i].end());
+    std::sort(skipped_frames_[i].begin(), skipped_frames_[i].end());
+  }
+  frame_size_ = info.size();
   current_frame_ = encoded_data[0].start_keyframe();
   next_frame_.store(encoded_data[0].valid_frames(0), std::memory_order_release);
   retriever_data_idx_.store(0, std::memory_order_release);
   retriever_valid_idx_ = 0;
 
-  FrameInfo info(encoded_data[0].height(), encoded_data[0].width(), 3,
-                 FrameType::U8);
-
-  if (info_ != info) {
-    decoder_->configure(info);
+  proto::VideoDescriptor::VideoCodecType codec_type =
+      encoded_data[0].codec_type();
+  if (info_ != info || codec_type_ != codec_type) {
+    decoder_->configure(info, codec_type);
   }
   if (frames_retrieved_ > 0) {
     decoder_->feed(nullptr, 0, true);
@@ -87,6 +131,7 @@ void DecoderAutomata::initialize(
 
   set_feeder_idx(0);
   info_ = info;
+  codec_type_ = codec_type;
   std::atomic_thread_fence(std::memory_order_release);
   seeking_ = false;
 }
@@ -101,11 +146,13 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
   {
     // Wait until frames are being requested
     std::unique_lock<std::mutex> lk(feeder_mutex_);
-    wake_feeder_.wait(lk, [this] { return feeder_waiting_.load(); });
+    state_changed_.wait(lk, [this] { return feeder_waiting_.load(); });
   }
 
   frames_retrieved_ = 0;
   frames_to_get_ = num_frames;
+  feeder_stalled_ = false;
+  bool retriever_stalled = false;
   // We don't want to send discontinuity packet and flush until we know
   // we have exhausted this decode args group
   if (encoded_data_.size() > retriever_data_idx_) {
@@ -127,9 +174,8 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
       {
         std::unique_lock<std::mutex> lk(feeder_mutex_);
         feeder_waiting_ = false;
-        LOG(INFO) << "waking feeder!";
       }
-      wake_feeder_.notify_one();
+      state_changed_.notify_all();
     }
   }
 
@@ -139,11 +185,19 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
   }
 
   while (frames_retrieved_ < frames_to_get_) {
+    if (decoder_->decoded_frames_buffered() == 0) {
+      retriever_stalled = true;
+      wait_for_decoded_frames();
+    }
     if (decoder_->decoded_frames_buffered() > 0) {
       auto iter = now();
       // New frames
       bool more_frames = true;
       while (more_frames && frames_retrieved_ < frames_to_get_) {
+        // The decoder never outputs the frames of skipped packets
+        while (is_skipped_frame(retriever_data_idx_, current_frame_)) {
+          current_frame_++;
+        }
         const auto& valid_frames =
             encoded_data_[retriever_data_idx_].valid_frames();
         assert(valid_frames.size() > retriever_valid_idx_.load());
@@ -163,13 +217,21 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
               {
                 // Wait until feeder is waiting
                 //skip_frames_ = true;
-                std::unique_lock<std::mutex> lk(feeder_mutex_);
-                wake_feeder_.wait(lk, [this, &total_frames_decoded] {
-                  while (decoder_->discard_frame()) {
-                    total_frames_decoded++;
+                // while discarding the frames it decodes in the meantime
+                auto discard_until_waiting = [this, &total_frames_decoded] {
+                  if (decoder_->decoded_frames_buffered() > 0) {
+                    while (decoder_->discard_frame()) {
+                      total_frames_decoded++;
+                    }
+                    // Unblock the feeder if it is waiting for buffer space
+                    state_changed_.notify_all();
                   }
                   return feeder_waiting_.load();
-                });
+                };
+                std::unique_lock<std::mutex> lk(feeder_mutex_);
+                while (!state_changed_.wait_for(lk, BUFFER_POLL_INTERVAL,
+                                                discard_until_waiting)) {
+                }
                 //skip_frames_ = false;
               }
 
@@ -184,7 +246,7 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
                 current_frame_ =
                     encoded_data_[retriever_data_idx_].keyframes(0) - 1;
               }
-              wake_feeder_.notify_one();
+              state_changed_.notify_all();
               more_frames = false;
             } else {
               assert(frames_retrieved_ + 1 == frames_to_get_);
@@ -201,6 +263,7 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
         } else {
           more_frames = decoder_->discard_frame();
         }
+        notify_state_changed();
         current_frame_++;
         total_frames_decoded++;
         // printf("curr frame %d, frames decoded %d\n", current_frame_,
@@ -210,9 +273,16 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
         profiler_->add_interval("iter", iter, now());
       }
     }
-    std::this_thread::yield();
   }
   decoder_->wait_until_frames_copied();
+  adapt_buffer_depth(retriever_stalled);
+  if (!encoded_data_.empty()) {
+    // Calibrates the choice between seeking and decoding through frames
+    const proto::DecodeArgs& args = encoded_data_[0];
+    get_decode_cost_model().record_decode(
+        std::make_tuple(args.table_id(), args.column_id(), args.item_id()),
+        total_frames_decoded, nano_since(start) / 1e9);
+  }
   if (profiler_) {
     profiler_->add_interval("get_frames", start, now());
     profiler_->increment("frames_used", total_frames_used);
@@ -220,6 +290,68 @@ void DecoderAutomata::get_frames(u8* buffer, i32 num_frames) {
   }
 }
 
+void DecoderAutomata::notify_state_changed() {
+  // Taking the lock orders the change before a waiter's predicate check, so
+  // the notification can not be lost between the check and the wait
+  { std::unique_lock<std::mutex> lk(feeder_mutex_); }
+  state_changed_.notify_all();
+}
+
+void DecoderAutomata::wait_for_buffer_space() {
+  auto has_space = [this] {
+    return frames_retrieved_ >= frames_to_get_ ||
+           decoder_->decoded_frames_buffered() <= buffer_depth_;
+  };
+  if (has_space()) {
+    return;
+  }
+  auto start = now();
+  feeder_stalled_ = true;
+  // The retriever may be waiting for us while discarding frames
+  state_changed_.notify_all();
+  {
+    std::unique_lock<std::mutex> lk(feeder_mutex_);
+    while (!state_changed_.wait_for(lk, BUFFER_POLL_INTERVAL, has_space)) {
+    }
+  }
+  if (profiler_) {
+    profiler_->add_interval("feeder_stall", start, now());
+  }
+}
+
+void DecoderAutomata::wait_for_decoded_frames() {
+  auto start = now();
+  {
+    std::unique_lock<std::mutex> lk(feeder_mutex_);
+    while (!state_changed_.wait_for(lk, BUFFER_POLL_INTERVAL, [this] {
+      return frames_retrieved_ >= frames_to_get_ ||
+             decoder_->decoded_frames_buffered() > 0;
+    })) {
+    }
+  }
+  if (profiler_) {
+    profiler_->add_interval("retriever_stall", start, now());
+  }
+}
+
+void DecoderAutomata::adapt_buffer_depth(bool retriever_stalled) {
+  i32 depth = buffer_depth_;
+  if (retriever_stalled && feeder_stalled_) {
+    // The feeder was held back even though the retriever ran dry, so a deeper
+    // buffer would have absorbed the difference in their rates
+    depth = std::min(depth * 2, max_buffered_frames_);
+  } else if (!retriever_stalled && feeder_stalled_) {
+    // Frames were always ready, so give back some of the buffered memory
+    i32 min_depth =
+        std::min(MIN_DECODER_BUFFERED_FRAMES, max_buffered_frames_);
+    depth = std::max(depth - 1, min_depth);
+  }
+  if (depth != buffer_depth_ && profiler_) {
+    profiler_->increment("decoder_buffer_depth_changes", 1);
+  }
+  buffer_depth_ = depth;
+}
+
 void DecoderAutomata::set_profiler(Profiler* profiler) {
   profiler_ = profiler;
   decoder_->set_profiler(profiler);
@@ -229,6 +361,7 @@ void DecoderAutomata::feeder() {
   // printf("feeder start\n");
   i64 total_frames_fed = 0;
   i32 frames_fed = 0;
+  i32 packets_skipped = 0;
   seeking_ = false;
   while (not_done_) {
     {
@@ -236,11 +369,11 @@ void DecoderAutomata::feeder() {
       std::unique_lock<std::mutex> lk(feeder_mutex_);
       feeder_waiting_ = true;
     }
-    wake_feeder_.notify_one();
+    state_changed_.notify_all();
 
     {
       std::unique_lock<std::mutex> lk(feeder_mutex_);
-      wake_feeder_.wait(lk, [this] { return !feeder_waiting_; });
+      state_changed_.wait(lk, [this] { return !feeder_waiting_; });
     }
     std::atomic_thread_fence(std::memory_order_acquire);
 
@@ -251,16 +384,13 @@ void DecoderAutomata::feeder() {
 
     if (profiler_) {
       profiler_->increment("frames_fed", frames_fed);
+      profiler_->increment("packets_skipped", packets_skipped);
     }
     frames_fed = 0;
+    packets_skipped = 0;
     bool seen_metadata = false;
     while (frames_retrieved_ < frames_to_get_) {
-      i32 frames_to_wait = 8;
-      while (frames_retrieved_ < frames_to_get_ &&
-             decoder_->decoded_frames_buffered() > frames_to_wait) {
-        wake_feeder_.notify_one();
-        std::this_thread::yield();
-      }
+      wait_for_buffer_space();
       if (skip_frames_) {
         seen_metadata = false;
         seeking_ = true;
@@ -297,9 +427,11 @@ void DecoderAutomata::feeder() {
           if (encoded_packet_size == 0) {
             break;
           }
-          i32 nal_type = get_nal_unit_type(nal_start);
-          i32 nal_ref = get_nal_ref_idc(nal_start);
-          if (is_vcl_nal(nal_type)) {
+          bool is_vcl =
+              (codec_type_ == proto::VideoDescriptor::HEVC)
+                  ? is_hevc_vcl_nal(get_hevc_nal_unit_type(nal_start))
+                  : is_vcl_nal(get_nal_unit_type(nal_start));
+          if (is_vcl) {
             encoded_packet = nal_start -= 3;
             encoded_packet_size = nal_size + encoded_packet_size + 3;
             break;
@@ -307,7 +439,15 @@ void DecoderAutomata::feeder() {
         }
       }
 
-      decoder_->feed(encoded_packet, encoded_packet_size, false);
+      // Packets of non-reference frames which are not requested are not
+      // needed to decode any other frame
+      if (encoded_packet_size > 0 &&
+          is_skipped_sample(fdi, feeder_current_frame_)) {
+        packets_skipped++;
+      } else {
+        decoder_->feed(encoded_packet, encoded_packet_size, false);
+        notify_state_changed();
+      }
 
       if (feeder_current_frame_ == feeder_next_frame_) {
         feeder_valid_idx_++;
@@ -335,11 +475,26 @@ void DecoderAutomata::feeder() {
       } else {
         seen_metadata = true;
       }
-      std::this_thread::yield();
     }
   }
 }
 
+bool DecoderAutomata::is_skipped_sample(i32 data_idx, i64 sample) const {
+  if (data_idx >= skipped_samples_.size()) {
+    return false;
+  }
+  const auto& samples = skipped_samples_[data_idx];
+  return std::binary_search(samples.begin(), samples.end(), sample);
+}
+
+bool DecoderAutomata::is_skipped_frame(i32 data_idx, i64 frame) const {
+  if (data_idx >= skipped_frames_.size()) {
+    return false;
+  }
+  const auto& frames = skipped_frames_[data_idx];
+  return std::binary_search(frames.begin(), frames.end(), frame);
+}
+
 void DecoderAutomata::set_feeder_idx(i32 data_idx) {
   feeder_data_idx_ = data_idx;
   feeder_valid_idx_ = 0;
@@ -350,5 +505,138 @@ void DecoderAutomata::set_feeder_idx(i32 data_idx) {
     feeder_next_keyframe_ = encoded_data_[feeder_data_idx_].keyframes(1);
   }
 }
+
+namespace {
+
+// Copies the GOPs of args from keyframes(first) up to keyframes(last). The
+// encoded video of the copy points into the buffer of args.
+proto::DecodeArgs slice_decode_args(const proto::DecodeArgs& args, i32 first,
+                                    i32 last) {
+  i64 start_keyframe = args.keyframes(first);
+  i64 end_keyframe = args.keyframes(last);
+  i64 start_sample = start_keyframe - args.start_keyframe();
+  i64 end_sample = end_keyframe - args.start_keyframe();
+  u64 start_offset = args.sample_offsets(start_sample);
+  u64 end_offset = (end_keyframe == args.end_keyframe())
+                       ? args.encoded_video_size()
+                       : args.sample_offsets(end_sample);
+
+  proto::DecodeArgs slice;
+  slice.set_width(args.width());
+  slice.set_height(args.height());
+  slice.set_start_keyframe(start_keyframe);
+  slice.set_end_keyframe(end_keyframe);
+  for (i32 k = first; k <= last; ++k) {
+    slice.add_keyframes(args.keyframes(k));
+    if (k < args.keyframe_indices_size()) {
+      slice.add_keyframe_indices(args.keyframe_indices(k));
+    }
+  }
+  for (i64 i = start_sample; i <= end_sample && i < args.sample_sizes_size();
+       ++i) {
+    slice.add_sample_offsets(args.sample_offsets(i) - start_offset);
+    slice.add_sample_sizes(args.sample_sizes(i));
+  }
+  for (i64 frame : args.valid_frames()) {
+    if (frame >= start_keyframe && frame < end_keyframe) {
+      slice.add_valid_frames(frame);
+    }
+  }
+  for (i32 i = 0; i < args.non_reference_samples_size(); ++i) {
+    i64 sample = args.non_reference_samples(i);
+    if (sample >= start_keyframe && sample < end_keyframe) {
+      slice.add_non_reference_samples(sample);
+      slice.add_non_reference_frames(args.non_reference_frames(i));
+    }
+  }
+  slice.set_encoded_video(args.encoded_video() + start_offset);
+  slice.set_encoded_video_size(end_offset - start_offset);
+  slice.set_metadata(args.metadata());
+  slice.set_codec_type(args.codec_type());
+  return slice;
+}
+
+}
+
+std::vector<std::vector<proto::DecodeArgs>> split_decode_args_at_keyframes(
+    const std::vector<proto::DecodeArgs>& encoded_data, i32 num_groups) {
+  bool splittable = true;
+  for (const auto& args : encoded_data) {
+    splittable &= (args.keyframes_size() >= 2);
+  }
+  if (!splittable) {
+    std::vector<proto::DecodeArgs> nonempty;
+    for (const auto& args : encoded_data) {
+      if (args.valid_frames_size() > 0) {
+        nonempty.push_back(args);
+      }
+    }
+    if (nonempty.empty()) {
+      return {};
+    }
+    return {nonempty};
+  }
+
+  // GOPs which contain valid frames, along with the number of packets which
+  // must be decoded to reach the last valid frame in them
+  struct GOP {
+    size_t data_idx;
+    i32 keyframe_idx;
+    i64 cost;
+  };
+  std::vector<GOP> gops;
+  i64 remaining_cost = 0;
+  for (size_t i = 0; i < encoded_data.size(); ++i) {
+    const proto::DecodeArgs& args = encoded_data[i];
+    i32 valid_idx = 0;
+    for (i32 k = 0; k + 1 < args.keyframes_size(); ++k) {
+      i64 last_valid_frame = -1;
+      while (valid_idx < args.valid_frames_size() &&
+             args.valid_frames(valid_idx) < args.keyframes(k + 1)) {
+        last_valid_frame = args.valid_frames(valid_idx++);
+      }
+      if (last_valid_frame >= 0) {
+        i64 cost = last_valid_frame - args.keyframes(k) + 1;
+        gops.push_back(GOP{i, k, cost});
+        remaining_cost += cost;
+      }
+    }
+  }
+
+  std::vector<std::vector<proto::DecodeArgs>> groups;
+  size_t gop_idx = 0;
+  while (gop_idx < gops.size()) {
+    // Give this group its share of the remaining work, adding GOPs while that
+    // brings it closer to the share. The last group takes everything left.
+    i64 target_cost = remaining_cost / (num_groups - (i64)groups.size());
+    bool last_group = (groups.size() + 1 == (size_t)num_groups);
+    size_t end_idx = gop_idx;
+    i64 cost = 0;
+    while (end_idx < gops.size() &&
+           (cost == 0 || last_group ||
+            2 * cost + gops[end_idx].cost < 2 * target_cost)) {
+      cost += gops[end_idx++].cost;
+    }
+    remaining_cost -= cost;
+
+    // Consecutive GOPs from the same decode args are decoded as one segment
+    // so the decoder is only flushed between segments
+    groups.emplace_back();
+    while (gop_idx < end_idx) {
+      size_t run_end = gop_idx + 1;
+      while (run_end < end_idx &&
+             gops[run_end].data_idx == gops[gop_idx].data_idx &&
+             gops[run_end].keyframe_idx == gops[run_end - 1].keyframe_idx + 1) {
+        run_end++;
+      }
+      groups.back().push_back(
+          slice_decode_args(encoded_data[gops[gop_idx].data_idx],
+                            gops[gop_idx].keyframe_idx,
+                            gops[run_end - 1].keyframe_idx + 1));
+      gop_idx = run_end;
+    }
+  }
+  return groups;
+}
 }
 }
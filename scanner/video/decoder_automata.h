@@ -25,18 +25,32 @@
 namespace scanner {
 namespace internal {
 
+// Bounds on the number of decoded frames the feeder lets the decoder buffer
+// ahead of the frames being retrieved
+static const i32 DEFAULT_MAX_DECODER_BUFFERED_FRAMES = 32;
+static const i32 MIN_DECODER_BUFFERED_FRAMES = 2;
+static const i32 INITIAL_DECODER_BUFFERED_FRAMES = 8;
+
 class DecoderAutomata {
   DecoderAutomata() = delete;
   DecoderAutomata(const DecoderAutomata&) = delete;
   DecoderAutomata(const DecoderAutomata&& other) = delete;
 
  public:
+  // The number of frames buffered by the decoder adapts between
+  // MIN_DECODER_BUFFERED_FRAMES and max_buffered_frames. 0 uses the default.
   DecoderAutomata(DeviceHandle device_handle, i32 num_devices,
-                  VideoDecoderType decoder_type);
+                  VideoDecoderType decoder_type, i32 max_buffered_frames = 0);
   ~DecoderAutomata();
 
+  // Frames are decoded into RGB24 at the size of the video
   void initialize(const std::vector<proto::DecodeArgs>& encoded_data);
 
+  // Frames are decoded into the size and format of output_info. Only the
+  // software decoder supports other formats than RGB24 or resizing.
+  void initialize(const std::vector<proto::DecodeArgs>& encoded_data,
+                  const FrameInfo& output_info);
+
   void get_frames(u8* buffer, i32 num_frames);
 
   void set_profiler(Profiler* profiler);
@@ -46,7 +60,24 @@ class DecoderAutomata {
 
   void set_feeder_idx(i32 data_idx);
 
-  const i32 MAX_BUFFERED_FRAMES = 8;
+  // Wakes up the feeder and the retriever after the state they wait on has
+  // changed
+  void notify_state_changed();
+
+  // Blocks the feeder until the decoder buffers at most buffer_depth_ frames
+  void wait_for_buffer_space();
+
+  // Blocks the retriever until the decoder has buffered a frame
+  void wait_for_decoded_frames();
+
+  // Resizes buffer_depth_ based on the stalls of the last get_frames
+  void adapt_buffer_depth(bool retriever_stalled);
+
+  // Whether the packet of a sample of encoded_data_[data_idx] is not fed to
+  // the decoder, and whether the frame it decodes to is therefore missing
+  // from the decoder's output
+  bool is_skipped_sample(i32 data_idx, i64 sample) const;
+  bool is_skipped_frame(i32 data_idx, i64 frame) const;
 
   Profiler* profiler_ = nullptr;
 
@@ -54,15 +85,24 @@ class DecoderAutomata {
   i32 num_devices_;
   VideoDecoderType decoder_type_;
   std::unique_ptr<VideoDecoder> decoder_;
+  const i32 max_buffered_frames_;
+  std::atomic<i32> buffer_depth_;
+  std::atomic<bool> feeder_stalled_;
   std::atomic<bool> feeder_waiting_;
   std::thread feeder_thread_;
   std::atomic<bool> not_done_;
 
   FrameInfo info_{};
+  proto::VideoDescriptor::VideoCodecType codec_type_ =
+      proto::VideoDescriptor::H264;
   size_t frame_size_;
   i32 current_frame_;
   std::atomic<i32> reset_current_frame_;
   std::vector<proto::DecodeArgs> encoded_data_;
+  // Per decode args, the sorted non-reference samples which decode to frames
+  // that are not valid, and those frames
+  std::vector<std::vector<i64>> skipped_samples_;
+  std::vector<std::vector<i64>> skipped_frames_;
 
   std::atomic<i64> next_frame_;
   std::atomic<i64> frames_retrieved_;
@@ -81,7 +121,19 @@ class DecoderAutomata {
   std::atomic<size_t> feeder_buffer_offset_;
   std::atomic<i64> feeder_next_keyframe_;
   std::mutex feeder_mutex_;
-  std::condition_variable wake_feeder_;
+  // Signalled when the feeder handshake, the frames requested or the frames
+  // buffered by the decoder change
+  std::condition_variable state_changed_;
 };
+
+// Splits the decode args of a task into at most num_groups groups which can be
+// decoded independently by separate decoders. Every group starts at a keyframe
+// and the groups are balanced by the number of packets which must be decoded.
+// GOPs without valid frames are dropped, so no groups are returned if there
+// is nothing to decode. Concatenating the valid frames of the groups in order
+// gives the valid frames of encoded_data. The returned args point into the
+// encoded video buffers of encoded_data, which must outlive them.
+std::vector<std::vector<proto::DecodeArgs>> split_decode_args_at_keyframes(
+    const std::vector<proto::DecodeArgs>& encoded_data, i32 num_groups);
 }
 }
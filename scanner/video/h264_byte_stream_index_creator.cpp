@@ -36,6 +36,7 @@ extern "C" {
 #include "libswscale/swscale.h"
 }
 
+#include <algorithm>
 #include <cassert>
 #include <fstream>
 
@@ -47,7 +48,10 @@ namespace scanner {
 namespace internal {
 
 H264ByteStreamIndexCreator::H264ByteStreamIndexCreator(WriteFile* b)
-  : demuxed_bytestream_(b) {}
+  : demuxed_bytestream_(b), bytestream_buffer_(nullptr) {}
+
+H264ByteStreamIndexCreator::H264ByteStreamIndexCreator(std::vector<u8>* b)
+  : demuxed_bytestream_(nullptr), bytestream_buffer_(b) {}
 
 bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
   u8* orig_data = data;
@@ -77,9 +81,6 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
     VLOG(2) << "frame " << frame_ << ", nal size " << nal_size
             << ", nal_ref_idc " << nal_ref_idc << ", nal unit "
             << nal_unit_type;
-    if (nal_ref_idc == 0) {
-      num_non_ref_frames_ += 1;
-    }
     if (nal_unit_type > 4) {
       if (!in_meta_packet_sequence_) {
         meta_packet_sequence_start_offset_ = nal_bytestream_offset;
@@ -88,75 +89,10 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
         saw_sps_nal_ = false;
       }
     }
-    std::vector<u8> rbsp_buffer;
-    rbsp_buffer.reserve(64 * 1024);
-    u32 consecutive_zeros = 0;
-    i32 bytes = nal_size - 1;
-    const u8* pb = nal_start + 1;
-    while (bytes > 0) {
-      /* Copy the byte into the rbsp, unless it
-       * is the 0x03 in a 0x000003 */
-      if (consecutive_zeros < 2 || *pb != 0x03) {
-        rbsp_buffer.push_back(*pb);
-      }
-      if (*pb == 0) {
-        ++consecutive_zeros;
-      } else {
-        consecutive_zeros = 0;
-      }
-      ++pb;
-      --bytes;
-    }
-
-    // We need to track the last SPS NAL because some streams do
-    // not insert an SPS every keyframe and we need to insert it
-    // ourselves.
-    // fprintf(stderr, "nal_size %d, rbsp size %lu\n", nal_size,
-    // rbsp_buffer.size());
-    const u8* rbsp_start = rbsp_buffer.data();
-    i32 rbsp_size = rbsp_buffer.size();
-
-    // SPS
-    if (nal_unit_type == 7) {
-      saw_sps_nal_ = true;
-      i32 offset = 8;
-      GetBitsState gb;
-      gb.buffer = rbsp_start;
-      gb.offset = 0;
-      SPS sps;
-      if (!parse_sps(gb, sps)) {
-        error_message_ = "Failed to parse sps";
+    if (nal_unit_type == 7 || nal_unit_type == 8) {
+      if (!parse_parameter_set(nal_unit_type, nal_start, nal_size)) {
         return false;
       }
-      i32 sps_id = sps.sps_id;
-      sps_map_[sps_id] = sps;
-      last_sps_ = sps.sps_id;
-
-      sps_nal_bytes_[sps_id].clear();
-      sps_nal_bytes_[sps_id].insert(sps_nal_bytes_[sps_id].end(), nal_start - 3,
-                                    nal_start + nal_size + 3);
-      VLOG(2) << "Last SPS NAL (" << sps_id << ", " << offset << ")"
-              << " seen at frame " << frame_;
-    }
-    // PPS
-    if (nal_unit_type == 8) {
-      GetBitsState gb;
-      gb.buffer = rbsp_start;
-      gb.offset = 0;
-      PPS pps;
-      if (!parse_pps(gb, pps)) {
-        error_message_ = "Failed to parse pps";
-        return false;
-      }
-      pps_map_[pps.pps_id] = pps;
-      last_pps_ = pps.pps_id;
-      saw_pps_nal_ = true;
-      i32 pps_id = pps.pps_id;
-      pps_nal_bytes_[pps_id].clear();
-      pps_nal_bytes_[pps_id].insert(pps_nal_bytes_[pps_id].end(), nal_start - 3,
-                                    nal_start + nal_size + 3);
-      VLOG(2) << "PPS id " << pps.pps_id << ", SPS id " << pps.sps_id
-              << ", frame " << frame_;
     }
     if (is_vcl_nal(nal_unit_type)) {
       assert(last_pps_ != -1);
@@ -173,6 +109,18 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
       // printf("ref_idx_l0 %d, ref_idx_l1 %d\n",
       // sh.num_ref_idx_l0_active, sh.num_ref_idx_l1_active);
       if (frame_ == 0 || is_new_access_unit(sps_map_, pps_map_, prev_sh_, sh)) {
+        if (nal_unit_type == 5) {
+          finish_gop();
+          gop_start_ = frame_;
+          gop_mappable_ = true;
+        }
+        const SPS& sps = sps_map_.at(last_sps_);
+        if (sps.poc_type == 1 || sh.field_pic_flag) {
+          // Display order is not tracked for these streams
+          gop_mappable_ = false;
+        }
+        gop_pocs_.push_back(picture_order_count(sps, sh));
+        gop_is_reference_.push_back(nal_ref_idc != 0);
         frame_++;
         size_t bytestream_offset;
         sample_offsets_.push_back(nal_bytestream_offset);
@@ -199,21 +147,21 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
 
           for (auto& kv : sps_nal_bytes_) {
             auto& sps_nal = kv.second;
-            s_write(demuxed_bytestream_, sps_nal.data(), sps_nal.size());
+            write(sps_nal.data(), sps_nal.size());
           }
           for (auto& kv : pps_nal_bytes_) {
             auto& pps_nal = kv.second;
-            s_write(demuxed_bytestream_, pps_nal.data(), pps_nal.size());
+            write(pps_nal.data(), pps_nal.size());
           }
           // Append the packet to the stream
-          s_write(demuxed_bytestream_, orig_data, orig_size);
+          write(orig_data, orig_size);
 
           bytestream_pos_ += size;
 
           total_size = size;
         } else {
           // Append the packet to the stream
-          s_write(demuxed_bytestream_, orig_data, orig_size);
+          write(orig_data, orig_size);
 
           bytestream_pos_ += orig_size;
 
@@ -228,5 +176,197 @@ bool H264ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
   }
   return true;
 }
+
+bool H264ByteStreamIndexCreator::parse_parameter_set(i32 nal_unit_type,
+                                                     const u8* nal_start,
+                                                     i32 nal_size) {
+  // Only parameter sets are parsed from the RBSP, so the emulation prevention
+  // bytes are removed from them alone
+  std::vector<u8> rbsp_buffer;
+  rbsp_buffer.reserve(nal_size);
+  u32 consecutive_zeros = 0;
+  i32 bytes = nal_size - 1;
+  const u8* pb = nal_start + 1;
+  while (bytes > 0) {
+    /* Copy the byte into the rbsp, unless it
+     * is the 0x03 in a 0x000003 */
+    if (consecutive_zeros < 2 || *pb != 0x03) {
+      rbsp_buffer.push_back(*pb);
+    }
+    if (*pb == 0) {
+      ++consecutive_zeros;
+    } else {
+      consecutive_zeros = 0;
+    }
+    ++pb;
+    --bytes;
+  }
+
+  // We need to track the last SPS NAL because some streams do
+  // not insert an SPS every keyframe and we need to insert it
+  // ourselves.
+  const u8* rbsp_start = rbsp_buffer.data();
+
+  // SPS
+  if (nal_unit_type == 7) {
+    saw_sps_nal_ = true;
+    i32 offset = 8;
+    GetBitsState gb;
+    gb.buffer = rbsp_start;
+    gb.offset = 0;
+    SPS sps;
+    if (!parse_sps(gb, sps)) {
+      error_message_ = "Failed to parse sps";
+      return false;
+    }
+    i32 sps_id = sps.sps_id;
+    sps_map_[sps_id] = sps;
+    last_sps_ = sps.sps_id;
+
+    sps_nal_bytes_[sps_id].clear();
+    sps_nal_bytes_[sps_id].insert(sps_nal_bytes_[sps_id].end(), nal_start - 3,
+                                  nal_start + nal_size + 3);
+    VLOG(2) << "Last SPS NAL (" << sps_id << ", " << offset << ")"
+            << " seen at frame " << frame_;
+  }
+  // PPS
+  if (nal_unit_type == 8) {
+    GetBitsState gb;
+    gb.buffer = rbsp_start;
+    gb.offset = 0;
+    PPS pps;
+    if (!parse_pps(gb, pps)) {
+      error_message_ = "Failed to parse pps";
+      return false;
+    }
+    pps_map_[pps.pps_id] = pps;
+    last_pps_ = pps.pps_id;
+    saw_pps_nal_ = true;
+    i32 pps_id = pps.pps_id;
+    pps_nal_bytes_[pps_id].clear();
+    pps_nal_bytes_[pps_id].insert(pps_nal_bytes_[pps_id].end(), nal_start - 3,
+                                  nal_start + nal_size + 3);
+    VLOG(2) << "PPS id " << pps.pps_id << ", SPS id " << pps.sps_id
+            << ", frame " << frame_;
+  }
+  return true;
+}
+
+bool H264ByteStreamIndexCreator::scan_packet(const u8* data, size_t size,
+                                             bool& is_idr) {
+  is_idr = false;
+  const u8* nal_parse = data;
+  i32 size_left = size;
+  while (size_left > 3) {
+    // Parameter sets precede the slices of an access unit, so we stop at the
+    // first slice instead of scanning through its data
+    while (size_left > 2 &&
+           !(nal_parse[0] == 0x00 && nal_parse[1] == 0x00 &&
+             nal_parse[2] == 0x01)) {
+      nal_parse++;
+      size_left--;
+    }
+    if (size_left <= 3) {
+      break;
+    }
+    i32 nal_unit_type = get_nal_unit_type(nal_parse + 3);
+    if (is_vcl_nal(nal_unit_type)) {
+      is_idr = (nal_unit_type == 5);
+      break;
+    }
+    const u8* nal_start = nullptr;
+    i32 nal_size = 0;
+    next_nal(nal_parse, size_left, nal_start, nal_size);
+    if (size_left < 0 || nal_size < 1) {
+      continue;
+    }
+    if (nal_unit_type == 7 || nal_unit_type == 8) {
+      if (!parse_parameter_set(nal_unit_type, nal_start, nal_size)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void H264ByteStreamIndexCreator::copy_parameter_sets(
+    const H264ByteStreamIndexCreator& other) {
+  sps_map_ = other.sps_map_;
+  pps_map_ = other.pps_map_;
+  sps_nal_bytes_ = other.sps_nal_bytes_;
+  pps_nal_bytes_ = other.pps_nal_bytes_;
+  last_sps_ = other.last_sps_;
+  last_pps_ = other.last_pps_;
+}
+
+void H264ByteStreamIndexCreator::write(const u8* data, size_t size) {
+  if (demuxed_bytestream_ != nullptr) {
+    s_write(demuxed_bytestream_, data, size);
+  } else {
+    bytestream_buffer_->insert(bytestream_buffer_->end(), data, data + size);
+  }
+}
+
+void H264ByteStreamIndexCreator::finish() { finish_gop(); }
+
+void H264ByteStreamIndexCreator::finish_gop() {
+  i64 num_samples = gop_pocs_.size();
+  std::vector<i64> display_order(num_samples);
+  for (i64 i = 0; i < num_samples; ++i) {
+    display_order[i] = i;
+    if (!gop_is_reference_[i]) {
+      num_non_ref_frames_++;
+    }
+  }
+  std::stable_sort(
+      display_order.begin(), display_order.end(),
+      [this](i64 a, i64 b) { return gop_pocs_[a] < gop_pocs_[b]; });
+  for (i64 i = 1; i < num_samples; ++i) {
+    if (gop_pocs_[display_order[i - 1]] == gop_pocs_[display_order[i]]) {
+      gop_mappable_ = false;
+    }
+  }
+  if (gop_mappable_) {
+    std::vector<i64> frame_of_sample(num_samples);
+    for (i64 i = 0; i < num_samples; ++i) {
+      frame_of_sample[display_order[i]] = gop_start_ + i;
+    }
+    for (i64 i = 0; i < num_samples; ++i) {
+      if (!gop_is_reference_[i]) {
+        non_reference_samples_.push_back(gop_start_ + i);
+        non_reference_frames_.push_back(frame_of_sample[i]);
+      }
+    }
+  }
+  gop_pocs_.clear();
+  gop_is_reference_.clear();
+  gop_mappable_ = false;
+}
+
+i64 H264ByteStreamIndexCreator::picture_order_count(const SPS& sps,
+                                                     const SliceHeader& sh) {
+  if (sps.poc_type == 2) {
+    // Display order is decode order
+    return gop_pocs_.size();
+  }
+  if (sh.nal_unit_type == 5) {
+    prev_poc_msb_ = 0;
+    prev_poc_lsb_ = 0;
+  }
+  // Section 8.2.1.1 of the H.264 spec
+  i64 max_lsb = 1LL << sps.log2_max_pic_order_cnt_lsb;
+  i64 lsb = sh.pic_order_cnt_lsb;
+  i64 msb = prev_poc_msb_;
+  if (lsb < prev_poc_lsb_ && prev_poc_lsb_ - lsb >= max_lsb / 2) {
+    msb += max_lsb;
+  } else if (lsb > prev_poc_lsb_ && lsb - prev_poc_lsb_ > max_lsb / 2) {
+    msb -= max_lsb;
+  }
+  if (sh.nal_ref_idc != 0) {
+    prev_poc_msb_ = msb;
+    prev_poc_lsb_ = lsb;
+  }
+  return msb + lsb;
+}
 }
 }
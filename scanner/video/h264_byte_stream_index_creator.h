@@ -31,12 +31,36 @@ class H264ByteStreamIndexCreator {
  public:
   H264ByteStreamIndexCreator(storehouse::WriteFile* demuxed_bytestream);
 
+  // Appends the demuxed bytestream to a buffer instead of a file
+  H264ByteStreamIndexCreator(std::vector<u8>* demuxed_bytestream);
+
   bool feed_packet(u8* data, size_t size);
 
+  // Records the parameter sets of a packet without indexing it, and whether
+  // the packet holds an IDR frame. Only reads the NAL units before the first
+  // slice of the packet.
+  bool scan_packet(const u8* data, size_t size, bool& is_idr);
+
+  // Starts indexing with the parameter sets recorded by other, so that a
+  // stream can be indexed in pieces which start at IDR frames
+  void copy_parameter_sets(const H264ByteStreamIndexCreator& other);
+
+  // Must be called after the last packet has been fed
+  void finish();
+
   const std::vector<u8>& metadata_bytes() { return metadata_bytes_; }
   const std::vector<u64>& sample_offsets() { return sample_offsets_; }
   const std::vector<u64>& sample_sizes() { return sample_sizes_; }
   const std::vector<u64>& keyframe_indices() { return keyframe_indices_; }
+  // Samples which no other frame references and the frame, in display order,
+  // each of them decodes to. Only recorded for GOPs whose display order could
+  // be determined from the picture order counts.
+  const std::vector<u64>& non_reference_samples() {
+    return non_reference_samples_;
+  }
+  const std::vector<u64>& non_reference_frames() {
+    return non_reference_frames_;
+  }
 
   i32 frames() { return frame_; };
   i32 num_non_ref_frames() { return num_non_ref_frames_; };
@@ -49,12 +73,33 @@ class H264ByteStreamIndexCreator {
   std::string error_message_;
 
   storehouse::WriteFile* demuxed_bytestream_;
+  std::vector<u8>* bytestream_buffer_;
+
+  void write(const u8* data, size_t size);
+
+  bool parse_parameter_set(i32 nal_unit_type, const u8* nal_start,
+                           i32 nal_size);
 
   u64 bytestream_pos_ = 0;
   std::vector<u8> metadata_bytes_;
   std::vector<u64> sample_offsets_;
   std::vector<u64> sample_sizes_;
   std::vector<u64> keyframe_indices_;
+  std::vector<u64> non_reference_samples_;
+  std::vector<u64> non_reference_frames_;
+
+  // Maps the samples of the current GOP to display order
+  void finish_gop();
+
+  // Picture order count of a slice starting a new frame
+  i64 picture_order_count(const SPS& sps, const SliceHeader& sh);
+
+  i64 gop_start_ = 0;
+  bool gop_mappable_ = false;
+  std::vector<i64> gop_pocs_;
+  std::vector<bool> gop_is_reference_;
+  i64 prev_poc_msb_ = 0;
+  i64 prev_poc_lsb_ = 0;
 
   i64 frame_ = 0;
   bool in_meta_packet_sequence_ = false;
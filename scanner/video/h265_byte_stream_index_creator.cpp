@@ -0,0 +1,303 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/video/h265_byte_stream_index_creator.h"
+#include "scanner/util/storehouse.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+using storehouse::WriteFile;
+
+namespace scanner {
+namespace internal {
+
+H265ByteStreamIndexCreator::H265ByteStreamIndexCreator(WriteFile* b)
+  : demuxed_bytestream_(b), bytestream_buffer_(nullptr) {}
+
+H265ByteStreamIndexCreator::H265ByteStreamIndexCreator(std::vector<u8>* b)
+  : demuxed_bytestream_(nullptr), bytestream_buffer_(b) {}
+
+bool H265ByteStreamIndexCreator::feed_packet(u8* data, size_t size) {
+  i64 packet_offset = bytestream_pos_;
+  bool packet_written = false;
+
+  const u8* nal_parse = data;
+  i32 size_left = size;
+  while (size_left > 3) {
+    const u8* nal_start = nullptr;
+    i32 nal_size = 0;
+    next_nal(nal_parse, size_left, nal_start, nal_size);
+    if (size_left < 0 || nal_size < 2) {
+      continue;
+    }
+
+    i32 nal_unit_type = get_hevc_nal_unit_type(nal_start);
+    VLOG(2) << "frame " << frame_ << ", nal size " << nal_size
+            << ", nal unit " << nal_unit_type;
+    if (nal_unit_type >= HEVC_NAL_VPS && nal_unit_type <= HEVC_NAL_PPS) {
+      if (!parse_parameter_set(nal_unit_type, nal_start, nal_size)) {
+        return false;
+      }
+      continue;
+    }
+    if (!is_hevc_vcl_nal(nal_unit_type) ||
+        !is_hevc_first_slice_segment(nal_start, nal_size)) {
+      continue;
+    }
+
+    // First slice segment of a new picture
+    if (packet_written) {
+      // Each sample must hold exactly one picture for the frame indices to
+      // line up with the samples
+      error_message_ =
+          "Packet " + std::to_string(sample_offsets_.size() - 1) +
+          " holds more than one picture, which can not be indexed";
+      return false;
+    }
+    if (sps_nal_bytes_.empty() || pps_nal_bytes_.empty()) {
+      error_message_ = "Slice before the first parameter sets";
+      return false;
+    }
+    if (is_hevc_rasl_nal(nal_unit_type) && discard_rasl_) {
+      // The decoder drops the RASL pictures of a BLA picture and of the CRA
+      // picture which starts the stream, so they do not count as frames
+      VLOG(2) << "skipping rasl picture after frame " << frame_ - 1;
+      return true;
+    }
+
+    std::vector<u8> rbsp;
+    nal_to_rbsp(nal_start + 2, std::min(nal_size - 2, 64), rbsp);
+    GetBitsState gb;
+    gb.buffer = rbsp.data();
+    gb.offset = 0;
+    gb.size = rbsp.size();
+    u32 pps_id = get_hevc_slice_pps_id(gb, nal_unit_type);
+    if (pps_map_.count(pps_id) == 0 ||
+        sps_map_.count(pps_map_.at(pps_id).sps_id) == 0) {
+      error_message_ = "Slice refers to missing parameter sets";
+      return false;
+    }
+    const HEVCPPS& pps = pps_map_.at(pps_id);
+    const HEVCSPS& sps = sps_map_.at(pps.sps_id);
+    i64 poc_lsb = get_hevc_slice_poc_lsb(gb, nal_unit_type, sps, pps);
+    if (gb.offset > gb.size * 8) {
+      error_message_ = "Failed to parse slice header";
+      return false;
+    }
+
+    bool keyframe = is_hevc_irap_nal(nal_unit_type);
+    // IRAP pictures after which picture order counts start over
+    bool new_sequence =
+        keyframe && (nal_unit_type != HEVC_NAL_CRA_NUT || frame_ == 0);
+    i64 poc;
+    if (new_sequence) {
+      poc = poc_lsb;
+    } else {
+      // Section 8.3.1
+      i64 max_poc_lsb = 1 << sps.log2_max_pic_order_cnt_lsb;
+      i64 prev_poc_lsb = prev_tid0_poc_ & (max_poc_lsb - 1);
+      i64 poc_msb = prev_tid0_poc_ - prev_poc_lsb;
+      if (poc_lsb < prev_poc_lsb &&
+          prev_poc_lsb - poc_lsb >= max_poc_lsb / 2) {
+        poc_msb += max_poc_lsb;
+      } else if (poc_lsb > prev_poc_lsb &&
+                 poc_lsb - prev_poc_lsb > max_poc_lsb / 2) {
+        poc_msb -= max_poc_lsb;
+      }
+      poc = poc_msb + poc_lsb;
+    }
+    i32 temporal_id = get_hevc_temporal_id(nal_start);
+    bool leading = nal_unit_type >= 6 && nal_unit_type <= 9;
+    bool sub_layer_non_reference =
+        is_hevc_sub_layer_non_reference_nal(nal_unit_type);
+    if (temporal_id == 0 && !leading && !sub_layer_non_reference) {
+      prev_tid0_poc_ = poc;
+    }
+
+    if (is_hevc_rasl_nal(nal_unit_type) && in_cra_leading_pictures_) {
+      // Decoding from the CRA would drop this picture, so the CRA can not be
+      // used as a keyframe
+      VLOG(2) << "not a keyframe: " << keyframe_indices_.back();
+      keyframe_indices_.pop_back();
+      in_cra_leading_pictures_ = false;
+    } else if (nal_unit_type < 6) {
+      // Trailing picture
+      in_cra_leading_pictures_ = false;
+    }
+    bool is_reference = !(sub_layer_non_reference &&
+                          temporal_id == (i32)sps.max_sub_layers - 1);
+    if (!is_reference) {
+      num_non_ref_frames_++;
+    }
+
+    if (keyframe) {
+      keyframe_indices_.push_back(frame_);
+      // A CRA which starts the stream is always a keyframe
+      in_cra_leading_pictures_ =
+          (nal_unit_type == HEVC_NAL_CRA_NUT && frame_ > 0);
+      discard_rasl_ = new_sequence && nal_unit_type != HEVC_NAL_IDR_W_RADL &&
+                      nal_unit_type != HEVC_NAL_IDR_N_LP;
+    }
+    if (new_sequence) {
+      finish_gop();
+      gop_start_ = frame_;
+    }
+    gop_pocs_.push_back(poc);
+    gop_is_reference_.push_back(is_reference);
+    frame_++;
+
+    packet_written = true;
+    u64 total_size = size;
+    if (keyframe) {
+      for (auto* nals : {&vps_nal_bytes_, &sps_nal_bytes_, &pps_nal_bytes_}) {
+        for (auto& kv : *nals) {
+          write(kv.second.data(), kv.second.size());
+          total_size += kv.second.size();
+        }
+      }
+    }
+    write(data, size);
+    bytestream_pos_ += total_size;
+    sample_offsets_.push_back(packet_offset);
+    sample_sizes_.push_back(total_size);
+  }
+  return true;
+}
+
+bool H265ByteStreamIndexCreator::parse_parameter_set(i32 nal_unit_type,
+                                                     const u8* nal_start,
+                                                     i32 nal_size) {
+  std::vector<u8> rbsp;
+  nal_to_rbsp(nal_start + 2, nal_size - 2, rbsp);
+  GetBitsState gb;
+  gb.buffer = rbsp.data();
+  gb.offset = 0;
+  gb.size = rbsp.size();
+
+  std::map<u32, std::vector<u8>>* nal_bytes;
+  u32 id;
+  if (nal_unit_type == HEVC_NAL_VPS) {
+    if (rbsp.size() < 1) {
+      error_message_ = "Failed to parse vps";
+      return false;
+    }
+    id = get_bits(gb, 4);
+    nal_bytes = &vps_nal_bytes_;
+  } else if (nal_unit_type == HEVC_NAL_SPS) {
+    HEVCSPS sps;
+    if (!parse_hevc_sps(gb, sps)) {
+      error_message_ = "Failed to parse sps";
+      return false;
+    }
+    id = sps.sps_id;
+    sps_map_[id] = sps;
+    nal_bytes = &sps_nal_bytes_;
+  } else {
+    HEVCPPS pps;
+    if (!parse_hevc_pps(gb, pps)) {
+      error_message_ = "Failed to parse pps";
+      return false;
+    }
+    id = pps.pps_id;
+    pps_map_[id] = pps;
+    nal_bytes = &pps_nal_bytes_;
+  }
+  // Keep the start code so the NAL unit can be written out as is
+  (*nal_bytes)[id].assign(nal_start - 3, nal_start + nal_size);
+  return true;
+}
+
+bool H265ByteStreamIndexCreator::scan_packet(const u8* data, size_t size,
+                                             bool& is_idr) {
+  is_idr = false;
+  const u8* nal_parse = data;
+  i32 size_left = size;
+  while (size_left > 3) {
+    const u8* nal_start = nullptr;
+    i32 nal_size = 0;
+    next_nal(nal_parse, size_left, nal_start, nal_size);
+    if (size_left < 0 || nal_size < 2) {
+      continue;
+    }
+    i32 nal_unit_type = get_hevc_nal_unit_type(nal_start);
+    if (is_hevc_vcl_nal(nal_unit_type)) {
+      // CRA pictures are not split points since whether they are keyframes
+      // depends on the pictures which follow them
+      is_idr = (nal_unit_type == HEVC_NAL_IDR_W_RADL ||
+                nal_unit_type == HEVC_NAL_IDR_N_LP);
+      break;
+    }
+    if (nal_unit_type >= HEVC_NAL_VPS && nal_unit_type <= HEVC_NAL_PPS) {
+      if (!parse_parameter_set(nal_unit_type, nal_start, nal_size)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void H265ByteStreamIndexCreator::copy_parameter_sets(
+    const H265ByteStreamIndexCreator& other) {
+  sps_map_ = other.sps_map_;
+  pps_map_ = other.pps_map_;
+  vps_nal_bytes_ = other.vps_nal_bytes_;
+  sps_nal_bytes_ = other.sps_nal_bytes_;
+  pps_nal_bytes_ = other.pps_nal_bytes_;
+}
+
+void H265ByteStreamIndexCreator::finish() { finish_gop(); }
+
+void H265ByteStreamIndexCreator::finish_gop() {
+  i64 num_samples = gop_pocs_.size();
+  std::vector<i64> display_order(num_samples);
+  for (i64 i = 0; i < num_samples; ++i) {
+    display_order[i] = i;
+  }
+  std::stable_sort(
+      display_order.begin(), display_order.end(),
+      [this](i64 a, i64 b) { return gop_pocs_[a] < gop_pocs_[b]; });
+  bool mappable = true;
+  for (i64 i = 1; i < num_samples; ++i) {
+    if (gop_pocs_[display_order[i - 1]] == gop_pocs_[display_order[i]]) {
+      mappable = false;
+    }
+  }
+  if (mappable) {
+    std::vector<i64> frame_of_sample(num_samples);
+    for (i64 i = 0; i < num_samples; ++i) {
+      frame_of_sample[display_order[i]] = gop_start_ + i;
+    }
+    for (i64 i = 0; i < num_samples; ++i) {
+      if (!gop_is_reference_[i]) {
+        non_reference_samples_.push_back(gop_start_ + i);
+        non_reference_frames_.push_back(frame_of_sample[i]);
+      }
+    }
+  }
+  gop_pocs_.clear();
+  gop_is_reference_.clear();
+}
+
+void H265ByteStreamIndexCreator::write(const u8* data, size_t size) {
+  if (demuxed_bytestream_ != nullptr) {
+    s_write(demuxed_bytestream_, data, size);
+  } else {
+    bytestream_buffer_->insert(bytestream_buffer_->end(), data, data + size);
+  }
+}
+}
+}
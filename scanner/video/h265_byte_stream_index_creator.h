@@ -0,0 +1,123 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "scanner/util/common.h"
+#include "scanner/util/h265.h"
+
+#include "storehouse/storage_backend.h"
+
+#include <map>
+#include <string>
+
+namespace scanner {
+namespace internal {
+
+/// Indexes an HEVC annex b bytestream one packet at a time, with the same
+/// interface as H264ByteStreamIndexCreator.
+///
+/// Keyframes are IDR and BLA pictures, and CRA pictures which are not
+/// followed by RASL pictures (those can not be decoded when decoding starts
+/// at the CRA). The parameter sets are written in front of every keyframe.
+/// RASL pictures which the decoder discards, i.e. those following a BLA or
+/// the CRA which starts the stream, are left out of the index and the
+/// bytestream. Pictures of the highest temporal sub-layer which are not
+/// referenced are recorded as non-reference samples. Their display order is
+/// derived from the picture order counts of the coded video sequence. Every
+/// packet must hold a single picture.
+class H265ByteStreamIndexCreator {
+ public:
+  H265ByteStreamIndexCreator(storehouse::WriteFile* demuxed_bytestream);
+
+  // Appends the demuxed bytestream to a buffer instead of a file
+  H265ByteStreamIndexCreator(std::vector<u8>* demuxed_bytestream);
+
+  bool feed_packet(u8* data, size_t size);
+
+  // Records the parameter sets of a packet without indexing it, and whether
+  // the packet holds an IDR picture
+  bool scan_packet(const u8* data, size_t size, bool& is_idr);
+
+  void copy_parameter_sets(const H265ByteStreamIndexCreator& other);
+
+  void finish();
+
+  const std::vector<u8>& metadata_bytes() { return metadata_bytes_; }
+  const std::vector<u64>& sample_offsets() { return sample_offsets_; }
+  const std::vector<u64>& sample_sizes() { return sample_sizes_; }
+  const std::vector<u64>& keyframe_indices() { return keyframe_indices_; }
+  const std::vector<u64>& non_reference_samples() {
+    return non_reference_samples_;
+  }
+  const std::vector<u64>& non_reference_frames() {
+    return non_reference_frames_;
+  }
+
+  i32 frames() { return frame_; };
+  i32 num_non_ref_frames() { return num_non_ref_frames_; };
+  i64 bytestream_pos() { return bytestream_pos_; }
+
+  std::string error_message() { return error_message_; }
+
+ private:
+  void write(const u8* data, size_t size);
+
+  bool parse_parameter_set(i32 nal_unit_type, const u8* nal_start,
+                           i32 nal_size);
+
+  // Records the non-reference samples of the coded video sequence in
+  // display order
+  void finish_gop();
+
+  std::string error_message_;
+
+  storehouse::WriteFile* demuxed_bytestream_;
+  std::vector<u8>* bytestream_buffer_;
+
+  u64 bytestream_pos_ = 0;
+  std::vector<u8> metadata_bytes_;
+  std::vector<u64> sample_offsets_;
+  std::vector<u64> sample_sizes_;
+  std::vector<u64> keyframe_indices_;
+  std::vector<u64> non_reference_samples_;
+  std::vector<u64> non_reference_frames_;
+
+  i64 frame_ = 0;
+  i32 num_non_ref_frames_ = 0;
+  // Whether the last keyframe is a CRA picture which has not been followed
+  // by a trailing picture yet
+  bool in_cra_leading_pictures_ = false;
+  // Whether the RASL pictures of the last IRAP picture are discarded by the
+  // decoder
+  bool discard_rasl_ = false;
+  // Picture order count of the last picture of temporal sub-layer 0 which
+  // is not a leading or sub-layer non-reference picture (section 8.3.1)
+  i64 prev_tid0_poc_ = 0;
+  // Pictures of the current coded video sequence, which starts at an IDR or
+  // BLA picture or at the CRA picture which starts the stream. Picture order
+  // counts carry on across the CRA pictures within it.
+  i64 gop_start_ = 0;
+  std::vector<i64> gop_pocs_;
+  std::vector<bool> gop_is_reference_;
+
+  std::map<u32, HEVCSPS> sps_map_;
+  std::map<u32, HEVCPPS> pps_map_;
+  std::map<u32, std::vector<u8>> vps_nal_bytes_;
+  std::map<u32, std::vector<u8>> sps_nal_bytes_;
+  std::map<u32, std::vector<u8>> pps_nal_bytes_;
+};
+}
+}
@@ -89,7 +89,11 @@ NVIDIAVideoDecoder::~NVIDIAVideoDecoder() {
   CUD_CHECK(cuDevicePrimaryCtxRelease(device_id_));
 }
 
-void NVIDIAVideoDecoder::configure(const FrameInfo& metadata) {
+void NVIDIAVideoDecoder::configure(
+    const FrameInfo& metadata,
+    proto::VideoDescriptor::VideoCodecType codec_type) {
+  LOG_IF(FATAL, metadata.format != FrameFormat::RGB24)
+      << "NVIDIA decoder only produces RGB24 frames";
   frame_width_ = metadata.width();
   frame_height_ = metadata.height();
 
@@ -123,8 +127,10 @@ void NVIDIAVideoDecoder::configure(const FrameInfo& metadata) {
   frame_queue_elements_ = 0;
 
   CUVIDPARSERPARAMS cuparseinfo = {};
-  // cuparseinfo.CodecType = metadata.codec_type;
-  cuparseinfo.CodecType = cudaVideoCodec_H264;
+  cudaVideoCodec codec = (codec_type == proto::VideoDescriptor::HEVC)
+                             ? cudaVideoCodec_HEVC
+                             : cudaVideoCodec_H264;
+  cuparseinfo.CodecType = codec;
   cuparseinfo.ulMaxNumDecodeSurfaces = max_output_frames_;
   cuparseinfo.ulMaxDisplayDelay = 1;
   cuparseinfo.pUserData = this;
@@ -138,8 +144,7 @@ void NVIDIAVideoDecoder::configure(const FrameInfo& metadata) {
   CUD_CHECK(cuvidCreateVideoParser(&parser_, &cuparseinfo));
 
   CUVIDDECODECREATEINFO cuinfo = {};
-  // cuinfo.CodecType = metadata.codec_type;
-  cuinfo.CodecType = cudaVideoCodec_H264;
+  cuinfo.CodecType = codec;
   // cuinfo.ChromaFormat = metadata.chroma_format;
   cuinfo.ChromaFormat = cudaVideoChromaFormat_420;
   cuinfo.OutputFormat = cudaVideoSurfaceFormat_NV12;
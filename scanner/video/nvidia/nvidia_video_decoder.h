@@ -40,7 +40,8 @@ class NVIDIAVideoDecoder : public VideoDecoder {
 
   ~NVIDIAVideoDecoder();
 
-  void configure(const FrameInfo& metadata) override;
+  void configure(const FrameInfo& metadata,
+                 proto::VideoDescriptor::VideoCodecType codec_type) override;
 
   bool feed(const u8* encoded_buffer, size_t encoded_size,
             bool discontinuity = false) override;
@@ -14,6 +14,7 @@
  */
 
 #include "scanner/video/software/software_video_decoder.h"
+#include "scanner/video/software/yuv_to_rgb.h"
 #include "scanner/util/h264.h"
 
 extern "C" {
@@ -30,11 +31,51 @@ extern "C" {
 #include "scanner/util/cuda.h"
 #endif
 
+#include <algorithm>
 #include <cassert>
 
 namespace scanner {
 namespace internal {
 
+namespace {
+
+AVPixelFormat frame_format_to_pixel_format(FrameFormat format) {
+  switch (format) {
+    case FrameFormat::RGB24:
+      return AV_PIX_FMT_RGB24;
+    case FrameFormat::GRAY8:
+      return AV_PIX_FMT_GRAY8;
+    case FrameFormat::YUV420P:
+      return AV_PIX_FMT_YUV420P;
+    case FrameFormat::NV12:
+      return AV_PIX_FMT_NV12;
+    default:
+      LOG(FATAL) << "Unsupported frame format " << format;
+  }
+  return AV_PIX_FMT_NONE;
+}
+
+// Whether the first plane of the pixel format is an 8 bit luma plane, which
+// can be copied out as a GRAY8 frame
+bool has_luma_plane(AVPixelFormat format) {
+  switch (format) {
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+    case AV_PIX_FMT_GRAY8:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// SoftwareVideoDecoder
 SoftwareVideoDecoder::SoftwareVideoDecoder(i32 device_id,
@@ -42,32 +83,19 @@ SoftwareVideoDecoder::SoftwareVideoDecoder(i32 device_id,
                                            i32 thread_count)
   : device_id_(device_id),
     output_type_(output_type),
+    thread_count_(thread_count),
     codec_(nullptr),
     cc_(nullptr),
+    output_pixel_format_(AV_PIX_FMT_RGB24),
+    scale_src_width_(0),
+    scale_src_height_(0),
     reset_context_(true),
     sws_context_(nullptr),
     frame_pool_(1024),
-    decoded_frame_queue_(1024) {
+    decoded_frame_queue_(1024),
+    convert_pool_(new ThreadPool(std::max(1, thread_count))) {
   av_init_packet(&packet_);
-
-  codec_ = avcodec_find_decoder(AV_CODEC_ID_H264);
-  if (!codec_) {
-    fprintf(stderr, "could not find h264 decoder\n");
-    exit(EXIT_FAILURE);
-  }
-
-  cc_ = avcodec_alloc_context3(codec_);
-  if (!cc_) {
-    fprintf(stderr, "could not alloc codec context");
-    exit(EXIT_FAILURE);
-  }
-
-  cc_->thread_count = thread_count;
-
-  if (avcodec_open2(cc_, codec_, NULL) < 0) {
-    fprintf(stderr, "could not open codec\n");
-    assert(false);
-  }
+  open_codec(AV_CODEC_ID_H264);
 }
 
 SoftwareVideoDecoder::~SoftwareVideoDecoder() {
@@ -91,14 +119,54 @@ SoftwareVideoDecoder::~SoftwareVideoDecoder() {
   sws_freeContext(sws_context_);
 }
 
-void SoftwareVideoDecoder::configure(const FrameInfo& metadata) {
+void SoftwareVideoDecoder::open_codec(AVCodecID codec_id) {
+  if (cc_) {
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(55, 53, 0)
+    avcodec_free_context(&cc_);
+#else
+    avcodec_close(cc_);
+    av_freep(&cc_);
+#endif
+  }
+
+  codec_ = avcodec_find_decoder(codec_id);
+  if (!codec_) {
+    fprintf(stderr, "could not find %s decoder\n", avcodec_get_name(codec_id));
+    exit(EXIT_FAILURE);
+  }
+
+  cc_ = avcodec_alloc_context3(codec_);
+  if (!cc_) {
+    fprintf(stderr, "could not alloc codec context");
+    exit(EXIT_FAILURE);
+  }
+
+  cc_->thread_count = thread_count_;
+
+  if (avcodec_open2(cc_, codec_, NULL) < 0) {
+    fprintf(stderr, "could not open codec\n");
+    assert(false);
+  }
+}
+
+void SoftwareVideoDecoder::configure(
+    const FrameInfo& metadata,
+    proto::VideoDescriptor::VideoCodecType codec_type) {
+  AVCodecID codec_id = (codec_type == proto::VideoDescriptor::HEVC)
+                           ? AV_CODEC_ID_HEVC
+                           : AV_CODEC_ID_H264;
+  if (codec_->id != codec_id) {
+    open_codec(codec_id);
+  }
+
   metadata_ = metadata;
   frame_width_ = metadata_.width();
   frame_height_ = metadata_.height();
+  output_pixel_format_ = frame_format_to_pixel_format(metadata_.format);
   reset_context_ = true;
 
-  int required_size = av_image_get_buffer_size(AV_PIX_FMT_RGB24, frame_width_,
-                                               frame_height_, 1);
+  int required_size = av_image_get_buffer_size(
+      output_pixel_format_, frame_width_, frame_height_, 1);
 
   conversion_buffer_.resize(required_size);
 }
@@ -184,52 +252,104 @@ bool SoftwareVideoDecoder::get_frame(u8* decoded_buffer, size_t decoded_size) {
     return false;
   }
 
-  if (reset_context_) {
-    auto get_context_start = now();
-    AVPixelFormat decoder_pixel_format = cc_->pix_fmt;
-    sws_freeContext(sws_context_);
-    sws_context_ = sws_getContext(
-        frame_width_, frame_height_, decoder_pixel_format, frame_width_,
-        frame_height_, AV_PIX_FMT_RGB24, SWS_BICUBIC, NULL, NULL, NULL);
-    reset_context_ = false;
-    auto get_context_end = now();
-    if (profiler_) {
-      profiler_->add_interval("ffmpeg:get_sws_context", get_context_start,
-                              get_context_end);
-    }
-  }
-
-  if (sws_context_ == NULL) {
-    LOG(FATAL) << "Could not get sws_context for rgb conversion";
-  }
-
   u8* scale_buffer = decoded_buffer;
 
   uint8_t* out_slices[4];
   int out_linesizes[4];
-  int required_size =
-      av_image_fill_arrays(out_slices, out_linesizes, scale_buffer,
-                           AV_PIX_FMT_RGB24, frame_width_, frame_height_, 1);
+  int required_size = av_image_fill_arrays(out_slices, out_linesizes,
+                                           scale_buffer, output_pixel_format_,
+                                           frame_width_, frame_height_, 1);
   if (required_size < 0) {
     LOG(FATAL) << "Error in av_image_fill_arrays";
   }
   if (required_size > decoded_size) {
     LOG(FATAL) << "Decode buffer not large enough for image";
   }
-  auto scale_start = now();
-  if (sws_scale(sws_context_, frame->data, frame->linesize, 0, frame->height,
-                out_slices, out_linesizes) < 0) {
-    LOG(FATAL) << "sws_scale failed";
+
+  AVPixelFormat decoder_pixel_format = cc_->pix_fmt;
+  bool same_size =
+      (frame->width == frame_width_ && frame->height == frame_height_);
+  if (same_size &&
+      (decoder_pixel_format == output_pixel_format_ ||
+       (output_pixel_format_ == AV_PIX_FMT_GRAY8 &&
+        has_luma_plane(decoder_pixel_format)))) {
+    // The decoder already produces the planes we need, so copy them out
+    // instead of converting
+    auto copy_start = now();
+    if (output_pixel_format_ == AV_PIX_FMT_GRAY8) {
+      av_image_copy_plane(out_slices[0], out_linesizes[0], frame->data[0],
+                          frame->linesize[0], frame_width_, frame_height_);
+    } else {
+      av_image_copy(out_slices, out_linesizes, (const uint8_t**)frame->data,
+                    frame->linesize, output_pixel_format_, frame_width_,
+                    frame_height_);
+    }
+    if (profiler_) {
+      profiler_->add_interval("ffmpeg:copy_frame", copy_start, now());
+    }
+  } else if (same_size && output_pixel_format_ == AV_PIX_FMT_RGB24 &&
+             decoder_pixel_format == AV_PIX_FMT_YUV420P &&
+             frame->color_range != AVCOL_RANGE_JPEG) {
+    // The common case, which our vectorized converter is faster at than
+    // sws_scale
+    auto convert_start = now();
+    yuv420p_to_rgb24(frame->data, frame->linesize, frame_width_,
+                     frame_height_, out_slices[0], out_linesizes[0],
+                     convert_pool_.get());
+    if (profiler_) {
+      profiler_->add_interval("yuv_to_rgb", convert_start, now());
+    }
+  } else {
+    // Frames are resized here when a resize op was fused into the decoder.
+    // SWS_FAST_BILINEAR samples two taps at any scale, like the
+    // INTER_LINEAR cv::resize of the Resize kernel, so a fused resize
+    // matches the kernel's output up to rounding. It scales the YUV planes
+    // before converting to RGB, so it is not bit-identical.
+    if (reset_context_ || frame->width != scale_src_width_ ||
+        frame->height != scale_src_height_) {
+      auto get_context_start = now();
+      sws_freeContext(sws_context_);
+      sws_context_ = sws_getContext(
+          frame->width, frame->height, decoder_pixel_format, frame_width_,
+          frame_height_, output_pixel_format_,
+          same_size ? SWS_BICUBIC : SWS_FAST_BILINEAR, NULL, NULL, NULL);
+      scale_src_width_ = frame->width;
+      scale_src_height_ = frame->height;
+      reset_context_ = false;
+      auto get_context_end = now();
+      if (profiler_) {
+        profiler_->add_interval("ffmpeg:get_sws_context", get_context_start,
+                                get_context_end);
+      }
+    }
+
+    if (sws_context_ == NULL) {
+      LOG(FATAL) << "Could not get sws_context for frame conversion";
+    }
+
+    auto scale_start = now();
+    if (sws_scale(sws_context_, frame->data, frame->linesize, 0,
+                  frame->height, out_slices, out_linesizes) < 0) {
+      LOG(FATAL) << "sws_scale failed";
+    }
+    auto scale_end = now();
+    if (profiler_) {
+      profiler_->add_interval("ffmpeg:scale_frame", scale_start, scale_end);
+      if (!same_size) {
+        // Time spent on fused resizes, to set against the time the Resize
+        // kernel takes on the full size frames of an unfused job
+        profiler_->increment(
+            "fused_resize_ns",
+            std::chrono::duration_cast<std::chrono::nanoseconds>(scale_end -
+                                                                 scale_start)
+                .count());
+      }
+    }
   }
-  auto scale_end = now();
 
   av_frame_unref(frame);
   frame_pool_.push(frame);
 
-  if (profiler_) {
-    profiler_->add_interval("ffmpeg:scale_frame", scale_start, scale_end);
-  }
-
   return decoded_frame_queue_.size() > 0;
 }
 
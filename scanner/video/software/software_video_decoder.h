@@ -17,6 +17,7 @@
 
 #include "scanner/api/kernel.h"
 #include "scanner/util/queue.h"
+#include "scanner/util/thread_pool.h"
 #include "scanner/video/video_decoder.h"
 
 extern "C" {
@@ -31,6 +32,7 @@ extern "C" {
 }
 
 #include <deque>
+#include <memory>
 #include <mutex>
 #include <vector>
 
@@ -45,7 +47,8 @@ class SoftwareVideoDecoder : public VideoDecoder {
 
   ~SoftwareVideoDecoder();
 
-  void configure(const FrameInfo& metadata) override;
+  void configure(const FrameInfo& metadata,
+                 proto::VideoDescriptor::VideoCodecType codec_type) override;
 
   bool feed(const u8* encoded_buffer, size_t encoded_size,
             bool discontinuity = false) override;
@@ -61,8 +64,12 @@ class SoftwareVideoDecoder : public VideoDecoder {
  private:
   void feed_packet(bool flush);
 
+  // Replaces the codec context with one for codec_id
+  void open_codec(AVCodecID codec_id);
+
   int device_id_;
   DeviceType output_type_;
+  i32 thread_count_;
   AVPacket packet_;
   AVCodec* codec_;
   AVCodecContext* cc_;
@@ -70,12 +77,18 @@ class SoftwareVideoDecoder : public VideoDecoder {
   FrameInfo metadata_;
   i32 frame_width_;
   i32 frame_height_;
+  AVPixelFormat output_pixel_format_;
+  // Size of the decoded pictures sws_context_ was created for
+  i32 scale_src_width_;
+  i32 scale_src_height_;
   std::vector<u8> conversion_buffer_;
   bool reset_context_;
   SwsContext* sws_context_;
 
   Queue<AVFrame*> frame_pool_;
   Queue<AVFrame*> decoded_frame_queue_;
+  // Splits the colour conversion of large frames across rows
+  std::unique_ptr<ThreadPool> convert_pool_;
 };
 }
 }
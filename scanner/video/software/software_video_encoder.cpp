@@ -104,11 +104,29 @@ void SoftwareVideoEncoder::configure(const FrameInfo& metadata,
     }
   }
 
+  AVCodecID codec_id = (opts.codec == proto::VideoDescriptor::HEVC)
+                           ? AV_CODEC_ID_HEVC
+                           : AV_CODEC_ID_H264;
+  if (codec_->id != codec_id) {
+    codec_ = avcodec_find_encoder(codec_id);
+    if (!codec_) {
+      LOG(FATAL) << "could not find " << avcodec_get_name(codec_id)
+                 << " encoder";
+    }
+    av_bitstream_filter_close(annexb_);
+    annexb_ = av_bitstream_filter_init(codec_id == AV_CODEC_ID_HEVC
+                                           ? "hevc_mp4toannexb"
+                                           : "h264_mp4toannexb");
+  }
+
   cc_ = avcodec_alloc_context3(codec_);
   if (!cc_) {
     LOG(FATAL) << "could not alloc codec context";
   }
 
+  // A freshly opened codec context does not need to be flushed
+  was_reset_ = false;
+
   metadata_ = metadata;
   frame_width_ = metadata_.width();
   frame_height_ = metadata_.height();
@@ -117,13 +135,13 @@ void SoftwareVideoEncoder::configure(const FrameInfo& metadata,
   int required_size = av_image_get_buffer_size(AV_PIX_FMT_RGB24, frame_width_,
                                                frame_height_, 1);
 
-  cc_->thread_count = 4;
+  cc_->thread_count = opts.threads != -1 ? opts.threads : 4;
   cc_->width = frame_width_;    // Note Resolution must be a multiple of 2!!
   cc_->height = frame_height_;  // Note Resolution must be a multiple of 2!!
   // TODO(apoms): figure out this fps from the input video automatically
   cc_->time_base.den = 24;
   cc_->time_base.num = 1;
-  cc_->gop_size = 120;  // Intra frames per x P frames
+  cc_->gop_size = DEFAULT_KEYFRAME_DISTANCE;  // Intra frames per x P frames
   cc_->pix_fmt =
       AV_PIX_FMT_YUV420P;  // Do not change this, H264 needs YUV format not RGB
   if (opts.quality != -1) {
@@ -131,18 +149,37 @@ void SoftwareVideoEncoder::configure(const FrameInfo& metadata,
       LOG(FATAL) << "Could not set CRF on codec context";
     }
   }
+  if (!opts.preset.empty()) {
+    if (av_opt_set(cc_->priv_data, "preset", opts.preset.c_str(), 0) < 0) {
+      LOG(FATAL) << "Could not set preset " << opts.preset
+                 << " on codec context";
+    }
+  }
   if (opts.bitrate != -1) {
     cc_->bit_rate = opts.bitrate;
   }
   if (opts.keyframe_distance != -1) {
     cc_->gop_size = opts.keyframe_distance;
   }
+  if (codec_id == AV_CODEC_ID_HEVC) {
+    // Open GOPs start with CRA pictures whose leading pictures need the
+    // previous GOP, so they can not be used as keyframes by the indexer.
+    // Scene cuts would add keyframes off the requested distance.
+    cc_->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+    if (av_opt_set(cc_->priv_data, "x265-params", "open-gop=0:scenecut=0",
+                   0) < 0) {
+      LOG(WARNING) << "Could not request closed GOPs from " << codec_->name;
+    }
+  }
 
   if (avcodec_open2(cc_, codec_, NULL) < 0) {
     LOG(FATAL) << "could not open codec";
   }
 
   AVPixelFormat encoder_pixel_format = cc_->pix_fmt;
+  if (sws_context_) {
+    sws_freeContext(sws_context_);
+  }
   sws_context_ = sws_getContext(
       frame_width_, frame_height_, AV_PIX_FMT_RGB24, frame_width_,
       frame_height_, encoder_pixel_format, SWS_BICUBIC, NULL, NULL, NULL);
@@ -0,0 +1,272 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "scanner/video/software/yuv_to_rgb.h"
+
+#include <algorithm>
+#include <future>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+// BT.601 limited range coefficients in fixed point with 6 fractional bits,
+// small enough for the products to fit in 16 bit lanes
+const i32 COEF_Y = 75;    // 1.164
+const i32 COEF_RV = 102;  // 1.596
+const i32 COEF_GU = 25;   // 0.391
+const i32 COEF_GV = 52;   // 0.813
+const i32 COEF_BU = 129;  // 2.018
+
+// Frames with fewer pixels are converted on the calling thread
+const i64 PARALLEL_MIN_PIXELS = 1280 * 720;
+const i32 PARALLEL_ROWS_PER_TASK = 64;
+
+inline u8 clamp_u8(i32 v) { return (u8)std::min(std::max(v, 0), 255); }
+
+// Matches the vector paths exactly: their 16 bit adds only saturate for
+// values which are clamped to 255 anyway
+void convert_row_scalar(const u8* y, const u8* u, const u8* v, u8* out,
+                        i32 x, i32 width) {
+  for (; x < width; ++x) {
+    i32 c = COEF_Y * (y[x] - 16);
+    i32 d = u[x / 2] - 128;
+    i32 e = v[x / 2] - 128;
+    out[3 * x + 0] = clamp_u8((c + COEF_RV * e + 32) >> 6);
+    out[3 * x + 1] = clamp_u8((c - COEF_GU * d - COEF_GV * e + 32) >> 6);
+    out[3 * x + 2] = clamp_u8((c + COEF_BU * d + 32) >> 6);
+  }
+}
+
+#ifdef HAVE_X86_SIMD
+
+// Shuffle masks which interleave 16 R, G and B values into 48 bytes of
+// RGB24. Mask 3 * j + c places channel c into output bytes [16j, 16j + 16).
+struct InterleaveMasks {
+  InterleaveMasks() {
+    for (i32 j = 0; j < 3; ++j) {
+      for (i32 c = 0; c < 3; ++c) {
+        for (i32 i = 0; i < 16; ++i) {
+          i32 byte = 16 * j + i;
+          masks[3 * j + c][i] = (byte % 3 == c) ? (u8)(byte / 3) : 0x80;
+        }
+      }
+    }
+  }
+
+  alignas(16) u8 masks[9][16];
+};
+
+const InterleaveMasks& interleave_masks() {
+  static InterleaveMasks masks;
+  return masks;
+}
+
+__attribute__((target("ssse3"))) inline void store_rgb24(
+    __m128i r, __m128i g, __m128i b, const __m128i* masks, u8* out) {
+  for (i32 j = 0; j < 3; ++j) {
+    __m128i chunk =
+        _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, masks[3 * j]),
+                                  _mm_shuffle_epi8(g, masks[3 * j + 1])),
+                     _mm_shuffle_epi8(b, masks[3 * j + 2]));
+    _mm_storeu_si128((__m128i*)(out + 16 * j), chunk);
+  }
+}
+
+// Zero extends the low or high 8 bytes to 16 bit lanes
+__attribute__((target("ssse3"))) inline __m128i widen(__m128i x, i32 half) {
+  const __m128i zero = _mm_setzero_si128();
+  return half ? _mm_unpackhi_epi8(x, zero) : _mm_unpacklo_epi8(x, zero);
+}
+
+__attribute__((target("ssse3"))) inline void yuv_to_rgb_16(
+    __m128i y, __m128i u, __m128i v, __m128i& r, __m128i& g, __m128i& b) {
+  __m128i rgb[3][2];
+  for (i32 half = 0; half < 2; ++half) {
+    __m128i y16 = widen(y, half);
+    __m128i u16 = widen(u, half);
+    __m128i v16 = widen(v, half);
+    __m128i c = _mm_mullo_epi16(_mm_sub_epi16(y16, _mm_set1_epi16(16)),
+                                _mm_set1_epi16(COEF_Y));
+    __m128i d = _mm_sub_epi16(u16, _mm_set1_epi16(128));
+    __m128i e = _mm_sub_epi16(v16, _mm_set1_epi16(128));
+    __m128i round = _mm_set1_epi16(32);
+    __m128i rv = _mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(COEF_RV)));
+    __m128i gv = _mm_subs_epi16(
+        _mm_subs_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(COEF_GU))),
+        _mm_mullo_epi16(e, _mm_set1_epi16(COEF_GV)));
+    __m128i bv = _mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(COEF_BU)));
+    rgb[0][half] = _mm_srai_epi16(_mm_adds_epi16(rv, round), 6);
+    rgb[1][half] = _mm_srai_epi16(_mm_adds_epi16(gv, round), 6);
+    rgb[2][half] = _mm_srai_epi16(_mm_adds_epi16(bv, round), 6);
+  }
+  r = _mm_packus_epi16(rgb[0][0], rgb[0][1]);
+  g = _mm_packus_epi16(rgb[1][0], rgb[1][1]);
+  b = _mm_packus_epi16(rgb[2][0], rgb[2][1]);
+}
+
+__attribute__((target("ssse3"))) void convert_row_ssse3(
+    const u8* y, const u8* u, const u8* v, u8* out, i32 x, i32 width) {
+  __m128i masks[9];
+  for (i32 i = 0; i < 9; ++i) {
+    masks[i] = _mm_load_si128((const __m128i*)interleave_masks().masks[i]);
+  }
+  for (; x + 16 <= width; x += 16) {
+    __m128i yv = _mm_loadu_si128((const __m128i*)(y + x));
+    __m128i uv = _mm_loadl_epi64((const __m128i*)(u + x / 2));
+    __m128i vv = _mm_loadl_epi64((const __m128i*)(v + x / 2));
+    // Each chroma sample covers two pixels of the row
+    uv = _mm_unpacklo_epi8(uv, uv);
+    vv = _mm_unpacklo_epi8(vv, vv);
+    __m128i r, g, b;
+    yuv_to_rgb_16(yv, uv, vv, r, g, b);
+    store_rgb24(r, g, b, masks, out + 3 * x);
+  }
+  convert_row_scalar(y, u, v, out, x, width);
+}
+
+__attribute__((target("avx2"))) void convert_row_avx2(
+    const u8* y, const u8* u, const u8* v, u8* out, i32 x, i32 width) {
+  __m128i masks[9];
+  for (i32 i = 0; i < 9; ++i) {
+    masks[i] = _mm_load_si128((const __m128i*)interleave_masks().masks[i]);
+  }
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i round = _mm256_set1_epi16(32);
+  for (; x + 32 <= width; x += 32) {
+    __m256i yv = _mm256_loadu_si256((const __m256i*)(y + x));
+    __m128i u8v = _mm_loadu_si128((const __m128i*)(u + x / 2));
+    __m128i v8v = _mm_loadu_si128((const __m128i*)(v + x / 2));
+    // Each chroma sample covers two pixels of the row
+    __m256i uv = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_unpacklo_epi8(u8v, u8v)),
+        _mm_unpackhi_epi8(u8v, u8v), 1);
+    __m256i vv = _mm256_inserti128_si256(
+        _mm256_castsi128_si256(_mm_unpacklo_epi8(v8v, v8v)),
+        _mm_unpackhi_epi8(v8v, v8v), 1);
+
+    // Unpacking and packing both work within 128 bit lanes, so the pixels
+    // end up back in their original order
+    __m256i rgb[3][2];
+    for (i32 half = 0; half < 2; ++half) {
+      __m256i y16 = half ? _mm256_unpackhi_epi8(yv, zero)
+                         : _mm256_unpacklo_epi8(yv, zero);
+      __m256i u16 = half ? _mm256_unpackhi_epi8(uv, zero)
+                         : _mm256_unpacklo_epi8(uv, zero);
+      __m256i v16 = half ? _mm256_unpackhi_epi8(vv, zero)
+                         : _mm256_unpacklo_epi8(vv, zero);
+      __m256i c = _mm256_mullo_epi16(
+          _mm256_sub_epi16(y16, _mm256_set1_epi16(16)),
+          _mm256_set1_epi16(COEF_Y));
+      __m256i d = _mm256_sub_epi16(u16, _mm256_set1_epi16(128));
+      __m256i e = _mm256_sub_epi16(v16, _mm256_set1_epi16(128));
+      __m256i rv = _mm256_adds_epi16(
+          c, _mm256_mullo_epi16(e, _mm256_set1_epi16(COEF_RV)));
+      __m256i gv = _mm256_subs_epi16(
+          _mm256_subs_epi16(
+              c, _mm256_mullo_epi16(d, _mm256_set1_epi16(COEF_GU))),
+          _mm256_mullo_epi16(e, _mm256_set1_epi16(COEF_GV)));
+      __m256i bv = _mm256_adds_epi16(
+          c, _mm256_mullo_epi16(d, _mm256_set1_epi16(COEF_BU)));
+      rgb[0][half] = _mm256_srai_epi16(_mm256_adds_epi16(rv, round), 6);
+      rgb[1][half] = _mm256_srai_epi16(_mm256_adds_epi16(gv, round), 6);
+      rgb[2][half] = _mm256_srai_epi16(_mm256_adds_epi16(bv, round), 6);
+    }
+    __m256i r = _mm256_packus_epi16(rgb[0][0], rgb[0][1]);
+    __m256i g = _mm256_packus_epi16(rgb[1][0], rgb[1][1]);
+    __m256i b = _mm256_packus_epi16(rgb[2][0], rgb[2][1]);
+
+    store_rgb24(_mm256_castsi256_si128(r), _mm256_castsi256_si128(g),
+                _mm256_castsi256_si128(b), masks, out + 3 * x);
+    store_rgb24(_mm256_extracti128_si256(r, 1), _mm256_extracti128_si256(g, 1),
+                _mm256_extracti128_si256(b, 1), masks, out + 3 * x + 48);
+  }
+  convert_row_ssse3(y, u, v, out, x, width);
+}
+
+#endif
+
+void convert_rows(const u8* const planes[3], const int strides[3], i32 width,
+                  i32 row_start, i32 row_end, u8* rgb, i32 rgb_stride,
+                  SimdLevel level) {
+  for (i32 row = row_start; row < row_end; ++row) {
+    const u8* y = planes[0] + (i64)row * strides[0];
+    const u8* u = planes[1] + (i64)(row / 2) * strides[1];
+    const u8* v = planes[2] + (i64)(row / 2) * strides[2];
+    u8* out = rgb + (i64)row * rgb_stride;
+    switch (level) {
+#ifdef HAVE_X86_SIMD
+      case SimdLevel::AVX2:
+        convert_row_avx2(y, u, v, out, 0, width);
+        break;
+      case SimdLevel::SSSE3:
+        convert_row_ssse3(y, u, v, out, 0, width);
+        break;
+#endif
+      default:
+        convert_row_scalar(y, u, v, out, 0, width);
+        break;
+    }
+  }
+}
+
+}
+
+SimdLevel detected_simd_level() {
+#ifdef HAVE_X86_SIMD
+  static const SimdLevel level = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+      return SimdLevel::AVX2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+      return SimdLevel::SSSE3;
+    }
+    return SimdLevel::Scalar;
+  }();
+  return level;
+#else
+  return SimdLevel::Scalar;
+#endif
+}
+
+void yuv420p_to_rgb24(const u8* const planes[3], const int strides[3],
+                      i32 width, i32 height, u8* rgb, i32 rgb_stride,
+                      ThreadPool* pool, SimdLevel level) {
+  if (pool == nullptr || (i64)width * height < PARALLEL_MIN_PIXELS) {
+    convert_rows(planes, strides, width, 0, height, rgb, rgb_stride, level);
+    return;
+  }
+  std::vector<std::future<void>> tasks;
+  for (i32 row = 0; row < height; row += PARALLEL_ROWS_PER_TASK) {
+    i32 row_end = std::min(row + PARALLEL_ROWS_PER_TASK, height);
+    tasks.push_back(pool->enqueue([=]() {
+      convert_rows(planes, strides, width, row, row_end, rgb, rgb_stride,
+                   level);
+    }));
+  }
+  for (auto& task : tasks) {
+    task.wait();
+  }
+}
+}
+}
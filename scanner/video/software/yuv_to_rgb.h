@@ -0,0 +1,41 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "scanner/util/common.h"
+#include "scanner/util/thread_pool.h"
+
+namespace scanner {
+namespace internal {
+
+enum class SimdLevel { Scalar, SSSE3, AVX2 };
+
+//! Widest vector instruction set the yuv to rgb conversion can use on this CPU
+SimdLevel detected_simd_level();
+
+/// Converts a YUV420P frame with BT.601 limited range samples to packed
+/// RGB24, matching the default colourspace of sws_scale. Each chroma sample
+/// covers a 2x2 block of pixels.
+///
+/// The vectorized paths are picked at runtime. When a thread pool is given,
+/// the rows of large frames are split between its threads.
+void yuv420p_to_rgb24(const u8* const planes[3], const int strides[3],
+                      i32 width, i32 height, u8* rgb, i32 rgb_stride,
+                      ThreadPool* pool = nullptr,
+                      SimdLevel level = detected_simd_level());
+}
+}
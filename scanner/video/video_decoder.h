@@ -46,7 +46,8 @@ class VideoDecoder {
 
   virtual ~VideoDecoder(){};
 
-  virtual void configure(const FrameInfo& metadata) = 0;
+  virtual void configure(const FrameInfo& metadata,
+                         proto::VideoDescriptor::VideoCodecType codec_type) = 0;
 
   virtual bool feed(const u8* encoded_buffer, size_t encoded_size,
                     bool discontinuity = false) = 0;
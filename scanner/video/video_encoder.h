@@ -31,10 +31,16 @@ enum class VideoEncoderType {
   SOFTWARE,
 };
 
+// Frames between keyframes when no keyframe distance is requested
+static const i64 DEFAULT_KEYFRAME_DISTANCE = 120;
+
 struct EncodeOptions {
   i32 quality = -1;
   i64 bitrate = -1;
   i64 keyframe_distance = -1;
+  i32 threads = -1;    //!< Threads used by one encoder, -1 for its default
+  std::string preset;  //!< Codec speed preset, empty for its default
+  proto::VideoDescriptor::VideoCodecType codec = proto::VideoDescriptor::H264;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -49,10 +49,63 @@ class HistogramKernelCPU : public BatchedKernel {
   DeviceHandle device_;
 };
 
+// Histogram of the luma of each frame. Decoded frames are read in a planar
+// format so that only the Y plane has to be produced.
+class LumaHistogramKernelCPU : public BatchedKernel {
+ public:
+  LumaHistogramKernelCPU(const KernelConfig& config)
+    : BatchedKernel(config), device_(config.devices[0]) {}
+
+  void execute(const BatchedElements& input_columns,
+               BatchedElements& output_columns) override {
+    auto& frame_col = input_columns[0];
+
+    size_t hist_size = BINS * sizeof(int);
+    i32 input_count = num_rows(frame_col);
+    u8* output_block =
+        new_block_buffer(device_, hist_size * input_count, input_count);
+
+    for (i32 i = 0; i < input_count; ++i) {
+      const Frame* frame = frame_col[i].as_const_frame();
+      i64 num_pixels = (i64)frame->shape[0] * frame->shape[1];
+      int* hist = (int*)(output_block + i * hist_size);
+      std::fill(hist, hist + BINS, 0);
+      if (frame->format == FrameFormat::RGB24) {
+        // BT.601 limited range luma, as produced by the decoder
+        for (i64 p = 0; p < num_pixels; ++p) {
+          const u8* rgb = frame->data + p * 3;
+          i32 y = ((66 * rgb[0] + 129 * rgb[1] + 25 * rgb[2] + 128) >> 8) + 16;
+          hist[y * BINS / 256]++;
+        }
+      } else {
+        // Every planar format starts with the Y plane
+        for (i64 p = 0; p < num_pixels; ++p) {
+          hist[frame->data[p] * BINS / 256]++;
+        }
+      }
+
+      insert_element(output_columns[0], (u8*)hist, hist_size);
+    }
+  }
+
+ private:
+  DeviceHandle device_;
+};
+
 REGISTER_OP(Histogram).frame_input("frame").output("histogram");
 
+REGISTER_OP(LumaHistogram)
+    .frame_input("frame", {FrameFormat::GRAY8, FrameFormat::YUV420P,
+                           FrameFormat::NV12})
+    .output("histogram");
+
 REGISTER_KERNEL(Histogram, HistogramKernelCPU)
     .device(DeviceType::CPU)
     .batch()
     .num_devices(1);
+
+REGISTER_KERNEL(LumaHistogram, LumaHistogramKernelCPU)
+    .device(DeviceType::CPU)
+    .batch()
+    .num_devices(1);
 }
@@ -7,6 +7,29 @@
 
 namespace scanner {
 
+namespace {
+
+void resize_target(const proto::ResizeArgs& args, i32 width, i32 height,
+                   i32& target_width, i32& target_height) {
+  target_width = args.width();
+  target_height = args.height();
+  if (args.preserve_aspect()) {
+    if (target_width == 0) {
+      target_width = width * target_height / height;
+    } else {
+      target_height = height * target_width / width;
+    }
+  }
+  if (args.min()) {
+    if (width <= target_width && height <= target_height) {
+      target_width = width;
+      target_height = height;
+    }
+  }
+}
+
+}
+
 class ResizeKernel : public BatchedKernel {
  public:
   ResizeKernel(const KernelConfig& config)
@@ -21,26 +44,22 @@ class ResizeKernel : public BatchedKernel {
 
     const Frame* frame = frame_col[0].as_const_frame();
 
-    i32 target_width = args_.width();
-    i32 target_height = args_.height();
-    if (args_.preserve_aspect()) {
-      if (target_width == 0) {
-        target_width =
-            frame->width() * target_height / frame->height();
-      } else {
-        target_height =
-            frame->height() * target_width / frame->width();
-      }
-    }
-    if (args_.min()) {
-      if (frame->width() <= target_width &&
-          frame->height() <= target_height) {
-        target_width = frame->width();
-        target_height = frame->height();
+    i32 target_width;
+    i32 target_height;
+    resize_target(args_, frame->width(), frame->height(), target_width,
+                  target_height);
+
+    i32 input_count = num_rows(frame_col);
+    if (frame->width() == target_width && frame->height() == target_height) {
+      // Already the right size, e.g. because the resize was fused into the
+      // decoder
+      for (i32 i = 0; i < input_count; ++i) {
+        Element element = frame_col[i];
+        output_columns[0].push_back(add_element_ref(device_, element));
       }
+      return;
     }
 
-    i32 input_count = num_rows(frame_col);
     FrameInfo info(target_height, target_width, frame->channels(), frame->type);
     std::vector<Frame*> output_frames = new_frames(device_, info, input_count);
 
@@ -74,8 +93,16 @@ class ResizeKernel : public BatchedKernel {
   proto::ResizeArgs args_;
 };
 
-REGISTER_OP(Resize).frame_input("frame").frame_output("frame").protobuf_name(
-    "ResizeArgs");
+REGISTER_OP(Resize)
+    .frame_input("frame")
+    .frame_output("frame")
+    .decoder_resize([](const std::vector<u8>& args, i32 width, i32 height,
+                       i32& out_width, i32& out_height) {
+      proto::ResizeArgs resize_args;
+      resize_args.ParseFromArray(args.data(), args.size());
+      resize_target(resize_args, width, height, out_width, out_height);
+    })
+    .protobuf_name("ResizeArgs");
 
 REGISTER_KERNEL(Resize, ResizeKernel).device(DeviceType::CPU).num_devices(1);
 
@@ -25,7 +25,10 @@ class DiscardKernel : public BatchedKernel {
 
 REGISTER_OP(Discard).input("ignore").output("dummy");
 
-REGISTER_OP(DiscardFrame).frame_input("ignore").output("dummy");
+REGISTER_OP(DiscardFrame)
+    .frame_input("ignore", {FrameFormat::GRAY8, FrameFormat::YUV420P,
+                            FrameFormat::NV12})
+    .output("dummy");
 
 REGISTER_KERNEL(Discard, DiscardKernel).device(DeviceType::CPU).batch().num_devices(1);
 
@@ -20,6 +20,7 @@
 #include "storehouse/storage_backend.h"
 #include "scanner/engine/video_index_entry.h"
 #include "scanner/engine/table_meta_cache.h"
+#include "scanner/util/disk_cache.h"
 
 #include <glog/logging.h>
 #include <vector>
@@ -187,16 +188,19 @@ class PackedFileSource : public Source {
 
     // Read the data
     std::unique_ptr<RandomReadFile> file;
+    u64 file_size = 0;
     if (element_args.size() > 0) {
       BACKOFF_FAIL(make_unique_random_read_file(storage_.get(), path, file),
                    "while trying to make read file for " + path);
+      BACKOFF_FAIL(file->get_size(file_size),
+                   "while trying to get file size for " + path);
     }
     u64 offset = 0;
     for (size_t i = 0; i < element_args.size(); ++i) {
       u8* dest_buffer = block_buffer + offset;
       u64 pos = offset_to_read[i];
       u64 size = size_to_read[i];
-      s_read(file.get(), dest_buffer, size, pos);
+      s_read_cached(file.get(), file_size, dest_buffer, size, pos);
       insert_element(output_columns[0], dest_buffer, size);
 
       offset += size;
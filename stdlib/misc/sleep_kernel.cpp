@@ -21,7 +21,10 @@ class SleepKernel : public Kernel {
 
 REGISTER_OP(Sleep).input("ignore").output("dummy");
 
-REGISTER_OP(SleepFrame).frame_input("ignore").output("dummy");
+REGISTER_OP(SleepFrame)
+    .frame_input("ignore", {FrameFormat::GRAY8, FrameFormat::YUV420P,
+                            FrameFormat::NV12})
+    .output("dummy");
 
 REGISTER_KERNEL(Sleep, SleepKernel).device(DeviceType::CPU).num_devices(1);
 
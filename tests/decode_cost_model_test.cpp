@@ -0,0 +1,199 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "scanner/engine/decode_cost_model.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+const u64 SAMPLE_SIZE = 1000;
+
+// Index of a single encoded video with GOPs of gop_size frames
+struct SyntheticIndex {
+  std::vector<u64> keyframe_positions;
+  std::vector<u64> sample_offsets;
+  std::vector<u64> sample_sizes;
+  std::vector<u64> non_reference_samples;
+
+  SyntheticIndex(i64 frames, i64 gop_size) {
+    for (i64 f = 0; f < frames; ++f) {
+      if (f % gop_size == 0) {
+        keyframe_positions.push_back(f);
+      }
+      sample_offsets.push_back(f * SAMPLE_SIZE);
+      sample_sizes.push_back(SAMPLE_SIZE);
+    }
+    keyframe_positions.push_back(frames);
+    sample_offsets.push_back(frames * SAMPLE_SIZE);
+  }
+
+  VideoIntervals plan(const std::vector<i64>& rows, const DecodeCost& cost) {
+    return plan_decode_intervals(keyframe_positions, sample_offsets,
+                                 sample_sizes, non_reference_samples, rows,
+                                 cost);
+  }
+};
+
+DecodeCost make_cost(double frame_seconds, double interval_seconds) {
+  DecodeCost cost;
+  cost.frame_seconds = frame_seconds;
+  cost.byte_seconds = 0;
+  cost.interval_seconds = interval_seconds;
+  return cost;
+}
+
+// The plan which starts a new interval at every sampled GOP
+VideoIntervals seek_every_gop(const SyntheticIndex& index,
+                              const std::vector<i64>& rows) {
+  VideoIntervals plan;
+  for (i64 row : rows) {
+    size_t gop = std::upper_bound(index.keyframe_positions.begin(),
+                                  index.keyframe_positions.end() - 1,
+                                  (u64)row) -
+                 index.keyframe_positions.begin() - 1;
+    if (plan.keyframe_index_intervals.empty() ||
+        std::get<0>(plan.keyframe_index_intervals.back()) != gop) {
+      plan.keyframe_index_intervals.push_back(std::make_tuple(gop, gop + 1));
+      plan.valid_frames.emplace_back();
+    }
+    plan.valid_frames.back().push_back(row);
+  }
+  return plan;
+}
+
+}
+
+TEST(DecodeCostModel, AdjacentGOPsShareAnInterval) {
+  SyntheticIndex index(100, 10);
+  // Decoding on to the next sampled GOP costs the 4 frames after each row
+  VideoIntervals plan = index.plan({5, 15, 25}, make_cost(1, 4));
+  ASSERT_EQ(plan.keyframe_index_intervals.size(), 1);
+  EXPECT_EQ(plan.keyframe_index_intervals[0], std::make_tuple(0, 3));
+  EXPECT_EQ(plan.valid_frames[0], std::vector<i64>({5, 15, 25}));
+}
+
+TEST(DecodeCostModel, SeeksWhenDecodingThroughIsExpensive) {
+  SyntheticIndex index(100, 10);
+  // Decoding on from frame 5 through GOPs 1-3 costs 34 frames, more than a
+  // new interval
+  VideoIntervals plan = index.plan({5, 45}, make_cost(1, 20));
+  ASSERT_EQ(plan.keyframe_index_intervals.size(), 2);
+  EXPECT_EQ(plan.keyframe_index_intervals[0], std::make_tuple(0, 1));
+  EXPECT_EQ(plan.keyframe_index_intervals[1], std::make_tuple(4, 5));
+  EXPECT_EQ(plan.valid_frames[0], std::vector<i64>({5}));
+  EXPECT_EQ(plan.valid_frames[1], std::vector<i64>({45}));
+}
+
+TEST(DecodeCostModel, DecodesThroughWhenSeekingIsExpensive) {
+  SyntheticIndex index(100, 10);
+  VideoIntervals plan = index.plan({5, 45}, make_cost(1, 40));
+  ASSERT_EQ(plan.keyframe_index_intervals.size(), 1);
+  EXPECT_EQ(plan.keyframe_index_intervals[0], std::make_tuple(0, 5));
+  EXPECT_EQ(plan.valid_frames[0], std::vector<i64>({5, 45}));
+}
+
+TEST(DecodeCostModel, SkippedFramesAreNotCharged) {
+  SyntheticIndex index(100, 10);
+  // Half of the frames of GOPs 1-3 can be skipped, so decoding on from
+  // frame 5 costs 19 frames
+  for (u64 s = 10; s < 40; s += 2) {
+    index.non_reference_samples.push_back(s + 1);
+  }
+  VideoIntervals plan = index.plan({5, 45}, make_cost(1, 20));
+  ASSERT_EQ(plan.keyframe_index_intervals.size(), 1);
+}
+
+TEST(DecodeCostModel, SeparatelyEncodedVideosAreNotDecodedThrough) {
+  SyntheticIndex index(100, 10);
+  // The second video starts at frame 50 and does not follow the first one
+  // in the file
+  for (size_t i = 50; i < index.sample_offsets.size(); ++i) {
+    index.sample_offsets[i] += 10;
+  }
+  VideoIntervals plan = index.plan({45, 55}, make_cost(1, 1000));
+  ASSERT_EQ(plan.keyframe_index_intervals.size(), 2);
+  EXPECT_EQ(plan.keyframe_index_intervals[1], std::make_tuple(5, 6));
+}
+
+TEST(DecodeCostModel, ZeroSeekCostSplitsAdjacentGOPs) {
+  SyntheticIndex index(100, 10);
+  // The frames after row 5 are only decoded by decoding through
+  VideoIntervals plan = index.plan({5, 15}, make_cost(1, 0));
+  ASSERT_EQ(plan.keyframe_index_intervals.size(), 2);
+  EXPECT_EQ(plan.keyframe_index_intervals[0], std::make_tuple(0, 1));
+  EXPECT_EQ(plan.keyframe_index_intervals[1], std::make_tuple(1, 2));
+  // Nothing is left to decode after the last frame of a GOP
+  plan = index.plan({9, 15}, make_cost(1, 0));
+  ASSERT_EQ(plan.keyframe_index_intervals.size(), 1);
+}
+
+TEST(DecodeCostModel, PlanIsNoCostlierThanAlwaysSeeking) {
+  SyntheticIndex index(3000, 30);
+  DecodeCost cost = make_cost(1, 25);
+  for (i64 stride : {1, 7, 29, 31, 45, 61, 200}) {
+    std::vector<i64> rows;
+    for (i64 r = 0; r < 3000; r += stride) {
+      rows.push_back(r);
+    }
+    VideoIntervals plan = index.plan(rows, cost);
+    VideoIntervals seek_plan = seek_every_gop(index, rows);
+    std::vector<i64> planned_rows;
+    for (auto& frames : plan.valid_frames) {
+      planned_rows.insert(planned_rows.end(), frames.begin(), frames.end());
+    }
+    EXPECT_EQ(planned_rows, rows);
+    EXPECT_LE(estimate_plan_seconds(plan, index.keyframe_positions,
+                                    index.sample_offsets,
+                                    index.non_reference_samples, cost),
+              estimate_plan_seconds(seek_plan, index.keyframe_positions,
+                                    index.sample_offsets,
+                                    index.non_reference_samples, cost));
+  }
+}
+
+TEST(DecodeCostModel, CalibratesFromMeasurements) {
+  DecodeCostModel model;
+  DecodeCostModel::VideoKey video(0, 1, 0);
+  DecodeCost initial = model.cost(video, 1920, 1080);
+  EXPECT_DOUBLE_EQ(initial.frame_seconds,
+                   DEFAULT_DECODE_SECONDS_PER_PIXEL * 1920 * 1080);
+  EXPECT_DOUBLE_EQ(initial.byte_seconds, DEFAULT_READ_BYTE_SECONDS);
+
+  model.record_decode(video, 100, 1.0);
+  // Reads take 2ms plus 1ns per byte
+  for (i64 i = 0; i < 50; ++i) {
+    i64 bytes = (i % 5 + 1) * 1000000;
+    model.record_read(bytes, 2e-3 + bytes * 1e-9);
+  }
+  DecodeCost cost = model.cost(video, 1920, 1080);
+  EXPECT_DOUBLE_EQ(cost.frame_seconds, 0.01);
+  EXPECT_NEAR(cost.byte_seconds, 1e-9, 1e-12);
+  EXPECT_NEAR(cost.interval_seconds,
+              2e-3 + DECODER_RESTART_FRAMES * cost.frame_seconds, 1e-6);
+  // Other videos are not affected by the measurement
+  DecodeCost other = model.cost(DecodeCostModel::VideoKey(0, 1, 1), 640, 480);
+  EXPECT_DOUBLE_EQ(other.frame_seconds,
+                   DEFAULT_DECODE_SECONDS_PER_PIXEL * 640 * 480);
+}
+
+}
+}
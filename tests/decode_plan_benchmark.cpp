@@ -0,0 +1,170 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Compares decode interval plans over synthetic sampling patterns. For each
+// pattern it prints the number of intervals and estimated read and decode
+// time of starting a new interval at every sampled GOP versus the cost
+// model's plan, and the time taken to plan.
+// Usage: DecodePlanBenchmark [frames gop_size]
+
+#include "scanner/engine/decode_cost_model.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace scanner;
+using namespace scanner::internal;
+
+namespace {
+
+// 1080p H.264 with two B-frames between reference frames
+const u64 KEYFRAME_BYTES = 200000;
+const u64 REFERENCE_BYTES = 40000;
+const u64 NON_REFERENCE_BYTES = 15000;
+
+struct Pattern {
+  std::string name;
+  std::vector<i64> rows;
+};
+
+std::vector<Pattern> make_patterns(i64 frames) {
+  std::vector<Pattern> patterns;
+  for (i64 stride : {2, 10, 30, 100, 300, 1000}) {
+    Pattern p{"stride " + std::to_string(stride), {}};
+    for (i64 r = 0; r < frames; r += stride) {
+      p.rows.push_back(r);
+    }
+    patterns.push_back(p);
+  }
+  std::mt19937 rng(0);
+  for (i64 count : {100, 1000}) {
+    Pattern p{"gather " + std::to_string(count), {}};
+    std::uniform_int_distribution<i64> dist(0, frames - 1);
+    for (i64 i = 0; i < count; ++i) {
+      p.rows.push_back(dist(rng));
+    }
+    std::sort(p.rows.begin(), p.rows.end());
+    p.rows.erase(std::unique(p.rows.begin(), p.rows.end()), p.rows.end());
+    patterns.push_back(p);
+  }
+  // Short bursts of consecutive frames, as sampled around detected events
+  Pattern bursts{"bursts", {}};
+  std::uniform_int_distribution<i64> gap(50, 2000);
+  for (i64 r = 0; r + 10 < frames; r += gap(rng)) {
+    for (i64 i = 0; i < 10; ++i) {
+      bursts.rows.push_back(r + i);
+    }
+  }
+  patterns.push_back(bursts);
+  return patterns;
+}
+
+// The plan which starts a new interval at every sampled GOP
+VideoIntervals seek_every_gop(const std::vector<u64>& keyframe_positions,
+                              const std::vector<i64>& rows) {
+  VideoIntervals plan;
+  for (i64 row : rows) {
+    size_t gop = std::upper_bound(keyframe_positions.begin(),
+                                  keyframe_positions.end() - 1, (u64)row) -
+                 keyframe_positions.begin() - 1;
+    if (plan.keyframe_index_intervals.empty() ||
+        std::get<0>(plan.keyframe_index_intervals.back()) != gop) {
+      plan.keyframe_index_intervals.push_back(std::make_tuple(gop, gop + 1));
+      plan.valid_frames.emplace_back();
+    }
+    plan.valid_frames.back().push_back(row);
+  }
+  return plan;
+}
+
+}
+
+int main(int argc, char** argv) {
+  i64 frames = 108000;
+  i64 gop_size = 250;
+  if (argc == 3) {
+    frames = std::atoll(argv[1]);
+    gop_size = std::atoll(argv[2]);
+  }
+
+  std::vector<u64> keyframe_positions;
+  std::vector<u64> sample_offsets;
+  std::vector<u64> sample_sizes;
+  std::vector<u64> non_reference_samples;
+  u64 offset = 0;
+  for (i64 f = 0; f < frames; ++f) {
+    i64 gop_frame = f % gop_size;
+    u64 size = REFERENCE_BYTES;
+    if (gop_frame == 0) {
+      keyframe_positions.push_back(f);
+      size = KEYFRAME_BYTES;
+    } else if (gop_frame % 3 != 0) {
+      non_reference_samples.push_back(f);
+      size = NON_REFERENCE_BYTES;
+    }
+    sample_offsets.push_back(offset);
+    sample_sizes.push_back(size);
+    offset += size;
+  }
+  keyframe_positions.push_back(frames);
+  sample_offsets.push_back(offset);
+
+  struct Storage {
+    const char* name;
+    double request_seconds;
+    double byte_seconds;
+  };
+  std::vector<Storage> storages = {{"local disk", 1e-4, 1.0 / 2e9},
+                                   {"object store", 5e-2, 1.0 / 2e8}};
+  const double frame_seconds = 4e-3;
+
+  printf("%lld frames, GOP size %lld\n", (long long)frames,
+         (long long)gop_size);
+  for (const Storage& storage : storages) {
+    DecodeCost cost;
+    cost.frame_seconds = frame_seconds;
+    cost.byte_seconds = storage.byte_seconds;
+    cost.interval_seconds =
+        storage.request_seconds + DECODER_RESTART_FRAMES * frame_seconds;
+    printf("\n%s\n", storage.name);
+    printf("%-12s %10s %10s %10s %10s %10s\n", "pattern", "seek ivls",
+           "seek (s)", "model ivls", "model (s)", "plan (us)");
+    for (const Pattern& pattern : make_patterns(frames)) {
+      VideoIntervals seek_plan =
+          seek_every_gop(keyframe_positions, pattern.rows);
+      auto start = std::chrono::high_resolution_clock::now();
+      VideoIntervals plan = plan_decode_intervals(
+          keyframe_positions, sample_offsets, sample_sizes,
+          non_reference_samples, pattern.rows, cost);
+      auto end = std::chrono::high_resolution_clock::now();
+      printf("%-12s %10zu %10.2f %10zu %10.2f %10.1f\n", pattern.name.c_str(),
+             seek_plan.keyframe_index_intervals.size(),
+             estimate_plan_seconds(seek_plan, keyframe_positions,
+                                   sample_offsets, non_reference_samples,
+                                   cost),
+             plan.keyframe_index_intervals.size(),
+             estimate_plan_seconds(plan, keyframe_positions, sample_offsets,
+                                   non_reference_samples, cost),
+             std::chrono::duration<double, std::micro>(end - start).count());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,224 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/util/disk_cache.h"
+#include "scanner/util/fs.h"
+#include "scanner/util/storehouse.h"
+#include "storehouse/storage_backend.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+namespace scanner {
+
+namespace {
+
+const i64 BLOCK_SIZE = 1024;
+// Simulates the round trip to a remote object store
+const auto FETCH_LATENCY = std::chrono::milliseconds(20);
+
+}
+
+class DiskCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    sc_.reset(storehouse::StorageConfig::make_posix_config());
+    storage_.reset(storehouse::StorageBackend::make_from_config(sc_.get()));
+
+    temp_file(object_path_);
+    data_.resize(BLOCK_SIZE * 8);
+    for (size_t i = 0; i < data_.size(); ++i) {
+      data_[i] = (u8)(i * 7);
+    }
+    std::unique_ptr<storehouse::WriteFile> file;
+    BACKOFF_FAIL(make_unique_write_file(storage_.get(), object_path_, file),
+                 "while trying to make write file for " + object_path_);
+    s_write(file.get(), data_.data(), data_.size());
+    BACKOFF_FAIL(file->save(), "while trying to save " + object_path_);
+
+    BACKOFF_FAIL(make_unique_random_read_file(storage_.get(), object_path_,
+                                              file_),
+                 "while trying to make read file for " + object_path_);
+  }
+
+  void TearDown() override {
+    file_.reset();
+    delete_file(object_path_);
+  }
+
+  DiskCacheConfig make_config(i64 capacity) {
+    DiskCacheConfig config;
+    temp_dir(config.path);
+    config.capacity = capacity;
+    config.block_size = BLOCK_SIZE;
+    return config;
+  }
+
+  DiskCache::FetchFn slow_fetch() {
+    return [this](u64 offset, size_t size, u8* buffer) {
+      std::this_thread::sleep_for(FETCH_LATENCY);
+      u64 pos = offset;
+      s_read(file_.get(), buffer, size, pos);
+    };
+  }
+
+  std::unique_ptr<storehouse::StorageConfig> sc_;
+  std::unique_ptr<storehouse::StorageBackend> storage_;
+  std::unique_ptr<storehouse::RandomReadFile> file_;
+  std::string object_path_;
+  std::vector<u8> data_;
+};
+
+TEST_F(DiskCacheTest, ReadThrough) {
+  DiskCache cache(make_config(BLOCK_SIZE * 64));
+
+  // Unaligned range spanning three blocks
+  const u64 offset = BLOCK_SIZE / 2;
+  const size_t size = BLOCK_SIZE * 2;
+  std::vector<u8> buffer(size);
+
+  auto start = std::chrono::steady_clock::now();
+  cache.read(object_path_, data_.size(), data_.size(), offset, size,
+             buffer.data(), slow_fetch());
+  auto cold = std::chrono::steady_clock::now() - start;
+  EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(), data_.begin() + offset));
+  EXPECT_EQ(cache.stats().misses, 3);
+  EXPECT_EQ(cache.stats().hits, 0);
+
+  std::fill(buffer.begin(), buffer.end(), 0);
+  start = std::chrono::steady_clock::now();
+  cache.read(object_path_, data_.size(), data_.size(), offset, size,
+             buffer.data(), slow_fetch());
+  auto warm = std::chrono::steady_clock::now() - start;
+  EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(), data_.begin() + offset));
+  EXPECT_EQ(cache.stats().misses, 3);
+  EXPECT_EQ(cache.stats().hits, 3);
+  EXPECT_EQ(cache.stats().bytes_read_from_cache, (i64)size);
+  EXPECT_GE(cold, FETCH_LATENCY * 3);
+  EXPECT_LT(warm, cold);
+
+  // A new version of the object must not be served from stale blocks
+  cache.read(object_path_, data_.size() + 1, data_.size(), offset, size,
+             buffer.data(), slow_fetch());
+  EXPECT_EQ(cache.stats().misses, 6);
+}
+
+TEST_F(DiskCacheTest, PersistsAcrossInstances) {
+  DiskCacheConfig config = make_config(BLOCK_SIZE * 64);
+  std::vector<u8> buffer(BLOCK_SIZE);
+  {
+    DiskCache cache(config);
+    cache.read(object_path_, data_.size(), data_.size(), 0, BLOCK_SIZE,
+               buffer.data(), slow_fetch());
+  }
+  DiskCache cache(config);
+  EXPECT_GT(cache.bytes_used(), BLOCK_SIZE);
+  cache.read(object_path_, data_.size(), data_.size(), 0, BLOCK_SIZE,
+             buffer.data(), slow_fetch());
+  EXPECT_EQ(cache.stats().hits, 1);
+  EXPECT_EQ(cache.stats().misses, 0);
+}
+
+TEST_F(DiskCacheTest, Eviction) {
+  // Room for roughly two blocks plus their headers
+  const i64 capacity = BLOCK_SIZE * 2 + 512;
+  DiskCache cache(make_config(capacity));
+  std::vector<u8> buffer(BLOCK_SIZE);
+  for (i64 b = 0; b < 4; ++b) {
+    cache.read(object_path_, data_.size(), data_.size(), b * BLOCK_SIZE,
+               BLOCK_SIZE, buffer.data(), slow_fetch());
+    EXPECT_TRUE(std::equal(buffer.begin(), buffer.end(),
+                           data_.begin() + b * BLOCK_SIZE));
+    EXPECT_LE(cache.bytes_used(), capacity);
+  }
+  EXPECT_EQ(cache.stats().evictions, 2);
+
+  // Most recent block is still cached, the first one was evicted
+  cache.read(object_path_, data_.size(), data_.size(), 3 * BLOCK_SIZE,
+             BLOCK_SIZE, buffer.data(), slow_fetch());
+  EXPECT_EQ(cache.stats().hits, 1);
+  cache.read(object_path_, data_.size(), data_.size(), 0, BLOCK_SIZE,
+             buffer.data(), slow_fetch());
+  EXPECT_EQ(cache.stats().misses, 5);
+}
+
+TEST_F(DiskCacheTest, VersionChangesOnRewrite) {
+  DiskCacheConfig config = make_config(BLOCK_SIZE * 64);
+  u64 version;
+  {
+    DiskCache cache(config);
+    version = cache.version(object_path_, data_.size(), slow_fetch());
+    EXPECT_EQ(cache.version(object_path_, data_.size(), slow_fetch()),
+              version);
+  }
+
+  // Same size, different contents
+  data_[data_.size() - 1]++;
+  std::unique_ptr<storehouse::WriteFile> file;
+  BACKOFF_FAIL(make_unique_write_file(storage_.get(), object_path_, file),
+               "while trying to make write file for " + object_path_);
+  s_write(file.get(), data_.data(), data_.size());
+  BACKOFF_FAIL(file->save(), "while trying to save " + object_path_);
+  BACKOFF_FAIL(make_unique_random_read_file(storage_.get(), object_path_,
+                                            file_),
+               "while trying to make read file for " + object_path_);
+
+  DiskCache cache(config);
+  EXPECT_NE(cache.version(object_path_, data_.size(), slow_fetch()), version);
+}
+
+TEST_F(DiskCacheTest, BudgetIsSharedByCachesOnTheNode) {
+  // Two caches over the same directory stand in for two worker processes
+  const i64 capacity = BLOCK_SIZE * 2 + 512;
+  DiskCacheConfig config = make_config(capacity);
+  DiskCache first(config);
+  DiskCache second(config);
+  std::vector<u8> buffer(BLOCK_SIZE);
+  for (i64 b = 0; b < 2; ++b) {
+    first.read(object_path_, data_.size(), data_.size(), b * BLOCK_SIZE,
+               BLOCK_SIZE, buffer.data(), slow_fetch());
+  }
+  for (i64 b = 2; b < 4; ++b) {
+    second.read(object_path_, data_.size(), data_.size(), b * BLOCK_SIZE,
+                BLOCK_SIZE, buffer.data(), slow_fetch());
+  }
+  // The second cache saw the blocks of the first one and evicted them
+  EXPECT_LE(second.bytes_used(), capacity);
+  EXPECT_EQ(second.stats().evictions, 2);
+  DiskCache after(config);
+  EXPECT_LE(after.bytes_used(), capacity);
+  first.read(object_path_, data_.size(), data_.size(), 0, BLOCK_SIZE,
+             buffer.data(), slow_fetch());
+  EXPECT_EQ(first.stats().misses, 3);
+}
+
+TEST_F(DiskCacheTest, ReadStats) {
+  DiskCache cache(make_config(BLOCK_SIZE * 64));
+  std::vector<u8> buffer(BLOCK_SIZE * 2);
+  DiskCacheStats cold;
+  cache.read(object_path_, data_.size(), data_.size(), 0, buffer.size(),
+             buffer.data(), slow_fetch(), &cold);
+  EXPECT_EQ(cold.misses, 2);
+  EXPECT_EQ(cold.hits, 0);
+  DiskCacheStats warm;
+  cache.read(object_path_, data_.size(), data_.size(), 0, buffer.size(),
+             buffer.data(), slow_fetch(), &warm);
+  EXPECT_EQ(warm.misses, 0);
+  EXPECT_EQ(warm.hits, 2);
+}
+
+}
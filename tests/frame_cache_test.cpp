@@ -0,0 +1,144 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/frame_cache.h"
+#include "scanner/util/memory.h"
+
+#include <gtest/gtest.h>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+const size_t FRAME_SIZE = 1024;
+const i32 FRAMES_PER_BLOCK = 4;
+const size_t BLOCK_SIZE = FRAME_SIZE * FRAMES_PER_BLOCK;
+
+const i32 FRAME_WIDTH = 32;
+const i32 FRAME_HEIGHT = 32;
+
+FrameCacheKey key(i32 table_id, i32 column_id, i32 item_id, i64 frame,
+                  FrameFormat format = FrameFormat::RGB24,
+                  i32 width = FRAME_WIDTH) {
+  return FrameCacheKey(table_id, column_id, item_id, frame, format, width,
+                       FRAME_HEIGHT);
+}
+
+}
+
+class FrameCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    MemoryPoolConfig config;
+    init_memory_allocators(config, {});
+  }
+
+  void TearDown() override { destroy_memory_allocators(); }
+
+  // Allocates a block of decoded frames, filling each frame with its index
+  u8* new_frames(i64 first_frame) {
+    u8* block = new_block_buffer(CPU_DEVICE, BLOCK_SIZE, FRAMES_PER_BLOCK);
+    for (i32 i = 0; i < FRAMES_PER_BLOCK; ++i) {
+      memset(block + i * FRAME_SIZE, (u8)(first_frame + i), FRAME_SIZE);
+    }
+    return block;
+  }
+
+  void delete_frames(u8* block) {
+    for (i32 i = 0; i < FRAMES_PER_BLOCK; ++i) {
+      delete_buffer(CPU_DEVICE, block + i * FRAME_SIZE);
+    }
+  }
+};
+
+TEST_F(FrameCacheTest, HitSharesBuffer) {
+  FrameCache cache(BLOCK_SIZE * 4);
+  u8* block = new_frames(0);
+  for (i32 i = 0; i < FRAMES_PER_BLOCK; ++i) {
+    cache.insert(CPU_DEVICE, key(1, 2, 0, i), block + i * FRAME_SIZE);
+  }
+  // The cache keeps the frames alive after the decoder output is released
+  delete_frames(block);
+  EXPECT_EQ(cache.bytes_used(), (i64)BLOCK_SIZE);
+
+  u8* frame = cache.get(CPU_DEVICE, key(1, 2, 0, 2));
+  ASSERT_EQ(frame, block + 2 * FRAME_SIZE);
+  EXPECT_EQ(frame[0], 2);
+  EXPECT_EQ(cache.get(CPU_DEVICE, key(1, 2, 1, 2)), nullptr);
+  EXPECT_EQ(cache.get(CPU_DEVICE, key(1, 2, 0, 2, FrameFormat::GRAY8)),
+            nullptr);
+  EXPECT_EQ(cache.get(CPU_DEVICE,
+                      key(1, 2, 0, 2, FrameFormat::RGB24, FRAME_WIDTH / 2)),
+            nullptr);
+  DeviceHandle gpu = {DeviceType::GPU, 0};
+  EXPECT_EQ(cache.get(gpu, key(1, 2, 0, 2)), nullptr);
+
+  // The returned reference outlives the cache's own reference
+  cache.clear();
+  EXPECT_EQ(cache.bytes_used(), 0);
+  EXPECT_EQ(frame[FRAME_SIZE - 1], 2);
+  delete_buffer(CPU_DEVICE, frame);
+  EXPECT_EQ(current_memory_allocated(CPU_DEVICE), 0);
+
+  FrameCacheStats stats = cache.stats();
+  EXPECT_EQ(stats.hits, 1);
+  EXPECT_EQ(stats.misses, 4);
+  EXPECT_EQ(stats.insertions, FRAMES_PER_BLOCK);
+}
+
+TEST_F(FrameCacheTest, EvictsLeastRecentlyUsedBlocks) {
+  FrameCache cache(BLOCK_SIZE * 2);
+  for (i64 b = 0; b < 3; ++b) {
+    u8* block = new_frames(b * FRAMES_PER_BLOCK);
+    for (i32 i = 0; i < FRAMES_PER_BLOCK; ++i) {
+      cache.insert(CPU_DEVICE, key(0, 0, 0, b * FRAMES_PER_BLOCK + i),
+                   block + i * FRAME_SIZE);
+    }
+    delete_frames(block);
+    if (b == 1) {
+      // Make the first frame of the first block the most recently used
+      delete_buffer(CPU_DEVICE, cache.get(CPU_DEVICE, key(0, 0, 0, 0)));
+    }
+  }
+  // Frame 0 pins the first block, which leaves room for only one other block,
+  // so the second block is evicted
+  EXPECT_LE(cache.bytes_used(), (i64)BLOCK_SIZE * 2);
+  EXPECT_EQ(current_memory_allocated(CPU_DEVICE), (u64)cache.bytes_used());
+  u8* frame = cache.get(CPU_DEVICE, key(0, 0, 0, 0));
+  ASSERT_NE(frame, nullptr);
+  delete_buffer(CPU_DEVICE, frame);
+  EXPECT_EQ(cache.get(CPU_DEVICE, key(0, 0, 0, FRAMES_PER_BLOCK)),
+            nullptr);
+  frame = cache.get(CPU_DEVICE, key(0, 0, 0, 2 * FRAMES_PER_BLOCK));
+  ASSERT_NE(frame, nullptr);
+  delete_buffer(CPU_DEVICE, frame);
+
+  cache.clear();
+  EXPECT_EQ(current_memory_allocated(CPU_DEVICE), 0);
+}
+
+TEST_F(FrameCacheTest, SkipsBlocksLargerThanCapacity) {
+  FrameCache cache(BLOCK_SIZE / 2);
+  u8* block = new_frames(0);
+  cache.insert(CPU_DEVICE, key(0, 0, 0, 0), block);
+  delete_frames(block);
+  EXPECT_EQ(cache.bytes_used(), 0);
+  EXPECT_EQ(cache.get(CPU_DEVICE, key(0, 0, 0, 0)), nullptr);
+  EXPECT_EQ(current_memory_allocated(CPU_DEVICE), 0);
+}
+
+}
+}
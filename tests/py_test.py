@@ -137,6 +137,8 @@ def db():
             [('test1_inplace', vid1_path), ('test2_inplace', vid2_path)],
             inplace=True)
 
+        db.ingest_videos([('test1_proxy', vid1_path)], proxy_scales=[2, 4])
+
         yield db
 
         # Tear down
@@ -176,6 +178,67 @@ def test_gather_video_column(db):
         assert len(frames) == len(rows)
 
 
+def test_inplace_ingest(db):
+    def frames(table, rows):
+        return [f for f in table.column('frame').load(rows=rows)]
+
+    def is_inplace(table):
+        column = table.column('frame')
+        column._load_meta()
+        return column._video_descriptor.inplace
+
+    # The fixture's video and its copy ingest
+    rows = [0, 1, 10, 100, 200, 719]
+    inplace = db.table('test1_inplace')
+    assert is_inplace(inplace)
+    for (i, c) in zip(frames(inplace, rows), frames(db.table('test1'), rows)):
+        assert np.array_equal(i, c)
+
+    # The container index is parsed in blocks whether it precedes or follows
+    # the media data
+    for movflags in ['+faststart', '-faststart']:
+        with tempfile.NamedTemporaryFile(delete=False, suffix='.mp4') as f:
+            vid_path = f.name
+        run([
+            'ffmpeg', '-y', '-f', 'lavfi', '-i',
+            'testsrc=duration=4:size=160x120:rate=24', '-c:v', 'libx264',
+            '-g', '24', '-movflags', movflags, vid_path
+        ])
+        [inplace], _ = db.ingest_videos(
+            [('test_inplace', vid_path)], inplace=True, force=True)
+        [copied], _ = db.ingest_videos(
+            [('test_inplace_copy', vid_path)], force=True)
+        assert is_inplace(inplace)
+        assert inplace.num_rows() == 96
+        assert copied.num_rows() == 96
+        rows = list(range(0, 96, 5)) + [95]
+        for (i, c) in zip(frames(inplace, rows), frames(copied, rows)):
+            assert np.array_equal(i, c)
+        db.delete_tables(['test_inplace', 'test_inplace_copy'])
+        run(['rm', '-f', vid_path])
+
+    # The in-place decoder only handles H.264, so HEVC videos are copied
+    with tempfile.NamedTemporaryFile(delete=False, suffix='.mp4') as f:
+        vid_path = f.name
+    run([
+        'ffmpeg', '-y', '-f', 'lavfi', '-i',
+        'testsrc=duration=4:size=160x120:rate=24', '-c:v', 'libx265',
+        vid_path
+    ])
+    [table], failures = db.ingest_videos(
+        [('test_inplace_hevc', vid_path)], inplace=True, force=True)
+    assert failures == []
+    assert not is_inplace(table)
+    column = table.column('frame')
+    column._load_meta()
+    desc = column._video_descriptor
+    assert desc.codec_type == db.protobufs.VideoDescriptor.HEVC
+    assert table.num_rows() == 96
+    assert len([f for f in column.load()]) == 96
+    db.delete_table('test_inplace_hevc')
+    run(['rm', '-f', vid_path])
+
+
 def test_profiler(db):
     frame = db.sources.FrameColumn()
     hist = db.ops.Histogram(frame=frame)
@@ -195,6 +258,48 @@ def test_profiler(db):
     run(['rm', '-f', f.name])
 
 
+def test_luma_histogram(db):
+    def run(output_name, with_rgb_consumer):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.Range(frame, 0, 30)
+        luma = db.ops.LumaHistogram(frame=range_frame)
+        columns = {'histogram': luma}
+        if with_rgb_consumer:
+            # Histogram reads RGB24, so the decoder can not produce GRAY8
+            columns['rgb_histogram'] = db.ops.Histogram(frame=range_frame)
+        output_op = db.sinks.Column(columns=columns)
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name
+        })
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            cache_results=False)
+        hists = [
+            np.frombuffer(h, dtype=np.int32)
+            for h in table.column('histogram').load()
+        ]
+        return hists, table.profiler().counters()
+
+    gray_hists, gray_counters = run('test_luma_histogram_gray', False)
+    rgb_hists, rgb_counters = run('test_luma_histogram_rgb', True)
+    assert gray_counters.get('decoded_GRAY8_frames', 0) > 0
+    assert gray_counters.get('decoded_RGB24_frames', 0) == 0
+    assert rgb_counters.get('decoded_RGB24_frames', 0) > 0
+    assert rgb_counters.get('decoded_GRAY8_frames', 0) == 0
+    assert len(gray_hists) == 30
+    assert len(rgb_hists) == 30
+    for (g, r) in zip(gray_hists, rgb_hists):
+        assert g.shape == (16, )
+        assert g.sum() == 640 * 480
+        assert r.sum() == 640 * 480
+        # The luma recomputed from RGB24 differs from the decoded Y plane
+        # only by rounding
+        assert np.abs(g - r).sum() < 0.05 * 640 * 480
+
+
 def test_new_table(db):
     def b(s):
         return bytes(s, 'utf-8')
@@ -206,6 +311,72 @@ def test_new_table(db):
     assert (next(t.column('col2').load()) == b('r01'))
 
 
+def test_delete_table(db):
+    def b(s):
+        return bytes(s, 'utf-8')
+
+    with tempfile.NamedTemporaryFile(delete=False, suffix='.mp4') as f:
+        vid_path = f.name
+    run([
+        'ffmpeg', '-y', '-f', 'lavfi', '-i',
+        'testsrc=duration=2:size=160x120:rate=24', '-c:v', 'libx264',
+        vid_path
+    ])
+
+    # New table, ingest and deletion entries all go through the master's
+    # metadata log
+    db.new_table('test_delete', ['col1'], [[b('r00')]])
+    db.ingest_videos([('test_delete_video', vid_path)])
+    db.delete_table('test_delete')
+    db.delete_table('test_delete_video')
+    assert not db.has_table('test_delete')
+    assert not db.has_table('test_delete_video')
+
+    # The deleted names can be reused
+    [table], _ = db.ingest_videos([('test_delete_video', vid_path)])
+    assert table.num_rows() == 48
+    db.delete_table('test_delete_video')
+    assert not db.has_table('test_delete_video')
+    run(['rm', '-f', vid_path])
+
+
+def test_parallel_index(db):
+    with tempfile.NamedTemporaryFile(delete=False, suffix='.mp4') as f:
+        vid_path = f.name
+    # A keyframe every 12 frames, so the video splits into many chunks
+    run([
+        'ffmpeg', '-y', '-f', 'lavfi', '-i',
+        'testsrc=duration=4:size=160x120:rate=24', '-c:v', 'libx264', '-g',
+        '12', vid_path
+    ])
+
+    [sequential], _ = db.ingest_videos(
+        [('test_index_sequential', vid_path)], force=True)
+    # Every video is indexed in parallel, with a chunk per IDR frame
+    [parallel], _ = db.ingest_videos(
+        [('test_index_parallel', vid_path)],
+        force=True,
+        parallel_index_min_bytes=1,
+        index_chunk_bytes=1)
+
+    def descriptor(table):
+        column = table.column('frame')
+        column._load_meta()
+        return column._video_descriptor
+
+    seq_desc = descriptor(sequential)
+    par_desc = descriptor(parallel)
+    assert seq_desc.frames == 96
+    assert len(seq_desc.keyframe_indices) > 1
+    assert par_desc.frames == seq_desc.frames
+    assert par_desc.keyframe_indices == seq_desc.keyframe_indices
+    assert par_desc.sample_offsets == seq_desc.sample_offsets
+    assert par_desc.sample_sizes == seq_desc.sample_sizes
+    assert par_desc.metadata_packets == seq_desc.metadata_packets
+    db.delete_tables(['test_index_sequential', 'test_index_parallel'])
+    run(['rm', '-f', vid_path])
+
+
 def test_sample(db):
     def run_sampler_job(sampler, sampler_args, expected_rows):
         frame = db.sources.FrameColumn()
@@ -359,6 +530,49 @@ def test_bounded_state(db):
     assert num_rows == 5
 
 
+def test_task_affinity(db):
+    warmup = 3
+    num_rows = 60
+    warmup_key = 'warmup_rows:TestIncrementBounded'
+
+    def run(output_name, task_affinity):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.Range(frame, 0, num_rows)
+        increment = db.ops.TestIncrementBounded(
+            ignore=range_frame, bounded_state=warmup)
+        output_op = db.sinks.Column(columns={'integer': increment})
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name,
+        })
+        # Every task can wait in the queue of one instance, so the instance
+        # which ran the previous task is never considered backed up
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            io_packet_size=5,
+            work_packet_size=5,
+            pipeline_instances_per_node=2,
+            tasks_in_queue_per_pu=num_rows // 5,
+            task_affinity=task_affinity)
+        vals = [
+            struct.unpack('=q', b)[0] for b in table.column('integer').load()
+        ]
+        return vals, table.profiler().counters()
+
+    # The tasks are run in order on one instance, which carries the kernel
+    # state across every task boundary
+    vals, counters = run('test_task_affinity', True)
+    assert vals == list(range(num_rows))
+
+    # Without affinity, each task after the first warms up from scratch
+    reset_vals, reset_counters = run('test_task_affinity_reset', False)
+    assert len(reset_vals) == num_rows
+    assert reset_counters.get(warmup_key, 0) > 0
+    assert counters.get(warmup_key, 0) < reset_counters[warmup_key]
+
+
 def test_unbounded_state(db):
     frame = db.sources.FrameColumn()
     slice_frame = db.streams.Slice(frame, db.partitioner.all(50))
@@ -721,6 +935,45 @@ def test_python_batch_kernel(db):
     next(tables[0].load(['dummy']))
 
 
+@scannerpy.register_python_op(batch=8)
+class TestPyBatchSize(Kernel):
+    def __init__(self, config):
+        pass
+
+    def close(self):
+        pass
+
+    def execute(self, frame: Sequence[FrameType]) -> Sequence[bytes]:
+        return [struct.pack('=q', len(frame)) for _ in frame]
+
+
+def test_cross_task_batching(db):
+    frame = db.sources.FrameColumn()
+    range_frame = db.streams.Range(frame, 0, 30)
+    test_out = db.ops.TestPyBatchSize(frame=range_frame, batch=8)
+    output_op = db.sinks.Column(columns={'batch_size': test_out})
+    job = Job(op_args={
+        frame: db.table('test1').column('frame'),
+        output_op: 'test_cross_task_batching'
+    })
+
+    # Tasks of 5 rows can only fill a batch of 8 with rows of the next task
+    [table] = db.run(
+        output_op, [job],
+        force=True,
+        show_progress=False,
+        io_packet_size=5,
+        work_packet_size=5,
+        pipeline_instances_per_node=1,
+        cross_task_batch_timeout=10000)
+    sizes = [
+        struct.unpack('=q', b)[0]
+        for b in table.column('batch_size').load()
+    ]
+    assert len(sizes) == 30
+    assert max(sizes) == 8
+
+
 @scannerpy.register_python_op(stencil=[0, 1])
 class TestPyStencil(Kernel):
     def __init__(self, config):
@@ -813,6 +1066,129 @@ def test_bind_op_args(db):
         assert p['y'] == y
 
 
+def test_result_cache(db):
+    def run(output_name, cache_results):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.Range(frame, 0, 30)
+        hist = db.ops.Histogram(frame=range_frame)
+        output_op = db.sinks.Column(columns={'histogram': hist})
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name
+        })
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            cache_results=cache_results)
+        return [h for h in table.column('histogram').load()]
+
+    # The second run reads the histograms written by the first instead of
+    # recomputing them, so all three must agree
+    computed = run('test_result_cache_1', True)
+    reused = run('test_result_cache_2', True)
+    (hits, _) = db.result_cache_stats()
+    assert hits > 0
+    recomputed = run('test_result_cache_3', False)
+    assert db.result_cache_stats() == (0, 0)
+    assert len(computed) == 30
+    assert computed == reused
+    assert computed == recomputed
+
+
+def test_gop_parallel_decode(db):
+    def run(output_name, gop_parallel_decoders, decoder_buffered_frames=0):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.StridedRange(frame, 0, 300, 3)
+        hist = db.ops.Histogram(frame=range_frame)
+        output_op = db.sinks.Column(columns={'histogram': hist})
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name
+        })
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            io_packet_size=100,
+            work_packet_size=10,
+            cache_results=False,
+            gop_parallel_decoders=gop_parallel_decoders,
+            decoder_buffered_frames=decoder_buffered_frames)
+        return [h for h in table.column('histogram').load()]
+
+    sequential = run('test_gop_parallel_decode_1', 1)
+    parallel = run('test_gop_parallel_decode_4', 4)
+    shallow = run('test_gop_parallel_decode_shallow', 1, 1)
+    assert len(sequential) == 100
+    assert sequential == parallel
+    assert sequential == shallow
+
+
+def test_sparse_decode(db):
+    # Strided decodes skip the packets of non-reference frames which are not
+    # sampled, so they must produce the same frames as a dense decode
+    def run(output_name, stride):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.StridedRange(frame, 0, 300, stride)
+        hist = db.ops.Histogram(frame=range_frame)
+        output_op = db.sinks.Column(columns={'histogram': hist})
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name
+        })
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            cache_results=False)
+        return [h for h in table.column('histogram').load()]
+
+    dense = run('test_sparse_decode_dense', 1)
+    sparse = run('test_sparse_decode_sparse', 5)
+    assert len(sparse) == 60
+    assert dense[::5] == sparse
+
+
+@scannerpy.register_python_op(name='ConcatPrevious', stencil=[-1, 0])
+def concat_previous(config, row: Sequence[bytes]) -> bytes:
+    return row[0] + row[1]
+
+
+def test_incremental(db):
+    def run():
+        row = db.sources.Column()
+        out = db.ops.ConcatPrevious(row=row)
+        output_op = db.sinks.Column(columns={'out': out})
+        job = Job(op_args={
+            row: db.table('test_incremental_src').column('x'),
+            output_op: 'test_incremental'
+        })
+        [table] = db.run(
+            output_op, [job],
+            incremental=True,
+            cache_results=False,
+            show_progress=False)
+        return table
+
+    if db.has_table('test_incremental'):
+        db.delete_table('test_incremental')
+    db.new_table('test_incremental_src', ['x'], [[b'a'], [b'b']], force=True)
+    table = run()
+    assert table.num_rows() == 2
+
+    # Only the appended rows are processed, and the first of them sees the
+    # last row from before the append through its stencil
+    db.new_table('test_incremental_src', ['x'], [[b'c'], [b'd']], append=True)
+    table = run()
+    assert table.num_rows() == 4
+    assert list(table.column('out').load()) == [b'aa', b'ab', b'bc', b'cd']
+
+    # No new rows
+    table = run()
+    assert table.num_rows() == 4
+
+
 def test_blur(db):
     frame = db.sources.FrameColumn()
     range_frame = db.streams.Range(frame, 0, 30)
@@ -834,6 +1210,169 @@ def test_blur(db):
     assert frame_array.shape[2] == 3
 
 
+def test_fused_resize(db):
+    def run(output_name, fused):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.Range(frame, 0, 30)
+        resized_frame = db.ops.Resize(frame=range_frame, width=320, height=240)
+        columns = {'frame': resized_frame}
+        if not fused:
+            # A second consumer needs the frames at their original size
+            columns['histogram'] = db.ops.Histogram(frame=range_frame)
+        output_op = db.sinks.Column(columns=columns)
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name,
+        })
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            cache_results=False)
+        frames = [f for f in table.column('frame').load()]
+        return frames, table.profiler().counters()
+
+    # Resize is the only consumer of the frames, so the decoder produces
+    # frames at the target size
+    fused_frames, fused_counters = run('test_fused_resize', True)
+    frames, counters = run('test_unfused_resize', False)
+    assert fused_counters.get('fused_resize_frames', 0) > 0
+    assert fused_counters.get('fused_resize_ns', 0) > 0
+    assert counters.get('fused_resize_frames', 0) == 0
+    assert len(fused_frames) == 30
+    assert len(frames) == 30
+    for (fused, unfused) in zip(fused_frames, frames):
+        assert fused.dtype == np.uint8
+        assert fused.shape == (240, 320, 3)
+        assert unfused.shape == (240, 320, 3)
+        # The decoder resizes before converting to RGB, which only differs
+        # from the Resize kernel by rounding
+        diff = np.abs(fused.astype(np.int32) - unfused.astype(np.int32))
+        assert diff.mean() < 4
+
+
+def test_proxy_resize(db):
+    table = db.table('test1_proxy')
+    assert table.num_rows() == db.table('test1').num_rows()
+    proxy = next(table.column('frame_proxy_4').load(rows=[0]))
+    assert proxy.shape == (120, 160, 3)
+
+    # Frames resized to the proxy size or below are decoded from the proxy
+    def run_resize(use_proxies):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.Range(frame, 0, 30)
+        resized_frame = db.ops.Resize(frame=range_frame, width=80, height=60)
+        output_op = db.sinks.Column(columns={'frame': resized_frame})
+        job = Job(op_args={
+            frame: table.column('frame'),
+            output_op: 'test_proxy_resize',
+        })
+        [output] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            use_proxies=use_proxies,
+            cache_results=False)
+        counters = output.profiler().counters()
+        assert counters.get('decoded_RGB24_frames', 0) > 0
+        # Size of the frames the decoder read
+        decoded_size = (counters['decoded_pixels'] /
+                        counters['decoded_RGB24_frames'])
+        return [f for f in output.column('frame').load()], decoded_size
+
+    proxy_frames, proxy_size = run_resize(True)
+    full_frames, full_size = run_resize(False)
+    assert proxy_size == 160 * 120
+    assert full_size == 640 * 480
+    assert len(proxy_frames) == 30
+    assert len(full_frames) == 30
+    for (p, f) in zip(proxy_frames, full_frames):
+        assert p.shape == (60, 80, 3)
+        assert f.shape == (60, 80, 3)
+        # Both are downscaled from the same picture, up to encoding loss
+        assert np.abs(p.astype(np.int32) - f.astype(np.int32)).mean() < 16
+
+
+def test_kernel_fusion(db):
+    # Blur and Histogram run back-to-back on each batch when fused
+    def run(output_name, fuse_kernels):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.Range(frame, 0, 30)
+        blurred_frame = db.ops.Blur(
+            frame=range_frame, kernel_size=3, sigma=0.5)
+        hist = db.ops.Histogram(frame=blurred_frame)
+        output_op = db.sinks.Column(columns={'histogram': hist})
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name
+        })
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            cache_results=False,
+            fuse_kernels=fuse_kernels)
+        return [h for h in table.column('histogram').load()]
+
+    fused = run('test_kernel_fusion_1', True)
+    unfused = run('test_kernel_fusion_2', False)
+    assert len(fused) == 30
+    assert fused == unfused
+
+
+def test_branch_threads(db):
+    # Histogram runs on the branch pool while Blur evaluates the same frames
+    def run(output_name, branch_threads):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.Range(frame, 0, 30)
+        hist = db.ops.Histogram(frame=range_frame)
+        blurred_frame = db.ops.Blur(
+            frame=range_frame, kernel_size=3, sigma=0.5)
+        output_op = db.sinks.Column(columns={
+            'histogram': hist,
+            'frame': blurred_frame.lossless()
+        })
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name
+        })
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            cache_results=False,
+            branch_threads=branch_threads)
+        return [h for h in table.column('histogram').load()]
+
+    concurrent = run('test_branch_threads_1', 2)
+    sequential = run('test_branch_threads_2', 1)
+    assert len(concurrent) == 30
+    assert concurrent == sequential
+
+
+def test_replicated_op(db):
+    def run(output_name, replicas):
+        frame = db.sources.FrameColumn()
+        range_frame = db.streams.Range(frame, 0, 30)
+        hist = db.ops.Histogram(frame=range_frame, replicas=replicas)
+        output_op = db.sinks.Column(columns={'histogram': hist})
+        job = Job(op_args={
+            frame: db.table('test1').column('frame'),
+            output_op: output_name
+        })
+        [table] = db.run(
+            output_op, [job],
+            force=True,
+            show_progress=False,
+            cache_results=False)
+        return [h for h in table.column('histogram').load()]
+
+    replicated = run('test_replicated_op_1', 3)
+    single = run('test_replicated_op_2', 1)
+    assert len(replicated) == 30
+    assert replicated == single
+
+
 def test_lossless(db):
     frame = db.sources.FrameColumn()
     range_frame = db.streams.Range(frame, 0, 30)
@@ -867,6 +1406,138 @@ def test_compress(db):
     next(table.load(['frame']))
 
 
+def test_compress_parallel_gops(db):
+    frame = db.sources.FrameColumn()
+    range_frame = db.streams.Range(frame, 0, 30)
+    compressed_frame = range_frame.compress(
+        'video', keyframe_distance=8, threads=1, preset='veryfast', encoders=3)
+    output_op = db.sinks.Column(columns={'frame': compressed_frame})
+
+    job = Job(op_args={
+        frame: db.table('test1').column('frame'),
+        output_op: 'test_compress_parallel_gops'
+    })
+
+    tables = db.run(output_op, [job], force=True, show_progress=False)
+    table = tables[0]
+    assert table.num_rows() == 30
+    assert len([_ for _ in table.column('frame').load()]) == 30
+
+
+def test_compress_hevc(db):
+    frame = db.sources.FrameColumn()
+    range_frame = db.streams.Range(frame, 0, 30)
+    compressed_frame = range_frame.compress('hevc', keyframe_distance=8)
+    output_op = db.sinks.Column(columns={'frame': compressed_frame})
+
+    job = Job(op_args={
+        frame: db.table('test1').column('frame'),
+        output_op: 'test_compress_hevc'
+    })
+
+    tables = db.run(output_op, [job], force=True, show_progress=False)
+    table = tables[0]
+    assert table.num_rows() == 30
+
+    # Every requested keyframe is an IDR picture, since GOPs are closed
+    column = table.column('frame')
+    column._load_meta()
+    desc = column._video_descriptor
+    assert desc.codec_type == db.protobufs.VideoDescriptor.HEVC
+    assert list(desc.keyframe_indices) == list(range(0, 30, 8))
+
+    # Decoding a strided subset seeks to the HEVC keyframes
+    frame = db.sources.FrameColumn()
+    strided_frame = db.streams.Stride(frame, 5)
+    hist = db.ops.Histogram(frame=strided_frame)
+    output_op = db.sinks.Column(columns={'histogram': hist})
+    job = Job(op_args={
+        frame: table.column('frame'),
+        output_op: 'test_compress_hevc_strided'
+    })
+    tables = db.run(output_op, [job], force=True, show_progress=False)
+    assert tables[0].num_rows() == 6
+
+
+def test_ingest_hevc(db):
+    with tempfile.NamedTemporaryFile(delete=False, suffix='.mp4') as f:
+        vid_path = f.name
+    # Closed GOPs of 12 frames, so every keyframe is an IDR picture
+    run([
+        'ffmpeg', '-y', '-f', 'lavfi', '-i',
+        'testsrc=duration=4:size=160x120:rate=24', '-c:v', 'libx265',
+        '-x265-params', 'keyint=12:min-keyint=12:scenecut=0:open-gop=0',
+        vid_path
+    ])
+    [table], failures = db.ingest_videos([('test_ingest_hevc', vid_path)],
+                                         force=True)
+    assert failures == []
+    assert table.num_rows() == 96
+
+    column = table.column('frame')
+    column._load_meta()
+    desc = column._video_descriptor
+    assert desc.codec_type == db.protobufs.VideoDescriptor.HEVC
+    assert desc.frames == 96
+    assert list(desc.keyframe_indices) == list(range(0, 96, 12))
+    # One sample per picture, laid out back to back
+    assert len(desc.sample_offsets) == 96
+    assert len(desc.sample_sizes) == 96
+    for i in range(95):
+        assert (desc.sample_offsets[i + 1] ==
+                desc.sample_offsets[i] + desc.sample_sizes[i])
+
+    # Seeking to the keyframes gives the frames of a sequential decode
+    frames = [f for f in column.load()]
+    rows = [0, 11, 12, 30, 60, 95]
+    for (r, f) in zip(rows, column.load(rows=rows)):
+        assert np.array_equal(f, frames[r])
+    db.delete_table('test_ingest_hevc')
+
+    # Open GOPs, cut so that the stream starts at a CRA picture whose RASL
+    # pictures are discarded by the decoder
+    with tempfile.NamedTemporaryFile(delete=False, suffix='.mp4') as f:
+        open_path = f.name
+    with tempfile.NamedTemporaryFile(delete=False, suffix='.mp4') as f:
+        cut_path = f.name
+    run([
+        'ffmpeg', '-y', '-f', 'lavfi', '-i',
+        'testsrc=duration=4:size=160x120:rate=24', '-c:v', 'libx265',
+        '-x265-params', 'keyint=12:min-keyint=12:scenecut=0:open-gop=1',
+        open_path
+    ])
+    run(['ffmpeg', '-y', '-ss', '1', '-i', open_path, '-c', 'copy', cut_path])
+    for path in [open_path, cut_path]:
+        decoded = int(
+            subprocess.check_output([
+                'ffprobe', '-v', 'error', '-select_streams', 'v:0',
+                '-count_frames', '-show_entries', 'stream=nb_read_frames',
+                '-of', 'csv=p=0', path
+            ]).decode('utf-8').strip())
+        [table], failures = db.ingest_videos([('test_ingest_hevc', path)],
+                                             force=True)
+        assert failures == []
+        assert table.num_rows() == decoded
+
+        column = table.column('frame')
+        column._load_meta()
+        desc = column._video_descriptor
+        assert desc.frames == decoded
+        assert len(desc.sample_offsets) == decoded
+        # The non-referenced B pictures are mapped to their display order
+        assert len(desc.non_reference_samples) > 0
+        assert (len(desc.non_reference_frames) == len(
+            desc.non_reference_samples))
+
+        frames = [f for f in column.load()]
+        assert len(frames) == decoded
+        rows = list(range(0, decoded, 7)) + [decoded - 1]
+        for (r, f) in zip(rows, column.load(rows=rows)):
+            assert np.array_equal(f, frames[r])
+        db.delete_table('test_ingest_hevc')
+    run(['rm', '-f', vid_path, open_path, cut_path])
+
+
 def test_save_mp4(db):
     frame = db.sources.FrameColumn()
     range_frame = db.streams.Range(frame, 0, 30)
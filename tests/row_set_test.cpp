@@ -0,0 +1,96 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/row_set.h"
+
+#include <gtest/gtest.h>
+
+#include <set>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+void expect_same_rows(const RowSet& set, const std::set<i64>& expected) {
+  EXPECT_EQ(set.size(), expected.size());
+  EXPECT_EQ(set.rows(), std::vector<i64>(expected.begin(), expected.end()));
+  if (expected.empty()) {
+    return;
+  }
+  for (i64 r = *expected.begin() - 2; r <= *expected.rbegin() + 2; ++r) {
+    EXPECT_EQ(set.contains(r), expected.count(r) > 0) << "row " << r;
+  }
+}
+
+}
+
+TEST(RowSet, Empty) {
+  RowSet set;
+  EXPECT_TRUE(set.empty());
+  EXPECT_FALSE(set.contains(0));
+  EXPECT_TRUE(set.rows().empty());
+  set.insert(std::vector<i64>{});
+  EXPECT_TRUE(set.empty());
+}
+
+TEST(RowSet, DenseRows) {
+  std::vector<i64> rows;
+  for (i64 r = 100; r < 10100; ++r) {
+    rows.push_back(r);
+  }
+  RowSet set(rows);
+  expect_same_rows(set, std::set<i64>(rows.begin(), rows.end()));
+}
+
+TEST(RowSet, StridedRows) {
+  std::vector<i64> rows;
+  for (i64 r = 0; r < 1000; r += 3) {
+    rows.push_back(r);
+  }
+  RowSet set(rows);
+  expect_same_rows(set, std::set<i64>(rows.begin(), rows.end()));
+}
+
+TEST(RowSet, UnsortedDuplicateRows) {
+  std::vector<i64> rows = {9, 3, 4, 3, 10, -1, 9, 0};
+  RowSet set(rows);
+  expect_same_rows(set, std::set<i64>(rows.begin(), rows.end()));
+}
+
+TEST(RowSet, Insert) {
+  std::set<i64> expected;
+  RowSet set;
+  // Mixes runs, which keep the set as intervals, with strided rows, which
+  // switch it to a bitmap and back
+  for (i64 start : {500, 0, 250, 10}) {
+    std::vector<i64> rows;
+    for (i64 r = start; r < start + 200; r += (start % 20 == 0 ? 1 : 2)) {
+      rows.push_back(r);
+    }
+    set.insert(rows);
+    expected.insert(rows.begin(), rows.end());
+    expect_same_rows(set, expected);
+  }
+  RowSet other(std::vector<i64>{-5, 1000, 1001});
+  set.insert(other);
+  expected.insert({-5, 1000, 1001});
+  expect_same_rows(set, expected);
+  EXPECT_EQ(set, RowSet(set.rows()));
+  EXPECT_NE(set, other);
+}
+
+}
+}
@@ -0,0 +1,177 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Microbenchmark of staging stencil inputs the way EvaluateWorker::feed does:
+// the stencil cache against the per-feed row -> element map it replaced.
+// Usage: StencilCacheBenchmark [stencil_radius batch_size rows_per_feed feeds]
+
+#include "scanner/engine/stencil_cache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+using namespace scanner;
+using namespace scanner::internal;
+
+namespace {
+
+struct Config {
+  std::vector<i32> stencil;
+  i32 batch_size;
+  i64 rows_per_feed;
+  i64 feeds;
+};
+
+Element element_for(i64 row) {
+  Element element;
+  element.buffer = reinterpret_cast<u8*>(row + 1);
+  element.size = 1;
+  element.is_frame = false;
+  element.index = row;
+  return element;
+}
+
+// Replays the feeds of one task and returns the time spent per output row.
+// stage is called with the first and last row to produce for each feed and
+// stages the stencil of every row, evict drops rows below its argument.
+double time_per_row_us(const Config& config,
+                       const std::function<void(i64)>& insert,
+                       const std::function<u64(i64, i64)>& stage,
+                       const std::function<void(i64)>& evict) {
+  i64 total_rows = config.rows_per_feed * config.feeds;
+  i64 last_offset = config.stencil.back();
+  i64 next_row = 0;
+  i64 next_output = 0;
+  u64 checksum = 0;
+  auto start = std::chrono::high_resolution_clock::now();
+  for (i64 f = 0; f < config.feeds; ++f) {
+    for (i64 r = 0; r < config.rows_per_feed; ++r) {
+      insert(next_row++);
+    }
+    // Rows whose whole stencil has been seen, rounded down to the batch size
+    i64 end = std::min(next_row - last_offset, total_rows);
+    if (f == config.feeds - 1) {
+      end = total_rows;
+    } else {
+      end -= (end - next_output) % config.batch_size;
+    }
+    if (end > next_output) {
+      checksum += stage(next_output, end);
+      next_output = end;
+    }
+    evict(next_output + config.stencil.front());
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  if (checksum == 0) {
+    printf("unexpected checksum\n");
+  }
+  return std::chrono::duration<double, std::micro>(end - start).count() /
+         total_rows;
+}
+
+u64 stage_rows(const Config& config, i64 start, i64 end, i64 max_rows,
+               const std::function<const Element*(i64)>& lookup) {
+  u64 checksum = 0;
+  Elements stencil;
+  for (i64 row = start; row < end; ++row) {
+    stencil.clear();
+    for (i32 s : config.stencil) {
+      i64 desired_row = std::min(std::max(row + s, (i64)0), max_rows - 1);
+      const Element* element = lookup(desired_row);
+      stencil.push_back(element ? *element : Element());
+    }
+    checksum += (u64)stencil.back().buffer;
+  }
+  return checksum;
+}
+
+double run_map(const Config& config) {
+  std::deque<i64> rows;
+  std::deque<Element> elements;
+  i64 max_rows = config.rows_per_feed * config.feeds;
+  return time_per_row_us(
+      config,
+      [&](i64 row) {
+        rows.push_back(row);
+        elements.push_back(element_for(row));
+      },
+      [&](i64 start, i64 end) {
+        std::unordered_map<i32, Element> row_map;
+        for (size_t j = 0; j < rows.size(); ++j) {
+          row_map[rows[j]] = elements[j];
+        }
+        return stage_rows(config, start, end, max_rows, [&](i64 row) {
+          return &row_map[row];
+        });
+      },
+      [&](i64 min_row) {
+        while (!rows.empty() && rows.front() < min_row) {
+          rows.pop_front();
+          elements.pop_front();
+        }
+      });
+}
+
+double run_ring(const Config& config) {
+  StencilCache cache(
+      stencil_cache_capacity(config.stencil, config.batch_size));
+  i64 max_rows = config.rows_per_feed * config.feeds;
+  return time_per_row_us(
+      config, [&](i64 row) { cache.push_back(row, element_for(row)); },
+      [&](i64 start, i64 end) {
+        return stage_rows(config, start, end, max_rows,
+                          [&](i64 row) { return cache.find(row); });
+      },
+      [&](i64 min_row) {
+        while (!cache.empty() && cache.front_row() < min_row) {
+          cache.pop_front();
+        }
+      });
+}
+
+}
+
+int main(int argc, char** argv) {
+  // 9 frame stencil, e.g. temporal smoothing over +/- 4 frames
+  i32 radius = 4;
+  Config config;
+  config.batch_size = 1;
+  config.rows_per_feed = 1;
+  config.feeds = 100000;
+  if (argc == 5) {
+    radius = std::atoi(argv[1]);
+    config.batch_size = std::atoi(argv[2]);
+    config.rows_per_feed = std::atoi(argv[3]);
+    config.feeds = std::atoi(argv[4]);
+  }
+  for (i32 s = -radius; s <= radius; ++s) {
+    config.stencil.push_back(s);
+  }
+
+  printf("stencil %lu, batch %d, %ld rows per feed, %ld feeds\n",
+         config.stencil.size(), config.batch_size, config.rows_per_feed,
+         config.feeds);
+  double map_us = run_map(config);
+  double ring_us = run_ring(config);
+  printf("%-16s %8.3f us/row\n", "row map", map_us);
+  printf("%-16s %8.3f us/row\n", "stencil cache", ring_us);
+  printf("%-16s %8.2fx\n", "speedup", map_us / ring_us);
+  return 0;
+}
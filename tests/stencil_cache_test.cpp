@@ -0,0 +1,117 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "scanner/engine/stencil_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+Element element_for(i64 row) {
+  Element element;
+  element.buffer = reinterpret_cast<u8*>(row + 1);
+  element.size = 1;
+  element.is_frame = false;
+  element.index = row;
+  return element;
+}
+
+}
+
+TEST(StencilCache, Capacity) {
+  EXPECT_EQ(stencil_cache_capacity({0}, 1), 1);
+  EXPECT_EQ(stencil_cache_capacity({}, 0), 1);
+  EXPECT_EQ(stencil_cache_capacity({-4, -3, -2, -1, 0, 1, 2, 3, 4}, 1), 16);
+  EXPECT_EQ(stencil_cache_capacity({-1, 0, 1}, 8), 16);
+  EXPECT_EQ(stencil_cache_capacity({0, 1}, 2), 4);
+}
+
+TEST(StencilCache, ConsecutiveRows) {
+  StencilCache cache(4);
+  for (i64 row = 10; row < 14; ++row) {
+    cache.push_back(row, element_for(row));
+  }
+  EXPECT_EQ(cache.size(), 4);
+  EXPECT_EQ(cache.front_row(), 10);
+  EXPECT_EQ(cache.back_row(), 13);
+  for (i64 row = 10; row < 14; ++row) {
+    ASSERT_NE(cache.find(row), nullptr);
+    EXPECT_EQ(cache.find(row)->index, row);
+  }
+  EXPECT_EQ(cache.find(9), nullptr);
+  EXPECT_EQ(cache.find(14), nullptr);
+
+  // Wrap around the end of the ring
+  EXPECT_EQ(cache.pop_front().index, 10);
+  EXPECT_EQ(cache.pop_front().index, 11);
+  cache.push_back(14, element_for(14));
+  cache.push_back(15, element_for(15));
+  EXPECT_EQ(cache.front_row(), 12);
+  for (i64 i = 0; i < cache.size(); ++i) {
+    EXPECT_EQ(cache.row_at(i), 12 + i);
+    EXPECT_EQ(cache.at(i).index, 12 + i);
+    EXPECT_EQ(cache.find(12 + i)->index, 12 + i);
+  }
+}
+
+TEST(StencilCache, GrowsWhenFull) {
+  StencilCache cache(2);
+  cache.push_back(0, element_for(0));
+  cache.push_back(1, element_for(1));
+  cache.pop_front();
+  for (i64 row = 2; row < 20; ++row) {
+    cache.push_back(row, element_for(row));
+  }
+  EXPECT_EQ(cache.size(), 19);
+  for (i64 row = 1; row < 20; ++row) {
+    ASSERT_NE(cache.find(row), nullptr);
+    EXPECT_EQ(cache.find(row)->index, row);
+  }
+}
+
+TEST(StencilCache, SparseRows) {
+  StencilCache cache(8);
+  std::vector<i64> rows = {3, 4, 10, 11, 12, 30};
+  for (i64 row : rows) {
+    cache.push_back(row, element_for(row));
+  }
+  for (i64 row = 0; row < 40; ++row) {
+    bool cached = std::find(rows.begin(), rows.end(), row) != rows.end();
+    const Element* element = cache.find(row);
+    if (cached) {
+      ASSERT_NE(element, nullptr);
+      EXPECT_EQ(element->index, row);
+    } else {
+      EXPECT_EQ(element, nullptr);
+    }
+  }
+  // Once the gaps have been evicted, rows are addressed by offset again
+  cache.pop_front();
+  cache.pop_front();
+  cache.push_back(31, element_for(31));
+  cache.pop_front();
+  cache.pop_front();
+  cache.pop_front();
+  EXPECT_EQ(cache.find(30)->index, 30);
+  EXPECT_EQ(cache.find(31)->index, 31);
+}
+
+}
+}
@@ -0,0 +1,105 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+// Microbenchmark of the YUV420P to RGB24 conversion paths against sws_scale.
+// Usage: YUVToRGBBenchmark [width height iterations]
+
+#include "scanner/video/software/yuv_to_rgb.h"
+
+extern "C" {
+#include "libswscale/swscale.h"
+}
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace scanner;
+using namespace scanner::internal;
+
+namespace {
+
+double time_per_frame_ms(i32 iterations, const std::function<void()>& fn) {
+  fn();
+  auto start = std::chrono::high_resolution_clock::now();
+  for (i32 i = 0; i < iterations; ++i) {
+    fn();
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<double, std::milli>(end - start).count() /
+         iterations;
+}
+
+}
+
+int main(int argc, char** argv) {
+  i32 width = 1920;
+  i32 height = 1080;
+  i32 iterations = 200;
+  if (argc == 4) {
+    width = std::atoi(argv[1]);
+    height = std::atoi(argv[2]);
+    iterations = std::atoi(argv[3]);
+  }
+
+  int strides[3] = {width, (width + 1) / 2, (width + 1) / 2};
+  std::vector<u8> data[3] = {
+      std::vector<u8>(strides[0] * height),
+      std::vector<u8>(strides[1] * ((height + 1) / 2)),
+      std::vector<u8>(strides[2] * ((height + 1) / 2))};
+  const u8* planes[3];
+  for (i32 i = 0; i < 3; ++i) {
+    for (u8& sample : data[i]) {
+      sample = (u8)(std::rand() % 256);
+    }
+    planes[i] = data[i].data();
+  }
+  std::vector<u8> rgb(width * height * 3);
+
+  auto run = [&](const char* name, ThreadPool* pool, SimdLevel level) {
+    double ms = time_per_frame_ms(iterations, [&]() {
+      yuv420p_to_rgb24(planes, strides, width, height, rgb.data(), width * 3,
+                       pool, level);
+    });
+    printf("%-16s %8.3f ms/frame\n", name, ms);
+  };
+
+  printf("%dx%d, %d iterations\n", width, height, iterations);
+  run("scalar", nullptr, SimdLevel::Scalar);
+  if (detected_simd_level() >= SimdLevel::SSSE3) {
+    run("ssse3", nullptr, SimdLevel::SSSE3);
+  }
+  if (detected_simd_level() >= SimdLevel::AVX2) {
+    run("avx2", nullptr, SimdLevel::AVX2);
+  }
+  ThreadPool pool(std::thread::hardware_concurrency());
+  run("best, threaded", &pool, detected_simd_level());
+
+  SwsContext* context =
+      sws_getContext(width, height, AV_PIX_FMT_YUV420P, width, height,
+                     AV_PIX_FMT_RGB24, SWS_BICUBIC, NULL, NULL, NULL);
+  u8* out_slices[4] = {rgb.data(), nullptr, nullptr, nullptr};
+  int out_linesizes[4] = {width * 3, 0, 0, 0};
+  double ms = time_per_frame_ms(iterations, [&]() {
+    sws_scale(context, planes, strides, 0, height, out_slices, out_linesizes);
+  });
+  printf("%-16s %8.3f ms/frame\n", "sws_scale", ms);
+  sws_freeContext(context);
+  return 0;
+}
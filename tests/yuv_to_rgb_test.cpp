@@ -0,0 +1,146 @@
+/* Copyright 2018 Carnegie Mellon University
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "scanner/video/software/yuv_to_rgb.h"
+
+extern "C" {
+#include "libswscale/swscale.h"
+}
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <vector>
+
+namespace scanner {
+namespace internal {
+
+namespace {
+
+struct YUVFrame {
+  YUVFrame(i32 w, i32 h) : width(w), height(h) {
+    // Pad the rows like the decoder does
+    strides[0] = width + 32;
+    strides[1] = strides[2] = (width + 1) / 2 + 16;
+    data[0].resize(strides[0] * height);
+    data[1].resize(strides[1] * ((height + 1) / 2));
+    data[2].resize(strides[2] * ((height + 1) / 2));
+    for (i32 i = 0; i < 3; ++i) {
+      planes[i] = data[i].data();
+    }
+  }
+
+  i32 width;
+  i32 height;
+  std::vector<u8> data[3];
+  const u8* planes[3];
+  int strides[3];
+};
+
+YUVFrame random_frame(i32 width, i32 height) {
+  YUVFrame frame(width, height);
+  std::srand(0);
+  for (auto& plane : frame.data) {
+    for (u8& sample : plane) {
+      sample = (u8)(std::rand() % 256);
+    }
+  }
+  return frame;
+}
+
+// Smooth chroma, so that sws_scale's chroma interpolation is close to ours
+YUVFrame gradient_frame(i32 width, i32 height) {
+  YUVFrame frame(width, height);
+  for (i32 y = 0; y < height; ++y) {
+    for (i32 x = 0; x < width; ++x) {
+      frame.data[0][y * frame.strides[0] + x] = (u8)(16 + (x + y) % 220);
+    }
+  }
+  i32 chroma_width = (width + 1) / 2;
+  i32 chroma_height = (height + 1) / 2;
+  for (i32 y = 0; y < chroma_height; ++y) {
+    for (i32 x = 0; x < chroma_width; ++x) {
+      frame.data[1][y * frame.strides[1] + x] =
+          (u8)(64 + x * 128 / chroma_width);
+      frame.data[2][y * frame.strides[2] + x] =
+          (u8)(64 + y * 128 / chroma_height);
+    }
+  }
+  return frame;
+}
+
+std::vector<u8> convert(const YUVFrame& frame, ThreadPool* pool,
+                        SimdLevel level) {
+  std::vector<u8> rgb(frame.width * frame.height * 3);
+  yuv420p_to_rgb24(frame.planes, frame.strides, frame.width, frame.height,
+                   rgb.data(), frame.width * 3, pool, level);
+  return rgb;
+}
+
+}
+
+TEST(YUVToRGB, VectorPathsMatchScalar) {
+  // Odd sizes exercise the scalar tails of the vector loops
+  YUVFrame frame = random_frame(101, 37);
+  std::vector<u8> expected = convert(frame, nullptr, SimdLevel::Scalar);
+  std::vector<SimdLevel> levels;
+  if (detected_simd_level() >= SimdLevel::SSSE3) {
+    levels.push_back(SimdLevel::SSSE3);
+  }
+  if (detected_simd_level() >= SimdLevel::AVX2) {
+    levels.push_back(SimdLevel::AVX2);
+  }
+  for (SimdLevel level : levels) {
+    EXPECT_EQ(convert(frame, nullptr, level), expected);
+  }
+}
+
+TEST(YUVToRGB, ThreadedMatchesSingleThreaded) {
+  YUVFrame frame = random_frame(1920, 1080);
+  ThreadPool pool(4);
+  EXPECT_EQ(convert(frame, &pool, detected_simd_level()),
+            convert(frame, nullptr, detected_simd_level()));
+}
+
+TEST(YUVToRGB, MatchesSwsScale) {
+  const i32 width = 320;
+  const i32 height = 240;
+  YUVFrame frame = gradient_frame(width, height);
+  std::vector<u8> rgb = convert(frame, nullptr, detected_simd_level());
+
+  std::vector<u8> expected(width * height * 3);
+  SwsContext* context =
+      sws_getContext(width, height, AV_PIX_FMT_YUV420P, width, height,
+                     AV_PIX_FMT_RGB24, SWS_BICUBIC, NULL, NULL, NULL);
+  ASSERT_NE(context, nullptr);
+  u8* out_slices[4] = {expected.data(), nullptr, nullptr, nullptr};
+  int out_linesizes[4] = {width * 3, 0, 0, 0};
+  sws_scale(context, frame.planes, frame.strides, 0, height, out_slices,
+            out_linesizes);
+  sws_freeContext(context);
+
+  i64 total_diff = 0;
+  i32 max_diff = 0;
+  for (size_t i = 0; i < rgb.size(); ++i) {
+    i32 diff = std::abs((i32)rgb[i] - (i32)expected[i]);
+    total_diff += diff;
+    max_diff = std::max(max_diff, diff);
+  }
+  EXPECT_LE(max_diff, 8);
+  EXPECT_LT((double)total_diff / rgb.size(), 1.5);
+}
+}
+}